@@ -0,0 +1,516 @@
+#include "BlockCompressor.h"
+#include "ThreadPool.h"
+
+#include <emmintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+namespace Helpers
+{
+	// A 4x4 block of texels split into channels so four texels fit an SSE register
+	struct BlockTexels
+	{
+		alignas(16) float channel[4][16];
+	};
+
+	// BC7 4 bit index weights out of 64
+	static const int kBC7Weights[16]{ 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// Gathers the 4x4 block at (bx, by), texels past the edge repeat the last row / column
+	static void LoadBlock(const BYTE* pixels, int width, int height, int bx, int by, BlockTexels& texels)
+	{
+		alignas(16) BYTE rgba[64];
+		for (int y = 0; y < 4; y++)
+		{
+			const BYTE* row{ pixels + (size_t)std::min(by * 4 + y, height - 1) * width * 4 };
+			if (bx * 4 + 4 <= width)
+			{
+				memcpy(rgba + y * 16, row + bx * 16, 16);
+				continue;
+			}
+
+			for (int x = 0; x < 4; x++)
+				memcpy(rgba + y * 16 + x * 4, row + std::min(bx * 4 + x, width - 1) * 4, 4);
+		}
+
+		// Each 32 bit lane is one texel, shift the wanted channel down and convert
+		const __m128i mask{ _mm_set1_epi32(0xFF) };
+		for (int i = 0; i < 4; i++)
+		{
+			const __m128i texel{ _mm_load_si128((const __m128i*)(rgba + i * 16)) };
+			_mm_store_ps(texels.channel[0] + i * 4, _mm_cvtepi32_ps(_mm_and_si128(texel, mask)));
+			_mm_store_ps(texels.channel[1] + i * 4, _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texel, 8), mask)));
+			_mm_store_ps(texels.channel[2] + i * 4, _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texel, 16), mask)));
+			_mm_store_ps(texels.channel[3] + i * 4, _mm_cvtepi32_ps(_mm_srli_epi32(texel, 24)));
+		}
+	}
+
+	// Fits a line through the texels along their principal axis and returns its extreme points.
+	// Only the first numChannels channels take part.
+	static void FitPrincipalAxis(const BlockTexels& texels, int numChannels, float start[4], float end[4])
+	{
+		float mean[4]{}, low[4], high[4];
+		for (int c = 0; c < numChannels; c++)
+		{
+			low[c] = FLT_MAX;
+			high[c] = -FLT_MAX;
+			for (int i = 0; i < 16; i++)
+			{
+				mean[c] += texels.channel[c][i];
+				low[c] = std::min(low[c], texels.channel[c][i]);
+				high[c] = std::max(high[c], texels.channel[c][i]);
+			}
+			mean[c] /= 16.0f;
+		}
+
+		float covariance[4][4]{};
+		for (int i = 0; i < 16; i++)
+		{
+			for (int a = 0; a < numChannels; a++)
+			{
+				for (int b = a; b < numChannels; b++)
+					covariance[a][b] += (texels.channel[a][i] - mean[a]) * (texels.channel[b][i] - mean[b]);
+			}
+		}
+
+		for (int a = 0; a < numChannels; a++)
+		{
+			for (int b = 0; b < a; b++)
+				covariance[a][b] = covariance[b][a];
+		}
+
+		// Power iteration, starting along the bounding box so it is never orthogonal to the answer
+		float axis[4]{};
+		for (int c = 0; c < numChannels; c++)
+			axis[c] = high[c] - low[c];
+
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4]{};
+			float largest{ 0 };
+			for (int a = 0; a < numChannels; a++)
+			{
+				for (int b = 0; b < numChannels; b++)
+					next[a] += covariance[a][b] * axis[b];
+				largest = std::max(largest, std::fabs(next[a]));
+			}
+
+			if (largest < 1e-6f)
+				break;
+
+			for (int c = 0; c < numChannels; c++)
+				axis[c] = next[c] / largest;
+		}
+
+		float lengthSq{ 0 };
+		for (int c = 0; c < numChannels; c++)
+			lengthSq += axis[c] * axis[c];
+
+		// Flat block
+		if (lengthSq < 1e-12f)
+		{
+			for (int c = 0; c < 4; c++)
+				start[c] = end[c] = c < numChannels ? mean[c] : 255.0f;
+			return;
+		}
+
+		float minT{ FLT_MAX }, maxT{ -FLT_MAX };
+		for (int i = 0; i < 16; i++)
+		{
+			float t{ 0 };
+			for (int c = 0; c < numChannels; c++)
+				t += (texels.channel[c][i] - mean[c]) * axis[c];
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+
+		for (int c = 0; c < 4; c++)
+		{
+			start[c] = c < numChannels ? std::clamp(mean[c] + axis[c] * minT / lengthSq, 0.0f, 255.0f) : 255.0f;
+			end[c] = c < numChannels ? std::clamp(mean[c] + axis[c] * maxT / lengthSq, 0.0f, 255.0f) : 255.0f;
+		}
+	}
+
+	// Position of each texel along start -> end as 0 - 1, four texels at a time
+	static void ProjectTexels(const BlockTexels& texels, int numChannels, const float start[4], const float end[4], float t[16])
+	{
+		float direction[4]{};
+		float lengthSq{ 0 };
+		for (int c = 0; c < numChannels; c++)
+		{
+			direction[c] = end[c] - start[c];
+			lengthSq += direction[c] * direction[c];
+		}
+
+		if (lengthSq < 1e-6f)
+		{
+			std::fill(t, t + 16, 0.0f);
+			return;
+		}
+
+		const __m128 scale{ _mm_set1_ps(1.0f / lengthSq) };
+		const __m128 zero{ _mm_setzero_ps() };
+		const __m128 one{ _mm_set1_ps(1.0f) };
+
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 dot{ _mm_setzero_ps() };
+			for (int c = 0; c < numChannels; c++)
+			{
+				const __m128 offset{ _mm_sub_ps(_mm_load_ps(texels.channel[c] + i), _mm_set1_ps(start[c])) };
+				dot = _mm_add_ps(dot, _mm_mul_ps(offset, _mm_set1_ps(direction[c])));
+			}
+
+			_mm_storeu_ps(t + i, _mm_min_ps(_mm_max_ps(_mm_mul_ps(dot, scale), zero), one));
+		}
+	}
+
+	// Least squares endpoints for texels placed at the given weights (0 = start, 1 = end)
+	static void RefitEndpoints(const BlockTexels& texels, int numChannels, const float weights[16], float start[4], float end[4])
+	{
+		float aa{ 0 }, ab{ 0 }, bb{ 0 };
+		float ax[4]{}, bx[4]{};
+		for (int i = 0; i < 16; i++)
+		{
+			const float a{ 1.0f - weights[i] };
+			const float b{ weights[i] };
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < numChannels; c++)
+			{
+				ax[c] += a * texels.channel[c][i];
+				bx[c] += b * texels.channel[c][i];
+			}
+		}
+
+		// Every texel at the same weight, nothing to solve
+		const float determinant{ aa * bb - ab * ab };
+		if (std::fabs(determinant) < 1e-6f)
+			return;
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			start[c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+			end[c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+		}
+	}
+
+	static uint16_t PackRGB565(const float colour[4])
+	{
+		const int r{ (int)(colour[0] * 31.0f / 255.0f + 0.5f) };
+		const int g{ (int)(colour[1] * 63.0f / 255.0f + 0.5f) };
+		const int b{ (int)(colour[2] * 31.0f / 255.0f + 0.5f) };
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	// Expands the same way the hardware does, replicating the top bits into the bottom
+	static void UnpackRGB565(uint16_t packed, float colour[4])
+	{
+		const int r{ packed >> 11 }, g{ (packed >> 5) & 63 }, b{ packed & 31 };
+		colour[0] = (float)((r << 3) | (r >> 2));
+		colour[1] = (float)((g << 2) | (g >> 4));
+		colour[2] = (float)((b << 3) | (b >> 2));
+		colour[3] = 255.0f;
+	}
+
+	// BC1 block, also the colour half of BC3. Always four colour mode.
+	static void EncodeColourBlock(const BlockTexels& texels, BYTE* block)
+	{
+		float start[4], end[4], t[16], weights[16];
+		FitPrincipalAxis(texels, 3, start, end);
+
+		// Snap to the four palette entries once and solve for endpoints that suit them better
+		ProjectTexels(texels, 3, start, end, t);
+		for (int i = 0; i < 16; i++)
+			weights[i] = std::floor(t[i] * 3.0f + 0.5f) / 3.0f;
+		RefitEndpoints(texels, 3, weights, start, end);
+
+		// Four colour mode needs colour0 > colour1
+		uint16_t colour0{ PackRGB565(start) };
+		uint16_t colour1{ PackRGB565(end) };
+		if (colour0 < colour1)
+			std::swap(colour0, colour1);
+
+		uint32_t indices{ 0 };
+		if (colour0 != colour1)
+		{
+			// Indices against what the hardware will actually decode
+			float decoded0[4], decoded1[4];
+			UnpackRGB565(colour0, decoded0);
+			UnpackRGB565(colour1, decoded1);
+			ProjectTexels(texels, 3, decoded0, decoded1, t);
+
+			// Steps along colour0 -> colour1 in BC1 index order
+			static const uint32_t kOrder[4]{ 0, 2, 3, 1 };
+			for (int i = 0; i < 16; i++)
+				indices |= kOrder[(int)(t[i] * 3.0f + 0.5f)] << (2 * i);
+		}
+
+		block[0] = (BYTE)colour0;
+		block[1] = (BYTE)(colour0 >> 8);
+		block[2] = (BYTE)colour1;
+		block[3] = (BYTE)(colour1 >> 8);
+		memcpy(block + 4, &indices, 4);
+	}
+
+	// BC3 alpha block (the same layout as BC4) using the eight value mode between the min and max alpha
+	static void EncodeAlphaBlock(const float alpha[16], BYTE* block)
+	{
+		float low{ 255.0f }, high{ 0.0f };
+		for (int i = 0; i < 16; i++)
+		{
+			low = std::min(low, alpha[i]);
+			high = std::max(high, alpha[i]);
+		}
+
+		const int alpha0{ (int)(high + 0.5f) };
+		const int alpha1{ (int)(low + 0.5f) };
+		block[0] = (BYTE)alpha0;
+		block[1] = (BYTE)alpha1;
+
+		uint64_t indices{ 0 };
+		if (alpha0 > alpha1)
+		{
+			// Steps up from alpha1 in BC3 index order, step 0 is index 1, step 7 is index 0, the rest 8 - step
+			const float scale{ 7.0f / (float)(alpha0 - alpha1) };
+			for (int i = 0; i < 16; i++)
+			{
+				const int step{ std::clamp((int)((alpha[i] - alpha1) * scale + 0.5f), 0, 7) };
+				const uint64_t index{ step == 0 ? 1u : step == 7 ? 0u : (uint64_t)(8 - step) };
+				indices |= index << (3 * i);
+			}
+		}
+
+		for (int i = 0; i < 6; i++)
+			block[2 + i] = (BYTE)(indices >> (8 * i));
+	}
+
+	// Mode 6 endpoints are 7 bits per channel plus a low bit shared by the endpoint, picks the low bit with least error
+	static void QuantiseBC7Endpoint(const float endpoint[4], int quantised[4], int& pBit, float decoded[4])
+	{
+		float bestError{ FLT_MAX };
+		for (int p = 0; p < 2; p++)
+		{
+			int candidate[4];
+			float error{ 0 };
+			for (int c = 0; c < 4; c++)
+			{
+				candidate[c] = std::clamp((int)((endpoint[c] - p) * 0.5f + 0.5f), 0, 127);
+				const float difference{ (float)((candidate[c] << 1) | p) - endpoint[c] };
+				error += difference * difference;
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				pBit = p;
+				for (int c = 0; c < 4; c++)
+				{
+					quantised[c] = candidate[c];
+					decoded[c] = (float)((candidate[c] << 1) | p);
+				}
+			}
+		}
+	}
+
+	// Writes values into a 128 bit block, least significant bit first
+	struct BitWriter
+	{
+		BYTE* block;
+		int position{ 0 };
+
+		void Write(uint32_t value, int numBits)
+		{
+			for (int i = 0; i < numBits; i++, position++)
+			{
+				if ((value >> i) & 1)
+					block[position >> 3] |= (BYTE)(1 << (position & 7));
+			}
+		}
+	};
+
+	// BC7 mode 6: one RGBA line per block with 16 steps along it
+	static void EncodeBC7Block(const BlockTexels& texels, BYTE* block)
+	{
+		float start[4], end[4], t[16], weights[16];
+		FitPrincipalAxis(texels, 4, start, end);
+
+		ProjectTexels(texels, 4, start, end, t);
+		for (int i = 0; i < 16; i++)
+			weights[i] = kBC7Weights[(int)(t[i] * 15.0f + 0.5f)] / 64.0f;
+		RefitEndpoints(texels, 4, weights, start, end);
+
+		int quantised0[4], quantised1[4], pBit0{ 0 }, pBit1{ 0 };
+		float decoded0[4], decoded1[4];
+		QuantiseBC7Endpoint(start, quantised0, pBit0, decoded0);
+		QuantiseBC7Endpoint(end, quantised1, pBit1, decoded1);
+
+		// Nearest of the (not quite evenly spaced) weights
+		int indices[16];
+		ProjectTexels(texels, 4, decoded0, decoded1, t);
+		for (int i = 0; i < 16; i++)
+		{
+			const float target{ t[i] * 64.0f };
+			int index{ (int)(t[i] * 15.0f + 0.5f) };
+			if (index > 0 && std::fabs(kBC7Weights[index - 1] - target) < std::fabs(kBC7Weights[index] - target))
+				index--;
+			else if (index < 15 && std::fabs(kBC7Weights[index + 1] - target) < std::fabs(kBC7Weights[index] - target))
+				index++;
+			indices[i] = index;
+		}
+
+		// The first index is stored without its top bit so must be below 8, the weights are symmetric so flipping the line is exact
+		if (indices[0] >= 8)
+		{
+			std::swap(quantised0, quantised1);
+			std::swap(pBit0, pBit1);
+			for (int& index : indices)
+				index = 15 - index;
+		}
+
+		memset(block, 0, 16);
+		BitWriter bits{ block };
+		bits.Write(1 << 6, 7);
+		for (int c = 0; c < 4; c++)
+		{
+			bits.Write((uint32_t)quantised0[c], 7);
+			bits.Write((uint32_t)quantised1[c], 7);
+		}
+		bits.Write((uint32_t)pBit0, 1);
+		bits.Write((uint32_t)pBit1, 1);
+		bits.Write((uint32_t)indices[0], 3);
+		for (int i = 1; i < 16; i++)
+			bits.Write((uint32_t)indices[i], 4);
+	}
+
+	// True if any of the count RGBA8 pixels is not fully opaque
+	bool HasAlpha(const BYTE* pixels, size_t count)
+	{
+		// AND every pixel together, the alpha bytes only stay 255 if every alpha is
+		__m128i all{ _mm_set1_epi32(-1) };
+		size_t i{ 0 };
+		for (; i + 4 <= count; i += 4)
+			all = _mm_and_si128(all, _mm_loadu_si128((const __m128i*)(pixels + i * 4)));
+
+		alignas(16) BYTE lanes[16];
+		_mm_store_si128((__m128i*)lanes, all);
+
+		BYTE alpha{ (BYTE)(lanes[3] & lanes[7] & lanes[11] & lanes[15]) };
+		for (; i < count; i++)
+			alpha &= pixels[i * 4 + 3];
+
+		return alpha != 255;
+	}
+
+	// Encodes width x height RGBA8 pixels into blocks of format
+	void CompressImage(const BYTE* pixels, int width, int height, BlockFormat format, BYTE* blocks)
+	{
+		const int blocksX{ std::max(1, (width + 3) / 4) };
+		const int blocksY{ std::max(1, (height + 3) / 4) };
+		const size_t blockBytes{ CompressedImage::BlockBytes(format) };
+
+		ThreadPool::Global().ParallelFor((size_t)blocksY, [&](size_t by)
+		{
+			BlockTexels texels;
+			BYTE* block{ blocks + by * blocksX * blockBytes };
+
+			for (int bx = 0; bx < blocksX; bx++, block += blockBytes)
+			{
+				LoadBlock(pixels, width, height, bx, (int)by, texels);
+
+				switch (format)
+				{
+				case BlockFormat::BC1:
+					EncodeColourBlock(texels, block);
+					break;
+				case BlockFormat::BC3:
+					EncodeAlphaBlock(texels.channel[3], block);
+					EncodeColourBlock(texels, block + 8);
+					break;
+				case BlockFormat::BC7:
+					EncodeBC7Block(texels, block);
+					break;
+				default:
+					memset(block, 0, blockBytes);
+					break;
+				}
+			}
+		});
+	}
+
+	// Encodes every level of chain
+	void CompressMipChain(const MipChain& chain, BlockFormat format, CompressedImage& image)
+	{
+		if (chain.levels.empty())
+			return;
+
+		image.Allocate(format, chain.levels[0].width, chain.levels[0].height, (int)chain.levels.size());
+
+		for (size_t level = 0; level < chain.levels.size(); level++)
+		{
+			CompressImage(chain.LevelData(level), chain.levels[level].width, chain.levels[level].height, format,
+				image.data.data() + image.levels[level].offset);
+		}
+	}
+
+	// Words of CompressedImage::stamp identifying what a cache file was made from
+	enum CacheStampWord { kStampMagic, kStampVersion, kStampSizeLow, kStampSizeHigh, kStampTimeLow, kStampTimeHigh, kStampSettings, kStampCount };
+
+	static const uint32_t kCacheMagic{ 'B' | ('C' << 8) | ('N' << 16) | ('C' << 24) };
+
+	// Fills in the stamp for sourceFilepath, false if it does not exist
+	static bool StampSource(const std::string& sourceFilepath, uint32_t settingsStamp, uint32_t stamp[kDDSStampWords])
+	{
+		std::error_code error;
+		const uint64_t size{ fs::file_size(sourceFilepath, error) };
+		if (error)
+			return false;
+
+		const uint64_t time{ (uint64_t)fs::last_write_time(sourceFilepath, error).time_since_epoch().count() };
+		if (error)
+			return false;
+
+		stamp[kStampMagic] = kCacheMagic;
+		stamp[kStampVersion] = 1;
+		stamp[kStampSizeLow] = (uint32_t)size;
+		stamp[kStampSizeHigh] = (uint32_t)(size >> 32);
+		stamp[kStampTimeLow] = (uint32_t)time;
+		stamp[kStampTimeHigh] = (uint32_t)(time >> 32);
+		stamp[kStampSettings] = settingsStamp;
+		return true;
+	}
+
+	// Writes image as a DDS file stamped with the size and time of sourceFilepath plus settingsStamp
+	bool SaveCompressedCache(const std::string& cacheFilepath, const std::string& sourceFilepath, uint32_t settingsStamp, CompressedImage& image)
+	{
+		if (image.levels.empty() || !StampSource(sourceFilepath, settingsStamp, image.stamp))
+			return false;
+
+		std::error_code error;
+		fs::create_directories(fs::path(cacheFilepath).parent_path(), error);
+
+		return SaveDDS(cacheFilepath, image);
+	}
+
+	// Reads a file written by SaveCompressedCache
+	bool LoadCompressedCache(const std::string& cacheFilepath, const std::string& sourceFilepath, uint32_t settingsStamp, CompressedImage& image)
+	{
+		uint32_t expected[kDDSStampWords]{};
+		std::error_code error;
+		if (!StampSource(sourceFilepath, settingsStamp, expected) || !fs::exists(cacheFilepath, error))
+			return false;
+
+		// Cache files are already bottom row first
+		if (LoadDDS(cacheFilepath, image, false) && memcmp(image.stamp, expected, kStampCount * sizeof(uint32_t)) == 0)
+			return true;
+
+		image.levels.clear();
+		image.data.clear();
+		return false;
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+// CPU encoding of RGBA8 images to BC1 / BC3 / BC7 blocks, plus caching the result on disk as DDS
+
+#include "ExternalLibraryHeaders.h"
+#include "DDSLoader.h"
+#include "MipGenerator.h"
+
+namespace Helpers
+{
+	// True if any of the count RGBA8 pixels is not fully opaque
+	bool HasAlpha(const BYTE* pixels, size_t count);
+
+	// Encodes width x height RGBA8 pixels into blocks of format, which must be BC1, BC3 or BC7.
+	// blocks must hold CompressedImage::LevelBytes(format, width, height) bytes.
+	// Block fitting uses SSE, rows of blocks are spread across the thread pool.
+	//  BC1: principal axis fit with a least squares refinement, alpha is dropped
+	//  BC3: BC1 colour plus a min / max fitted alpha block
+	//  BC7: mode 6 only (single subset RGBA with 4 bit indices)
+	void CompressImage(const BYTE* pixels, int width, int height, BlockFormat format, BYTE* blocks);
+
+	// Encodes every level of chain
+	void CompressMipChain(const MipChain& chain, BlockFormat format, CompressedImage& image);
+
+	// Writes image as a DDS file stamped with the size and time of sourceFilepath plus settingsStamp. Returns false on error.
+	bool SaveCompressedCache(const std::string& cacheFilepath, const std::string& sourceFilepath, uint32_t settingsStamp, CompressedImage& image);
+
+	// Reads a file written by SaveCompressedCache. Returns false if missing, or stale compared to sourceFilepath / settingsStamp.
+	bool LoadCompressedCache(const std::string& cacheFilepath, const std::string& sourceFilepath, uint32_t settingsStamp, CompressedImage& image);
+}
@@ -0,0 +1,207 @@
+#include "Bounds.h"
+
+#include <xmmintrin.h>
+
+namespace Helpers
+{
+	// glm::vec3 is tightly packed so 4 positions are 12 floats: x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+	// This loads them and transposes into one register per axis
+	static inline void LoadPositions4(const float* p, __m128& x, __m128& y, __m128& z)
+	{
+		const __m128 a{ _mm_loadu_ps(p) };
+		const __m128 b{ _mm_loadu_ps(p + 4) };
+		const __m128 c{ _mm_loadu_ps(p + 8) };
+
+		// x = a0 a3 b2 c1
+		const __m128 xbc{ _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)) };
+		x = _mm_shuffle_ps(a, xbc, _MM_SHUFFLE(2, 0, 3, 0));
+
+		// y = a1 b0 b3 c2
+		const __m128 yab{ _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)) };
+		const __m128 ybc{ _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)) };
+		y = _mm_shuffle_ps(yab, ybc, _MM_SHUFFLE(2, 0, 2, 0));
+
+		// z = a2 b1 c0 c3
+		const __m128 zab{ _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)) };
+		z = _mm_shuffle_ps(zab, c, _MM_SHUFFLE(3, 0, 2, 0));
+	}
+
+	static inline float HorizontalMin(__m128 v)
+	{
+		v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(v);
+	}
+
+	static inline float HorizontalMax(__m128 v)
+	{
+		v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(v);
+	}
+
+	// Computes the box surrounding count positions
+	AABB ComputeAABB(const glm::vec3* positions, size_t count)
+	{
+		AABB box;
+		if (count == 0)
+			return box;
+
+		const float* p{ &positions[0].x };
+		size_t i{ 0 };
+
+		if (count >= 4)
+		{
+			__m128 minX{ _mm_set1_ps(FLT_MAX) }, minY{ minX }, minZ{ minX };
+			__m128 maxX{ _mm_set1_ps(-FLT_MAX) }, maxY{ maxX }, maxZ{ maxX };
+
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128 x, y, z;
+				LoadPositions4(p + i * 3, x, y, z);
+
+				minX = _mm_min_ps(minX, x); maxX = _mm_max_ps(maxX, x);
+				minY = _mm_min_ps(minY, y); maxY = _mm_max_ps(maxY, y);
+				minZ = _mm_min_ps(minZ, z); maxZ = _mm_max_ps(maxZ, z);
+			}
+
+			box.minExtents = glm::vec3(HorizontalMin(minX), HorizontalMin(minY), HorizontalMin(minZ));
+			box.maxExtents = glm::vec3(HorizontalMax(maxX), HorizontalMax(maxY), HorizontalMax(maxZ));
+		}
+
+		// Remaining 0 - 3 positions
+		for (; i < count; i++)
+		{
+			box.minExtents = glm::min(box.minExtents, positions[i]);
+			box.maxExtents = glm::max(box.maxExtents, positions[i]);
+		}
+
+		return box;
+	}
+
+	// Computes a sphere around the box centre that contains all count positions
+	BoundingSphere ComputeBoundingSphere(const glm::vec3* positions, size_t count, const AABB& box)
+	{
+		BoundingSphere sphere;
+		if (count == 0 || box.IsEmpty())
+			return sphere;
+
+		sphere.centre = box.Centre();
+
+		const float* p{ &positions[0].x };
+		size_t i{ 0 };
+		float maxDistSq{ 0 };
+
+		if (count >= 4)
+		{
+			const __m128 cx{ _mm_set1_ps(sphere.centre.x) };
+			const __m128 cy{ _mm_set1_ps(sphere.centre.y) };
+			const __m128 cz{ _mm_set1_ps(sphere.centre.z) };
+			__m128 maxD{ _mm_setzero_ps() };
+
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128 x, y, z;
+				LoadPositions4(p + i * 3, x, y, z);
+
+				x = _mm_sub_ps(x, cx);
+				y = _mm_sub_ps(y, cy);
+				z = _mm_sub_ps(z, cz);
+
+				const __m128 d{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)) };
+				maxD = _mm_max_ps(maxD, d);
+			}
+
+			maxDistSq = HorizontalMax(maxD);
+		}
+
+		for (; i < count; i++)
+		{
+			const glm::vec3 d{ positions[i] - sphere.centre };
+			maxDistSq = std::max(maxDistSq, glm::dot(d, d));
+		}
+
+		sphere.radius = std::sqrt(maxDistSq);
+
+		return sphere;
+	}
+
+	// Returns the box surrounding box once transformed
+	AABB TransformAABB(const AABB& box, const glm::mat4& transform)
+	{
+		if (box.IsEmpty())
+			return box;
+
+		const glm::vec3 centre{ box.Centre() };
+		const glm::vec3 halfSize{ box.HalfSize() };
+
+		// New centre is the transformed centre, new half size is the absolute rotation / scale applied to the old one
+		const glm::vec3 newCentre{ transform * glm::vec4(centre, 1.0f) };
+		const glm::mat3 absolute{ glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])) };
+		const glm::vec3 newHalfSize{ absolute * halfSize };
+
+		AABB result;
+		result.minExtents = newCentre - newHalfSize;
+		result.maxExtents = newCentre + newHalfSize;
+		return result;
+	}
+
+	// Returns the sphere transformed, the radius is scaled by the largest axis scale
+	BoundingSphere TransformSphere(const BoundingSphere& sphere, const glm::mat4& transform)
+	{
+		const float scaleX{ glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])) };
+		const float scaleY{ glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])) };
+		const float scaleZ{ glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])) };
+
+		BoundingSphere result;
+		result.centre = glm::vec3(transform * glm::vec4(sphere.centre, 1.0f));
+		result.radius = sphere.radius * std::sqrt(std::max(scaleX, std::max(scaleY, scaleZ)));
+		return result;
+	}
+
+	// Returns the planes of the clip volume of viewProjection
+	Frustum ExtractFrustum(const glm::mat4& viewProjection)
+	{
+		// Rows of the matrix, glm stores columns
+		const glm::mat4 rows{ glm::transpose(viewProjection) };
+
+		Frustum frustum;
+		frustum.planes[0] = rows[3] + rows[0];
+		frustum.planes[1] = rows[3] - rows[0];
+		frustum.planes[2] = rows[3] + rows[1];
+		frustum.planes[3] = rows[3] - rows[1];
+		frustum.planes[4] = rows[3] + rows[2];
+		frustum.planes[5] = rows[3] - rows[2];
+
+		for (glm::vec4& plane : frustum.planes)
+			plane /= glm::length(glm::vec3(plane));
+
+		return frustum;
+	}
+
+	// True if any of sphere may be inside frustum
+	bool SphereInFrustum(const Frustum& frustum, const BoundingSphere& sphere)
+	{
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			const float distance{ plane.x * sphere.centre.x + plane.y * sphere.centre.y + plane.z * sphere.centre.z + plane.w };
+			if (distance < -sphere.radius)
+				return false;
+		}
+		return true;
+	}
+
+	// True if any of box may be inside frustum
+	bool AABBInFrustum(const Frustum& frustum, const AABB& box)
+	{
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			const float x{ plane.x >= 0 ? box.maxExtents.x : box.minExtents.x };
+			const float y{ plane.y >= 0 ? box.maxExtents.y : box.minExtents.y };
+			const float z{ plane.z >= 0 ? box.maxExtents.z : box.minExtents.z };
+			if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0)
+				return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+// Bounding volumes used for culling, LOD selection and picking
+
+#include "ExternalLibraryHeaders.h"
+
+#include <cfloat>
+
+namespace Helpers
+{
+	// Axis aligned bounding box. A default constructed box is empty (min > max)
+	struct AABB
+	{
+		glm::vec3 minExtents{ FLT_MAX };
+		glm::vec3 maxExtents{ -FLT_MAX };
+
+		// True if nothing has been added to this box
+		bool IsEmpty() const { return minExtents.x > maxExtents.x; }
+
+		glm::vec3 Centre() const { return (minExtents + maxExtents) * 0.5f; }
+		glm::vec3 HalfSize() const { return (maxExtents - minExtents) * 0.5f; }
+
+		// Grow this box so it also surrounds other
+		void Merge(const AABB& other)
+		{
+			minExtents = glm::min(minExtents, other.minExtents);
+			maxExtents = glm::max(maxExtents, other.maxExtents);
+		}
+	};
+
+	// Sphere surrounding a set of points
+	struct BoundingSphere
+	{
+		glm::vec3 centre{ 0 };
+		float radius{ 0 };
+	};
+
+	// Six planes facing inwards: left, right, bottom, top, near, far. A point p is inside a plane when
+	// dot(plane.xyz, p) + plane.w >= 0, and the planes are normalised so that value is a distance.
+	struct Frustum
+	{
+		glm::vec4 planes[6];
+	};
+
+	// Computes the box surrounding count positions. Uses a 4 wide SSE reduction.
+	AABB ComputeAABB(const glm::vec3* positions, size_t count);
+
+	// Computes a sphere around the box centre that contains all count positions. Uses a 4 wide SSE reduction.
+	BoundingSphere ComputeBoundingSphere(const glm::vec3* positions, size_t count, const AABB& box);
+
+	// Returns the box surrounding box once transformed (Arvo's method, no need to transform 8 corners)
+	AABB TransformAABB(const AABB& box, const glm::mat4& transform);
+
+	// Returns the sphere transformed, the radius is scaled by the largest axis scale
+	BoundingSphere TransformSphere(const BoundingSphere& sphere, const glm::mat4& transform);
+
+	// Returns the planes of the clip volume of viewProjection (Gribb and Hartmann)
+	Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+	// True if any of sphere may be inside frustum. The same test as cull_draws.comp, though a sphere just touching a
+	// plane may fall the other way on the GPU as it may round differently.
+	bool SphereInFrustum(const Frustum& frustum, const BoundingSphere& sphere);
+
+	// True if any of box may be inside frustum, tested with the corner furthest along each plane's normal
+	bool AABBInFrustum(const Frustum& frustum, const AABB& box);
+}
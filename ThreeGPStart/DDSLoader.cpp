@@ -0,0 +1,339 @@
+#include "DDSLoader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace Helpers
+{
+	// Layout of the DDS file header, see the DirectX documentation for DDS_HEADER
+	struct DDSPixelFormat
+	{
+		uint32_t size;
+		uint32_t flags;
+		uint32_t fourCC;
+		uint32_t rgbBitCount;
+		uint32_t rBitMask;
+		uint32_t gBitMask;
+		uint32_t bBitMask;
+		uint32_t aBitMask;
+	};
+
+	struct DDSHeader
+	{
+		uint32_t size;
+		uint32_t flags;
+		uint32_t height;
+		uint32_t width;
+		uint32_t pitchOrLinearSize;
+		uint32_t depth;
+		uint32_t mipMapCount;
+		uint32_t reserved1[11];
+		DDSPixelFormat pixelFormat;
+		uint32_t caps;
+		uint32_t caps2;
+		uint32_t caps3;
+		uint32_t caps4;
+		uint32_t reserved2;
+	};
+
+	struct DDSHeaderDX10
+	{
+		uint32_t dxgiFormat;
+		uint32_t resourceDimension;
+		uint32_t miscFlag;
+		uint32_t arraySize;
+		uint32_t miscFlags2;
+	};
+
+	static_assert(sizeof(DDSHeader) == 124, "DDS header must match the file layout");
+
+	static constexpr uint32_t MakeFourCC(char a, char b, char c, char d)
+	{
+		return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+	}
+
+	static const uint32_t kDDSMagic{ MakeFourCC('D', 'D', 'S', ' ') };
+	static const uint32_t kDDPFFourCC{ 0x4 };
+	static const uint32_t kDDSDCaps{ 0x1 }, kDDSDHeight{ 0x2 }, kDDSDWidth{ 0x4 }, kDDSDPixelFormat{ 0x1000 }, kDDSDMipMapCount{ 0x20000 }, kDDSDLinearSize{ 0x80000 };
+	static const uint32_t kDDSCapsTexture{ 0x1000 }, kDDSCapsMipMap{ 0x400000 }, kDDSCapsComplex{ 0x8 };
+
+	// DXGI_FORMAT values used in DX10 headers
+	enum DXGIFormat : uint32_t
+	{
+		DXGI_BC1_UNORM = 71, DXGI_BC1_SRGB = 72,
+		DXGI_BC2_UNORM = 74, DXGI_BC2_SRGB = 75,
+		DXGI_BC3_UNORM = 77, DXGI_BC3_SRGB = 78,
+		DXGI_BC4_UNORM = 80,
+		DXGI_BC5_UNORM = 83,
+		DXGI_BC7_UNORM = 98, DXGI_BC7_SRGB = 99
+	};
+
+	// Matching OpenGL internal format for glCompressedTexImage2D
+	GLenum CompressedImage::GLInternalFormat() const
+	{
+		switch (format)
+		{
+		case BlockFormat::BC1: return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		case BlockFormat::BC2: return GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+		case BlockFormat::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case BlockFormat::BC4: return GL_COMPRESSED_RED_RGTC1;
+		case BlockFormat::BC5: return GL_COMPRESSED_RG_RGTC2;
+		case BlockFormat::BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+		}
+		return 0;
+	}
+
+	// Bytes per 4x4 block
+	size_t CompressedImage::BlockBytes(BlockFormat format)
+	{
+		return (format == BlockFormat::BC1 || format == BlockFormat::BC4) ? 8 : 16;
+	}
+
+	// Bytes a width x height level takes, partial blocks at the edges count as whole
+	size_t CompressedImage::LevelBytes(BlockFormat format, int width, int height)
+	{
+		return (size_t)std::max(1, (width + 3) / 4) * (size_t)std::max(1, (height + 3) / 4) * BlockBytes(format);
+	}
+
+	// Sets up the level table and sizes data for numLevels levels of a width x height texture
+	void CompressedImage::Allocate(BlockFormat blockFormat, int width, int height, int numLevels)
+	{
+		format = blockFormat;
+		levels.resize(numLevels);
+
+		size_t offset{ 0 };
+		for (Level& level : levels)
+		{
+			level.width = width;
+			level.height = height;
+			level.offset = offset;
+			level.size = LevelBytes(format, width, height);
+
+			offset += level.size;
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+
+		data.resize(offset);
+	}
+
+	// Reverses the first numRows rows of 3 bit indices in a BC3 alpha / BC4 block
+	static void FlipAlphaBlock(BYTE* block, int numRows)
+	{
+		uint64_t bits{ 0 };
+		for (int i = 0; i < 6; i++)
+			bits |= (uint64_t)block[2 + i] << (8 * i);
+
+		uint64_t flipped{ bits };
+		for (int row = 0; row < numRows; row++)
+		{
+			const uint64_t rowBits{ (bits >> (12 * row)) & 0xFFF };
+			const int target{ numRows - 1 - row };
+			flipped &= ~(0xFFFull << (12 * target));
+			flipped |= rowBits << (12 * target);
+		}
+
+		for (int i = 0; i < 6; i++)
+			block[2 + i] = (BYTE)(flipped >> (8 * i));
+	}
+
+	// Reverses the first numRows rows of 2 bit indices in a BC1 colour block
+	static void FlipColourBlock(BYTE* block, int numRows)
+	{
+		std::reverse(block + 4, block + 4 + numRows);
+	}
+
+	// Flips a level upside down, block rows are reversed and then the texel rows within each block
+	static void FlipLevel(BlockFormat format, BYTE* data, int width, int height)
+	{
+		const size_t blockBytes{ CompressedImage::BlockBytes(format) };
+		const int blocksX{ std::max(1, (width + 3) / 4) };
+		const int blocksY{ std::max(1, (height + 3) / 4) };
+		const size_t rowBytes{ blocksX * blockBytes };
+		const int rowsInBlock{ std::min(4, height) };
+
+		std::vector<BYTE> temp(rowBytes);
+		for (int y = 0; y < blocksY / 2; y++)
+		{
+			BYTE* top{ data + y * rowBytes };
+			BYTE* bottom{ data + (blocksY - 1 - y) * rowBytes };
+			memcpy(temp.data(), top, rowBytes);
+			memcpy(top, bottom, rowBytes);
+			memcpy(bottom, temp.data(), rowBytes);
+		}
+
+		for (size_t b = 0; b < (size_t)blocksX * blocksY; b++)
+		{
+			BYTE* block{ data + b * blockBytes };
+			switch (format)
+			{
+			case BlockFormat::BC1:
+				FlipColourBlock(block, rowsInBlock);
+				break;
+			case BlockFormat::BC2:
+				// Explicit alpha is 2 bytes per row
+				for (int row = 0; row < rowsInBlock / 2; row++)
+					std::swap_ranges(block + row * 2, block + row * 2 + 2, block + (rowsInBlock - 1 - row) * 2);
+				FlipColourBlock(block + 8, rowsInBlock);
+				break;
+			case BlockFormat::BC3:
+				FlipAlphaBlock(block, rowsInBlock);
+				FlipColourBlock(block + 8, rowsInBlock);
+				break;
+			case BlockFormat::BC4:
+				FlipAlphaBlock(block, rowsInBlock);
+				break;
+			case BlockFormat::BC5:
+				FlipAlphaBlock(block, rowsInBlock);
+				FlipAlphaBlock(block + 8, rowsInBlock);
+				break;
+			case BlockFormat::BC7:
+				break;
+			}
+		}
+	}
+
+	// Load a DDS file holding BC1 - BC5 or BC7 data
+	bool LoadDDS(const std::string& filepath, CompressedImage& image, bool flipVertically)
+	{
+		FILE* file{ nullptr };
+		if (fopen_s(&file, filepath.c_str(), "rb") != 0 || !file)
+		{
+			std::cout << "File does not exist: " << filepath << std::endl;
+			return false;
+		}
+
+		uint32_t magic{ 0 };
+		DDSHeader header{};
+		bool ok{ fread(&magic, sizeof(magic), 1, file) == 1 && magic == kDDSMagic &&
+			fread(&header, sizeof(header), 1, file) == 1 && header.size == sizeof(DDSHeader) };
+
+		BlockFormat format{ BlockFormat::BC1 };
+		if (ok && (header.pixelFormat.flags & kDDPFFourCC))
+		{
+			const uint32_t fourCC{ header.pixelFormat.fourCC };
+			if (fourCC == MakeFourCC('D', 'X', 'T', '1'))
+				format = BlockFormat::BC1;
+			else if (fourCC == MakeFourCC('D', 'X', 'T', '2') || fourCC == MakeFourCC('D', 'X', 'T', '3'))
+				format = BlockFormat::BC2;
+			else if (fourCC == MakeFourCC('D', 'X', 'T', '4') || fourCC == MakeFourCC('D', 'X', 'T', '5'))
+				format = BlockFormat::BC3;
+			else if (fourCC == MakeFourCC('A', 'T', 'I', '1') || fourCC == MakeFourCC('B', 'C', '4', 'U'))
+				format = BlockFormat::BC4;
+			else if (fourCC == MakeFourCC('A', 'T', 'I', '2') || fourCC == MakeFourCC('B', 'C', '5', 'U'))
+				format = BlockFormat::BC5;
+			else if (fourCC == MakeFourCC('D', 'X', '1', '0'))
+			{
+				DDSHeaderDX10 dx10{};
+				ok = fread(&dx10, sizeof(dx10), 1, file) == 1;
+				switch (dx10.dxgiFormat)
+				{
+				case DXGI_BC1_UNORM: case DXGI_BC1_SRGB: format = BlockFormat::BC1; break;
+				case DXGI_BC2_UNORM: case DXGI_BC2_SRGB: format = BlockFormat::BC2; break;
+				case DXGI_BC3_UNORM: case DXGI_BC3_SRGB: format = BlockFormat::BC3; break;
+				case DXGI_BC4_UNORM: format = BlockFormat::BC4; break;
+				case DXGI_BC5_UNORM: format = BlockFormat::BC5; break;
+				case DXGI_BC7_UNORM: case DXGI_BC7_SRGB: format = BlockFormat::BC7; break;
+				default: ok = false; break;
+				}
+			}
+			else
+			{
+				ok = false;
+			}
+		}
+		else
+		{
+			// Uncompressed DDS files are left to FreeImage
+			ok = false;
+		}
+
+		if (ok)
+		{
+			const int numLevels{ std::max(1, (int)header.mipMapCount) };
+			image.Allocate(format, (int)header.width, (int)header.height, numLevels);
+			memcpy(image.stamp, header.reserved1, sizeof(image.stamp));
+
+			// Files may hold fewer levels than the header claims, keep what is there
+			const size_t read{ fread(image.data.data(), 1, image.data.size(), file) };
+			while (!image.levels.empty() && image.levels.back().offset + image.levels.back().size > read)
+				image.levels.pop_back();
+
+			ok = !image.levels.empty();
+		}
+
+		fclose(file);
+
+		if (!ok)
+		{
+			std::cout << "LoadDDS: unsupported or corrupt DDS file " << filepath << std::endl;
+			return false;
+		}
+
+		if (flipVertically && image.format != BlockFormat::BC7)
+		{
+			for (size_t level = 0; level < image.levels.size(); level++)
+				FlipLevel(image.format, image.data.data() + image.levels[level].offset, image.levels[level].width, image.levels[level].height);
+		}
+
+		return true;
+	}
+
+	// Save as a DDS file. BC7 uses a DX10 header, the others the legacy DXTn / ATIn FourCCs.
+	bool SaveDDS(const std::string& filepath, const CompressedImage& image)
+	{
+		if (image.levels.empty())
+			return false;
+
+		DDSHeader header{};
+		header.size = sizeof(DDSHeader);
+		header.flags = kDDSDCaps | kDDSDHeight | kDDSDWidth | kDDSDPixelFormat | kDDSDLinearSize;
+		header.width = (uint32_t)image.levels[0].width;
+		header.height = (uint32_t)image.levels[0].height;
+		header.pitchOrLinearSize = (uint32_t)image.levels[0].size;
+		header.mipMapCount = (uint32_t)image.levels.size();
+		header.caps = kDDSCapsTexture;
+		memcpy(header.reserved1, image.stamp, sizeof(image.stamp));
+
+		if (image.levels.size() > 1)
+		{
+			header.flags |= kDDSDMipMapCount;
+			header.caps |= kDDSCapsMipMap | kDDSCapsComplex;
+		}
+
+		header.pixelFormat.size = sizeof(DDSPixelFormat);
+		header.pixelFormat.flags = kDDPFFourCC;
+
+		DDSHeaderDX10 dx10{};
+		bool writeDX10{ false };
+		switch (image.format)
+		{
+		case BlockFormat::BC1: header.pixelFormat.fourCC = MakeFourCC('D', 'X', 'T', '1'); break;
+		case BlockFormat::BC2: header.pixelFormat.fourCC = MakeFourCC('D', 'X', 'T', '3'); break;
+		case BlockFormat::BC3: header.pixelFormat.fourCC = MakeFourCC('D', 'X', 'T', '5'); break;
+		case BlockFormat::BC4: header.pixelFormat.fourCC = MakeFourCC('A', 'T', 'I', '1'); break;
+		case BlockFormat::BC5: header.pixelFormat.fourCC = MakeFourCC('A', 'T', 'I', '2'); break;
+		case BlockFormat::BC7:
+			header.pixelFormat.fourCC = MakeFourCC('D', 'X', '1', '0');
+			dx10.dxgiFormat = DXGI_BC7_UNORM;
+			dx10.resourceDimension = 3; // Texture 2D
+			dx10.arraySize = 1;
+			writeDX10 = true;
+			break;
+		}
+
+		FILE* file{ nullptr };
+		if (fopen_s(&file, filepath.c_str(), "wb") != 0 || !file)
+			return false;
+
+		bool ok{ fwrite(&kDDSMagic, sizeof(kDDSMagic), 1, file) == 1 && fwrite(&header, sizeof(header), 1, file) == 1 };
+		if (ok && writeDX10)
+			ok = fwrite(&dx10, sizeof(dx10), 1, file) == 1;
+		if (ok)
+			ok = fwrite(image.data.data(), 1, image.data.size(), file) == image.data.size();
+
+		fclose(file);
+		return ok;
+	}
+}
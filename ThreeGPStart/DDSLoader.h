@@ -0,0 +1,61 @@
+#pragma once
+// Reading and writing of block compressed (BCn / DXTn) textures held in DDS files
+
+#include "ExternalLibraryHeaders.h"
+
+namespace Helpers
+{
+	enum class BlockFormat
+	{
+		BC1,	// DXT1, RGB 4 bits per texel
+		BC2,	// DXT3, RGB + explicit 4 bit alpha, 8 bits per texel
+		BC3,	// DXT5, RGB + interpolated alpha, 8 bits per texel
+		BC4,	// Single channel, 4 bits per texel
+		BC5,	// Two channel, 8 bits per texel
+		BC7		// High quality RGBA, 8 bits per texel
+	};
+
+	// Number of words in the DDS reserved area available to callers, e.g. to stamp cache files
+	static const int kDDSStampWords{ 8 };
+
+	// Block compressed data for every level of a texture, largest first
+	struct CompressedImage
+	{
+		struct Level
+		{
+			int width{ 0 };
+			int height{ 0 };
+			size_t offset{ 0 };
+			size_t size{ 0 };
+		};
+
+		BlockFormat format{ BlockFormat::BC1 };
+		std::vector<Level> levels;
+		std::vector<BYTE> data;
+
+		// Caller defined words stored in the otherwise unused reserved part of the header
+		uint32_t stamp[kDDSStampWords]{};
+
+		const BYTE* LevelData(size_t level) const { return data.data() + levels[level].offset; }
+
+		// Matching OpenGL internal format for glCompressedTexImage2D
+		GLenum GLInternalFormat() const;
+
+		// Bytes per 4x4 block
+		static size_t BlockBytes(BlockFormat format);
+
+		// Bytes a width x height level takes, partial blocks at the edges count as whole
+		static size_t LevelBytes(BlockFormat format, int width, int height);
+
+		// Sets up the level table and sizes data for numLevels levels of a width x height texture
+		void Allocate(BlockFormat blockFormat, int width, int height, int numLevels);
+	};
+
+	// Load a DDS file holding BC1 - BC5 or BC7 data (either legacy DXTn or DX10 headers). Returns false on error.
+	// DDS files are stored top row first while OpenGL expects the bottom row first, so by default the blocks are
+	// flipped on load. BC7 cannot be flipped cheaply so is left as is.
+	bool LoadDDS(const std::string& filepath, CompressedImage& image, bool flipVertically = true);
+
+	// Save as a DDS file. The data is written as held, so images that were not flipped on load stay bottom row first.
+	bool SaveDDS(const std::string& filepath, const CompressedImage& image);
+}
@@ -5,11 +5,12 @@
 uniform vec4 diffuse_colour;
 
 in vec3 varying_colour;
+in vec4 varying_tint;
 
 out vec4 fragment_colour;
 
 void main(void)
 {
 	//fragment_colour = vec4(1.0,0.0,1.0,1.0);
-	fragment_colour = vec4(varying_colour,1.0);
+	fragment_colour = vec4(varying_colour * varying_tint.rgb,1.0);
 }
\ No newline at end of file
@@ -1,16 +1,63 @@
-#version 330
+#version 460
 
-uniform mat4 combined_xform;
-uniform mat4 model_xform;
+// Written once a frame
+layout(std140) uniform FrameUniforms
+{
+	mat4 combined_xform;
+	mat4 view_xform;
+	mat4 projection_xform;
+	vec4 camera_position;
+};
+
+// One entry per draw of the frame, found by the draw's baseInstance wherever culling packed its command.
+// Binding 2 is kDrawDataBinding in Renderer.cpp
+struct DrawData
+{
+	mat4 model_xform;
+	uint first_instance;
+	uint instance_count;
+};
+
+layout(std430, binding = 2) readonly buffer DrawDataBlock
+{
+	DrawData draws[];
+};
+
+// Instances of instanced models, read when a draw has an instance count. Binding 6 is kInstanceBinding in Renderer.cpp
+struct InstanceData
+{
+	mat4 transform;
+	vec4 tint;
+};
+
+layout(std430, binding = 6) readonly buffer InstanceBlock
+{
+	InstanceData instances[];
+};
+
+// The depth prepass and the pass after it must reach exactly the same depth for GL_EQUAL to pass
+invariant gl_Position;
 
 layout (location=0) in vec3 vertex_position;
 layout (location=1) in vec3 vertex_colour;
 
 out vec3 varying_colour;
+out vec4 varying_tint;
 
 void main(void)
 {	
 	varying_colour = vertex_colour;
 
+	DrawData draw = draws[gl_BaseInstance];
+	mat4 model_xform = draw.model_xform;
+	varying_tint = vec4(1.0);
+
+	if (draw.instance_count > 0u)
+	{
+		InstanceData instance = instances[draw.first_instance + uint(gl_InstanceID)];
+		model_xform = model_xform * instance.transform;
+		varying_tint = instance.tint;
+	}
+
 	gl_Position = combined_xform * model_xform * vec4(vertex_position, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,6 @@
+#version 330
+
+// Depth prepass, only the depth test and write do anything
+void main(void)
+{
+}
@@ -6,6 +6,7 @@ uniform vec4 diffuse_colour;
 in vec3 varying_normals;
 in vec2 varying_texcoords;
 in vec3 varying_positions;
+in vec4 varying_tint;
 
 out vec4 fragment_colour;
 
@@ -30,7 +31,7 @@ void main(void)
 
 	vec3 ambient_light = vec3(0.01);
 
-	vec3 tex_colour = texture(sampler_tex, varying_texcoords).rgb;
+	vec3 tex_colour = texture(sampler_tex, varying_texcoords).rgb * varying_tint.rgb;
 
 	//Ambient light
 	tex_colour = ambient_light + tex_colour * (directional_intensity + pointLight_intensity);
@@ -1,20 +1,12 @@
 #version 330
 
-uniform sampler2D sampler_tex;
-uniform vec4 diffuse_colour;
+uniform samplerCube sampler_sky;
 
-in vec3 varying_normals;
-in vec2 varying_texcoords;
-in vec3 varying_positions;
+in vec3 varying_direction;
 
 out vec4 fragment_colour;
 
 void main(void)
 {
-
-	vec3 tex_colour = texture(sampler_tex, varying_texcoords).rgb;
- 
-
-	fragment_colour = vec4(tex_colour, 1.0);
-	
-}
\ No newline at end of file
+	fragment_colour = vec4(texture(sampler_sky, varying_direction).rgb, 1.0);
+}
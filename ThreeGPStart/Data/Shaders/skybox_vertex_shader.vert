@@ -1,24 +1,18 @@
 #version 330
 
-uniform mat4 combined_xform;
-uniform mat4 model_xform;
+// Inverse of projection * view with the translation removed
+uniform mat4 inverse_view_projection;
 
-layout (location=0) in vec3 vertex_position;
-layout (location=1) in vec3 vertex_normals;
-layout (location=2) in vec2 vertex_texture;
-
-out vec3 varying_normals;
-out vec2 varying_texcoords;
-out vec3 varying_positions;
+out vec3 varying_direction;
 
 void main(void)
-{	
-
+{
+	// One triangle covering the screen from the vertex index, no buffers needed
+	vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
 
-	varying_positions = vertex_position;
-	varying_normals = vertex_normals;
-	varying_texcoords = vertex_texture;
-	
+	// z = w puts it on the far plane so anything drawn before is in front
+	gl_Position = vec4(position, 1.0, 1.0);
 
-	gl_Position = combined_xform * model_xform * vec4(vertex_position, 1.0);
-}
\ No newline at end of file
+	vec4 world = inverse_view_projection * vec4(position, 1.0, 1.0);
+	varying_direction = world.xyz / world.w;
+}
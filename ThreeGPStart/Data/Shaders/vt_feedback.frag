@@ -0,0 +1,25 @@
+#version 330
+
+// Virtual size, page size, border, coarsest level
+uniform vec4 vt_params;
+
+// Brings the level chosen at the feedback resolution back to what the full screen would pick
+uniform float vt_feedback_bias;
+
+in vec2 varying_texcoords;
+
+out vec4 fragment_colour;
+
+// Writes the page this pixel needs as x, y, level, read back by the CPU to decide what to load
+void main(void)
+{
+	vec2 uv = clamp(varying_texcoords, 0.0, 0.99999);
+
+	vec2 dx = dFdx(uv * vt_params.x);
+	vec2 dy = dFdy(uv * vt_params.x);
+	float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vt_feedback_bias;
+	float level = clamp(floor(lod), 0.0, vt_params.w);
+
+	vec2 page = floor(uv * vt_params.x / vt_params.y / exp2(level));
+	fragment_colour = vec4(page, level, 255.0) / 255.0;
+}
@@ -0,0 +1,69 @@
+#version 330
+
+// Virtual texture: page table of physical x, y and level per page, physical texture of bordered pages
+uniform sampler2D vt_page_table;
+uniform sampler2D vt_physical;
+
+// Virtual size, page size, border, coarsest level
+uniform vec4 vt_params;
+uniform float vt_physical_size;
+
+in vec3 varying_normals;
+in vec2 varying_texcoords;
+in vec3 varying_positions;
+
+out vec4 fragment_colour;
+
+// Level the hardware would pick for a texture the virtual size
+float VirtualLevel(vec2 uv)
+{
+	vec2 dx = dFdx(uv * vt_params.x);
+	vec2 dy = dFdy(uv * vt_params.x);
+	float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+	return clamp(floor(lod), 0.0, vt_params.w);
+}
+
+vec3 VirtualSample(vec2 uv)
+{
+	uv = clamp(uv, 0.0, 0.99999);
+
+	int level = int(VirtualLevel(uv));
+	ivec2 page = ivec2(uv * vec2(textureSize(vt_page_table, level)));
+	vec3 entry = floor(texelFetch(vt_page_table, page, level).xyz * 255.0 + 0.5);
+
+	// The entry may be for an ancestor if the page wanted is not resident, it covers more of the texture
+	float mappedPages = vt_params.x / vt_params.y / exp2(entry.z);
+	vec2 withinPage = fract(uv * mappedPages);
+
+	float tileSize = vt_params.y + 2.0 * vt_params.z;
+	vec2 texel = entry.xy * tileSize + vt_params.z + withinPage * vt_params.y;
+	return textureLod(vt_physical, texel / vt_physical_size, 0.0).rgb;
+}
+
+void main(void)
+{
+	vec3 pointLightPos = vec3(1000,100,300);
+	vec3 light_direction = vec3(100,100,200);
+
+	vec3 N = normalize(varying_normals);
+
+	vec3 P = varying_positions;
+
+	//Point light
+	vec3 pointLight = normalize(pointLightPos - P);
+
+	//Directional light
+	vec3 directionalLight = normalize(-light_direction);
+
+	float pointLight_intensity = max(0, dot(pointLight, N));
+	float directional_intensity = max(0, dot(directionalLight, N));
+
+	vec3 ambient_light = vec3(0.01);
+
+	vec3 tex_colour = VirtualSample(varying_texcoords);
+
+	//Ambient light
+	tex_colour = ambient_light + tex_colour * (directional_intensity + pointLight_intensity);
+
+	fragment_colour = vec4(tex_colour, 1.0);
+}
@@ -0,0 +1,139 @@
+#include "DepthPyramid.h"
+
+namespace Helpers
+{
+	// Threads per group in each direction in depth_pyramid.comp
+	static const int kReduceGroupSize{ 8 };
+
+	// Image units of depth_pyramid.comp
+	static const GLuint kSourceImageUnit{ 0 };
+	static const GLuint kDestinationImageUnit{ 1 };
+
+	// Texture unit the depth copy is read from on level 0
+	static const int kDepthTextureUnit{ 0 };
+
+	static const UniformName kSourceDepth{ ShaderProgram::Name("source_depth") };
+	static const UniformName kFromDepth{ ShaderProgram::Name("from_depth") };
+	static const UniformName kSourceSize{ ShaderProgram::Name("source_size") };
+	static const UniformName kDestinationSize{ ShaderProgram::Name("destination_size") };
+
+	// Largest power of two no more than value
+	static int FloorPowerOfTwo(int value)
+	{
+		int power{ 1 };
+		while (power * 2 <= value)
+			power *= 2;
+		return power;
+	}
+
+	// Loads the reduction shader, returns false if it cannot
+	bool DepthPyramid::Create(const std::string& computeShaderPath)
+	{
+		Destroy();
+		return m_program.LoadCompute(computeShaderPath);
+	}
+
+	void DepthPyramid::Destroy()
+	{
+		m_program.Destroy();
+
+		glDeleteFramebuffers(1, &m_depthFramebuffer);
+		glDeleteTextures(1, &m_depthTexture);
+		glDeleteTextures(1, &m_pyramid);
+		m_depthFramebuffer = 0;
+		m_depthTexture = 0;
+		m_pyramid = 0;
+		m_screenWidth = m_screenHeight = 0;
+		m_width = m_height = m_levels = 0;
+	}
+
+	// Remakes the textures for a new screen size
+	void DepthPyramid::Resize(int screenWidth, int screenHeight)
+	{
+		glDeleteFramebuffers(1, &m_depthFramebuffer);
+		glDeleteTextures(1, &m_depthTexture);
+		glDeleteTextures(1, &m_pyramid);
+
+		m_screenWidth = screenWidth;
+		m_screenHeight = screenHeight;
+
+		// Depth blits need the same format as the window's 24 bit depth, 8 bit stencil buffer
+		glGenTextures(1, &m_depthTexture);
+		glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, screenWidth, screenHeight);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glGenFramebuffers(1, &m_depthFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFramebuffer);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, m_depthTexture, 0);
+		glDrawBuffer(GL_NONE);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+		m_width = FloorPowerOfTwo(screenWidth);
+		m_height = FloorPowerOfTwo(screenHeight);
+		m_levels = 1;
+		while ((m_width >> m_levels) > 0 || (m_height >> m_levels) > 0)
+			m_levels++;
+
+		glGenTextures(1, &m_pyramid);
+		glBindTexture(GL_TEXTURE_2D, m_pyramid);
+		glTexStorage2D(GL_TEXTURE_2D, m_levels, GL_R32F, m_width, m_height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		m_stats.width = m_width;
+		m_stats.height = m_height;
+		m_stats.levels = m_levels;
+	}
+
+	// Builds the chain from what the default framebuffer's depth holds now
+	void DepthPyramid::Build(int screenWidth, int screenHeight)
+	{
+		if (!m_program.IsValid() || screenWidth <= 0 || screenHeight <= 0)
+			return;
+
+		if (screenWidth != m_screenWidth || screenHeight != m_screenHeight)
+			Resize(screenWidth, screenHeight);
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFramebuffer);
+		glBlitFramebuffer(0, 0, screenWidth, screenHeight, 0, 0, screenWidth, screenHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		m_program.Use();
+		m_program.Set(kSourceDepth, kDepthTextureUnit);
+		glActiveTexture(GL_TEXTURE0 + kDepthTextureUnit);
+		glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+
+		// Level 0 from the depth copy, then each level from the one before
+		int sourceWidth{ screenWidth }, sourceHeight{ screenHeight };
+		for (int level = 0; level < m_levels; level++)
+		{
+			const int width{ std::max(m_width >> level, 1) };
+			const int height{ std::max(m_height >> level, 1) };
+
+			m_program.Set(kFromDepth, level == 0 ? 1 : 0);
+			glProgramUniform2i(m_program.Id(), m_program.Location(kSourceSize), sourceWidth, sourceHeight);
+			glProgramUniform2i(m_program.Id(), m_program.Location(kDestinationSize), width, height);
+
+			glBindImageTexture(kSourceImageUnit, m_pyramid, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+			glBindImageTexture(kDestinationImageUnit, m_pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+			glDispatchCompute((GLuint)((width + kReduceGroupSize - 1) / kReduceGroupSize), (GLuint)((height + kReduceGroupSize - 1) / kReduceGroupSize), 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+			sourceWidth = width;
+			sourceHeight = height;
+		}
+
+		// The culling shader samples the result
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		m_stats.builds++;
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+// Mip chain of the farthest depth under each texel, built from the frame's depth buffer for occlusion tests
+
+#include "ExternalLibraryHeaders.h"
+#include "ShaderProgram.h"
+
+namespace Helpers
+{
+	// The default framebuffer's depth is blitted, resolving multisampling, into a texture of the same format. A compute
+	// pass then reduces it into an R32F chain a power of two in each direction no larger than the screen, each texel
+	// the farthest depth of every texel it covers in the level above. Anything whose nearest depth is farther than a
+	// texel's value is hidden everywhere that texel covers, so two or four texels at the right level test a whole
+	// screen rectangle. GL thread only.
+	class DepthPyramid
+	{
+	public:
+		struct Stats
+		{
+			int width{ 0 };
+			int height{ 0 };
+			int levels{ 0 };
+			size_t builds{ 0 };
+		};
+	private:
+		ShaderProgram m_program;
+
+		// Resolved copy of the depth buffer and the framebuffer blitted into it
+		GLuint m_depthTexture{ 0 };
+		GLuint m_depthFramebuffer{ 0 };
+		int m_screenWidth{ 0 };
+		int m_screenHeight{ 0 };
+
+		GLuint m_pyramid{ 0 };
+		int m_width{ 0 };
+		int m_height{ 0 };
+		int m_levels{ 0 };
+
+		Stats m_stats;
+
+		// Remakes the textures for a new screen size
+		void Resize(int screenWidth, int screenHeight);
+	public:
+		DepthPyramid() = default;
+		~DepthPyramid() { Destroy(); }
+
+		DepthPyramid(const DepthPyramid&) = delete;
+		DepthPyramid& operator=(const DepthPyramid&) = delete;
+
+		// Loads the reduction shader, returns false if it cannot
+		bool Create(const std::string& computeShaderPath);
+
+		void Destroy();
+
+		bool IsValid() const { return m_program.IsValid(); }
+
+		// Builds the chain from what the default framebuffer's depth holds now. Leaves the default framebuffer bound.
+		void Build(int screenWidth, int screenHeight);
+
+		// Valid after Build
+		GLuint Texture() const { return m_pyramid; }
+		int Width() const { return m_width; }
+		int Height() const { return m_height; }
+		int Levels() const { return m_levels; }
+
+		const Stats& GetStats() const { return m_stats; }
+	};
+}
@@ -0,0 +1,417 @@
+#include "DrawCuller.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace Helpers
+{
+	// Storage bindings of cull_draws.comp, clear of those the draw shaders use
+	static const GLuint kRecordBinding{ 3 };
+	static const GLuint kCommandBinding{ 4 };
+	static const GLuint kCountBinding{ 5 };
+	static const GLuint kVisibilityBinding{ 7 };
+
+	// Texture unit cull_draws.comp samples the depth pyramid on
+	static const int kPyramidTextureUnit{ 0 };
+
+	// Threads per group in cull_draws.comp
+	static const GLuint kCullGroupSize{ 64 };
+
+	static const UniformName kFrustumPlanes{ ShaderProgram::Name("frustum_planes") };
+	static const UniformName kRecordCount{ ShaderProgram::Name("record_count") };
+	static const UniformName kPhase{ ShaderProgram::Name("phase") };
+	static const UniformName kViewProjection{ ShaderProgram::Name("view_projection") };
+	static const UniformName kDepthPyramid{ ShaderProgram::Name("depth_pyramid") };
+	static const UniformName kPyramidSize{ ShaderProgram::Name("pyramid_size") };
+	static const UniformName kPyramidLevels{ ShaderProgram::Name("pyramid_levels") };
+
+	// Loads the compute shaders. Returns false if the culling one cannot load, the CPU path still works.
+	bool DrawCuller::Create(const std::string& computeShaderPath, const std::string& pyramidShaderPath)
+	{
+		Destroy();
+		m_pyramid.Create(pyramidShaderPath);
+		return m_program.LoadCompute(computeShaderPath);
+	}
+
+	void DrawCuller::Destroy()
+	{
+		m_program.Destroy();
+		m_pyramid.Destroy();
+
+		glDeleteBuffers(1, &m_commandBuffer);
+		glDeleteBuffers(1, &m_countBuffer);
+		glDeleteBuffers(1, &m_visibilityBuffer);
+		m_commandBuffer = 0;
+		m_countBuffer = 0;
+		m_visibilityBuffer = 0;
+		m_commandCapacity = 0;
+		m_countCapacity = 0;
+		m_visibilityCapacity = 0;
+	}
+
+	// Occlusion needs the camera and the size of the default framebuffer the draws go to
+	void DrawCuller::SetView(const glm::mat4& viewProjection, int viewportWidth, int viewportHeight)
+	{
+		m_viewProjection = viewProjection;
+		m_viewportWidth = viewportWidth;
+		m_viewportHeight = viewportHeight;
+	}
+
+	// Makes a GPU only storage buffer of bytes
+	static GLuint CreateStorage(size_t bytes)
+	{
+		GLuint buffer{ 0 };
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)bytes, nullptr, 0);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return buffer;
+	}
+
+	// Grows the GPU output buffers to hold at least the given counts
+	void DrawCuller::ReserveGPU(size_t commands, size_t batches)
+	{
+		if (commands > m_commandCapacity)
+		{
+			m_commandCapacity = std::max({ commands, m_commandCapacity * 2, (size_t)1024 });
+			glDeleteBuffers(1, &m_commandBuffer);
+			m_commandBuffer = CreateStorage(m_commandCapacity * sizeof(IndirectCommand));
+		}
+
+		if (batches > m_countCapacity)
+		{
+			m_countCapacity = std::max({ batches, m_countCapacity * 2, (size_t)256 });
+			glDeleteBuffers(1, &m_countBuffer);
+			m_countBuffer = CreateStorage(m_countCapacity * sizeof(GLuint));
+		}
+	}
+
+	// Packs the surviving commands of every batch into m_packed and m_counts
+	void DrawCuller::CullCPU()
+	{
+		m_packed.resize(m_records.size());
+		m_counts.assign(m_batches.size(), 0);
+		m_stats.visible = 0;
+
+		for (const CullRecord& record : m_records)
+		{
+			const BoundingSphere sphere{ glm::vec3(record.sphere), record.sphere.w };
+			if (!SphereInFrustum(m_frustum, sphere))
+				continue;
+
+			m_packed[record.batchStart + m_counts[record.batch]++] = record.command;
+			m_stats.visible++;
+		}
+	}
+
+	// Writes m_records to the ring, false if they do not fit
+	bool DrawCuller::WriteRecords(UniformRing& ring)
+	{
+		return ring.Write(m_records.data(), m_records.size() * sizeof(CullRecord), m_recordOffset);
+	}
+
+	// Grows the visibility buffer to hold objects, new objects start hidden so the second phase draws them
+	void DrawCuller::ReserveVisibility(size_t objects)
+	{
+		if (objects <= m_visibilityCapacity)
+			return;
+
+		m_visibilityCapacity = std::max({ objects, m_visibilityCapacity * 2, (size_t)1024 });
+		glDeleteBuffers(1, &m_visibilityBuffer);
+		m_visibilityBuffer = CreateStorage(m_visibilityCapacity * sizeof(GLuint));
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visibilityBuffer);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// Issues the compute pass over m_records for m_phase
+	void DrawCuller::CullGPU(UniformRing& ring)
+	{
+		// Phase 2 writes the second half of each output
+		const size_t half{ m_phase == 2 ? (size_t)1 : 0 };
+		const size_t commandBytes{ m_records.size() * sizeof(IndirectCommand) };
+		const size_t countBytes{ m_batches.size() * sizeof(GLuint) };
+
+		// Every batch starts empty, the shader counts survivors in
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_countBuffer);
+		glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, (GLintptr)(half * countBytes), (GLsizeiptr)countBytes, GL_RED_INTEGER,
+			GL_UNSIGNED_INT, nullptr);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		m_program.Use();
+		glProgramUniform4fv(m_program.Id(), m_program.Location(kFrustumPlanes), 6, glm::value_ptr(m_frustum.planes[0]));
+		m_program.Set(kRecordCount, (int)m_records.size());
+		m_program.Set(kPhase, m_phase);
+
+		if (m_phase == 2)
+		{
+			m_program.Set(kViewProjection, m_viewProjection);
+			m_program.Set(kDepthPyramid, kPyramidTextureUnit);
+			m_program.Set(kPyramidSize, glm::vec2(m_pyramid.Width(), m_pyramid.Height()));
+			m_program.Set(kPyramidLevels, m_pyramid.Levels());
+			glActiveTexture(GL_TEXTURE0 + kPyramidTextureUnit);
+			glBindTexture(GL_TEXTURE_2D, m_pyramid.Texture());
+		}
+
+		ring.BindStorage(kRecordBinding, m_recordOffset, m_records.size() * sizeof(CullRecord));
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, kCommandBinding, m_commandBuffer, (GLintptr)(half * commandBytes), (GLsizeiptr)commandBytes);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, kCountBinding, m_countBuffer, (GLintptr)(half * countBytes), (GLsizeiptr)countBytes);
+		if (m_phase != 0)
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kVisibilityBinding, m_visibilityBuffer);
+
+		glDispatchCompute((GLuint)((m_records.size() + kCullGroupSize - 1) / kCullGroupSize), 1, 1);
+
+		// The draws read the commands and counts as indirect arguments, the next phase or frame the visibility
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// Binds the indirect buffers Draw reads for the current phase
+	void DrawCuller::BindOutputs(UniformRing& ring) const
+	{
+		if (m_frameMode == CullMode::GPU)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+			glBindBuffer(GL_PARAMETER_BUFFER, m_countBuffer);
+		}
+		else
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring.Buffer());
+		}
+	}
+
+	// Sorts the packed survivors of each batch, counts[b] of them from the batch's start in commands
+	DrawCuller::SurvivorSets DrawCuller::SortSurvivors(const std::vector<GLuint>& counts, const IndirectCommand* commands) const
+	{
+		SurvivorSets survivors(m_batches.size());
+		for (size_t b = 0; b < m_batches.size(); b++)
+		{
+			const DrawBatch& batch{ m_batches[b] };
+			const size_t count{ std::min((size_t)counts[b], (size_t)batch.count) };
+
+			std::vector<GLuint>& draws{ survivors[b] };
+			for (size_t i = 0; i < count; i++)
+				draws.push_back(commands[batch.start + i].baseInstance);
+			std::sort(draws.begin(), draws.end());
+
+			// Counting past the end of the batch is wrong whatever was written, so it never matches
+			if (counts[b] > batch.count)
+				draws.push_back(UINT32_MAX);
+		}
+		return survivors;
+	}
+
+	// Survivors of each batch from the last Cull or CullRevealed, read back if they were culled on the GPU. Stalls.
+	DrawCuller::SurvivorSets DrawCuller::ReadSurvivors() const
+	{
+		if (m_frameMode == CullMode::CPU)
+			return SortSurvivors(m_counts, m_packed.data());
+
+		if (m_frameMode != CullMode::GPU)
+			return SurvivorSets(m_batches.size());
+
+		// Phase 2 writes the second half of each output
+		const size_t half{ m_phase == 2 ? (size_t)1 : 0 };
+		std::vector<GLuint> counts(m_batches.size());
+		std::vector<IndirectCommand> commands(m_records.size());
+
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_COPY_READ_BUFFER, m_countBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr)(half * counts.size() * sizeof(GLuint)), (GLsizeiptr)(counts.size() * sizeof(GLuint)),
+			counts.data());
+		glBindBuffer(GL_COPY_READ_BUFFER, m_commandBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr)(half * commands.size() * sizeof(IndirectCommand)),
+			(GLsizeiptr)(commands.size() * sizeof(IndirectCommand)), commands.data());
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		return SortSurvivors(counts, commands.data());
+	}
+
+	// Checks the survivors of the same draws culled on the GPU against those culled on the CPU
+	DrawCuller::Comparison DrawCuller::CompareSurvivors(const SurvivorSets& gpu, const SurvivorSets& cpu)
+	{
+		Comparison comparison;
+		comparison.batches = std::max(gpu.size(), cpu.size());
+
+		static const std::vector<GLuint> kNone;
+		for (size_t b = 0; b < comparison.batches; b++)
+		{
+			const std::vector<GLuint>& gpuDraws{ b < gpu.size() ? gpu[b] : kNone };
+			const std::vector<GLuint>& cpuDraws{ b < cpu.size() ? cpu[b] : kNone };
+			comparison.gpuVisible += gpuDraws.size();
+			comparison.cpuVisible += cpuDraws.size();
+			if (gpuDraws != cpuDraws)
+				comparison.differingBatches++;
+		}
+		return comparison;
+	}
+
+	// Reads the GPU result back and checks it against the CPU path, fills m_comparison. Stalls.
+	void DrawCuller::CompareGPU()
+	{
+		const SurvivorSets gpu{ ReadSurvivors() };
+
+		CullCPU();
+		const Comparison comparison{ CompareSurvivors(gpu, SortSurvivors(m_counts, m_packed.data())) };
+
+		std::ostringstream report;
+		if (comparison.Agrees())
+			report << "GPU and CPU culling agree: " << comparison.gpuVisible << " of " << m_records.size() << " draws visible";
+		else
+			report << "GPU and CPU culling differ in " << comparison.differingBatches << " of " << comparison.batches << " batches: GPU "
+			<< comparison.gpuVisible << ", CPU " << comparison.cpuVisible << " of " << m_records.size() << " draws visible";
+		m_comparison = report.str();
+	}
+
+	// Culls this frame's draws. Returns false if nothing was culled, when the caller should draw every command itself.
+	bool DrawCuller::Cull(UniformRing& ring, const std::vector<IndirectCommand>& commands, const std::vector<BoundingSphere>& spheres,
+		const std::vector<uint32_t>& objects, const std::vector<DrawBatch>& batches)
+	{
+		m_stats = Stats();
+		m_stats.tested = commands.size();
+		m_frameMode = m_mode;
+		m_phase = 0;
+
+		if (m_frameMode == CullMode::Off || commands.empty())
+		{
+			m_frameMode = CullMode::Off;
+			return false;
+		}
+
+		size_t objectCount{ 0 };
+		for (uint32_t object : objects)
+		{
+			if (object != kNoObject)
+				objectCount = std::max(objectCount, (size_t)object + 1);
+		}
+
+		m_records.resize(commands.size());
+		for (size_t b = 0; b < batches.size(); b++)
+		{
+			for (uint32_t i = batches[b].start; i < batches[b].start + batches[b].count; i++)
+			{
+				CullRecord& record{ m_records[i] };
+				record.command = commands[i];
+				record.batch = (uint32_t)b;
+				record.batchStart = batches[b].start;
+				record.object = objects[i];
+				record.sphere = glm::vec4(spheres[i].centre, spheres[i].radius);
+			}
+		}
+		m_batches = batches;
+
+		if (m_frameMode == CullMode::GPU && (!m_program.IsValid() || !WriteRecords(ring)))
+			m_frameMode = CullMode::CPU;
+
+		if (m_frameMode == CullMode::GPU)
+		{
+			// A comparison against the CPU path needs the frustum test alone
+			if (m_occlusion && m_pyramid.IsValid() && !m_compareRequested && m_viewportWidth > 0 && m_viewportHeight > 0)
+			{
+				m_phase = 1;
+				ReserveVisibility(objectCount);
+			}
+
+			ReserveGPU(m_records.size() * 2, m_batches.size() * 2);
+			CullGPU(ring);
+		}
+
+		if (m_frameMode == CullMode::GPU && m_compareRequested)
+		{
+			m_compareRequested = false;
+			CompareGPU();
+		}
+
+		if (m_frameMode == CullMode::CPU)
+		{
+			CullCPU();
+			if (!ring.Write(m_packed.data(), m_packed.size() * sizeof(IndirectCommand), m_packedOffset))
+			{
+				m_frameMode = CullMode::Off;
+				return false;
+			}
+		}
+
+		m_stats.mode = m_frameMode;
+		m_stats.occlusion = m_phase != 0;
+
+		// Both paths draw from their own buffers
+		BindOutputs(ring);
+		return true;
+	}
+
+	// After the batches from Cull are drawn, tests against their depth and leaves the draws they revealed ready
+	bool DrawCuller::CullRevealed(UniformRing& ring)
+	{
+		if (m_phase != 1 || m_visibilityCurrent)
+			return false;
+
+		// The pyramid build uses the framebuffer and texture bindings, the draws bind theirs again
+		m_pyramid.Build(m_viewportWidth, m_viewportHeight);
+
+		m_phase = 2;
+		CullGPU(ring);
+
+		if (m_occlusionReportRequested)
+		{
+			m_occlusionReportRequested = false;
+			ReportOcclusion();
+		}
+
+		BindOutputs(ring);
+		return true;
+	}
+
+	// Reads the visibility flags back and counts the draws in view they hide. Stalls.
+	void DrawCuller::ReportOcclusion()
+	{
+		size_t objectCount{ 0 };
+		for (const CullRecord& record : m_records)
+		{
+			if (record.object != kNoObject)
+				objectCount = std::max(objectCount, (size_t)record.object + 1);
+		}
+
+		std::vector<GLuint> visibility(objectCount);
+		glBindBuffer(GL_COPY_READ_BUFFER, m_visibilityBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)(objectCount * sizeof(GLuint)), visibility.data());
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		size_t inView{ 0 };
+		size_t occluded{ 0 };
+		for (const CullRecord& record : m_records)
+		{
+			if (record.object == kNoObject || !SphereInFrustum(m_frustum, { glm::vec3(record.sphere), record.sphere.w }))
+				continue;
+
+			inView++;
+			if (visibility[record.object] == 0)
+				occluded++;
+		}
+
+		std::ostringstream report;
+		report << occluded << " of " << inView << " occlusion tested draws in view are hidden, pyramid " << m_pyramid.Width() << "x"
+			<< m_pyramid.Height() << " with " << m_pyramid.Levels() << " levels";
+		m_occlusionReport = report.str();
+	}
+
+	// Draws the survivors of a batch from the last Cull or CullRevealed with whatever state is bound
+	void DrawCuller::Draw(size_t batch) const
+	{
+		const DrawBatch& range{ m_batches[batch] };
+
+		if (m_frameMode == CullMode::GPU)
+		{
+			// The second phase's commands and counts follow the first's
+			const size_t commandStart{ (m_phase == 2 ? m_records.size() : 0) + range.start };
+			const size_t countIndex{ (m_phase == 2 ? m_batches.size() : 0) + batch };
+			glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(uintptr_t)(commandStart * sizeof(IndirectCommand)),
+				(GLintptr)(countIndex * sizeof(GLuint)), (GLsizei)range.count, 0);
+		}
+		else if (m_frameMode == CullMode::CPU && m_counts[batch] > 0)
+		{
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(uintptr_t)(m_packedOffset + range.start * sizeof(IndirectCommand)),
+				(GLsizei)m_counts[batch], 0);
+		}
+	}
+}
@@ -0,0 +1,226 @@
+#pragma once
+// Frustum culling of indirect draws, on the GPU with a compute shader or on the CPU with the same test
+
+#include "ExternalLibraryHeaders.h"
+#include "Bounds.h"
+#include "DepthPyramid.h"
+#include "ShaderProgram.h"
+#include "UniformRing.h"
+
+namespace Helpers
+{
+	// As laid out in the indirect buffer
+	struct IndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	// Draws sharing state, drawn by one multi-draw from start
+	struct DrawBatch
+	{
+		uint32_t start{ 0 };
+		uint32_t count{ 0 };
+	};
+
+	enum class CullMode
+	{
+		Off,
+		CPU,
+		GPU
+	};
+
+	// Each frame Cull takes every draw's command and world bounding sphere with the batches they form, and leaves the
+	// commands of each batch that pass the frustum packed from the batch's start. Draw then issues a batch.
+	// On the GPU the records go through the ring into a compute shader that appends survivors with an atomic count per
+	// batch, and batches are drawn with glMultiDrawElementsIndirectCount so the CPU never sees the result. On the CPU
+	// the same test runs over the records and the packed commands go through the ring. The order within a batch may
+	// differ between the two as GPU threads append in any order. Commands keep their baseInstance, which is how the
+	// vertex shader finds the draw's transform wherever it is packed to.
+	// With occlusion on, the GPU path culls in two phases using a visibility flag per object kept on the GPU between
+	// frames. Cull passes only the objects visible last frame. Once they are drawn, CullRevealed builds a depth pyramid
+	// from their depth, tests every object in view against it and stores the result for next frame. It then passes
+	// the objects that are visible now but were not drawn in the first phase, so nothing pops in for a frame. Draws
+	// without an object are never occlusion tested. GL thread only.
+	class DrawCuller
+	{
+	public:
+		struct Stats
+		{
+			size_t tested{ 0 };
+
+			// Known on the CPU path only, the GPU count stays on the GPU
+			size_t visible{ 0 };
+
+			CullMode mode{ CullMode::Off };
+
+			// Whether this frame culled in two phases against the depth pyramid
+			bool occlusion{ false };
+		};
+
+		// Object of draws that are never occlusion tested
+		static const uint32_t kNoObject{ UINT32_MAX };
+
+		// The baseInstance of each batch's surviving commands, sorted. The GPU appends in any order so two culls of the
+		// same draws are compared by these.
+		using SurvivorSets = std::vector<std::vector<GLuint>>;
+
+		struct Comparison
+		{
+			size_t batches{ 0 };
+			size_t differingBatches{ 0 };
+			size_t gpuVisible{ 0 };
+			size_t cpuVisible{ 0 };
+
+			bool Agrees() const { return differingBatches == 0; }
+		};
+	private:
+		// One draw as the compute shader reads it, std430 layout
+		struct CullRecord
+		{
+			IndirectCommand command;
+			uint32_t batch;
+			uint32_t batchStart;
+			uint32_t object;
+			glm::vec4 sphere;
+		};
+
+		ShaderProgram m_program;
+		CullMode m_mode{ CullMode::GPU };
+		Frustum m_frustum{};
+
+		// Two phase occlusion, GPU path only
+		DepthPyramid m_pyramid;
+		bool m_occlusion{ true };
+		glm::mat4 m_viewProjection{ 1 };
+		int m_viewportWidth{ 0 };
+		int m_viewportHeight{ 0 };
+
+		// The flags already hold this frame's result, so the first phase is all there is
+		bool m_visibilityCurrent{ false };
+
+		// Was visible when last tested, one uint per object
+		GLuint m_visibilityBuffer{ 0 };
+		size_t m_visibilityCapacity{ 0 };
+
+		// 0 culls by frustum alone, 1 and 2 are the two occlusion phases. Each phase has its own half of the outputs so
+		// the second never writes what the first phase's draws read.
+		int m_phase{ 0 };
+
+		// Where this frame's records are in the ring
+		size_t m_recordOffset{ 0 };
+
+		// GPU output, written by the compute shader and read by the draws
+		GLuint m_commandBuffer{ 0 };
+		GLuint m_countBuffer{ 0 };
+		size_t m_commandCapacity{ 0 };
+		size_t m_countCapacity{ 0 };
+
+		// CPU output, packed commands in the ring and survivors per batch
+		std::vector<IndirectCommand> m_packed;
+		std::vector<uint32_t> m_counts;
+		size_t m_packedOffset{ 0 };
+
+		std::vector<CullRecord> m_records;
+		std::vector<DrawBatch> m_batches;
+
+		// Mode used this frame, GPU falls back to CPU if the compute shader did not load
+		CullMode m_frameMode{ CullMode::Off };
+
+		bool m_compareRequested{ false };
+		std::string m_comparison;
+
+		bool m_occlusionReportRequested{ false };
+		std::string m_occlusionReport;
+
+		Stats m_stats;
+
+		// Grows the GPU output buffers to hold at least the given counts
+		void ReserveGPU(size_t commands, size_t batches);
+
+		// Packs the surviving commands of every batch into m_packed and m_counts
+		void CullCPU();
+
+		// Writes m_records to the ring, false if they do not fit
+		bool WriteRecords(UniformRing& ring);
+
+		// Grows the visibility buffer to hold objects, new objects start hidden so the second phase draws them
+		void ReserveVisibility(size_t objects);
+
+		// Issues the compute pass over m_records for m_phase
+		void CullGPU(UniformRing& ring);
+
+		// Binds the indirect buffers Draw reads for the current phase
+		void BindOutputs(UniformRing& ring) const;
+
+		// Sorts the packed survivors of each batch, counts[b] of them from the batch's start in commands
+		SurvivorSets SortSurvivors(const std::vector<GLuint>& counts, const IndirectCommand* commands) const;
+
+		// Reads the GPU result back and checks it against the CPU path, fills m_comparison. Stalls.
+		void CompareGPU();
+
+		// Reads the visibility flags back and counts the draws in view they hide, fills m_occlusionReport. Stalls.
+		void ReportOcclusion();
+	public:
+		DrawCuller() = default;
+		~DrawCuller() { Destroy(); }
+
+		DrawCuller(const DrawCuller&) = delete;
+		DrawCuller& operator=(const DrawCuller&) = delete;
+
+		// Loads the compute shaders. Returns false if the culling one cannot load, the CPU path still works. Occlusion
+		// is skipped if the pyramid one cannot.
+		bool Create(const std::string& computeShaderPath, const std::string& pyramidShaderPath);
+
+		void Destroy();
+
+		void SetMode(CullMode mode) { m_mode = mode; }
+		CullMode GetMode() const { return m_mode; }
+
+		void SetFrustum(const Frustum& frustum) { m_frustum = frustum; }
+
+		// Occlusion needs the camera and the size of the default framebuffer the draws go to
+		void SetOcclusion(bool enabled) { m_occlusion = enabled; }
+		bool GetOcclusion() const { return m_occlusion; }
+		void SetView(const glm::mat4& viewProjection, int viewportWidth, int viewportHeight);
+
+		// Set for a second pass over draws already culled this frame, such as shading after a depth prepass. The
+		// visibility found by the first pass is used as is, with no second phase.
+		void SetVisibilityCurrent(bool current) { m_visibilityCurrent = current; }
+
+		// Culls this frame's draws, spheres[i] bounding commands[i] and objects[i] the object it draws, a stable index
+		// across frames or kNoObject. Returns false if nothing was culled, when the caller should draw every command itself.
+		bool Cull(UniformRing& ring, const std::vector<IndirectCommand>& commands, const std::vector<BoundingSphere>& spheres,
+			const std::vector<uint32_t>& objects, const std::vector<DrawBatch>& batches);
+
+		// After the batches from Cull are drawn, tests against their depth and leaves the draws they revealed ready to
+		// be drawn the same way. Returns false if there is no second phase this frame.
+		bool CullRevealed(UniformRing& ring);
+
+		// Draws the survivors of a batch from the last Cull or CullRevealed with whatever state is bound
+		void Draw(size_t batch) const;
+
+		// Survivors of each batch from the last Cull or CullRevealed, read back if they were culled on the GPU. Stalls.
+		SurvivorSets ReadSurvivors() const;
+
+		// Checks the survivors of the same draws culled on the GPU against those culled on the CPU
+		static Comparison CompareSurvivors(const SurvivorSets& gpu, const SurvivorSets& cpu);
+
+		// The next GPU cull is read back and checked against the CPU path, for testing
+		void RequestComparison() { m_compareRequested = true; }
+
+		// Result of the last comparison, empty if none has run
+		const std::string& GetComparison() const { return m_comparison; }
+
+		// The next second phase reads back how many draws occlusion hid, for testing
+		void RequestOcclusionReport() { m_occlusionReportRequested = true; }
+		const std::string& GetOcclusionReport() const { return m_occlusionReport; }
+
+		const DepthPyramid::Stats& GetPyramidStats() const { return m_pyramid.GetStats(); }
+
+		const Stats& GetStats() const { return m_stats; }
+	};
+}
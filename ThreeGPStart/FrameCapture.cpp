@@ -0,0 +1,237 @@
+#include "FrameCapture.h"
+#include "ImageLoader.h"
+#include "ThreadPool.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+namespace fs = std::filesystem;
+
+namespace Helpers
+{
+	// Longest to block on a fence when shutting down
+	static const GLuint64 kCaptureWaitTimeoutNs{ 1000000000ull };
+
+	// Makes the buffers for a width x height back buffer, after waiting for any in use
+	bool FrameCapture::CreateBuffers(int width, int height)
+	{
+		DestroyBuffers();
+
+		const size_t bytes{ (size_t)width * height * 4 };
+		const GLbitfield flags{ GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT };
+
+		for (int i = 0; i < m_options.numBuffers; i++)
+		{
+			std::unique_ptr<Slot> slot{ std::make_unique<Slot>() };
+			glGenBuffers(1, &slot->buffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+			glBufferStorage(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)bytes, nullptr, flags);
+			slot->mapped = (BYTE*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)bytes, flags);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+			if (!slot->mapped)
+			{
+				std::cout << "FrameCapture: could not map a buffer of " << bytes << " bytes" << std::endl;
+				glDeleteBuffers(1, &slot->buffer);
+				DestroyBuffers();
+				return false;
+			}
+
+			m_slots.push_back(std::move(slot));
+		}
+
+		m_width = width;
+		m_height = height;
+		return true;
+	}
+
+	void FrameCapture::DestroyBuffers()
+	{
+		// Reads already issued are finished and handed on, then the workers may still be copying out of the buffers
+		for (std::unique_ptr<Slot>& slot : m_slots)
+		{
+			if (slot->fence)
+				glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, kCaptureWaitTimeoutNs);
+		}
+		CollectFinished();
+
+		for (std::future<bool>& encode : m_encodes)
+			encode.wait();
+		CollectFinished();
+
+		for (std::unique_ptr<Slot>& slot : m_slots)
+		{
+			if (slot->fence)
+			{
+				glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, kCaptureWaitTimeoutNs);
+				glDeleteSync(slot->fence);
+			}
+
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			glDeleteBuffers(1, &slot->buffer);
+		}
+
+		m_slots.clear();
+		m_width = 0;
+		m_height = 0;
+	}
+
+	// Hands slots whose reads have finished to workers
+	void FrameCapture::CollectFinished()
+	{
+		const size_t bytes{ (size_t)m_width * m_height * 4 };
+
+		for (std::unique_ptr<Slot>& slot : m_slots)
+		{
+			if (!slot->fence)
+				continue;
+
+			const GLenum status{ glClientWaitSync(slot->fence, 0, 0) };
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				continue;
+
+			glDeleteSync(slot->fence);
+			slot->fence = nullptr;
+
+			// Encoding takes far longer than a frame, so copy out first and give the buffer straight back
+			slot->copying = true;
+			m_queuedBytes += bytes;
+
+			Slot* source{ slot.get() };
+			const int width{ m_width };
+			const int height{ m_height };
+			m_encodes.push_back(ThreadPool::Global().Submit([this, source, width, height, bytes]()
+			{
+				std::vector<BYTE> pixels(source->mapped, source->mapped + bytes);
+				const std::string filepath{ std::move(source->filepath) };
+				source->copying = false;
+
+				const bool ok{ SaveImage(pixels.data(), width, height, filepath) };
+				if (!ok)
+					std::cout << "FrameCapture: could not write " << filepath << ".png" << std::endl;
+
+				m_queuedBytes -= bytes;
+				return ok;
+			}));
+		}
+
+		// Forget encodes that have finished
+		for (size_t i = 0; i < m_encodes.size();)
+		{
+			if (m_encodes[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			{
+				if (m_encodes[i].get())
+					m_stats.written++;
+				m_encodes[i] = std::move(m_encodes.back());
+				m_encodes.pop_back();
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	// Starts reading the back buffer into a free slot to be written to filepath
+	void FrameCapture::Read(const std::string& filepath)
+	{
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		if (viewport[2] <= 0 || viewport[3] <= 0)
+			return;
+
+		if ((viewport[2] != m_width || viewport[3] != m_height) && !CreateBuffers(viewport[2], viewport[3]))
+			return;
+
+		const size_t bytes{ (size_t)m_width * m_height * 4 };
+		Slot* free{ nullptr };
+		for (std::unique_ptr<Slot>& slot : m_slots)
+		{
+			if (!slot->fence && !slot->copying)
+			{
+				free = slot.get();
+				break;
+			}
+		}
+
+		if (!free || m_queuedBytes + bytes > m_options.maxQueuedBytes)
+		{
+			m_stats.dropped++;
+			return;
+		}
+
+		free->filepath = filepath;
+
+		// With a pack buffer bound the pixels go into it and the call returns without waiting
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, free->buffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		free->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		m_stats.captured++;
+	}
+
+	// Captures the next frame passed to Update as name.png
+	void FrameCapture::Screenshot(const std::string& name)
+	{
+		m_screenshotName = name;
+	}
+
+	// Captures every frame as name_000000.png and so on until StopRecording
+	void FrameCapture::StartRecording(const std::string& name)
+	{
+		m_recording = true;
+		m_recordingName = name;
+		m_recordedFrames = 0;
+	}
+
+	void FrameCapture::StopRecording()
+	{
+		m_recording = false;
+	}
+
+	// Reads the frame if one was asked for and moves earlier ones along
+	void FrameCapture::Update()
+	{
+		CollectFinished();
+
+		if (m_screenshotName.empty() && !m_recording)
+			return;
+
+		std::error_code error;
+		fs::create_directories(m_options.directory, error);
+
+		if (!m_screenshotName.empty())
+		{
+			Read((fs::path(m_options.directory) / m_screenshotName).string());
+			m_screenshotName.clear();
+		}
+
+		if (m_recording)
+		{
+			std::ostringstream name;
+			name << m_recordingName << "_" << std::setw(6) << std::setfill('0') << m_recordedFrames++;
+			Read((fs::path(m_options.directory) / name.str()).string());
+		}
+	}
+
+	// Waits for every capture in flight to be written, then frees the buffers
+	void FrameCapture::Destroy()
+	{
+		m_recording = false;
+		m_screenshotName.clear();
+		DestroyBuffers();
+	}
+
+	FrameCapture::Stats FrameCapture::GetStats() const
+	{
+		Stats stats{ m_stats };
+		stats.queuedFrames = m_encodes.size();
+		stats.queuedBytes = m_queuedBytes;
+		return stats;
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+// Screenshots and frame recording that never wait on the GPU or on PNG encoding
+
+#include "ExternalLibraryHeaders.h"
+
+#include <atomic>
+#include <future>
+#include <memory>
+
+namespace Helpers
+{
+	struct FrameCaptureOptions
+	{
+		// Pixel pack buffers frames are read back into, a frame waits in one until the GPU has written it
+		int numBuffers{ 6 };
+
+		// Copies waiting to be encoded may hold this much memory, frames past it are dropped rather than stall
+		size_t maxQueuedBytes{ 512 * 1024 * 1024 };
+
+		// Where the PNGs are written
+		std::string directory{ "Data\\Captures" };
+	};
+
+	// The back buffer is read into a persistently mapped pixel pack buffer with glReadPixels, which returns at once,
+	// and fenced. Once the fence has signalled a worker copies the pixels out, freeing the buffer, and writes them as a
+	// PNG. The GL thread only ever issues the read and polls fences, so recording every frame of a benchmark leaves the
+	// frame times it measures alone. All calls on the GL thread.
+	class FrameCapture
+	{
+	public:
+		struct Stats
+		{
+			size_t captured{ 0 };
+			size_t written{ 0 };
+
+			// Frames lost because every buffer was busy or too much was queued for encoding
+			size_t dropped{ 0 };
+
+			// Copies waiting for or being encoded
+			size_t queuedFrames{ 0 };
+			size_t queuedBytes{ 0 };
+		};
+	private:
+		struct Slot
+		{
+			GLuint buffer{ 0 };
+			BYTE* mapped{ nullptr };
+
+			// Set while the GPU writes the buffer
+			GLsync fence{ nullptr };
+
+			// Set while a worker copies out of the buffer
+			std::atomic<bool> copying{ false };
+
+			std::string filepath;
+		};
+
+		FrameCaptureOptions m_options;
+		std::vector<std::unique_ptr<Slot>> m_slots;
+		int m_width{ 0 };
+		int m_height{ 0 };
+
+		// Encodes in flight, finished ones are removed by Update
+		std::vector<std::future<bool>> m_encodes;
+		std::atomic<size_t> m_queuedBytes{ 0 };
+
+		std::string m_screenshotName;
+		bool m_recording{ false };
+		std::string m_recordingName;
+		size_t m_recordedFrames{ 0 };
+
+		Stats m_stats;
+
+		// Makes the buffers for a width x height back buffer, after waiting for any in use
+		bool CreateBuffers(int width, int height);
+
+		// Waits for the reads and copies in flight, their PNGs are still written, then deletes the buffers
+		void DestroyBuffers();
+
+		// Hands slots whose reads have finished to workers
+		void CollectFinished();
+
+		// Starts reading the back buffer into a free slot to be written to filepath
+		void Read(const std::string& filepath);
+	public:
+		explicit FrameCapture(const FrameCaptureOptions& options = FrameCaptureOptions()) : m_options(options) {}
+		~FrameCapture() { Destroy(); }
+
+		FrameCapture(const FrameCapture&) = delete;
+		FrameCapture& operator=(const FrameCapture&) = delete;
+
+		// Captures the next frame passed to Update as name.png
+		void Screenshot(const std::string& name);
+
+		// Captures every frame as name_000000.png and so on until StopRecording
+		void StartRecording(const std::string& name);
+		void StopRecording();
+		bool IsRecording() const { return m_recording; }
+
+		// Call once a frame at the point to capture, with the framebuffer to read bound. Reads the frame if one was
+		// asked for and moves earlier ones along.
+		void Update();
+
+		// Waits for every capture in flight to be written, then frees the buffers
+		void Destroy();
+
+		Stats GetStats() const;
+	};
+}
@@ -0,0 +1,46 @@
+#include "FrameTimeHistogram.h"
+
+#include <algorithm>
+
+namespace Helpers
+{
+	FrameTimeHistogram::FrameTimeHistogram(int numBuckets, float bucketMilliseconds) :
+		m_buckets(std::max(numBuckets, 1), 0.0f), m_bucketMilliseconds(bucketMilliseconds)
+	{
+	}
+
+	void FrameTimeHistogram::Add(float milliseconds)
+	{
+		const int bucket{ std::min((int)(std::max(milliseconds, 0.0f) / m_bucketMilliseconds), (int)m_buckets.size() - 1) };
+		m_buckets[bucket]++;
+
+		m_frames++;
+		m_totalMilliseconds += milliseconds;
+		m_worstMilliseconds = std::max(m_worstMilliseconds, milliseconds);
+	}
+
+	void FrameTimeHistogram::Reset()
+	{
+		std::fill(m_buckets.begin(), m_buckets.end(), 0.0f);
+		m_frames = 0;
+		m_totalMilliseconds = 0;
+		m_worstMilliseconds = 0;
+	}
+
+	// Upper edge of the bucket holding the given fraction of frames
+	float FrameTimeHistogram::PercentileMilliseconds(float fraction) const
+	{
+		if (m_frames == 0)
+			return 0;
+
+		const float wanted{ fraction * m_frames };
+		float counted{ 0 };
+		for (size_t i = 0; i < m_buckets.size(); i++)
+		{
+			counted += m_buckets[i];
+			if (counted >= wanted)
+				return (i + 1 == m_buckets.size()) ? m_worstMilliseconds : (i + 1) * m_bucketMilliseconds;
+		}
+		return m_worstMilliseconds;
+	}
+}
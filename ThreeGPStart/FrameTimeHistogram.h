@@ -0,0 +1,35 @@
+#pragma once
+// Counts frames by how long they took, to show hitches an average hides
+
+#include "ExternalLibraryHeaders.h"
+
+namespace Helpers
+{
+	class FrameTimeHistogram
+	{
+	private:
+		// Bucket i counts frames of [i, i + 1) * m_bucketMilliseconds, the last also takes everything longer.
+		// Floats as that is what ImGui::PlotHistogram wants.
+		std::vector<float> m_buckets;
+		float m_bucketMilliseconds{ 1 };
+
+		size_t m_frames{ 0 };
+		double m_totalMilliseconds{ 0 };
+		float m_worstMilliseconds{ 0 };
+	public:
+		explicit FrameTimeHistogram(int numBuckets = 50, float bucketMilliseconds = 1.0f);
+
+		void Add(float milliseconds);
+		void Reset();
+
+		const std::vector<float>& Buckets() const { return m_buckets; }
+		float BucketMilliseconds() const { return m_bucketMilliseconds; }
+
+		size_t Frames() const { return m_frames; }
+		float AverageMilliseconds() const { return m_frames ? (float)(m_totalMilliseconds / m_frames) : 0.0f; }
+		float WorstMilliseconds() const { return m_worstMilliseconds; }
+
+		// Upper edge of the bucket holding the given fraction of frames, e.g. 0.99 for the 99th percentile
+		float PercentileMilliseconds(float fraction) const;
+	};
+}
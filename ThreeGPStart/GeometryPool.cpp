@@ -0,0 +1,99 @@
+#include "GeometryPool.h"
+
+namespace Helpers
+{
+	// Starts a page able to hold at least the given counts
+	GeometryPool::Page& GeometryPool::AddPage(size_t vertices, size_t indices)
+	{
+		Page page;
+		page.vertexCapacity = std::max(vertices, m_options.verticesPerPage);
+		page.indexCapacity = std::max(indices, m_options.indicesPerPage);
+
+		const size_t vertexBytes{ page.vertexCapacity * sizeof(PoolVertex) };
+		const size_t indexBytes{ page.indexCapacity * sizeof(GLuint) };
+
+		glGenBuffers(1, &page.vertexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, page.vertexBuffer);
+		glBufferStorage(GL_ARRAY_BUFFER, (GLsizeiptr)vertexBytes, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+		glGenBuffers(1, &page.indexBuffer);
+
+		// Every mesh in the page is drawn through this one VAO
+		glGenVertexArrays(1, &page.vao);
+		glBindVertexArray(page.vao);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PoolVertex), (void*)offsetof(PoolVertex, position));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(PoolVertex), (void*)offsetof(PoolVertex, normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(PoolVertex), (void*)offsetof(PoolVertex, uv));
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page.indexBuffer);
+		glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)indexBytes, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		m_stats.pages++;
+		m_stats.bytes += vertexBytes + indexBytes;
+
+		m_pages.push_back(page);
+		return m_pages.back();
+	}
+
+	// Copies a mesh into the pool, normals and uvs may be null. Returns false on error.
+	bool GeometryPool::Add(const glm::vec3* positions, const glm::vec3* normals, const glm::vec2* uvs, size_t vertexCount,
+		const GLuint* elements, size_t elementCount, GeometryRange& range)
+	{
+		if (!positions || !elements || vertexCount == 0 || elementCount == 0)
+			return false;
+
+		Page* page{ m_pages.empty() ? nullptr : &m_pages.back() };
+		if (!page || page->vertices + vertexCount > page->vertexCapacity || page->indices + elementCount > page->indexCapacity)
+			page = &AddPage(vertexCount, elementCount);
+
+		std::vector<PoolVertex> vertices(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			vertices[i].position = positions[i];
+			vertices[i].normal = normals ? normals[i] : glm::vec3(0);
+			vertices[i].uv = uvs ? uvs[i] : glm::vec2(0);
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, page->vertexBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(page->vertices * sizeof(PoolVertex)), (GLsizeiptr)(vertexCount * sizeof(PoolVertex)), vertices.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// The element binding belongs to the VAO, so go through the copy target rather than disturb one
+		glBindBuffer(GL_COPY_WRITE_BUFFER, page->indexBuffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)(page->indices * sizeof(GLuint)), (GLsizeiptr)(elementCount * sizeof(GLuint)), elements);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		range.vao = page->vao;
+		range.firstIndex = (GLuint)page->indices;
+		range.indexCount = (GLuint)elementCount;
+		range.baseVertex = (GLint)page->vertices;
+
+		page->vertices += vertexCount;
+		page->indices += elementCount;
+
+		m_stats.meshes++;
+		m_stats.vertices += vertexCount;
+		m_stats.indices += elementCount;
+		return true;
+	}
+
+	void GeometryPool::Destroy()
+	{
+		for (Page& page : m_pages)
+		{
+			glDeleteVertexArrays(1, &page.vao);
+			glDeleteBuffers(1, &page.vertexBuffer);
+			glDeleteBuffers(1, &page.indexBuffer);
+		}
+
+		m_pages.clear();
+		m_stats = Stats();
+	}
+}
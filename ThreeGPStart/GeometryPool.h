@@ -0,0 +1,85 @@
+#pragma once
+// Static meshes sub-allocated from a few large vertex and index buffers sharing a VAO
+
+#include "ExternalLibraryHeaders.h"
+
+namespace Helpers
+{
+	// The one vertex layout in the pool. Attribute 1 is the normal, or the colour for vertex coloured meshes.
+	// Attributes a mesh does not have are zero.
+	struct PoolVertex
+	{
+		glm::vec3 position;
+		glm::vec3 normal;
+		glm::vec2 uv;
+	};
+
+	// Where a mesh is in the pool, the arguments of its indexed draw
+	struct GeometryRange
+	{
+		// VAO of the page holding the mesh, meshes in the same page can be drawn by one multi-draw
+		GLuint vao{ 0 };
+		GLuint firstIndex{ 0 };
+		GLuint indexCount{ 0 };
+		GLint baseVertex{ 0 };
+
+		bool IsValid() const { return vao != 0; }
+	};
+
+	struct GeometryPoolOptions
+	{
+		// A page's capacity, a mesh larger than this gets a page of its own
+		size_t verticesPerPage{ 1024 * 1024 };
+		size_t indicesPerPage{ 3 * 1024 * 1024 };
+	};
+
+	// Meshes are appended to the current page's buffers with glBufferSubData and never moved or freed singly, which
+	// suits geometry loaded once at start up. A new page is started when one fills. Indices stay relative to the mesh
+	// and are offset by baseVertex when drawn. GL thread only.
+	class GeometryPool
+	{
+	public:
+		struct Stats
+		{
+			size_t pages{ 0 };
+			size_t meshes{ 0 };
+			size_t vertices{ 0 };
+			size_t indices{ 0 };
+
+			// Buffer storage allocated, used or not
+			size_t bytes{ 0 };
+		};
+	private:
+		struct Page
+		{
+			GLuint vao{ 0 };
+			GLuint vertexBuffer{ 0 };
+			GLuint indexBuffer{ 0 };
+			size_t vertexCapacity{ 0 };
+			size_t indexCapacity{ 0 };
+			size_t vertices{ 0 };
+			size_t indices{ 0 };
+		};
+
+		GeometryPoolOptions m_options;
+		std::vector<Page> m_pages;
+		Stats m_stats;
+
+		// Starts a page able to hold at least the given counts
+		Page& AddPage(size_t vertices, size_t indices);
+	public:
+		explicit GeometryPool(const GeometryPoolOptions& options = GeometryPoolOptions()) : m_options(options) {}
+		~GeometryPool() { Destroy(); }
+
+		GeometryPool(const GeometryPool&) = delete;
+		GeometryPool& operator=(const GeometryPool&) = delete;
+
+		// Copies a mesh into the pool, normals and uvs may be null. Returns false on error.
+		bool Add(const glm::vec3* positions, const glm::vec3* normals, const glm::vec2* uvs, size_t vertexCount,
+			const GLuint* elements, size_t elementCount, GeometryRange& range);
+
+		void Destroy();
+
+		const Stats& GetStats() const { return m_stats; }
+	};
+}
@@ -1,9 +1,100 @@
 #include "ImageLoader.h"
+#include <algorithm>
 #include <filesystem>
 namespace fs = std::filesystem;
 
 namespace Helpers
 {
+	int BytesPerPixel(PixelFormat format)
+	{
+		switch (format)
+		{
+		case PixelFormat::R8: return 1;
+		case PixelFormat::RG8: return 2;
+		case PixelFormat::R16: return 2;
+		default: return 4;
+		}
+	}
+
+	GLenum GLInternalFormat(PixelFormat format)
+	{
+		switch (format)
+		{
+		case PixelFormat::R8: return GL_R8;
+		case PixelFormat::RG8: return GL_RG8;
+		case PixelFormat::R16: return GL_R16;
+		default: return GL_RGBA8;
+		}
+	}
+
+	GLenum GLPixelFormat(PixelFormat format)
+	{
+		switch (format)
+		{
+		case PixelFormat::R8: return GL_RED;
+		case PixelFormat::RG8: return GL_RG;
+		case PixelFormat::R16: return GL_RED;
+		default: return GL_RGBA;
+		}
+	}
+
+	GLenum GLPixelType(PixelFormat format)
+	{
+		return format == PixelFormat::R16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+	}
+
+	ImageLoader::ImageLoader(ImageLoader&& other) noexcept :
+		m_width(other.m_width), m_height(other.m_height), m_format(other.m_format), m_data(other.m_data)
+	{
+		other.m_width = other.m_height = 0;
+		other.m_data = nullptr;
+	}
+
+	ImageLoader& ImageLoader::operator=(ImageLoader&& other) noexcept
+	{
+		if (this != &other)
+		{
+			delete[] m_data;
+			m_width = other.m_width;
+			m_height = other.m_height;
+			m_format = other.m_format;
+			m_data = other.m_data;
+			other.m_width = other.m_height = 0;
+			other.m_data = nullptr;
+		}
+		return *this;
+	}
+
+	// Replaces the image with an uninitialised width x height one of format
+	BYTE* ImageLoader::Allocate(int width, int height, PixelFormat format)
+	{
+		m_width = width;
+		m_height = height;
+		m_format = format;
+
+		delete[] m_data;
+		m_data = new BYTE[DataSize()];
+		return m_data;
+	}
+
+	// Grey value of the texel at x, y
+	BYTE ImageLoader::GetGreyTexel(int x, int y) const
+	{
+		const size_t index{ (size_t)x + (size_t)y * m_width };
+		if (m_format == PixelFormat::R16)
+			return (BYTE)(((const UINT16*)m_data)[index] >> 8);
+		return m_data[index * BytesPerPixel(m_format)];
+	}
+
+	// First channel of the texel at x, y as 0 to 1
+	float ImageLoader::GetTexelValue(int x, int y) const
+	{
+		const size_t index{ (size_t)x + (size_t)y * m_width };
+		if (m_format == PixelFormat::R16)
+			return ((const UINT16*)m_data)[index] / 65535.0f;
+		return m_data[index * BytesPerPixel(m_format)] / 255.0f;
+	}
+
 	BYTE ImageLoader::GetGreyValue(float u, float v) const
 	{
 		u = fmod(u, 1.0f);
@@ -13,6 +104,10 @@ namespace Helpers
 		const int x = (int)(u * (m_width - 1));
 		const int y = (int)(v * (m_height - 1));
 
+		// Only RGBA8 has an alpha to weigh by
+		if (m_format != PixelFormat::RGBA8)
+			return GetGreyTexel(x, y);
+
 		BYTE alpha{ m_data[(x + y * m_width) * 4 + 3] };
 		if (alpha == 0)
 			return 0;
@@ -26,15 +121,70 @@ namespace Helpers
 		return calc;
 	}
 
-	// Attempt to load an image from the file and path provided. Returns false on error.
-	bool ImageLoader::Load(const std::string& filepath)
+	// Converts the pixels to format in place
+	void ImageLoader::Convert(PixelFormat format)
+	{
+		if (format == m_format || !m_data)
+			return;
+
+		const size_t numPixels{ (size_t)m_width * m_height };
+		const PixelFormat sourceFormat{ m_format };
+		BYTE* source{ m_data };
+		m_data = nullptr;
+		BYTE* target{ Allocate(m_width, m_height, format) };
+
+		for (size_t i = 0; i < numPixels; i++)
+		{
+			// Via 16 bits a channel so R16 keeps its precision going to itself or back
+			UINT16 rgba[4]{ 0, 0, 0, 65535 };
+			switch (sourceFormat)
+			{
+			case PixelFormat::R8:
+				rgba[0] = rgba[1] = rgba[2] = (UINT16)(source[i] * 257);
+				break;
+			case PixelFormat::RG8:
+				rgba[0] = (UINT16)(source[i * 2] * 257);
+				rgba[1] = (UINT16)(source[i * 2 + 1] * 257);
+				break;
+			case PixelFormat::R16:
+				rgba[0] = rgba[1] = rgba[2] = ((const UINT16*)source)[i];
+				break;
+			default:
+				for (int c = 0; c < 4; c++)
+					rgba[c] = (UINT16)(source[i * 4 + c] * 257);
+				break;
+			}
+
+			switch (format)
+			{
+			case PixelFormat::R8:
+				target[i] = (BYTE)(rgba[0] >> 8);
+				break;
+			case PixelFormat::RG8:
+				target[i * 2] = (BYTE)(rgba[0] >> 8);
+				target[i * 2 + 1] = (BYTE)(rgba[1] >> 8);
+				break;
+			case PixelFormat::R16:
+				((UINT16*)target)[i] = rgba[0];
+				break;
+			default:
+				for (int c = 0; c < 4; c++)
+					target[i * 4 + c] = (BYTE)(rgba[c] >> 8);
+				break;
+			}
+		}
+
+		delete[] source;
+	}
+
+	// Opens the file and decodes it into a FreeImage bitmap, flags as FreeImage_Load. Returns nullptr on error.
+	static FIBITMAP* OpenBitmap(const std::string& filepath, int flags = 0)
 	{
-		
 		// First check file exists
 		if (!exists(fs::path(filepath)))
 		{
 			std::cout << "File does not exist: " << filepath << std::endl;
-			return false;
+			return nullptr;
 		}
 
 		// Determine the format of the image.
@@ -51,89 +201,206 @@ namespace Helpers
 			if (!FreeImage_FIFSupportsReading(format))
 			{
 				std::cout << "Detected image format cannot be read!" << std::endl;
-				return false;
+				return nullptr;
 			}
 		}
 
 		// If we're here we have a known image format, so load the image into a bitmap
-		FIBITMAP* bitmap{ FreeImage_Load(format, filepath.c_str()) };
+		return FreeImage_Load(format, filepath.c_str(), flags);
+	}
 
+	// Copies a 32 bit bitmap a row at a time as FreeImage may pad rows
+	static void CopyRows32(FIBITMAP* bitmap32, int width, int height, BYTE* destination)
+	{
+		const size_t rowBytes{ (size_t)width * 4 };
+		if (FreeImage_GetPitch(bitmap32) == rowBytes)
+		{
+			memcpy(destination, FreeImage_GetBits(bitmap32), rowBytes * height);
+			return;
+		}
+
+		for (int y = 0; y < height; y++)
+			memcpy(destination + y * rowBytes, FreeImage_GetScanLine(bitmap32, y), rowBytes);
+	}
+
+	// Decodes any bitmap to RGBA8 in destination. Returns false on error.
+	static bool CopyAsRGBA(FIBITMAP* bitmap, int width, int height, BYTE* destination)
+	{
 		// How many bits-per-pixel is the source image?
-		unsigned int bitsPerPixel{ FreeImage_GetBPP(bitmap) };
-				
-		// Grab size
-		m_width = FreeImage_GetWidth(bitmap);
-		m_height = FreeImage_GetHeight(bitmap);
+		const unsigned int bitsPerPixel{ FreeImage_GetBPP(bitmap) };
+		const FREE_IMAGE_TYPE imageType{ FreeImage_GetImageType(bitmap) };
+
+		bool ok{ true };
 
-		// Convert our image to 32 bits (8 bits per channel, Red/Green/Blue/Alpha) if not already
-		FIBITMAP* bitmap32{ nullptr };
-		if (bitsPerPixel == 32)
+		// 15/04/20: Rebuilt FreeImage with correct order so now RGBA so no need to convert = quicker :)
+		if (imageType == FIT_BITMAP && bitsPerPixel == 32)
 		{
-			bitmap32 = bitmap;
+			// Already the layout we want, the only copy is out of the decoder
+			CopyRows32(bitmap, width, height, destination);
 		}
-		else
+		else if (imageType == FIT_BITMAP && bitsPerPixel == 24)
 		{
-			bitmap32 = FreeImage_ConvertTo32Bits(bitmap);
-			if (!bitmap32)
+			// Expand straight into the destination rather than converting to a 32 bit bitmap and copying that
+			for (int y = 0; y < height; y++)
 			{
-				const FREE_IMAGE_TYPE image_type{ FreeImage_GetImageType(bitmap) };
-				if (image_type == FIT_UINT16)
+				const BYTE* source{ FreeImage_GetScanLine(bitmap, y) };
+				BYTE* target{ destination + (size_t)y * width * 4 };
+				for (int x = 0; x < width; x++, source += 3, target += 4)
 				{
-					// FreeImage seems to have an issue converting 16 bit grey scale images to 32 so handling this manually
-					UINT16* textureData{ (UINT16*)FreeImage_GetBits(bitmap) };
-
-					m_data = new GLubyte[(size_t)m_width * (size_t)m_height * 4];
-					size_t count{ 0 };
-					for (size_t i = 0; i < (size_t)m_width * (size_t)m_height * 4; i += 4)
-					{
-						BYTE asByte = (BYTE)(textureData[count++] / 256.0f);
-						m_data[i] = m_data[i + 1] = m_data[i + 2] = asByte;
-						m_data[i + 3] = 255;
-					}
-
-					return true;
+					target[0] = source[0];
+					target[1] = source[1];
+					target[2] = source[2];
+					target[3] = 255;
 				}
-
+			}
+		}
+		else if (imageType == FIT_UINT16)
+		{
+			// FreeImage seems to have an issue converting 16 bit grey scale images to 32 so handling this manually
+			for (int y = 0; y < height; y++)
+			{
+				const UINT16* source{ (const UINT16*)FreeImage_GetScanLine(bitmap, y) };
+				BYTE* target{ destination + (size_t)y * width * 4 };
+				for (int x = 0; x < width; x++, target += 4)
+				{
+					target[0] = target[1] = target[2] = (BYTE)(source[x] / 256.0f);
+					target[3] = 255;
+				}
+			}
+		}
+		else
+		{
+			// Anything else (palettised, 16 bit colour etc.) goes via FreeImage's conversion
+			FIBITMAP* bitmap32{ FreeImage_ConvertTo32Bits(bitmap) };
+			if (bitmap32)
+			{
+				CopyRows32(bitmap32, width, height, destination);
+				FreeImage_Unload(bitmap32);
+			}
+			else
+			{
 				std::cout << "ImageLoader::Load failed to convert image to 32 bits" << std::endl;
+				ok = false;
+			}
+		}
+
+		return ok;
+	}
+
+	// Reads just the dimensions of an image without decoding its pixels. Returns false on error.
+	bool ImageLoader::ReadSize(const std::string& filepath, int& width, int& height)
+	{
+		FIBITMAP* bitmap{ OpenBitmap(filepath, FIF_LOAD_NOPIXELS) };
+		if (!bitmap)
+			return false;
 
-				return false;
+		width = (int)FreeImage_GetWidth(bitmap);
+		height = (int)FreeImage_GetHeight(bitmap);
+		FreeImage_Unload(bitmap);
+		return true;
+	}
+
+	// Attempt to load an image from the file and path provided, expanded to RGBA8. Returns false on error.
+	bool ImageLoader::Load(const std::string& filepath)
+	{
+		return DecodeInto(filepath, [this](int width, int height)
+		{
+			return Allocate(width, height, PixelFormat::RGBA8);
+		});
+	}
+
+	// True if an 8 bit palettised bitmap only uses grey palette entries, e.g. a GIF heightmap
+	static bool UsesOnlyGreys(FIBITMAP* bitmap, int width, int height)
+	{
+		const RGBQUAD* palette{ FreeImage_GetPalette(bitmap) };
+		if (!palette || FreeImage_IsTransparent(bitmap))
+			return false;
+
+		// Palettes are often shared with colours the image never uses, so check the entries used
+		bool grey[256]{};
+		const unsigned int numColours{ std::min(FreeImage_GetColorsUsed(bitmap), 256u) };
+		for (unsigned int i = 0; i < numColours; i++)
+			grey[i] = palette[i].rgbRed == palette[i].rgbGreen && palette[i].rgbGreen == palette[i].rgbBlue;
+
+		for (int y = 0; y < height; y++)
+		{
+			const BYTE* row{ FreeImage_GetScanLine(bitmap, y) };
+			for (int x = 0; x < width; x++)
+			{
+				if (!grey[row[x]])
+					return false;
 			}
-		}		
-
-		// Get a pointer to the texture data as an array of unsigned bytes.
-		// Note: At this point bitmap32 ALWAYS holds a 32-bit colour version of our image - so we get our data from that.
-		// Also, we don't need to delete or delete[] this textureData because it's not on the heap (so attempting to do
-		// so will cause a crash) - just let it go out of scope and the memory will be returned to the stack.
-		BYTE* textureData{ FreeImage_GetBits(bitmap32) };
-
-		m_data = new GLubyte[(size_t)m_width * (size_t)m_height * 1 * 4];
-
-		// Copy to mine, Note: Freeimage data format is GL_BGRA while I need GL_RGBA
-		// Iterate through the pixels, copying the data
-		// from 'pixels' to 'bits' except in RGBA format.		
-
-		//for (int pix = 0; pix < m_width * m_height; pix++)
-		//{
-		//	m_data[pix * 4 + 0] = textureData[pix * 4 + 2];	//r = 3
-		//	m_data[pix * 4 + 1] = textureData[pix * 4 + 1];	//g = 0
-		//	m_data[pix * 4 + 2] = textureData[pix * 4 + 0];	//b = 1
-		//	m_data[pix * 4 + 3] = textureData[pix * 4 + 3];	//a = 2
-		//}
-		
-		// 15/04/20: Rebuilt FreeImage with correct order so now RGBA so no need to convert = quicker :)
-		memcpy(m_data, textureData, (size_t)m_width * (size_t)m_height * 1 * 4);
-		
-		// Unload the 32-bit colour bitmap
-		FreeImage_Unload(bitmap32);
-
-		// If we had to do a conversion to 32-bit colour, then unload the original
-		// non-32-bit-colour version of the image data too. Otherwise, bitmap32 and
-		// bitmap point at the same data, and that data's already been free'd, so
-		// don't attempt to free it again! (or we'll crash).
-		if (bitsPerPixel != 32)
+		}
+		return true;
+	}
+
+	// As Load but greyscale sources stay in one channel
+	bool ImageLoader::LoadKeepingFormat(const std::string& filepath)
+	{
+		FIBITMAP* bitmap{ OpenBitmap(filepath) };
+		if (!bitmap)
+			return false;
+
+		const unsigned int bitsPerPixel{ FreeImage_GetBPP(bitmap) };
+		const FREE_IMAGE_TYPE imageType{ FreeImage_GetImageType(bitmap) };
+		const int width{ (int)FreeImage_GetWidth(bitmap) };
+		const int height{ (int)FreeImage_GetHeight(bitmap) };
+
+		bool ok{ true };
+		if (imageType == FIT_UINT16)
+		{
+			BYTE* destination{ Allocate(width, height, PixelFormat::R16) };
+			for (int y = 0; y < height; y++)
+				memcpy(destination + (size_t)y * width * 2, FreeImage_GetScanLine(bitmap, y), (size_t)width * 2);
+		}
+		else if (imageType == FIT_BITMAP && bitsPerPixel == 8 &&
+			(FreeImage_GetColorType(bitmap) == FIC_MINISBLACK || UsesOnlyGreys(bitmap, width, height)))
+		{
+			// Through the palette, a grey ramp maps each index to itself
+			const RGBQUAD* palette{ FreeImage_GetPalette(bitmap) };
+			BYTE* destination{ Allocate(width, height, PixelFormat::R8) };
+			for (int y = 0; y < height; y++)
+			{
+				const BYTE* source{ FreeImage_GetScanLine(bitmap, y) };
+				BYTE* target{ destination + (size_t)y * width };
+				for (int x = 0; x < width; x++)
+					target[x] = palette ? palette[source[x]].rgbRed : source[x];
+			}
+		}
+		else
+		{
+			// Not greyscale, the usual RGBA8
+			ok = CopyAsRGBA(bitmap, width, height, Allocate(width, height, PixelFormat::RGBA8));
+		}
+
+		FreeImage_Unload(bitmap);
+
+		return ok;
+	}
+
+	// Decodes the file straight into memory supplied by getDestination
+	bool ImageLoader::DecodeInto(const std::string& filepath, const std::function<BYTE*(int width, int height)>& getDestination)
+	{
+		FIBITMAP* bitmap{ OpenBitmap(filepath) };
+		if (!bitmap)
+			return false;
+
+		// Grab size
+		const int width{ (int)FreeImage_GetWidth(bitmap) };
+		const int height{ (int)FreeImage_GetHeight(bitmap) };
+
+		BYTE* destination{ getDestination(width, height) };
+		if (!destination)
+		{
 			FreeImage_Unload(bitmap);
+			return false;
+		}
 
-		return true;
+		const bool ok{ CopyAsRGBA(bitmap, width, height, destination) };
+
+		FreeImage_Unload(bitmap);
+
+		return ok;
 	}
 
 	// Attempt to save an image to the file and path provided. Returns false on error.
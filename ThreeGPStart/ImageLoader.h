@@ -2,31 +2,98 @@
 
 #include "ExternalLibraryHeaders.h"
 
+#include <functional>
+
 namespace Helpers
 {
+	// Layout of the pixels an ImageLoader holds, rows bottom up with no padding
+	enum class PixelFormat
+	{
+		// One byte, e.g. greyscale heightmaps and masks
+		R8,
+
+		// Two bytes, e.g. tangent space normal XY
+		RG8,
+
+		// One 16 bit channel, native byte order
+		R16,
+
+		// Four bytes
+		RGBA8
+	};
+
+	int BytesPerPixel(PixelFormat format);
+
+	// Matching GL internal format, pixel format and type for glTexImage2D. Rows of R8, RG8 and R16 images are only 4
+	// byte aligned if the width allows, set GL_UNPACK_ALIGNMENT to 1 for them.
+	GLenum GLInternalFormat(PixelFormat format);
+	GLenum GLPixelFormat(PixelFormat format);
+	GLenum GLPixelType(PixelFormat format);
+
 	// Helper utilising FreeImage to load images / textures
-	// Loaded format is guaranteed to be 32 bit RGBA layout
+	// Load gives 32 bit RGBA, LoadKeepingFormat keeps greyscale sources in one channel
 	class ImageLoader
 	{
 	private:
 		int m_width{ 0 };
 		int m_height{ 0 };
+		PixelFormat m_format{ PixelFormat::RGBA8 };
 		BYTE* m_data{ nullptr };
 	public:
+		ImageLoader() = default;
 		~ImageLoader() { delete []m_data; }
 
+		ImageLoader(const ImageLoader&) = delete;
+		ImageLoader& operator=(const ImageLoader&) = delete;
+
+		ImageLoader(ImageLoader&& other) noexcept;
+		ImageLoader& operator=(ImageLoader&& other) noexcept;
+
 		// Width in texels of the image
 		int Width() const { return m_width; }
 
 		// Height in texels of the image
 		int Height() const { return m_height; }
 
-		// Attempt to load an image from the file and path provided. Returns false on error.
+		PixelFormat Format() const { return m_format; }
+
+		// GL internal format to upload GetData with
+		GLenum InternalFormat() const { return GLInternalFormat(m_format); }
+
+		// Bytes of GetData
+		size_t DataSize() const { return (size_t)m_width * m_height * BytesPerPixel(m_format); }
+
+		// Replaces the image with an uninitialised width x height one of format, returns its pixels to fill in
+		BYTE* Allocate(int width, int height, PixelFormat format);
+
+		// Attempt to load an image from the file and path provided, expanded to RGBA8. Returns false on error.
 		bool Load(const std::string& filepath);
 
-		// Allows access to the raw bytes that make up the image laid out in RGBA format (8 bits per channel)
+		// As Load but 8 bit greyscale (including palettes only using greys) stays R8 and 16 bit greyscale stays R16,
+		// a quarter and a half of the memory of RGBA8. Anything else is RGBA8.
+		bool LoadKeepingFormat(const std::string& filepath);
+
+		// Converts the pixels to format in place. Going to fewer channels keeps the first ones, going to more repeats
+		// a single channel into RGB (greyscale) and sets alpha opaque.
+		void Convert(PixelFormat format);
+
+		// Reads just the dimensions of an image without decoding its pixels. Returns false on error.
+		static bool ReadSize(const std::string& filepath, int& width, int& height);
+
+		// Decodes the file straight into memory supplied by getDestination rather than into a loader, e.g. a mapped buffer.
+		// getDestination is called once the size is known and must return width * height * 4 bytes, or nullptr to give up.
+		// Safe to call from any thread. Returns false on error.
+		static bool DecodeInto(const std::string& filepath, const std::function<BYTE*(int width, int height)>& getDestination);
+
+		// Allows access to the raw bytes that make up the image laid out as Format says
 		BYTE* GetData() const { return m_data; }
 
+		// Grey value of the texel at x, y: the first channel, the top byte of R16
+		BYTE GetGreyTexel(int x, int y) const;
+
+		// First channel of the texel at x, y as 0 to 1, at the full precision of the format
+		float GetTexelValue(int x, int y) const;
+
 		// Returns a grey scale value at provided uv, useful for RMA textures
 		BYTE GetGreyValue(float u, float v) const;
 	};
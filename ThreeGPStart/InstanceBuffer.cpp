@@ -0,0 +1,132 @@
+#include "InstanceBuffer.h"
+
+#include <cstring>
+
+namespace Helpers
+{
+	// Room a new set starts with
+	static const size_t kInitialSetCapacity{ 64 };
+
+	InstanceBuffer::SetId InstanceBuffer::CreateSet()
+	{
+		m_sets.emplace_back();
+		m_relayout = true;
+		m_stats.sets = m_sets.size();
+		return (SetId)(m_sets.size() - 1);
+	}
+
+	void InstanceBuffer::MarkDirty(Set& set, size_t begin, size_t end)
+	{
+		set.dirtyBegin = std::min(set.dirtyBegin, begin);
+		set.dirtyEnd = std::max(set.dirtyEnd, end);
+		set.version++;
+	}
+
+	// Appends an instance, returning its index in the set
+	uint32_t InstanceBuffer::Add(SetId id, const glm::mat4& transform, const glm::vec4& tint)
+	{
+		Set& set{ m_sets[id] };
+		set.instances.push_back({ transform, tint });
+		MarkDirty(set, set.instances.size() - 1, set.instances.size());
+
+		if (set.instances.size() > set.capacity)
+			m_relayout = true;
+
+		m_stats.instances++;
+		return (uint32_t)(set.instances.size() - 1);
+	}
+
+	// Changes an instance, nothing is uploaded if it is the same as before
+	void InstanceBuffer::Update(SetId id, uint32_t instance, const glm::mat4& transform, const glm::vec4& tint)
+	{
+		Set& set{ m_sets[id] };
+		InstanceData& data{ set.instances[instance] };
+		if (data.transform == transform && data.tint == tint)
+			return;
+
+		data.transform = transform;
+		data.tint = tint;
+		MarkDirty(set, instance, (size_t)instance + 1);
+	}
+
+	void InstanceBuffer::Clear(SetId id)
+	{
+		Set& set{ m_sets[id] };
+		m_stats.instances -= set.instances.size();
+		set.instances.clear();
+		set.dirtyBegin = SIZE_MAX;
+		set.dirtyEnd = 0;
+		set.version++;
+	}
+
+	// Sends what changed since the last call to the GPU
+	void InstanceBuffer::Upload()
+	{
+		m_stats.bytesUploaded = 0;
+
+		if (m_relayout)
+		{
+			// Every set gets twice the room it needs, then the buffer is remade if that no longer fits
+			size_t total{ 0 };
+			for (Set& set : m_sets)
+			{
+				if (set.instances.size() > set.capacity)
+					set.capacity = std::max(set.instances.size() * 2, kInitialSetCapacity);
+				set.first = total;
+				total += set.capacity;
+				MarkDirty(set, 0, set.instances.size());
+			}
+
+			if (total > m_bufferCapacity)
+			{
+				glDeleteBuffers(1, &m_buffer);
+				glGenBuffers(1, &m_buffer);
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+				glBufferStorage(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(total * sizeof(InstanceData)), nullptr, GL_DYNAMIC_STORAGE_BIT);
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+				m_bufferCapacity = total;
+			}
+
+			m_relayout = false;
+			m_stats.relayouts++;
+		}
+
+		if (!m_buffer)
+			return;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+		for (Set& set : m_sets)
+		{
+			if (set.dirtyBegin < set.dirtyEnd)
+			{
+				const size_t count{ std::min(set.dirtyEnd, set.instances.size()) - std::min(set.dirtyBegin, set.instances.size()) };
+				if (count > 0)
+				{
+					glBufferSubData(GL_SHADER_STORAGE_BUFFER, (GLintptr)((set.first + set.dirtyBegin) * sizeof(InstanceData)),
+						(GLsizeiptr)(count * sizeof(InstanceData)), set.instances.data() + set.dirtyBegin);
+					m_stats.bytesUploaded += count * sizeof(InstanceData);
+				}
+			}
+
+			set.dirtyBegin = SIZE_MAX;
+			set.dirtyEnd = 0;
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// Binds the whole buffer to a shader storage binding point
+	void InstanceBuffer::Bind(GLuint binding) const
+	{
+		if (m_buffer)
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_buffer);
+	}
+
+	void InstanceBuffer::Destroy()
+	{
+		glDeleteBuffers(1, &m_buffer);
+		m_buffer = 0;
+		m_bufferCapacity = 0;
+		m_sets.clear();
+		m_stats = Stats();
+	}
+}
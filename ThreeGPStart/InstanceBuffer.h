@@ -0,0 +1,94 @@
+#pragma once
+// Per instance transforms and tints of instanced models, kept on the GPU and only uploaded where they change
+
+#include "ExternalLibraryHeaders.h"
+
+namespace Helpers
+{
+	// One instance as the vertex shaders read it, std430 layout
+	struct InstanceData
+	{
+		glm::mat4 transform{ 1 };
+		glm::vec4 tint{ 1 };
+	};
+
+	// Instances are kept in sets, one per instanced model, laid out one after another in a single storage buffer with
+	// room to grow. Changing instances marks the span of its set that changed and Upload sends just those spans with
+	// glBufferSubData. A set outgrowing its room lays every set out again and uploads the lot, which doubling the room
+	// makes rare. A draw of a set reads instances First(set) to First(set) + Count(set) - 1. GL thread only for
+	// Upload and Bind.
+	class InstanceBuffer
+	{
+	public:
+		using SetId = uint32_t;
+
+		struct Stats
+		{
+			size_t sets{ 0 };
+			size_t instances{ 0 };
+
+			// Last Upload
+			size_t bytesUploaded{ 0 };
+
+			size_t relayouts{ 0 };
+		};
+	private:
+		struct Set
+		{
+			std::vector<InstanceData> instances;
+
+			// Place in the buffer and room there
+			size_t first{ 0 };
+			size_t capacity{ 0 };
+
+			// Changed instances [dirtyBegin, dirtyEnd), empty when dirtyBegin >= dirtyEnd
+			size_t dirtyBegin{ SIZE_MAX };
+			size_t dirtyEnd{ 0 };
+
+			// Bumped on every change so users can tell when to recompute anything derived from the instances
+			uint64_t version{ 0 };
+		};
+
+		std::vector<Set> m_sets;
+		GLuint m_buffer{ 0 };
+		size_t m_bufferCapacity{ 0 };
+		bool m_relayout{ false };
+
+		Stats m_stats;
+
+		void MarkDirty(Set& set, size_t begin, size_t end);
+	public:
+		InstanceBuffer() = default;
+		~InstanceBuffer() { Destroy(); }
+
+		InstanceBuffer(const InstanceBuffer&) = delete;
+		InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+		SetId CreateSet();
+
+		// Appends an instance, returning its index in the set
+		uint32_t Add(SetId set, const glm::mat4& transform, const glm::vec4& tint = glm::vec4(1));
+
+		// Changes an instance, nothing is uploaded if it is the same as before
+		void Update(SetId set, uint32_t instance, const glm::mat4& transform, const glm::vec4& tint = glm::vec4(1));
+
+		void Clear(SetId set);
+
+		uint32_t Count(SetId set) const { return (uint32_t)m_sets[set].instances.size(); }
+		const std::vector<InstanceData>& Instances(SetId set) const { return m_sets[set].instances; }
+		uint64_t Version(SetId set) const { return m_sets[set].version; }
+
+		// Where the set starts in the buffer, valid after Upload
+		uint32_t First(SetId set) const { return (uint32_t)m_sets[set].first; }
+
+		// Sends what changed since the last call to the GPU, call once a frame before drawing
+		void Upload();
+
+		// Binds the whole buffer to a shader storage binding point
+		void Bind(GLuint binding) const;
+
+		void Destroy();
+
+		const Stats& GetStats() const { return m_stats; }
+	};
+}
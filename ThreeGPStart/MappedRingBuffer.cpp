@@ -0,0 +1,188 @@
+#include "MappedRingBuffer.h"
+
+namespace Helpers
+{
+	// Longest to block waiting for the GPU before giving up on a fence
+	static const GLuint64 kWaitTimeoutNs{ 1000000000ull };
+
+	static size_t AlignUp(size_t value, size_t alignment)
+	{
+		return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+	}
+
+	// Creates and maps a buffer of size bytes for target. Returns false on error.
+	bool MappedRingBuffer::Create(GLenum target, size_t size)
+	{
+		Destroy();
+
+		const GLbitfield flags{ GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT };
+
+		glGenBuffers(1, &m_buffer);
+		glBindBuffer(target, m_buffer);
+		glBufferStorage(target, (GLsizeiptr)size, nullptr, flags);
+		m_mapped = (BYTE*)glMapBufferRange(target, 0, (GLsizeiptr)size, flags);
+		glBindBuffer(target, 0);
+
+		if (!m_mapped)
+		{
+			std::cout << "MappedRingBuffer: could not map a buffer of " << size << " bytes" << std::endl;
+			glDeleteBuffers(1, &m_buffer);
+			m_buffer = 0;
+			return false;
+		}
+
+		m_target = target;
+		m_size = size;
+		m_head = 0;
+		return true;
+	}
+
+	// Waits for the GPU to finish with every region then unmaps and deletes the buffer
+	void MappedRingBuffer::Destroy()
+	{
+		if (m_buffer == 0)
+			return;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (Region& region : m_regions)
+		{
+			if (region.fence)
+			{
+				glClientWaitSync(region.fence, GL_SYNC_FLUSH_COMMANDS_BIT, kWaitTimeoutNs);
+				glDeleteSync(region.fence);
+			}
+		}
+		m_regions.clear();
+
+		glBindBuffer(m_target, m_buffer);
+		glUnmapBuffer(m_target);
+		glBindBuffer(m_target, 0);
+		glDeleteBuffers(1, &m_buffer);
+
+		m_buffer = 0;
+		m_mapped = nullptr;
+		m_size = 0;
+		m_head = 0;
+	}
+
+	// Reserves bytes at a multiple of alignment. Returns nullptr without waiting if there is no free space.
+	BYTE* MappedRingBuffer::Allocate(size_t bytes, size_t alignment, size_t& offset)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_mapped || bytes == 0)
+			return nullptr;
+
+		// Nothing in flight so start again from the beginning
+		if (m_regions.empty())
+			m_head = 0;
+
+		const size_t tail{ m_regions.empty() ? 0 : m_regions.front().offset };
+		size_t start{ AlignUp(m_head, alignment) };
+
+		// In use space is [tail, head) unless it has wrapped to [tail, end) + [0, head).
+		// The head may never catch up with the tail, equal would look empty.
+		if (m_regions.empty() || m_head > tail)
+		{
+			if (start + bytes > m_size)
+			{
+				// Skip the rest of the buffer, it is free again when the region before it is
+				start = 0;
+				if (!m_regions.empty() && bytes >= tail)
+					return nullptr;
+				if (bytes > m_size)
+					return nullptr;
+			}
+		}
+		else if (start + bytes >= tail)
+		{
+			return nullptr;
+		}
+
+		Region region;
+		region.offset = start;
+		region.end = start + bytes;
+		m_regions.push_back(region);
+
+		m_head = region.end;
+		offset = start;
+		return m_mapped + start;
+	}
+
+	// As Allocate but waits for the GPU to finish with fenced regions if there is no space
+	BYTE* MappedRingBuffer::AllocateWait(size_t bytes, size_t alignment, size_t& offset)
+	{
+		for (;;)
+		{
+			BYTE* memory{ Allocate(bytes, alignment, offset) };
+			if (memory)
+				return memory;
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			// Space held by regions still being written cannot be waited for
+			if (m_regions.empty() || !m_regions.front().fenced)
+				return nullptr;
+
+			RetireLocked(true);
+		}
+	}
+
+	// Hands the region at offset back once the GL commands that read it have been issued
+	void MappedRingBuffer::Fence(size_t offset)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (Region& region : m_regions)
+		{
+			if (region.offset == offset && !region.fenced)
+			{
+				region.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				region.fenced = true;
+				break;
+			}
+		}
+
+		// Newly fenced regions may have been holding up others
+		RetireLocked(false);
+	}
+
+	// Frees the space of regions the GPU has finished with
+	void MappedRingBuffer::Retire()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		RetireLocked(false);
+	}
+
+	// Removes regions from the front whose fences have signalled, optionally blocking on the first
+	void MappedRingBuffer::RetireLocked(bool wait)
+	{
+		while (!m_regions.empty() && m_regions.front().fenced)
+		{
+			Region& region{ m_regions.front() };
+			if (region.fence)
+			{
+				const GLenum status{ glClientWaitSync(region.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? kWaitTimeoutNs : 0) };
+				if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+					return;
+
+				glDeleteSync(region.fence);
+			}
+
+			m_regions.pop_front();
+			wait = false;
+		}
+	}
+
+	// Bytes currently in use, including regions waiting on the GPU
+	size_t MappedRingBuffer::BytesInUse()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_regions.empty())
+			return 0;
+
+		const size_t tail{ m_regions.front().offset };
+		return m_head > tail ? m_head - tail : m_size - tail + m_head;
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+// GL buffer that stays mapped for its whole life, handed out in pieces that are reused once the GPU has finished with them
+
+#include "ExternalLibraryHeaders.h"
+
+#include <deque>
+#include <mutex>
+
+namespace Helpers
+{
+	// Space is allocated round the buffer in order. Once the GL commands that read a region have been issued it is fenced,
+	// and the space is reused when the fence has signalled, so writing never waits on the GPU.
+	// Allocate may be called from any thread as the mapping is persistent, everything else must be on the GL thread.
+	class MappedRingBuffer
+	{
+	private:
+		struct Region
+		{
+			size_t offset{ 0 };
+
+			// End of the region including any space skipped to wrap or align
+			size_t end{ 0 };
+
+			// Zero until the region is handed back with Fence
+			GLsync fence{ nullptr };
+			bool fenced{ false };
+		};
+
+		GLuint m_buffer{ 0 };
+		GLenum m_target{ 0 };
+		BYTE* m_mapped{ nullptr };
+		size_t m_size{ 0 };
+
+		// Regions in allocation order, the oldest is the first to be reused
+		std::deque<Region> m_regions;
+		size_t m_head{ 0 };
+
+		std::mutex m_mutex;
+
+		// Removes regions from the front whose fences have signalled, optionally blocking on the first
+		void RetireLocked(bool wait);
+	public:
+		MappedRingBuffer() = default;
+		~MappedRingBuffer() { Destroy(); }
+
+		MappedRingBuffer(const MappedRingBuffer&) = delete;
+		MappedRingBuffer& operator=(const MappedRingBuffer&) = delete;
+
+		// Creates and maps a buffer of size bytes for target e.g. GL_PIXEL_UNPACK_BUFFER. Returns false on error.
+		bool Create(GLenum target, size_t size);
+
+		// Waits for the GPU to finish with every region then unmaps and deletes the buffer
+		void Destroy();
+
+		// Reserves bytes at a multiple of alignment, returning where to write and its offset in the buffer.
+		// Returns nullptr without waiting if there is no free space.
+		BYTE* Allocate(size_t bytes, size_t alignment, size_t& offset);
+
+		// As Allocate but if there is no space, waits for the GPU to finish with fenced regions. Returns nullptr
+		// only if bytes can never fit. GL thread only.
+		BYTE* AllocateWait(size_t bytes, size_t alignment, size_t& offset);
+
+		// Hands the region at offset back once the GL commands that read it have been issued
+		void Fence(size_t offset);
+
+		// Frees the space of regions the GPU has finished with, call once a frame
+		void Retire();
+
+		bool IsCreated() const { return m_buffer != 0; }
+		GLuint Buffer() const { return m_buffer; }
+		size_t Size() const { return m_size; }
+
+		// Bytes currently in use, including regions waiting on the GPU
+		size_t BytesInUse();
+	};
+}
@@ -0,0 +1,117 @@
+#include "MemoryArena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace Helpers
+{
+	MemoryArena::MemoryArena(MemoryArena&& other) noexcept :
+		m_blocks(std::move(other.m_blocks)), m_finalisers(std::move(other.m_finalisers)), m_blockSize(other.m_blockSize)
+	{
+		other.m_blocks.clear();
+		other.m_finalisers.clear();
+	}
+
+	MemoryArena& MemoryArena::operator=(MemoryArena&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Release();
+
+			m_blocks = std::move(other.m_blocks);
+			m_finalisers = std::move(other.m_finalisers);
+			m_blockSize = other.m_blockSize;
+
+			other.m_blocks.clear();
+			other.m_finalisers.clear();
+		}
+		return *this;
+	}
+
+	// Adds a new block with at least minSize bytes
+	MemoryArena::Block& MemoryArena::AddBlock(size_t minSize)
+	{
+		Block block;
+		block.size = std::max(minSize, m_blockSize);
+		block.memory.reset(new std::byte[block.size]);
+		m_blocks.push_back(std::move(block));
+		return m_blocks.back();
+	}
+
+	// Makes sure the next bytes worth of allocations come from a single block
+	void MemoryArena::Reserve(size_t bytes)
+	{
+		if (!m_blocks.empty() && m_blocks.back().size - m_blocks.back().used >= bytes)
+			return;
+
+		AddBlock(bytes);
+	}
+
+	// Returns uninitialised memory with the requested alignment
+	void* MemoryArena::Allocate(size_t bytes, size_t alignment)
+	{
+		if (!m_blocks.empty())
+		{
+			Block& block{ m_blocks.back() };
+			const uintptr_t base{ reinterpret_cast<uintptr_t>(block.memory.get()) };
+			const uintptr_t aligned{ (base + block.used + alignment - 1) & ~(uintptr_t)(alignment - 1) };
+			const size_t newUsed{ (size_t)(aligned - base) + bytes };
+
+			if (newUsed <= block.size)
+			{
+				block.used = newUsed;
+				return reinterpret_cast<void*>(aligned);
+			}
+		}
+
+		// Doesn't fit so start a new block, new[] gives max_align_t alignment so only need to pad beyond that
+		const size_t padding{ alignment > alignof(std::max_align_t) ? alignment : 0 };
+		Block& block{ AddBlock(bytes + padding) };
+		const uintptr_t base{ reinterpret_cast<uintptr_t>(block.memory.get()) };
+		const uintptr_t aligned{ (base + alignment - 1) & ~(uintptr_t)(alignment - 1) };
+		block.used = (size_t)(aligned - base) + bytes;
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	// Copies a string into the arena and returns a view of the copy
+	std::string_view MemoryArena::CopyString(const char* str, size_t length)
+	{
+		if (length == 0)
+			return std::string_view();
+
+		char* copy{ static_cast<char*>(Allocate(length + 1, 1)) };
+		memcpy(copy, str, length);
+		copy[length] = 0;
+		return std::string_view(copy, length);
+	}
+
+	// Calls any destructors and frees all the memory in one go
+	void MemoryArena::Release()
+	{
+		// Reverse order of creation, like the stack
+		for (auto it = m_finalisers.rbegin(); it != m_finalisers.rend(); ++it)
+			it->destroy(it->object);
+
+		m_finalisers.clear();
+		m_blocks.clear();
+	}
+
+	// Total bytes handed out
+	size_t MemoryArena::BytesUsed() const
+	{
+		size_t total{ 0 };
+		for (const Block& block : m_blocks)
+			total += block.used;
+		return total;
+	}
+
+	// Total bytes held by the blocks
+	size_t MemoryArena::BytesReserved() const
+	{
+		size_t total{ 0 };
+		for (const Block& block : m_blocks)
+			total += block.size;
+		return total;
+	}
+}
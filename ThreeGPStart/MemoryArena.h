@@ -0,0 +1,113 @@
+#pragma once
+// Linear (bump) allocator so a whole set of related data can be allocated and released in one go
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Helpers
+{
+	// Non owning view of a contiguous run of T, like std::span (which needs C++20)
+	template <typename T>
+	struct Span
+	{
+		T* ptr{ nullptr };
+		size_t count{ 0 };
+
+		T* data() const { return ptr; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+
+		T* begin() const { return ptr; }
+		T* end() const { return ptr + count; }
+
+		T& operator[](size_t i) const { return ptr[i]; }
+	};
+
+	// Hands out memory from large blocks. Nothing is freed individually, instead everything is
+	// released at once when the arena is released or destroyed.
+	class MemoryArena
+	{
+	private:
+		struct Block
+		{
+			std::unique_ptr<std::byte[]> memory;
+			size_t size{ 0 };
+			size_t used{ 0 };
+		};
+
+		// Objects with destructors created via Create need their destructor calling on release
+		struct Finaliser
+		{
+			void (*destroy)(void*);
+			void* object;
+		};
+
+		std::vector<Block> m_blocks;
+		std::vector<Finaliser> m_finalisers;
+		size_t m_blockSize{ 0 };
+
+		// Adds a new block with at least minSize bytes
+		Block& AddBlock(size_t minSize);
+	public:
+		// blockSize is the size of blocks allocated when the arena runs out of space
+		explicit MemoryArena(size_t blockSize = 64 * 1024) : m_blockSize(blockSize) {}
+		~MemoryArena() { Release(); }
+
+		MemoryArena(const MemoryArena&) = delete;
+		MemoryArena& operator=(const MemoryArena&) = delete;
+
+		MemoryArena(MemoryArena&& other) noexcept;
+		MemoryArena& operator=(MemoryArena&& other) noexcept;
+
+		// Makes sure the next bytes worth of allocations come from a single block
+		void Reserve(size_t bytes);
+
+		// Returns uninitialised memory with the requested alignment
+		void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+		// Returns an array of count default constructed T, T must be trivially destructible
+		template <typename T>
+		Span<T> AllocateArray(size_t count)
+		{
+			static_assert(std::is_trivially_destructible_v<T>, "Arena arrays are never destructed");
+
+			if (count == 0)
+				return Span<T>();
+
+			T* memory{ static_cast<T*>(Allocate(sizeof(T) * count, alignof(T))) };
+			for (size_t i = 0; i < count; i++)
+				new (memory + i) T();
+
+			return Span<T>{ memory, count };
+		}
+
+		// Constructs a T in the arena. Its destructor is called when the arena is released.
+		template <typename T, typename... Args>
+		T* Create(Args&&... args)
+		{
+			T* object{ new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...) };
+
+			if constexpr (!std::is_trivially_destructible_v<T>)
+				m_finalisers.push_back(Finaliser{ [](void* p) { static_cast<T*>(p)->~T(); }, object });
+
+			return object;
+		}
+
+		// Copies a string into the arena and returns a view of the copy
+		std::string_view CopyString(const char* str, size_t length);
+
+		// Calls any destructors and frees all the memory in one go
+		void Release();
+
+		// Total bytes handed out
+		size_t BytesUsed() const;
+
+		// Total bytes held by the blocks
+		size_t BytesReserved() const;
+	};
+}
@@ -49,26 +49,54 @@ namespace Helpers
 		return angles;
 	}
 
-	// Retrieve the dimensions of this mesh in local coordinates
-	void Mesh::GetLocalExtents(glm::vec3& minExtents, glm::vec3& maxExtents) const
+	// Recalculate the bounds from the current vertices
+	void Mesh::CalculateBounds()
 	{
-		if (vertices.empty())
-			return;
+		bounds = ComputeAABB(vertices.data(), vertices.size());
+		boundingSphere = ComputeBoundingSphere(vertices.data(), vertices.size(), bounds);
+	}
 
-		minExtents.x = maxExtents.x = vertices[0].x;
-		minExtents.y = maxExtents.y = vertices[0].y;
-		minExtents.z = maxExtents.z = vertices[0].z;
+	// Bytes needed to hold the hierarchy from node down in the arena, including alignment padding
+	static size_t RecurseNodeArenaSize(const aiNode* node)
+	{
+		size_t bytes{ sizeof(Node) + alignof(Node) + node->mName.length + 1 +
+			node->mNumMeshes * sizeof(unsigned int) + alignof(unsigned int) +
+			node->mNumChildren * sizeof(Node*) + alignof(Node*) };
+
+		for (unsigned int i = 0; i < node->mNumChildren; i++)
+			bytes += RecurseNodeArenaSize(node->mChildren[i]);
 
-		for (size_t i = 1; i < vertices.size(); i++)
+		return bytes;
+	}
+
+	// Bytes needed to hold all the mesh data and hierarchy of scene in the arena
+	static size_t CalculateArenaSize(const aiScene* scene)
+	{
+		size_t bytes{ 0 };
+		for (unsigned int i = 0; i < scene->mNumMeshes; i++)
 		{
-			minExtents.x = std::min(minExtents.x, vertices[i].x);
-			minExtents.y = std::min(minExtents.y, vertices[i].y);
-			minExtents.z = std::min(minExtents.z, vertices[i].z);
+			const aiMesh* aimesh{ scene->mMeshes[i] };
 
-			maxExtents.x = std::max(maxExtents.x, vertices[i].x);
-			maxExtents.y = std::max(maxExtents.y, vertices[i].y);
-			maxExtents.z = std::max(maxExtents.z, vertices[i].z);
+			bytes += aimesh->mName.length + 1;
+			bytes += aimesh->mNumVertices * sizeof(glm::vec3) + alignof(glm::vec3);
+			if (aimesh->HasNormals())
+				bytes += aimesh->mNumVertices * sizeof(glm::vec3) + alignof(glm::vec3);
+			if (aimesh->HasTextureCoords(0))
+				bytes += aimesh->mNumVertices * sizeof(glm::vec2) + alignof(glm::vec2);
+			bytes += (size_t)aimesh->mNumFaces * 3 * sizeof(unsigned int) + alignof(unsigned int);
 		}
+
+		return bytes + RecurseNodeArenaSize(scene->mRootNode);
+	}
+
+	// Retrieve the dimensions of this mesh in local coordinates
+	void Mesh::GetLocalExtents(glm::vec3& minExtents, glm::vec3& maxExtents) const
+	{
+		if (bounds.IsEmpty())
+			return;
+
+		minExtents = bounds.minExtents;
+		maxExtents = bounds.maxExtents;
 	}
 
 	// Load a 3D model form a provided file and path, return false on error
@@ -101,6 +129,13 @@ namespace Helpers
 			aiProcess_GlobalScale |							// KD: Needed for FBX which uses cm rather than metres
 			0;
 
+		// Reloading so free anything from before
+		m_meshVector.clear();
+		m_materials.clear();
+		m_bounds = AABB();
+		m_rootNode = nullptr;
+		m_arena.Release();
+
 		// Create an instance of the Importer class
 		Assimp::Importer importer;
 
@@ -203,6 +238,10 @@ namespace Helpers
 
 		//std::cout << "Scene contains " + std::to_string(scene->mNumMeshes) + " mesh");
 
+		// Size everything up front so the whole model ends up in one allocation
+		m_arena.Reserve(CalculateArenaSize(scene));
+		m_meshVector.reserve(scene->mNumMeshes);
+
 		// ASSIMP mesh
 		// http://assimp.sourceforge.net/lib_html/structai_mesh.html
 		for (unsigned int i = 0; i < scene->mNumMeshes; i++)
@@ -222,49 +261,45 @@ namespace Helpers
 			m_meshVector.push_back(Mesh());
 			Mesh& newMesh = m_meshVector.back();
 
-			newMesh.name = aimesh->mName.C_Str();
+			newMesh.name = m_arena.CopyString(aimesh->mName.C_Str(), aimesh->mName.length);
 
 			//		std::cout << "Processing mesh with name: " + newMesh->name);
 
-					// Copy over all the vertices, ai format of a vertex is same as mine
-					// Probably be able to speed this all up at some point
-			for (size_t v = 0; v < aimesh->mNumVertices; v++)
-			{
-				glm::vec3 newV = *(glm::vec3*) & aimesh->mVertices[v];
-				newMesh.vertices.push_back(newV);
-			}
+			// Copy over all the vertices, ai format of a vertex is same as mine so can copy in one go
+			static_assert(sizeof(aiVector3D) == sizeof(glm::vec3), "Vertex layouts must match");
+			newMesh.vertices = m_arena.AllocateArray<glm::vec3>(aimesh->mNumVertices);
+			memcpy(newMesh.vertices.data(), aimesh->mVertices, sizeof(glm::vec3) * aimesh->mNumVertices);
 
 			// And the normals if there are any
 			if (aimesh->HasNormals())
 			{
-				for (size_t v = 0; v < aimesh->mNumVertices; v++)
-				{
-					glm::vec3 newN = *(glm::vec3*) & aimesh->mNormals[v];
-					newMesh.normals.push_back(newN);
-				}
+				newMesh.normals = m_arena.AllocateArray<glm::vec3>(aimesh->mNumVertices);
+				memcpy(newMesh.normals.data(), aimesh->mNormals, sizeof(glm::vec3) * aimesh->mNumVertices);
 			}
 
-			// And texture coordinates
+			// And texture coordinates, ai holds these as 3D so need to take x and y
 			if (aimesh->HasTextureCoords(0))
 			{
+				newMesh.uvCoords = m_arena.AllocateArray<glm::vec2>(aimesh->mNumVertices);
 				for (size_t v = 0; v < aimesh->mNumVertices; v++)
-				{
-					glm::vec2 newN = *(glm::vec2*) &aimesh->mTextureCoords[0][v];
-					
-					newMesh.uvCoords.push_back(newN);
-				}
+					newMesh.uvCoords[v] = *(glm::vec2*)&aimesh->mTextureCoords[0][v];
 			}
 
 			// Faces contain the vertex indices and due to the flags I set before are always triangles
+			newMesh.elements = m_arena.AllocateArray<unsigned int>((size_t)aimesh->mNumFaces * 3);
 			for (unsigned int face = 0; face < aimesh->mNumFaces; face++)
 			{
 				EsAssert(aimesh->mFaces[face].mNumIndices == 3);
 				for (int triInd = 0; triInd < 3; triInd++)
-					newMesh.elements.push_back(aimesh->mFaces[face].mIndices[triInd]);
+					newMesh.elements[(size_t)face * 3 + triInd] = aimesh->mFaces[face].mIndices[triInd];
 			}
 
 			// Material index
 			newMesh.materialIndex = aimesh->mMaterialIndex;
+
+			// Bounds are needed every frame for culling so work them out once here
+			newMesh.CalculateBounds();
+			m_bounds.Merge(newMesh.bounds);
 		}
 #if defined(VERBOSE)
 		if (hasBones)
@@ -428,55 +463,75 @@ namespace Helpers
 	// Recursive node creation
 	Node* ModelLoader::RecurseCreateNode(aiNode* node, Node* parent)
 	{
-		Node* newNode = new Node;
+		Node* newNode = m_arena.Create<Node>();
 
-		newNode->name = node->mName.C_Str();
+		newNode->name = m_arena.CopyString(node->mName.C_Str(), node->mName.length);
 		newNode->parentNode = parent;
 
+		newNode->meshIndices = m_arena.AllocateArray<unsigned int>(node->mNumMeshes);
 		for (size_t i = 0; i < node->mNumMeshes; i++)
-			newNode->meshIndices.push_back(node->mMeshes[i]);
+			newNode->meshIndices[i] = node->mMeshes[i];
 
 		newNode->transform = aiMatrix4x4ToGlm(&node->mTransformation);
 		
+		newNode->childNodes = m_arena.AllocateArray<Node*>(node->mNumChildren);
 		for (size_t i = 0; i < node->mNumChildren; i++)
-			newNode->childNodes.emplace_back(RecurseCreateNode(node->mChildren[i], newNode));
+			newNode->childNodes[i] = RecurseCreateNode(node->mChildren[i], newNode);
 
 		return newNode;
 	}
 
-	// Recursive deletion of nodes
-	void ModelLoader::RecurseDeleteNode(Node* node)
+	// Frees the CPU side data once uploaded, optionally keeping vertices and elements for collision
+	void ModelLoader::ReleaseCPUData(bool keepCollisionData)
 	{
-		if (!node)
-			return;
+		MemoryArena retained;
+
+		if (keepCollisionData)
+		{
+			size_t bytes{ 0 };
+			for (const Mesh& mesh : m_meshVector)
+				bytes += mesh.vertices.size() * sizeof(glm::vec3) + alignof(glm::vec3) + mesh.elements.size() * sizeof(unsigned int) + alignof(unsigned int);
+			retained.Reserve(bytes);
+		}
+
+		for (Mesh& mesh : m_meshVector)
+		{
+			if (keepCollisionData)
+			{
+				Span<glm::vec3> vertices{ retained.AllocateArray<glm::vec3>(mesh.vertices.size()) };
+				std::copy(mesh.vertices.begin(), mesh.vertices.end(), vertices.begin());
+				mesh.vertices = vertices;
+
+				Span<unsigned int> elements{ retained.AllocateArray<unsigned int>(mesh.elements.size()) };
+				std::copy(mesh.elements.begin(), mesh.elements.end(), elements.begin());
+				mesh.elements = elements;
+			}
+			else
+			{
+				mesh.vertices = Span<glm::vec3>();
+				mesh.elements = Span<unsigned int>();
+			}
+
+			// Bounds and material index are held in the mesh itself so remain valid
+			mesh.name = std::string_view();
+			mesh.normals = Span<glm::vec3>();
+			mesh.uvCoords = Span<glm::vec2>();
+		}
 
-		for (Node* n : node->childNodes)
-			RecurseDeleteNode(n);
+		// The hierarchy lives in the arena too
+		m_rootNode = nullptr;
 
-		delete node;
+		// Releases the old arena in one shot
+		m_arena = std::move(retained);
 	}
 
 	// Retrieve the dimensions of this model in local coordinates
 	void ModelLoader::GetLocalExtents(glm::vec3& minExtents, glm::vec3& maxExtents) const
 	{
-		if (m_meshVector.empty())
+		if (m_bounds.IsEmpty())
 			return;
 
-		m_meshVector[0].GetLocalExtents(minExtents, maxExtents);
-
-		for (size_t i = 1; i < m_meshVector.size(); i++)
-		{
-			glm::vec3 newMin;
-			glm::vec3 newMax;
-			m_meshVector[0].GetLocalExtents(newMin, newMax);
-
-			minExtents.x = std::min(minExtents.x, newMin.x);
-			minExtents.y = std::min(minExtents.y, newMin.y);
-			minExtents.z = std::min(minExtents.z, newMin.z);
-
-			maxExtents.x = std::max(maxExtents.x, newMax.x);
-			maxExtents.y = std::max(maxExtents.y, newMax.y);
-			maxExtents.z = std::max(maxExtents.z, newMax.z);
-		}
+		minExtents = m_bounds.minExtents;
+		maxExtents = m_bounds.maxExtents;
 	}
 }
\ No newline at end of file
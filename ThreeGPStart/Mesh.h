@@ -3,6 +3,8 @@
 
 #include "ExternalLibraryHeaders.h"
 #include "Helper.h"
+#include "Bounds.h"
+#include "MemoryArena.h"
 
 namespace Helpers
 {
@@ -51,29 +53,37 @@ namespace Helpers
 
 	// Data container for a mesh
 	// A model can be made up of a number of mesh
+	// The data is held in the owning ModelLoader's arena so is only valid while that is alive
 	struct Mesh
 	{
 		// Name may well be blank, depends on the mesh creator
-		std::string name;
+		std::string_view name;
 
 		// Data in the mesh, vertices are guaranteed but normals and uvCoords depend on the model creator
-		std::vector<glm::vec3> vertices;
-		std::vector<glm::vec3> normals;
-		std::vector<glm::vec2> uvCoords;
+		Span<glm::vec3> vertices;
+		Span<glm::vec3> normals;
+		Span<glm::vec2> uvCoords;
 
 		// Elements
-		std::vector<unsigned int> elements;
+		Span<unsigned int> elements;
 
 		// Index into the material vector held by the ModelLoader
 		size_t materialIndex{ 0 };
 
+		// Bounds in local model coordinates, calculated once at load
+		AABB bounds;
+		BoundingSphere boundingSphere;
+
+		// Recalculate the bounds, only needed if vertices are changed after load
+		void CalculateBounds();
+
 		// Retrieve the dimensions of this mesh in local model coordinates
 		void GetLocalExtents(glm::vec3& minExtents, glm::vec3& maxExtents) const;
 
 		// Helper
 		std::string ToString() const {
 			return
-				" Name: " + (name.empty() ? " Noname " : name) + "\n" +
+				" Name: " + (name.empty() ? std::string(" Noname ") : std::string(name)) + "\n" +
 				" Num Triangles: " + std::to_string(elements.size() / 3) + "\n" +
 				" Num verts: " + std::to_string(vertices.size()) + "\n" +
 				" Num normals: " + std::to_string(normals.size()) + "\n" +
@@ -83,15 +93,15 @@ namespace Helpers
 	};	
 
 	// A mesh can contain a hierarchy in a tree structure
-	// Each entry is a Node
+	// Each entry is a Node, also held in the ModelLoader's arena
 	struct Node
 	{
-		std::string name;
+		std::string_view name;
 		glm::mat4 transform{ 1 };
-		std::vector<unsigned int> meshIndices;
+		Span<unsigned int> meshIndices;
 
 		Node* parentNode{ nullptr };
-		std::vector<Node*> childNodes;
+		Span<Node*> childNodes;
 
 		// Animations
 		std::vector<AnimationData> translationAnimationKeys;
@@ -104,21 +114,27 @@ namespace Helpers
 	{
 	private:
 		std::string m_filename;
+
+		// All mesh data, names and nodes are allocated from here so the lot can be released in one go
+		MemoryArena m_arena;
+
 		std::vector<Mesh> m_meshVector;
 		std::vector<Material> m_materials;
 
+		// Union of all the mesh bounds
+		AABB m_bounds;
+
 		Node* m_rootNode{ nullptr };
 
 		bool PopulateFromAssimpScene(const aiScene* scene);
 
 		// Recursive
 		Node* RecurseCreateNode(aiNode* node, Node* parent);
-		void RecurseDeleteNode(Node* node);
 		Node* RecurseFindNode(Node* node, const std::string& nodeName);
 		void RecurseOutputHierarchy(Node* node, int depth);
 	public:
 		ModelLoader() = default;
-		~ModelLoader() { RecurseDeleteNode(m_rootNode); }
+		~ModelLoader() = default;
 
 		// Load a 3D model form a provided file and path, return false on error
 		bool LoadFromFile(const std::string& objFilename);
@@ -126,6 +142,14 @@ namespace Helpers
 		// Retrieves the collection of mesh loaded from the 3D model
 		std::vector<Mesh>& GetMeshVector() { return m_meshVector; }
 
+		// Call once the mesh data has been uploaded to the GPU. Frees the arena in one go.
+		// If keepCollisionData is true the vertices and elements are kept (in a new, tightly sized arena)
+		// but normals, uv coords, names and the node hierarchy are released.
+		void ReleaseCPUData(bool keepCollisionData = false);
+
+		// Bytes of CPU side model data currently held
+		size_t GetCPUDataSize() const { return m_arena.BytesUsed(); }
+
 		// Retrieves the collection of materials loaded from the 3D model
 		const std::vector<Material>& GetMaterialVector() const { return m_materials; }
 
@@ -140,6 +164,9 @@ namespace Helpers
 		// Retrieve the dimensions of this model in local model coordinates
 		void GetLocalExtents(glm::vec3& minExtents, glm::vec3& maxExtents) const;
 
+		// Retrieve the box surrounding all mesh in local model coordinates
+		const AABB& GetBounds() const { return m_bounds; }
+
 		// Helper to output the main info. of this loaded model
 		std::string ToString(bool describeEachMesh = true) const {
 			std::string root = "File: " + m_filename + "\nNum mesh: " + std::to_string(m_meshVector.size()) +
@@ -0,0 +1,373 @@
+#include "MipGenerator.h"
+#include "ThreadPool.h"
+
+#include <xmmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+namespace Helpers
+{
+	// Rows handed to each job when filtering a level
+	static const int kRowsPerJob{ 16 };
+
+	// Kaiser filter taps for a 2x reduction, applied at source offsets -2 .. +3 from 2 * destination
+	static const int kKaiserTaps{ 6 };
+
+	// sRGB <-> linear lookups, encode is indexed by linear value * 4095
+	struct GammaTables
+	{
+		float decode[256];
+		BYTE encode[4096];
+		float kaiser[kKaiserTaps];
+
+		GammaTables()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				const float c{ i / 255.0f };
+				decode[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+
+			for (int i = 0; i < 4096; i++)
+			{
+				const float l{ i / 4095.0f };
+				const float c{ l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f };
+				encode[i] = (BYTE)std::clamp((int)(c * 255.0f + 0.5f), 0, 255);
+			}
+
+			// Zeroth order modified Bessel function, the series converges quickly for the alpha used
+			auto besselI0 = [](float x)
+			{
+				float sum{ 1.0f }, term{ 1.0f };
+				for (int k = 1; k < 20; k++)
+				{
+					term *= (x / (2.0f * k)) * (x / (2.0f * k));
+					sum += term;
+				}
+				return sum;
+			};
+
+			// Taps sit at -2.5 .. 2.5 source texels from the destination centre, so -1.25 .. 1.25 in destination texels
+			const float alpha{ 4.0f };
+			const float radius{ 1.5f };
+			float total{ 0 };
+			for (int i = 0; i < kKaiserTaps; i++)
+			{
+				const float t{ (i - 2.5f) * 0.5f };
+				const float x{ t * 3.14159265f };
+				const float sinc{ std::abs(x) < 1e-5f ? 1.0f : std::sin(x) / x };
+				const float r{ t / radius };
+				const float window{ besselI0(alpha * std::sqrt(std::max(0.0f, 1.0f - r * r))) / besselI0(alpha) };
+				kaiser[i] = sinc * window;
+				total += kaiser[i];
+			}
+
+			for (int i = 0; i < kKaiserTaps; i++)
+				kaiser[i] /= total;
+		}
+	};
+
+	static const GammaTables& Tables()
+	{
+		static const GammaTables tables;
+		return tables;
+	}
+
+	static inline int Address(int i, int size, bool wrap)
+	{
+		if (wrap)
+			return ((i % size) + size) % size;
+		return std::clamp(i, 0, size - 1);
+	}
+
+	// Reads texels of the top level, converting bytes to (linear) floats
+	struct ByteSource
+	{
+		const BYTE* pixels;
+		int width;
+		int height;
+		const float* decode;
+
+		__m128 Load(int x, int y) const
+		{
+			const BYTE* t{ pixels + ((size_t)y * width + x) * 4 };
+			return _mm_setr_ps(decode[t[0]], decode[t[1]], decode[t[2]], t[3] * (1.0f / 255.0f));
+		}
+	};
+
+	// Reads texels of a level already in linear floats
+	struct FloatSource
+	{
+		const float* pixels;
+		int width;
+		int height;
+
+		__m128 Load(int x, int y) const
+		{
+			return _mm_loadu_ps(pixels + ((size_t)y * width + x) * 4);
+		}
+	};
+
+	// Writes one filtered linear texel as bytes and optionally keeps the float for the next level
+	static inline void Store(__m128 linear, bool gammaCorrect, BYTE* outBytes, float* outFloats)
+	{
+		linear = _mm_min_ps(_mm_max_ps(linear, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+
+		if (outFloats)
+			_mm_storeu_ps(outFloats, linear);
+
+		alignas(16) float v[4];
+		_mm_store_ps(v, linear);
+
+		if (gammaCorrect)
+		{
+			const BYTE* encode{ Tables().encode };
+			outBytes[0] = encode[(int)(v[0] * 4095.0f + 0.5f)];
+			outBytes[1] = encode[(int)(v[1] * 4095.0f + 0.5f)];
+			outBytes[2] = encode[(int)(v[2] * 4095.0f + 0.5f)];
+		}
+		else
+		{
+			outBytes[0] = (BYTE)(v[0] * 255.0f + 0.5f);
+			outBytes[1] = (BYTE)(v[1] * 255.0f + 0.5f);
+			outBytes[2] = (BYTE)(v[2] * 255.0f + 0.5f);
+		}
+		outBytes[3] = (BYTE)(v[3] * 255.0f + 0.5f);
+	}
+
+	// Filters the destination rows [rowStart, rowEnd) of a level from source
+	template <typename Source>
+	static void FilterRows(const Source& source, int width, int rowStart, int rowEnd,
+		const MipSettings& settings, BYTE* outBytes, float* outFloats)
+	{
+		const float* kaiser{ Tables().kaiser };
+		const __m128 quarter{ _mm_set1_ps(0.25f) };
+
+		for (int y = rowStart; y < rowEnd; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				__m128 sum{ _mm_setzero_ps() };
+
+				if (settings.filter == MipFilter::Box)
+				{
+					const int x0{ Address(x * 2, source.width, settings.wrap) };
+					const int x1{ Address(x * 2 + 1, source.width, settings.wrap) };
+					const int y0{ Address(y * 2, source.height, settings.wrap) };
+					const int y1{ Address(y * 2 + 1, source.height, settings.wrap) };
+
+					sum = _mm_add_ps(_mm_add_ps(source.Load(x0, y0), source.Load(x1, y0)), _mm_add_ps(source.Load(x0, y1), source.Load(x1, y1)));
+					sum = _mm_mul_ps(sum, quarter);
+				}
+				else
+				{
+					for (int j = 0; j < kKaiserTaps; j++)
+					{
+						const int sy{ Address(y * 2 - 2 + j, source.height, settings.wrap) };
+
+						__m128 row{ _mm_setzero_ps() };
+						for (int i = 0; i < kKaiserTaps; i++)
+						{
+							const int sx{ Address(x * 2 - 2 + i, source.width, settings.wrap) };
+							row = _mm_add_ps(row, _mm_mul_ps(source.Load(sx, sy), _mm_set1_ps(kaiser[i])));
+						}
+
+						sum = _mm_add_ps(sum, _mm_mul_ps(row, _mm_set1_ps(kaiser[j])));
+					}
+				}
+
+				const size_t index{ (size_t)y * width + x };
+				Store(sum, settings.gammaCorrect, outBytes + index * 4, outFloats ? outFloats + index * 4 : nullptr);
+			}
+		}
+	}
+
+	// Filters a whole level, spreading the rows across the thread pool
+	template <typename Source>
+	static void FilterLevel(const Source& source, int width, int height, const MipSettings& settings, BYTE* outBytes, float* outFloats)
+	{
+		const size_t jobs{ (size_t)(height + kRowsPerJob - 1) / kRowsPerJob };
+
+		ThreadPool::Global().ParallelFor(jobs, [&](size_t job)
+		{
+			const int rowStart{ (int)job * kRowsPerJob };
+			const int rowEnd{ std::min(height, rowStart + kRowsPerJob) };
+			FilterRows(source, width, rowStart, rowEnd, settings, outBytes, outFloats);
+		});
+	}
+
+	// Number of levels a full chain down to 1x1 has
+	int MipChain::NumLevels(int width, int height)
+	{
+		int levels{ 1 };
+		while (width > 1 || height > 1)
+		{
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+			levels++;
+		}
+		return levels;
+	}
+
+	// Sets up the level table and sizes data for a full chain of a width x height texture
+	void MipChain::Allocate(int width, int height)
+	{
+		levels.resize(NumLevels(width, height));
+
+		size_t offset{ 0 };
+		for (Level& level : levels)
+		{
+			level.width = width;
+			level.height = height;
+			level.offset = offset;
+
+			offset += (size_t)width * (size_t)height * 4;
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+
+		data.resize(offset);
+	}
+
+	// Builds the full chain down to 1x1 from width x height RGBA8 pixels
+	void GenerateMipChain(const BYTE* pixels, int width, int height, const MipSettings& settings, MipChain& chain)
+	{
+		chain.Allocate(width, height);
+		memcpy(chain.data.data(), pixels, chain.LevelSize(0));
+
+		if (chain.levels.size() == 1)
+			return;
+
+		// Identity table when not gamma correcting
+		float linearDecode[256];
+		for (int i = 0; i < 256; i++)
+			linearDecode[i] = i / 255.0f;
+
+		// Each level is filtered from the linear floats of the one above to avoid compounding rounding
+		std::vector<float> previous;
+		std::vector<float> current;
+
+		for (size_t level = 1; level < chain.levels.size(); level++)
+		{
+			const MipChain::Level& dest{ chain.levels[level] };
+			BYTE* outBytes{ chain.data.data() + dest.offset };
+
+			// Floats are not needed for the last level
+			const bool keepFloats{ level + 1 < chain.levels.size() };
+			current.resize(keepFloats ? (size_t)dest.width * dest.height * 4 : 0);
+			float* outFloats{ keepFloats ? current.data() : nullptr };
+
+			if (level == 1)
+			{
+				const ByteSource source{ pixels, width, height, settings.gammaCorrect ? Tables().decode : linearDecode };
+				FilterLevel(source, dest.width, dest.height, settings, outBytes, outFloats);
+			}
+			else
+			{
+				const MipChain::Level& above{ chain.levels[level - 1] };
+				const FloatSource source{ previous.data(), above.width, above.height };
+				FilterLevel(source, dest.width, dest.height, settings, outBytes, outFloats);
+			}
+
+			std::swap(previous, current);
+		}
+	}
+
+	// Start of a mip cache file, followed by the data of every level
+	struct MipCacheHeader
+	{
+		char magic[4]{ 'M', 'I', 'P', 'C' };
+		uint32_t version{ 1 };
+		uint64_t sourceSize{ 0 };
+		int64_t sourceTime{ 0 };
+		uint32_t settings{ 0 };
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		uint32_t levelCount{ 0 };
+	};
+
+	static uint32_t SettingsStamp(const MipSettings& settings)
+	{
+		return (uint32_t)settings.filter | (settings.gammaCorrect ? 0x100u : 0u) | (settings.wrap ? 0x200u : 0u);
+	}
+
+	// Fills in the parts of the header that identify the source file, false if it does not exist
+	static bool StampSource(const std::string& sourceFilepath, MipCacheHeader& header)
+	{
+		std::error_code error;
+		header.sourceSize = fs::file_size(sourceFilepath, error);
+		if (error)
+			return false;
+
+		header.sourceTime = (int64_t)fs::last_write_time(sourceFilepath, error).time_since_epoch().count();
+		return !error;
+	}
+
+	// Writes chain to cacheFilepath stamped with the size and time of sourceFilepath
+	bool SaveMipChain(const std::string& cacheFilepath, const std::string& sourceFilepath, const MipSettings& settings, const MipChain& chain)
+	{
+		if (chain.levels.empty())
+			return false;
+
+		MipCacheHeader header;
+		if (!StampSource(sourceFilepath, header))
+			return false;
+
+		header.settings = SettingsStamp(settings);
+		header.width = (uint32_t)chain.levels[0].width;
+		header.height = (uint32_t)chain.levels[0].height;
+		header.levelCount = (uint32_t)chain.levels.size();
+
+		std::error_code error;
+		fs::create_directories(fs::path(cacheFilepath).parent_path(), error);
+
+		FILE* file{ nullptr };
+		if (fopen_s(&file, cacheFilepath.c_str(), "wb") != 0 || !file)
+			return false;
+
+		const bool ok{ fwrite(&header, sizeof(header), 1, file) == 1 &&
+			fwrite(chain.data.data(), 1, chain.data.size(), file) == chain.data.size() };
+
+		fclose(file);
+		return ok;
+	}
+
+	// Reads a chain written by SaveMipChain
+	bool LoadMipChain(const std::string& cacheFilepath, const std::string& sourceFilepath, const MipSettings& settings, MipChain& chain)
+	{
+		MipCacheHeader expected;
+		if (!StampSource(sourceFilepath, expected))
+			return false;
+
+		FILE* file{ nullptr };
+		if (fopen_s(&file, cacheFilepath.c_str(), "rb") != 0 || !file)
+			return false;
+
+		MipCacheHeader header;
+		bool ok{ fread(&header, sizeof(header), 1, file) == 1 };
+
+		ok = ok && memcmp(header.magic, expected.magic, 4) == 0 && header.version == expected.version &&
+			header.sourceSize == expected.sourceSize && header.sourceTime == expected.sourceTime &&
+			header.settings == SettingsStamp(settings);
+
+		if (ok)
+		{
+			chain.Allocate((int)header.width, (int)header.height);
+			ok = chain.levels.size() == header.levelCount &&
+				fread(chain.data.data(), 1, chain.data.size(), file) == chain.data.size();
+		}
+
+		fclose(file);
+
+		if (!ok)
+		{
+			chain.levels.clear();
+			chain.data.clear();
+		}
+
+		return ok;
+	}
+}
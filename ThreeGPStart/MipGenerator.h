@@ -0,0 +1,60 @@
+#pragma once
+// CPU generation of texture mip chains so the driver does not have to, plus caching them on disk
+
+#include "ExternalLibraryHeaders.h"
+
+namespace Helpers
+{
+	enum class MipFilter
+	{
+		// 2x2 average, fast but blurry and prone to aliasing
+		Box,
+
+		// 6x6 Kaiser windowed sinc, keeps detail sharper without ringing
+		Kaiser
+	};
+
+	struct MipSettings
+	{
+		MipFilter filter{ MipFilter::Kaiser };
+
+		// Filter in linear space, treating the colour channels as sRGB. Alpha is always linear.
+		bool gammaCorrect{ true };
+
+		// Filter taps past the edge wrap around (tiling textures) rather than clamp
+		bool wrap{ true };
+	};
+
+	// RGBA8 data for every level of a texture, largest first, stored back to back
+	struct MipChain
+	{
+		struct Level
+		{
+			int width{ 0 };
+			int height{ 0 };
+			size_t offset{ 0 };
+		};
+
+		std::vector<Level> levels;
+		std::vector<BYTE> data;
+
+		const BYTE* LevelData(size_t level) const { return data.data() + levels[level].offset; }
+		size_t LevelSize(size_t level) const { return (size_t)levels[level].width * (size_t)levels[level].height * 4; }
+
+		// Number of levels a full chain down to 1x1 has
+		static int NumLevels(int width, int height);
+
+		// Sets up the level table and sizes data for a full chain of a width x height texture
+		void Allocate(int width, int height);
+	};
+
+	// Builds the full chain down to 1x1 from width x height RGBA8 pixels.
+	// Each level is filtered from the one above with SSE, rows are spread across the thread pool.
+	void GenerateMipChain(const BYTE* pixels, int width, int height, const MipSettings& settings, MipChain& chain);
+
+	// Writes chain to cacheFilepath stamped with the size and time of sourceFilepath. Returns false on error.
+	bool SaveMipChain(const std::string& cacheFilepath, const std::string& sourceFilepath, const MipSettings& settings, const MipChain& chain);
+
+	// Reads a chain written by SaveMipChain. Returns false if missing, or stale compared to sourceFilepath / settings.
+	bool LoadMipChain(const std::string& cacheFilepath, const std::string& sourceFilepath, const MipSettings& settings, MipChain& chain);
+}
@@ -0,0 +1,470 @@
+#include "OcclusionBuffer.h"
+#include "ThreadPool.h"
+
+#include <xmmintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Helpers
+{
+	// Occluders are clipped at this w rather than the camera's near plane, keeping screen positions small enough for
+	// float edge values. Losing the sliver of occluder nearer than this only makes the buffer hide less.
+	static const float kClipW{ 1.0f };
+
+	// Boxes tested before the test is spread over the pool
+	static const size_t kThreadedTestMinimum{ 256 };
+
+	// Whether the CPU and OS support AVX2
+	static bool CpuHasAVX2()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+
+		// AVX and the OS saving the upper halves of the registers
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+			return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+
+	void RasterizeTrianglesSSE(const RasterTriangle* triangles, size_t count, float* depth, int width, int yBegin, int yEnd)
+	{
+		const __m128 laneOffsets{ _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f) };
+		const __m128 zero{ _mm_setzero_ps() };
+
+		for (size_t t = 0; t < count; t++)
+		{
+			const RasterTriangle& tri{ triangles[t] };
+			const int rowBegin{ std::max(tri.minY, yBegin) };
+			const int rowEnd{ std::min(tri.maxY + 1, yEnd) };
+
+			const __m128 a0{ _mm_set1_ps(tri.edgeA[0]) }, a1{ _mm_set1_ps(tri.edgeA[1]) }, a2{ _mm_set1_ps(tri.edgeA[2]) };
+			const __m128 za{ _mm_set1_ps(tri.zA) };
+
+			for (int y = rowBegin; y < rowEnd; y++)
+			{
+				const float py{ y + 0.5f };
+
+				// Everything that only depends on the row
+				const __m128 r0{ _mm_set1_ps(tri.edgeB[0] * py + tri.edgeC[0]) };
+				const __m128 r1{ _mm_set1_ps(tri.edgeB[1] * py + tri.edgeC[1]) };
+				const __m128 r2{ _mm_set1_ps(tri.edgeB[2] * py + tri.edgeC[2]) };
+				const __m128 rz{ _mm_set1_ps(tri.zB * py + tri.zC) };
+
+				float* row{ depth + (size_t)y * width };
+				for (int x = tri.minX; x <= tri.maxX; x += 4)
+				{
+					const __m128 px{ _mm_add_ps(_mm_set1_ps((float)x), laneOffsets) };
+
+					const __m128 e0{ _mm_add_ps(_mm_mul_ps(a0, px), r0) };
+					const __m128 e1{ _mm_add_ps(_mm_mul_ps(a1, px), r1) };
+					const __m128 e2{ _mm_add_ps(_mm_mul_ps(a2, px), r2) };
+					const __m128 inside{ _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero)) };
+					if (_mm_movemask_ps(inside) == 0)
+						continue;
+
+					const __m128 z{ _mm_add_ps(_mm_mul_ps(za, px), rz) };
+					const __m128 old{ _mm_loadu_ps(row + x) };
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, _mm_max_ps(old, z)), _mm_andnot_ps(inside, old)));
+				}
+			}
+		}
+	}
+
+	bool AnyPixelBehindSSE(const float* depth, int width, int x0, int x1, int y0, int y1, float nearest)
+	{
+		const __m128 laneOffsets{ _mm_setr_ps(0, 1, 2, 3) };
+		const __m128 first{ _mm_set1_ps((float)x0) };
+		const __m128 last{ _mm_set1_ps((float)x1) };
+		const __m128 limit{ _mm_set1_ps(nearest) };
+		const int start{ x0 & ~3 };
+
+		for (int y = y0; y <= y1; y++)
+		{
+			const float* row{ depth + (size_t)y * width };
+			for (int x = start; x <= x1; x += 4)
+			{
+				const __m128 px{ _mm_add_ps(_mm_set1_ps((float)x), laneOffsets) };
+				const __m128 inRect{ _mm_and_ps(_mm_cmpge_ps(px, first), _mm_cmple_ps(px, last)) };
+				if (_mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), limit), inRect)) != 0)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	OcclusionBuffer::OcclusionBuffer() : m_hasAVX2{ CpuHasAVX2() }
+	{
+		Resize(320, 192);
+	}
+
+	// Sizes are rounded up to whole tiles
+	void OcclusionBuffer::Resize(int width, int height)
+	{
+		m_tilesX = std::max((width + kTileSize - 1) / kTileSize, 1);
+		m_tilesY = std::max((height + kTileSize - 1) / kTileSize, 1);
+		m_width = m_tilesX * kTileSize;
+		m_height = m_tilesY * kTileSize;
+		m_depth.assign((size_t)m_width * m_height, 0.0f);
+		m_tileDepth.assign((size_t)m_tilesX * m_tilesY, 0.0f);
+	}
+
+	// Clears the buffer for a new frame seen through viewProjection
+	void OcclusionBuffer::Begin(const glm::mat4& viewProjection)
+	{
+		m_viewProjection = viewProjection;
+		m_triangles.clear();
+		m_stats.trianglesClipped = 0;
+		m_stats.avx2 = UsingAVX2();
+	}
+
+	// Sets up a screen space triangle from clip space corners in front of the camera
+	void OcclusionBuffer::AddTriangle(const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2)
+	{
+		const glm::vec4* corners[3]{ &c0, &c1, &c2 };
+
+		// Screen position and 1 / w of each corner, y up like the depth rows
+		glm::vec2 p[3];
+		float z[3];
+		for (int i = 0; i < 3; i++)
+		{
+			z[i] = 1.0f / corners[i]->w;
+			p[i].x = (corners[i]->x * z[i] * 0.5f + 0.5f) * m_width;
+			p[i].y = (corners[i]->y * z[i] * 0.5f + 0.5f) * m_height;
+		}
+
+		const glm::vec2 low{ glm::min(glm::min(p[0], p[1]), p[2]) };
+		const glm::vec2 high{ glm::max(glm::max(p[0], p[1]), p[2]) };
+
+		// Pixels whose centres could be inside, clamped to the screen
+		RasterTriangle tri;
+		tri.minX = std::max((int)std::ceil(low.x - 0.5f), 0);
+		tri.maxX = std::min((int)std::floor(high.x - 0.5f), m_width - 1);
+		tri.minY = std::max((int)std::ceil(low.y - 0.5f), 0);
+		tri.maxY = std::min((int)std::floor(high.y - 0.5f), m_height - 1);
+		if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+			return;
+		tri.minX &= ~7;
+
+		// Edge i is opposite corner i, so edge i over the area is corner i's barycentric weight
+		double a[3], b[3], c[3];
+		for (int i = 0; i < 3; i++)
+		{
+			const glm::vec2& from{ p[(i + 1) % 3] };
+			const glm::vec2& to{ p[(i + 2) % 3] };
+			a[i] = (double)from.y - to.y;
+			b[i] = (double)to.x - from.x;
+			c[i] = (double)from.x * to.y - (double)from.y * to.x;
+		}
+
+		double area{ a[0] * p[0].x + b[0] * p[0].y + c[0] };
+		if (std::fabs(area) < 1e-6)
+			return;
+
+		// Either winding is drawn, a back face still hides what is behind it
+		const double sign{ area < 0 ? -1.0 : 1.0 };
+		area *= sign;
+
+		double za{ 0 }, zb{ 0 }, zc{ 0 };
+		for (int i = 0; i < 3; i++)
+		{
+			tri.edgeA[i] = (float)(a[i] * sign);
+			tri.edgeB[i] = (float)(b[i] * sign);
+			tri.edgeC[i] = (float)(c[i] * sign);
+			za += a[i] * sign * z[i];
+			zb += b[i] * sign * z[i];
+			zc += c[i] * sign * z[i];
+		}
+		tri.zA = (float)(za / area);
+		tri.zB = (float)(zb / area);
+		tri.zC = (float)(zc / area);
+
+		m_triangles.push_back(tri);
+	}
+
+	// Queues an occluder placed in the world by transform
+	void OcclusionBuffer::AddOccluder(const OccluderMesh& mesh, const glm::mat4& transform)
+	{
+		const glm::mat4 toClip{ m_viewProjection * transform };
+
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			const glm::vec4 corners[3]{
+				toClip * glm::vec4(mesh.positions[mesh.indices[i]], 1.0f),
+				toClip * glm::vec4(mesh.positions[mesh.indices[i + 1]], 1.0f),
+				toClip * glm::vec4(mesh.positions[mesh.indices[i + 2]], 1.0f) };
+
+			const int inFront{ (corners[0].w >= kClipW) + (corners[1].w >= kClipW) + (corners[2].w >= kClipW) };
+			if (inFront == 3)
+			{
+				AddTriangle(corners[0], corners[1], corners[2]);
+				continue;
+			}
+			if (inFront == 0)
+				continue;
+
+			// Cut at w = kClipW, leaving a triangle or a quad split in two
+			glm::vec4 polygon[4];
+			int count{ 0 };
+			for (int e = 0; e < 3; e++)
+			{
+				const glm::vec4& from{ corners[e] };
+				const glm::vec4& to{ corners[(e + 1) % 3] };
+				if (from.w >= kClipW)
+					polygon[count++] = from;
+				if ((from.w >= kClipW) != (to.w >= kClipW))
+					polygon[count++] = glm::mix(from, to, (kClipW - from.w) / (to.w - from.w));
+			}
+
+			AddTriangle(polygon[0], polygon[1], polygon[2]);
+			if (count == 4)
+				AddTriangle(polygon[0], polygon[2], polygon[3]);
+			m_stats.trianglesClipped++;
+		}
+	}
+
+	// Rasterizes the triangles into rows [yBegin, yEnd), a whole number of tile rows, and updates their tiles
+	void OcclusionBuffer::RasterizeBand(int yBegin, int yEnd)
+	{
+		std::fill(m_depth.begin() + (size_t)yBegin * m_width, m_depth.begin() + (size_t)yEnd * m_width, 0.0f);
+
+		if (UsingAVX2())
+			RasterizeTrianglesAVX2(m_triangles.data(), m_triangles.size(), m_depth.data(), m_width, yBegin, yEnd);
+		else
+			RasterizeTrianglesSSE(m_triangles.data(), m_triangles.size(), m_depth.data(), m_width, yBegin, yEnd);
+
+		// Farthest pixel of each tile, four columns at a time
+		for (int ty = yBegin / kTileSize; ty < yEnd / kTileSize; ty++)
+		{
+			for (int tx = 0; tx < m_tilesX; tx++)
+			{
+				__m128 farthest{ _mm_set1_ps(FLT_MAX) };
+				for (int y = ty * kTileSize; y < (ty + 1) * kTileSize; y++)
+				{
+					const float* row{ m_depth.data() + (size_t)y * m_width + (size_t)tx * kTileSize };
+					farthest = _mm_min_ps(farthest, _mm_min_ps(_mm_loadu_ps(row), _mm_loadu_ps(row + 4)));
+				}
+				farthest = _mm_min_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+				farthest = _mm_min_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+				m_tileDepth[(size_t)ty * m_tilesX + tx] = _mm_cvtss_f32(farthest);
+			}
+		}
+	}
+
+	// Draws the queued occluders
+	void OcclusionBuffer::Rasterize(bool threaded)
+	{
+		const auto start{ std::chrono::steady_clock::now() };
+		m_stats.triangles = m_triangles.size();
+
+		// Bands of whole tile rows, a few per thread to even out hills and sky
+		const int bands{ threaded ? std::min(m_tilesY, (int)(ThreadPool::Global().NumThreads() + 1) * 2) : 1 };
+		const int tileRowsPerBand{ (m_tilesY + bands - 1) / bands };
+
+		auto band = [this, tileRowsPerBand](size_t b)
+		{
+			const int yBegin{ (int)b * tileRowsPerBand * kTileSize };
+			const int yEnd{ std::min(yBegin + tileRowsPerBand * kTileSize, m_height) };
+			if (yBegin < yEnd)
+				RasterizeBand(yBegin, yEnd);
+		};
+
+		if (bands > 1)
+			ThreadPool::Global().ParallelFor((size_t)bands, band);
+		else
+			band(0);
+
+		m_stats.rasterMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// True when box is wholly behind occluders
+	bool OcclusionBuffer::IsOccluded(const AABB& box) const
+	{
+		if (box.IsEmpty())
+			return false;
+
+		// Screen rectangle and nearest 1 / w of the corners, anything reaching the clip plane is taken as seen
+		glm::vec2 low{ FLT_MAX };
+		glm::vec2 high{ -FLT_MAX };
+		float nearest{ 0 };
+
+		// Corners as the transformed minimum plus transformed edges, three matrix columns rather than eight products
+		const glm::vec3 size{ box.maxExtents - box.minExtents };
+		const glm::vec4 origin{ m_viewProjection * glm::vec4(box.minExtents, 1.0f) };
+		const glm::vec4 edgeX{ m_viewProjection[0] * size.x };
+		const glm::vec4 edgeY{ m_viewProjection[1] * size.y };
+		const glm::vec4 edgeZ{ m_viewProjection[2] * size.z };
+		for (int i = 0; i < 8; i++)
+		{
+			const glm::vec4 clip{ origin + (i & 1 ? edgeX : glm::vec4(0)) + (i & 2 ? edgeY : glm::vec4(0)) + (i & 4 ? edgeZ : glm::vec4(0)) };
+			if (clip.w < kClipW)
+				return false;
+
+			const float z{ 1.0f / clip.w };
+			const glm::vec2 screen{ (clip.x * z * 0.5f + 0.5f) * m_width, (clip.y * z * 0.5f + 0.5f) * m_height };
+			low = glm::min(low, screen);
+			high = glm::max(high, screen);
+			nearest = std::max(nearest, z);
+		}
+
+		// Every pixel the rectangle touches
+		const int x0{ std::max((int)std::floor(low.x), 0) };
+		const int x1{ std::min((int)std::floor(high.x), m_width - 1) };
+		const int y0{ std::max((int)std::floor(low.y), 0) };
+		const int y1{ std::min((int)std::floor(high.y), m_height - 1) };
+		if (x0 > x1 || y0 > y1)
+			return false;
+
+		// Tiles whose farthest pixel is nearer than the box hide their part of it, others are checked per pixel
+		const bool avx2{ UsingAVX2() };
+		for (int ty = y0 / kTileSize; ty <= y1 / kTileSize; ty++)
+		{
+			for (int tx = x0 / kTileSize; tx <= x1 / kTileSize; tx++)
+			{
+				if (m_tileDepth[(size_t)ty * m_tilesX + tx] > nearest)
+					continue;
+
+				const int px0{ std::max(x0, tx * kTileSize) }, px1{ std::min(x1, tx * kTileSize + kTileSize - 1) };
+				const int py0{ std::max(y0, ty * kTileSize) }, py1{ std::min(y1, ty * kTileSize + kTileSize - 1) };
+				const bool behind{ avx2 ? AnyPixelBehindAVX2(m_depth.data(), m_width, px0, px1, py0, py1, nearest) :
+					AnyPixelBehindSSE(m_depth.data(), m_width, px0, px1, py0, py1, nearest) };
+				if (behind)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	// Clears visible[i] for every box that is occluded, only testing those still visible
+	void OcclusionBuffer::Cull(const std::vector<AABB>& boxes, std::vector<bool>& visible, bool threaded)
+	{
+		const auto start{ std::chrono::steady_clock::now() };
+
+		// Bytes rather than bits so threads can write their own entries
+		m_results.assign(boxes.size(), 0);
+		auto test = [&](size_t i)
+		{
+			if (visible[i] && IsOccluded(boxes[i]))
+				m_results[i] = 1;
+		};
+
+		if (threaded && boxes.size() >= kThreadedTestMinimum)
+		{
+			const size_t chunk{ kThreadedTestMinimum / 4 };
+			ThreadPool::Global().ParallelFor((boxes.size() + chunk - 1) / chunk, [&](size_t c)
+			{
+				for (size_t i = c * chunk; i < std::min((c + 1) * chunk, boxes.size()); i++)
+					test(i);
+			});
+		}
+		else
+		{
+			for (size_t i = 0; i < boxes.size(); i++)
+				test(i);
+		}
+
+		m_stats.tested = 0;
+		m_stats.occluded = 0;
+		for (size_t i = 0; i < boxes.size(); i++)
+		{
+			m_stats.tested += visible[i] ? 1 : 0;
+			if (m_results[i])
+			{
+				visible[i] = false;
+				m_stats.occluded++;
+			}
+		}
+
+		m_stats.testMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Times rasterizing and testing a generated scene with SSE and AVX2, single and multi threaded, as text
+	std::string BenchmarkOcclusionCulling()
+	{
+		// A wall of ridged ground in front of the camera and boxes scattered behind and in front of it
+		OccluderMesh ground;
+		const int cells{ 64 };
+		for (int z = 0; z <= cells; z++)
+		{
+			for (int x = 0; x <= cells; x++)
+				ground.positions.push_back(glm::vec3(x * 16.0f - 512.0f, 40.0f + 30.0f * std::sin(x * 0.4f) * std::cos(z * 0.3f), -z * 16.0f));
+		}
+		for (int z = 0; z < cells; z++)
+		{
+			for (int x = 0; x < cells; x++)
+			{
+				const uint32_t i{ (uint32_t)(z * (cells + 1) + x) };
+				ground.indices.insert(ground.indices.end(), { i, i + 1, i + cells + 1, i + 1, i + cells + 2, i + cells + 1 });
+			}
+		}
+
+		std::mt19937 random{ 7 };
+		std::uniform_real_distribution<float> across(-800.0f, 800.0f);
+		std::uniform_real_distribution<float> along(-1500.0f, -50.0f);
+		std::vector<AABB> boxes(20000);
+		for (AABB& box : boxes)
+		{
+			box.minExtents = glm::vec3(across(random), 0.0f, along(random));
+			box.maxExtents = box.minExtents + glm::vec3(8.0f);
+		}
+
+		const glm::mat4 viewProjection{ glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 4000.0f) *
+			glm::lookAt(glm::vec3(0, 30, 0), glm::vec3(0, 30, -1), glm::vec3(0, 1, 0)) };
+
+		OcclusionBuffer buffer;
+		std::ostringstream report;
+		report << std::fixed << std::setprecision(3);
+		report << ground.indices.size() / 3 << " occluder triangles at " << buffer.Width() << "x" << buffer.Height() << ", "
+			<< boxes.size() << " boxes\n";
+
+		for (bool avx2 : { false, true })
+		{
+			if (avx2 && !buffer.HasAVX2())
+			{
+				report << "AVX2: not supported by this CPU\n";
+				continue;
+			}
+
+			buffer.SetUseAVX2(avx2);
+			for (bool threaded : { false, true })
+			{
+				// Best of a few runs
+				float raster{ FLT_MAX }, test{ FLT_MAX };
+				size_t occluded{ 0 };
+				for (int run = 0; run < 5; run++)
+				{
+					buffer.Begin(viewProjection);
+					buffer.AddOccluder(ground, glm::mat4(1));
+					buffer.Rasterize(threaded);
+
+					std::vector<bool> visible(boxes.size(), true);
+					buffer.Cull(boxes, visible, threaded);
+
+					raster = std::min(raster, buffer.GetStats().rasterMilliseconds);
+					test = std::min(test, buffer.GetStats().testMilliseconds);
+					occluded = buffer.GetStats().occluded;
+				}
+
+				report << (avx2 ? "AVX2" : "SSE") << (threaded ? " threaded" : "") << ": raster " << raster << " ms, test " << test
+					<< " ms, " << occluded << " occluded\n";
+			}
+		}
+		return report.str();
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+// Low resolution depth buffer rasterized on the CPU from a few occluders, to skip objects hidden behind them
+
+#include "ExternalLibraryHeaders.h"
+#include "Bounds.h"
+#include "OcclusionRaster.h"
+
+namespace Helpers
+{
+	// Triangles standing in for something that hides what is behind it. They must lie inside what they stand for,
+	// so anything they hide really is hidden.
+	struct OccluderMesh
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+	};
+
+	// Occluder triangles are set up on the calling thread, clipped against a plane just in front of the camera, then
+	// rasterized in bands of tile rows on the thread pool, each band only touching its own rows. Every pixel keeps
+	// the nearest 1 / w written to it and every 8x8 tile the farthest of its pixels. An object is hidden when its
+	// screen rectangle only covers tiles, or failing that pixels, nearer than the nearest corner of its box. The
+	// inner loops run 8 pixels at a time with AVX2 where the CPU has it and 4 at a time with SSE otherwise. Nothing
+	// is read back from the GPU so this works the same headless.
+	class OcclusionBuffer
+	{
+	public:
+		static const int kTileSize{ 8 };
+
+		struct Stats
+		{
+			// Last Rasterize
+			size_t triangles{ 0 };
+			size_t trianglesClipped{ 0 };
+			float rasterMilliseconds{ 0 };
+
+			// Last Cull
+			size_t tested{ 0 };
+			size_t occluded{ 0 };
+			float testMilliseconds{ 0 };
+
+			bool avx2{ false };
+		};
+	private:
+		int m_width{ 0 };
+		int m_height{ 0 };
+		int m_tilesX{ 0 };
+		int m_tilesY{ 0 };
+
+		// Nearest 1 / w of each pixel, 0 where nothing was drawn
+		std::vector<float> m_depth;
+
+		// Farthest pixel of each tile
+		std::vector<float> m_tileDepth;
+
+		glm::mat4 m_viewProjection{ 1 };
+		std::vector<RasterTriangle> m_triangles;
+
+		bool m_hasAVX2{ false };
+		bool m_useAVX2{ true };
+
+		// Filled in by Cull, one per box
+		std::vector<uint8_t> m_results;
+
+		Stats m_stats;
+
+		// Sets up a screen space triangle from clip space corners in front of the camera
+		void AddTriangle(const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2);
+
+		// Rasterizes the triangles into rows [yBegin, yEnd), a whole number of tile rows, and updates their tiles
+		void RasterizeBand(int yBegin, int yEnd);
+	public:
+		OcclusionBuffer();
+
+		// Sizes are rounded up to whole tiles
+		void Resize(int width, int height);
+
+		// Clears the buffer for a new frame seen through viewProjection
+		void Begin(const glm::mat4& viewProjection);
+
+		// Queues an occluder placed in the world by transform
+		void AddOccluder(const OccluderMesh& mesh, const glm::mat4& transform);
+
+		// Draws the queued occluders
+		void Rasterize(bool threaded = true);
+
+		// True when box is wholly behind occluders. Safe from any thread once Rasterize has returned.
+		bool IsOccluded(const AABB& box) const;
+
+		// Clears visible[i] for every box that is occluded, only testing those still visible
+		void Cull(const std::vector<AABB>& boxes, std::vector<bool>& visible, bool threaded = true);
+
+		// AVX2 is only used when the CPU has it, turning it off compares against the SSE loops
+		void SetUseAVX2(bool use) { m_useAVX2 = use; }
+		bool HasAVX2() const { return m_hasAVX2; }
+		bool UsingAVX2() const { return m_hasAVX2 && m_useAVX2; }
+
+		int Width() const { return m_width; }
+		int Height() const { return m_height; }
+
+		// Nearest 1 / w per pixel, rows bottom up
+		const std::vector<float>& Depth() const { return m_depth; }
+
+		const Stats& GetStats() const { return m_stats; }
+	};
+
+	// Times rasterizing and testing a generated scene with SSE and AVX2, single and multi threaded, as text
+	std::string BenchmarkOcclusionCulling();
+}
@@ -0,0 +1,42 @@
+#pragma once
+// Inner loops of the occlusion buffer, an SSE version every x64 CPU runs and an AVX2 one picked when the CPU has it
+
+#include "ExternalLibraryHeaders.h"
+
+// MSVC compiles AVX2 intrinsics in any file, GCC and Clang need the functions using them marked
+#if defined(__GNUC__)
+#define OCCLUSION_AVX2 __attribute__((target("avx2")))
+#else
+#define OCCLUSION_AVX2
+#endif
+
+namespace Helpers
+{
+	// A screen space triangle set up for rasterizing. A pixel centre (x, y) is inside when every edge value
+	// edgeA[i] * x + edgeB[i] * y + edgeC[i] is at least zero, and its depth there is zA * x + zB * y + zC.
+	// Depth is 1 / w so larger is nearer and it interpolates linearly across the screen.
+	struct RasterTriangle
+	{
+		float edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+		float zA;
+		float zB;
+		float zC;
+
+		// Pixels the triangle may cover, inclusive. minX is a multiple of 8.
+		int minX;
+		int maxX;
+		int minY;
+		int maxY;
+	};
+
+	// Writes each triangle's depth into rows [yBegin, yEnd) of depth where it is nearer than what is there.
+	// width is a multiple of 8.
+	void RasterizeTrianglesSSE(const RasterTriangle* triangles, size_t count, float* depth, int width, int yBegin, int yEnd);
+	void RasterizeTrianglesAVX2(const RasterTriangle* triangles, size_t count, float* depth, int width, int yBegin, int yEnd);
+
+	// True if any pixel in the inclusive rectangle is no nearer than nearest, so something there could be seen
+	bool AnyPixelBehindSSE(const float* depth, int width, int x0, int x1, int y0, int y1, float nearest);
+	bool AnyPixelBehindAVX2(const float* depth, int width, int x0, int x1, int y0, int y1, float nearest);
+}
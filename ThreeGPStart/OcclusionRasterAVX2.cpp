@@ -0,0 +1,76 @@
+#include "OcclusionRaster.h"
+
+#include <immintrin.h>
+#include <algorithm>
+
+namespace Helpers
+{
+	// Only called once OcclusionBuffer has checked the CPU has AVX2
+	OCCLUSION_AVX2 void RasterizeTrianglesAVX2(const RasterTriangle* triangles, size_t count, float* depth, int width, int yBegin, int yEnd)
+	{
+		const __m256 laneOffsets{ _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f) };
+		const __m256 zero{ _mm256_setzero_ps() };
+
+		for (size_t t = 0; t < count; t++)
+		{
+			const RasterTriangle& tri{ triangles[t] };
+			const int rowBegin{ std::max(tri.minY, yBegin) };
+			const int rowEnd{ std::min(tri.maxY + 1, yEnd) };
+
+			const __m256 a0{ _mm256_set1_ps(tri.edgeA[0]) }, a1{ _mm256_set1_ps(tri.edgeA[1]) }, a2{ _mm256_set1_ps(tri.edgeA[2]) };
+			const __m256 za{ _mm256_set1_ps(tri.zA) };
+
+			for (int y = rowBegin; y < rowEnd; y++)
+			{
+				const float py{ y + 0.5f };
+
+				// Everything that only depends on the row
+				const __m256 r0{ _mm256_set1_ps(tri.edgeB[0] * py + tri.edgeC[0]) };
+				const __m256 r1{ _mm256_set1_ps(tri.edgeB[1] * py + tri.edgeC[1]) };
+				const __m256 r2{ _mm256_set1_ps(tri.edgeB[2] * py + tri.edgeC[2]) };
+				const __m256 rz{ _mm256_set1_ps(tri.zB * py + tri.zC) };
+
+				float* row{ depth + (size_t)y * width };
+				for (int x = tri.minX; x <= tri.maxX; x += 8)
+				{
+					const __m256 px{ _mm256_add_ps(_mm256_set1_ps((float)x), laneOffsets) };
+
+					const __m256 e0{ _mm256_add_ps(_mm256_mul_ps(a0, px), r0) };
+					const __m256 e1{ _mm256_add_ps(_mm256_mul_ps(a1, px), r1) };
+					const __m256 e2{ _mm256_add_ps(_mm256_mul_ps(a2, px), r2) };
+					const __m256 inside{ _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+						_mm256_cmp_ps(e2, zero, _CMP_GE_OQ)) };
+					if (_mm256_testz_ps(inside, inside))
+						continue;
+
+					const __m256 z{ _mm256_add_ps(_mm256_mul_ps(za, px), rz) };
+					const __m256 old{ _mm256_loadu_ps(row + x) };
+					_mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_max_ps(old, z), inside));
+				}
+			}
+		}
+	}
+
+	OCCLUSION_AVX2 bool AnyPixelBehindAVX2(const float* depth, int width, int x0, int x1, int y0, int y1, float nearest)
+	{
+		const __m256 laneOffsets{ _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7) };
+		const __m256 first{ _mm256_set1_ps((float)x0) };
+		const __m256 last{ _mm256_set1_ps((float)x1) };
+		const __m256 limit{ _mm256_set1_ps(nearest) };
+		const int start{ x0 & ~7 };
+
+		for (int y = y0; y <= y1; y++)
+		{
+			const float* row{ depth + (size_t)y * width };
+			for (int x = start; x <= x1; x += 8)
+			{
+				const __m256 px{ _mm256_add_ps(_mm256_set1_ps((float)x), laneOffsets) };
+				const __m256 inRect{ _mm256_and_ps(_mm256_cmp_ps(px, first, _CMP_GE_OQ), _mm256_cmp_ps(px, last, _CMP_LE_OQ)) };
+				const __m256 behind{ _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(row + x), limit, _CMP_LE_OQ), inRect) };
+				if (!_mm256_testz_ps(behind, behind))
+					return true;
+			}
+		}
+		return false;
+	}
+}
@@ -0,0 +1,139 @@
+#include "OverdrawCounter.h"
+
+namespace Helpers
+{
+	void OverdrawCounter::Destroy()
+	{
+		for (Frame& frame : m_frames)
+		{
+			glDeleteQueries(kMaxPasses, frame.queries);
+			frame = Frame();
+		}
+		m_activePass = -1;
+	}
+
+	// Counting costs a query per pass, off until enabled
+	void OverdrawCounter::SetEnabled(bool enabled)
+	{
+		if (enabled == m_enabled)
+			return;
+
+		m_enabled = enabled;
+		if (!enabled)
+			Destroy();
+
+		for (int pass = 0; pass < kMaxPasses; pass++)
+		{
+			m_perPixel[pass] = 0;
+			m_measured[pass] = false;
+		}
+		m_framesMeasured = 0;
+	}
+
+	// Starts a frame of pixels fragments
+	void OverdrawCounter::BeginFrame(int pixels)
+	{
+		if (!m_enabled)
+			return;
+
+		Collect();
+
+		// Still waiting on the GPU for this slot's last frame, so this frame goes unmeasured
+		Frame& frame{ m_frames[m_current] };
+		if (frame.pending)
+			return;
+
+		if (frame.queries[0] == 0)
+			glGenQueries(kMaxPasses, frame.queries);
+
+		for (bool& used : frame.used)
+			used = false;
+		frame.pixels = std::max(pixels, 1);
+	}
+
+	// Counts what is drawn until EndPass as pass
+	void OverdrawCounter::BeginPass(int pass)
+	{
+		Frame& frame{ m_frames[m_current] };
+		if (!m_enabled || frame.pending || m_activePass >= 0 || pass < 0 || pass >= kMaxPasses || frame.queries[0] == 0)
+			return;
+
+		glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS, frame.queries[pass]);
+		frame.used[pass] = true;
+		m_activePass = pass;
+	}
+
+	void OverdrawCounter::EndPass()
+	{
+		if (m_activePass < 0)
+			return;
+
+		glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS);
+		m_activePass = -1;
+	}
+
+	void OverdrawCounter::EndFrame()
+	{
+		if (!m_enabled)
+			return;
+
+		EndPass();
+
+		Frame& frame{ m_frames[m_current] };
+		if (!frame.pending && frame.queries[0] != 0)
+		{
+			frame.pending = true;
+			m_current = (m_current + 1) % kFramesInFlight;
+		}
+	}
+
+	// Reads every pending frame whose queries have all finished
+	void OverdrawCounter::Collect()
+	{
+		// m_current is the slot written longest ago, so going on from it reads oldest first and the latest result wins
+		for (int i = 0; i < kFramesInFlight; i++)
+		{
+			Frame& frame{ m_frames[(m_current + i) % kFramesInFlight] };
+			if (!frame.pending)
+				continue;
+
+			bool ready{ true };
+			for (int pass = 0; pass < kMaxPasses && ready; pass++)
+			{
+				if (!frame.used[pass])
+					continue;
+
+				GLuint available{ 0 };
+				glGetQueryObjectuiv(frame.queries[pass], GL_QUERY_RESULT_AVAILABLE, &available);
+				ready = available != 0;
+			}
+			// Newer frames finish after this one, reading them now would let this one overwrite them later
+			if (!ready)
+				break;
+
+			for (int pass = 0; pass < kMaxPasses; pass++)
+			{
+				m_measured[pass] = frame.used[pass];
+				m_perPixel[pass] = 0;
+				if (frame.used[pass])
+				{
+					GLuint64 invocations{ 0 };
+					glGetQueryObjectui64v(frame.queries[pass], GL_QUERY_RESULT, &invocations);
+					m_perPixel[pass] = (float)((double)invocations / frame.pixels);
+				}
+			}
+
+			frame.pending = false;
+			m_framesMeasured++;
+		}
+	}
+
+	// Sum over every pass
+	float OverdrawCounter::TotalPerPixel() const
+	{
+		float total{ 0 };
+		for (int pass = 0; pass < kMaxPasses; pass++)
+			total += m_perPixel[pass];
+		return total;
+	}
+}
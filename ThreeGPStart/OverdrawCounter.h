@@ -0,0 +1,69 @@
+#pragma once
+// Fragment shader invocations per pixel of each render pass, counted by the GPU without stalling the CPU
+
+#include "ExternalLibraryHeaders.h"
+
+namespace Helpers
+{
+	// Each pass is wrapped in a GL_FRAGMENT_SHADER_INVOCATIONS query. Queries are kept for a few frames and read once
+	// the GPU has the answer, so results lag the frame they measure by a frame or two. A pixel shaded once by each of
+	// two passes counts as 2, so the total over every pass is the average overdraw. GL thread only.
+	class OverdrawCounter
+	{
+	public:
+		static const int kMaxPasses{ 4 };
+		static const int kFramesInFlight{ 4 };
+	private:
+		struct Frame
+		{
+			GLuint queries[kMaxPasses]{};
+			bool used[kMaxPasses]{};
+			double pixels{ 0 };
+			bool pending{ false };
+		};
+
+		Frame m_frames[kFramesInFlight];
+		int m_current{ 0 };
+		int m_activePass{ -1 };
+		bool m_enabled{ false };
+
+		// Latest result of each pass, fragments per pixel, and whether that pass ran in that frame
+		float m_perPixel[kMaxPasses]{};
+		bool m_measured[kMaxPasses]{};
+		size_t m_framesMeasured{ 0 };
+
+		// Reads every pending frame whose queries have all finished
+		void Collect();
+	public:
+		OverdrawCounter() = default;
+		~OverdrawCounter() { Destroy(); }
+
+		OverdrawCounter(const OverdrawCounter&) = delete;
+		OverdrawCounter& operator=(const OverdrawCounter&) = delete;
+
+		void Destroy();
+
+		// Counting costs a query per pass, off until enabled
+		void SetEnabled(bool enabled);
+		bool IsEnabled() const { return m_enabled; }
+
+		// Starts a frame of pixels fragments, usually the viewport area
+		void BeginFrame(int pixels);
+
+		// Counts what is drawn until EndPass as pass, one pass at a time
+		void BeginPass(int pass);
+		void EndPass();
+
+		void EndFrame();
+
+		// Fragments shaded per pixel by pass in the latest measured frame, 0 if it did not run
+		float PerPixel(int pass) const { return m_perPixel[pass]; }
+		bool Measured(int pass) const { return m_measured[pass]; }
+
+		// Sum over every pass
+		float TotalPerPixel() const;
+
+		// Frames whose results have been read since enabling, a new configuration needs a few before it shows
+		size_t FramesMeasured() const { return m_framesMeasured; }
+	};
+}
@@ -0,0 +1,192 @@
+#include "RenderQueue.h"
+
+namespace Helpers
+{
+	// depth is 0 at the camera and 1 at the far plane, clamped to that
+	uint64_t RenderQueue::MakeKey(unsigned pass, GLuint program, GLuint texture, GLuint vao, float depth)
+	{
+		const uint64_t depthBits{ (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * 0xFFFFF) };
+
+		return ((uint64_t)(pass & 0xF) << 60) | ((uint64_t)(program & 0xFF) << 52) | ((uint64_t)(texture & 0xFFFF) << 36) |
+			((uint64_t)(vao & 0xFFFF) << 20) | depthBits;
+	}
+
+	void RenderQueue::Clear()
+	{
+		m_commands.clear();
+		m_items.clear();
+		m_stats.failed = 0;
+	}
+
+	void RenderQueue::Add(uint64_t key, const DrawCommand& command)
+	{
+		if (!command.program || !command.geometry.IsValid())
+		{
+			m_stats.failed++;
+			return;
+		}
+
+		m_items.push_back({ key, (uint32_t)m_commands.size() });
+		m_commands.push_back(command);
+	}
+
+	// Orders the draws by key, draws with equal keys keep the order they were added in
+	void RenderQueue::Sort()
+	{
+		m_stats.sortPasses = 0;
+		m_scratch.resize(m_items.size());
+
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			size_t counts[256]{};
+			for (const SortItem& item : m_items)
+				counts[(item.key >> shift) & 0xFF]++;
+
+			// Every key has the same byte here so this pass would not move anything
+			if (m_items.empty() || counts[(m_items[0].key >> shift) & 0xFF] == m_items.size())
+				continue;
+
+			size_t start{ 0 };
+			for (size_t& count : counts)
+			{
+				const size_t bucket{ count };
+				count = start;
+				start += bucket;
+			}
+
+			// Stable scatter, so the order of lower bytes from earlier passes is kept
+			for (const SortItem& item : m_items)
+				m_scratch[counts[(item.key >> shift) & 0xFF]++] = item;
+
+			m_items.swap(m_scratch);
+			m_stats.sortPasses++;
+		}
+	}
+
+	// Issues the draws in sorted order, one multi-draw per run sharing state, binding only what differs from the run before
+	void RenderQueue::Execute(UniformRing& ring, const DrawBindings& bindings, const std::function<void(ShaderProgram&)>& onProgram,
+		DrawCuller* culler)
+	{
+		Stats stats;
+		stats.sortPasses = m_stats.sortPasses;
+		stats.failed = m_stats.failed;
+		stats.draws = m_items.size();
+		m_stats = stats;
+
+		const size_t count{ m_items.size() };
+		if (count == 0)
+			return;
+
+		// The frame's records in draw order, split into runs where nothing a draw binds changes
+		m_frameCommands.resize(count);
+		m_frameDrawData.resize(count);
+		m_frameSpheres.resize(count);
+		m_frameObjects.resize(count);
+		m_batches.clear();
+
+		for (size_t i = 0; i < count; i++)
+		{
+			const DrawCommand& command{ m_commands[m_items[i].index] };
+			m_frameCommands[i] = { command.geometry.indexCount, std::max(command.instanceCount, 1u), command.geometry.firstIndex,
+				command.geometry.baseVertex, (GLuint)i };
+			m_frameDrawData[i] = { command.transform, command.firstInstance, command.instanceCount };
+			m_stats.instances += m_frameCommands[i].instanceCount;
+			m_frameSpheres[i] = command.bounds;
+			m_frameObjects[i] = command.object;
+
+			const DrawCommand* previous{ i > 0 ? &m_commands[m_items[i - 1].index] : nullptr };
+			if (!previous || previous->program != command.program || previous->texture != command.texture ||
+				previous->geometry.vao != command.geometry.vao)
+				m_batches.push_back({ (uint32_t)i, 0 });
+			m_batches.back().count++;
+		}
+
+		// One draw data array for the whole frame
+		const size_t drawDataBytes{ count * sizeof(DrawData) };
+		size_t drawDataOffset{ 0 };
+		if (!ring.Write(m_frameDrawData.data(), drawDataBytes, drawDataOffset))
+		{
+			m_stats.failed += count;
+			return;
+		}
+
+		const bool culled{ culler && culler->Cull(ring, m_frameCommands, m_frameSpheres, m_frameObjects, m_batches) };
+
+		size_t commandOffset{ 0 };
+		if (!culled)
+		{
+			if (!ring.Write(m_frameCommands.data(), count * sizeof(IndirectCommand), commandOffset))
+			{
+				m_stats.failed += count;
+				return;
+			}
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring.Buffer());
+		}
+
+		ring.BindStorage(bindings.drawDataBinding, drawDataOffset, drawDataBytes);
+		m_stats.drawDataChanges++;
+
+		DrawBatches(bindings, onProgram, culled ? culler : nullptr, commandOffset);
+
+		// Draws hidden last frame that the first batches' depth shows are visible now
+		if (culled && culler->CullRevealed(ring))
+			DrawBatches(bindings, onProgram, culler, 0);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		const size_t made{ m_stats.programChanges + m_stats.textureChanges + m_stats.vaoChanges + m_stats.drawDataChanges };
+		m_stats.changesSaved = m_stats.draws * 4 > made ? m_stats.draws * 4 - made : 0;
+	}
+
+	// Draws every batch, binding what differs from the batch before
+	void RenderQueue::DrawBatches(const DrawBindings& bindings, const std::function<void(ShaderProgram&)>& onProgram, DrawCuller* culler,
+		size_t commandOffset)
+	{
+		const ShaderProgram* program{ nullptr };
+		GLuint texture{ 0 };
+		GLuint vao{ 0 };
+		bool first{ true };
+
+		for (size_t b = 0; b < m_batches.size(); b++)
+		{
+			const DrawBatch& batch{ m_batches[b] };
+			const DrawCommand& command{ m_commands[m_items[batch.start].index] };
+
+			const bool programChanged{ command.program != program };
+			if (programChanged)
+			{
+				command.program->Use();
+				command.program->Set(bindings.sampler, bindings.textureUnit);
+				if (onProgram)
+					onProgram(*command.program);
+
+				program = command.program;
+				m_stats.programChanges++;
+			}
+
+			// onProgram may have left another unit active
+			if (first || command.texture != texture || programChanged)
+			{
+				glActiveTexture(GL_TEXTURE0 + bindings.textureUnit);
+				glBindTexture(GL_TEXTURE_2D, command.texture);
+				texture = command.texture;
+				m_stats.textureChanges++;
+			}
+
+			if (first || command.geometry.vao != vao)
+			{
+				glBindVertexArray(command.geometry.vao);
+				vao = command.geometry.vao;
+				m_stats.vaoChanges++;
+			}
+
+			first = false;
+			if (culler)
+				culler->Draw(b);
+			else
+				glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(uintptr_t)(commandOffset + batch.start * sizeof(IndirectCommand)),
+					(GLsizei)batch.count, 0);
+			m_stats.batches++;
+		}
+	}
+}
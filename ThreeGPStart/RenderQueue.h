@@ -0,0 +1,137 @@
+#pragma once
+// Draws gathered for a frame, sorted by a 64 bit key so GL state only changes between groups of draws
+
+#include "ExternalLibraryHeaders.h"
+#include "DrawCuller.h"
+#include "GeometryPool.h"
+#include "ShaderProgram.h"
+#include "UniformRing.h"
+
+#include <functional>
+
+namespace Helpers
+{
+	// Everything one draw binds. The key only orders draws, what is bound is always taken from here, so two values
+	// that share key bits still work.
+	struct DrawCommand
+	{
+		ShaderProgram* program{ nullptr };
+		GLuint texture{ 0 };
+		GeometryRange geometry;
+
+		// Read by the vertex shader from the per draw storage buffer
+		glm::mat4 transform{ 1 };
+
+		// Instances drawn from the instance buffer starting at firstInstance, each placed by transform times its own.
+		// Zero draws the geometry once with transform alone.
+		uint32_t instanceCount{ 0 };
+		uint32_t firstInstance{ 0 };
+
+		// World space, for culling. For instanced draws this must hold every instance.
+		BoundingSphere bounds;
+
+		// Stable index of what is drawn, so occlusion culling can carry its visibility between frames
+		uint32_t object{ DrawCuller::kNoObject };
+	};
+
+	// One entry of the per draw storage buffer, std430 layout
+	struct DrawData
+	{
+		glm::mat4 transform{ 1 };
+		uint32_t firstInstance{ 0 };
+		uint32_t instanceCount{ 0 };
+		uint32_t padding[2]{};
+	};
+
+	// Where Execute binds each draw's resources
+	struct DrawBindings
+	{
+		// Storage buffer binding of the per draw array, one DrawData per draw indexed by gl_BaseInstance
+		GLuint drawDataBinding{ 2 };
+
+		// Sampler uniform set to textureUnit and the unit the draw's texture goes on
+		UniformName sampler{ 0 };
+		int textureUnit{ 0 };
+	};
+
+	// Keys are, from the top bit down: pass (4 bits), program (8), texture (16), VAO (16), depth (20). Draws are
+	// grouped by the state that costs most to change and front to back within a group, which suits opaque geometry.
+	// Sorting is an LSD radix sort over the key bytes, skipping bytes every key shares, so a frame costs O(draws).
+	// Each run of draws sharing program, texture and geometry page then goes to the GPU as one
+	// glMultiDrawElementsIndirect. The frame's DrawElementsIndirectCommand records and transforms are written into the
+	// uniform ring, each command's baseInstance being its index in the draw data so a culler may pack commands
+	// anywhere. An instanced draw is one command with its instance count, so draws do not grow with instances. GL thread only for Execute.
+	class RenderQueue
+	{
+	public:
+		struct Stats
+		{
+			size_t draws{ 0 };
+
+			// Geometry instances the draws make, more than draws when some are instanced
+			size_t instances{ 0 };
+
+			// Multi-draw calls the draws went out in
+			size_t batches{ 0 };
+
+			// Draws not issued as the ring had no room for their records or they had nothing to draw with
+			size_t failed{ 0 };
+
+			// Binds made, a draw that changes nothing makes none
+			size_t programChanges{ 0 };
+			size_t textureChanges{ 0 };
+			size_t vaoChanges{ 0 };
+			size_t drawDataChanges{ 0 };
+
+			// Binds a loop setting everything for every draw would have made over those made
+			size_t changesSaved{ 0 };
+
+			// Radix passes run of the eight possible
+			int sortPasses{ 0 };
+		};
+	private:
+		struct SortItem
+		{
+			uint64_t key;
+			uint32_t index;
+		};
+
+		std::vector<DrawCommand> m_commands;
+		std::vector<SortItem> m_items;
+		std::vector<SortItem> m_scratch;
+
+		// The frame's records in sorted order, kept to save allocating each frame
+		std::vector<IndirectCommand> m_frameCommands;
+		std::vector<DrawData> m_frameDrawData;
+		std::vector<BoundingSphere> m_frameSpheres;
+		std::vector<uint32_t> m_frameObjects;
+		std::vector<DrawBatch> m_batches;
+
+		Stats m_stats;
+
+		// Draws every batch, binding what differs from the batch before. Without a culler each draws its commands from
+		// commandOffset in the bound indirect buffer.
+		void DrawBatches(const DrawBindings& bindings, const std::function<void(ShaderProgram&)>& onProgram, DrawCuller* culler,
+			size_t commandOffset);
+	public:
+		// depth is 0 at the camera and 1 at the far plane, clamped to that
+		static uint64_t MakeKey(unsigned pass, GLuint program, GLuint texture, GLuint vao, float depth);
+
+		void Clear();
+
+		void Add(uint64_t key, const DrawCommand& command);
+
+		// Orders the draws by key, draws with equal keys keep the order they were added in
+		void Sort();
+
+		// Issues the draws in sorted order through the ring, calling onProgram each time the program changes so the
+		// caller can bind what that program needs. With a culler only the draws it passes are drawn, and when it
+		// culls in two phases the batches are drawn again with what the second phase revealed.
+		void Execute(UniformRing& ring, const DrawBindings& bindings, const std::function<void(ShaderProgram&)>& onProgram,
+			DrawCuller* culler = nullptr);
+
+		size_t Size() const { return m_commands.size(); }
+
+		const Stats& GetStats() const { return m_stats; }
+	};
+}
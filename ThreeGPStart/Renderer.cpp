@@ -1,480 +1,1038 @@
 #include "Renderer.h"
 #include "Camera.h"
 #include "ImageLoader.h"
+#include "Resampler.h"
+#include "ThreadPool.h"
 
-Renderer::Renderer() 
-{
+#include <cfloat>
+#include <filesystem>
+#include <random>
+#include <tuple>
+namespace fs = std::filesystem;
 
-}
+// Page file of the terrain's virtual texture, built on the first run
+static const std::string kTerrainPageFile{ "Data\\Cache\\terrain.vt" };
 
-// On exit must clean up any OpenGL resources e.g. the program, the buffers
-Renderer::~Renderer()
-{
-	// TODO: clean up any memory used including OpenGL objects via glDelete* calls
-	glDeleteProgram(m_program);
-	glDeleteBuffers(1, &m_VAO);
-}
+// Change when GenerateTerrainTexels changes so old page files are rebuilt
+static const uint64_t kTerrainGeneratorVersion{ 1 };
 
-// Use IMGUI for a simple on screen GUI
-void Renderer::DefineGUI()
+// Uniforms every mesh program has, looked up in the program's own table rather than asking the driver
+static const Helpers::UniformName kSamplerTex{ Helpers::ShaderProgram::Name("sampler_tex") };
+
+// Uniform blocks in the mesh vertex shaders, laid out std140 to match
+struct FrameUniforms
 {
-	// Show a simple window that we create ourselves. We use a Begin/End pair to created a named window.
-	ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
+	glm::mat4 combined_xform;
+	glm::mat4 view_xform;
+	glm::mat4 projection_xform;
+	glm::vec4 camera_position;
+};
 
-	ImGui::Begin("3GP");						// Create a window called "3GP" and append into it.
+static const GLuint kFrameUniformsBinding{ 0 };
 
-	ImGui::Text("Visibility.");					// Display some text (you can use a format strings too)	
+// Storage buffer of per draw data the vertex shaders index with gl_BaseInstance
+static const GLuint kDrawDataBinding{ 2 };
 
-	ImGui::Checkbox("Wireframe", &m_wireframe);	// A checkbox linked to a member variable
+// Storage buffer of instances, clear of the culler's bindings
+static const GLuint kInstanceBinding{ 6 };
 
-	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+// Passes the overdraw counter measures
+static const int kPrepassPass{ 0 };
+static const int kOpaquePass{ 1 };
+static const int kSkyPass{ 2 };
 
-	ImGui::End();
-}
-
-// Load, compile and link the shaders and create a program object to host them
-GLuint Renderer::CreateProgram(std::string vsPath, std::string fsPath)
+// Pass orders the overdraw sweep measures, in order
+struct PassOrder
 {
-	// Create a new program (returns a unqiue id)
-	GLuint program = glCreateProgram();
-
-	// Load and create vertex and fragment shaders
-	GLuint vertex_shader{ Helpers::LoadAndCompileShader(GL_VERTEX_SHADER, vsPath) };
-	GLuint fragment_shader{ Helpers::LoadAndCompileShader(GL_FRAGMENT_SHADER, fsPath) };
-	if (vertex_shader == 0 || fragment_shader == 0)
-		return false;
+	const char* name;
+	bool depthPrepass;
+	bool skyLast;
+};
+
+static const PassOrder kPassOrders[]{
+	{ "Sky first, no prepass", false, false },
+	{ "Sky last, no prepass", false, true },
+	{ "Sky first, depth prepass", true, false },
+	{ "Sky last, depth prepass", true, true }
+};
+
+// Sky sets that can be chosen in the GUI
+struct SkySet
+{
+	const char* name;
+	const char* filepath;
+};
+
+static const SkySet kSkySets[]{
+	{ "Clouds", "Data\\Models\\Sky\\Clouds\\skybox.x" },
+	{ "Hills", "Data\\Models\\Sky\\Hills\\skybox.x" },
+	{ "Mars", "Data\\Models\\Sky\\Mars\\skybox.X" },
+	{ "Mountains", "Data\\Models\\Sky\\Mountains\\skybox.x" }
+};
+
+// Recalculates the world bounds of each mesh if the transform has changed since the last call
+void Model::UpdateWorldBounds(const std::vector<Helpers::InstanceData>* instances)
+{
+	if (!boundsDirty)
+		return;
 
-	// Attach the vertex shader to this program (copies it)
-	glAttachShader(program, vertex_shader);
+	worldBounds = Helpers::AABB();
+	for (Mesh& mesh : meshVector)
+	{
+		if (instances)
+		{
+			// One box round every instance, and the sphere round that box
+			mesh.worldBounds = Helpers::AABB();
+			for (const Helpers::InstanceData& instance : *instances)
+				mesh.worldBounds.Merge(Helpers::TransformAABB(mesh.localBounds, transform * instance.transform));
+
+			// A point at the model's origin without instances, so the BVH never sees an empty box
+			if (mesh.worldBounds.IsEmpty())
+				mesh.worldBounds.minExtents = mesh.worldBounds.maxExtents = glm::vec3(transform[3]);
+			mesh.worldSphere = { mesh.worldBounds.Centre(), glm::length(mesh.worldBounds.HalfSize()) };
+		}
+		else
+		{
+			mesh.worldBounds = Helpers::TransformAABB(mesh.localBounds, transform);
+			mesh.worldSphere = Helpers::TransformSphere(mesh.localSphere, transform);
+		}
+		worldBounds.Merge(mesh.worldBounds);
+	}
 
-	/* The attibute location 0 maps to the input stream "vertex_position" in the vertex shader
-	 Not needed if you use (location=0) in the vertex shader itself
-	glBindAttribLocation(m_program, 0, "vertex_position");*/
+	boundsDirty = false;
+}
 
-	// Attach the fragment shader (copies it)
-	glAttachShader(program, fragment_shader);
+// Average texture coordinate units per unit of position over the triangles, 0 without texture coordinates
+static float ComputeUVDensity(const glm::vec3* positions, const glm::vec2* uvCoords, const unsigned int* elements, size_t numElements)
+{
+	if (!uvCoords || numElements < 3)
+		return 0;
 
-	// Done with the originals of these as we have made copies
-	glDeleteShader(vertex_shader);
-	glDeleteShader(fragment_shader);
+	// Ratio of total areas so large triangles count for more than slivers
+	double uvArea{ 0 }, positionArea{ 0 };
+	for (size_t i = 0; i + 2 < numElements; i += 3)
+	{
+		const glm::vec3& p0{ positions[elements[i]] };
+		const glm::vec2& t0{ uvCoords[elements[i]] };
+		const glm::vec2 t1{ uvCoords[elements[i + 1]] - t0 };
+		const glm::vec2 t2{ uvCoords[elements[i + 2]] - t0 };
 
-	// Link the shaders, checking for errors
-	if (!Helpers::LinkProgramShaders(program))
-		return 0;
+		positionArea += glm::length(glm::cross(positions[elements[i + 1]] - p0, positions[elements[i + 2]] - p0));
+		uvArea += std::fabs(t1.x * t2.y - t1.y * t2.x);
+	}
 
-	return program;
+	return positionArea > 0 ? (float)std::sqrt(uvArea / positionArea) : 0.0f;
 }
 
-// Load / create geometry into OpenGL buffers	
-bool Renderer::InitialiseGeometry()
+// Terrain occluder of every step'th grid point, each as low as the ground anywhere within a step of it so the
+// coarse surface never rises above the real one
+static std::shared_ptr<Helpers::OccluderMesh> BuildTerrainOccluder(const std::vector<glm::vec3>& vertices, int numVertX, int numVertZ, int step)
 {
-	//// Load and compile shaders into m_program
-	//if (!CreateProgram())
-	//	return false;
-	m_program = CreateProgram("Data\\Shaders\\vertex_shader.vert", "Data\\Shaders\\fragment_shader.frag");
-	m_cubeProgram = CreateProgram("Data\\Shaders\\cube_vertex_shader.vert", "Data\\Shaders\\cube_fragment_shader.frag");
-	m_skyboxProgram = CreateProgram("Data\\Shaders\\skybox_vertex_shader.vert", "Data\\Shaders\\skybox_fragment_shader.frag");
-
-	Helpers::ImageLoader GrassTexture;
-	if (!GrassTexture.Load("Data\\Textures\\grass.jpg"))
+	std::vector<int> rows, columns;
+	for (int r = 0; r < numVertZ; r += step)
+		rows.push_back(r);
+	if (rows.back() != numVertZ - 1)
+		rows.push_back(numVertZ - 1);
+	for (int c = 0; c < numVertX; c += step)
+		columns.push_back(c);
+	if (columns.back() != numVertX - 1)
+		columns.push_back(numVertX - 1);
+
+	auto occluder{ std::make_shared<Helpers::OccluderMesh>() };
+	for (int r : rows)
 	{
+		for (int c : columns)
+		{
+			float lowest{ FLT_MAX };
+			for (int nr = std::max(r - step, 0); nr <= std::min(r + step, numVertZ - 1); nr++)
+			{
+				for (int nc = std::max(c - step, 0); nc <= std::min(c + step, numVertX - 1); nc++)
+					lowest = std::min(lowest, vertices[(size_t)nr * numVertX + nc].y);
+			}
 
+			const glm::vec3& point{ vertices[(size_t)r * numVertX + c] };
+			occluder->positions.push_back(glm::vec3(point.x, lowest, point.z));
+		}
 	}
 
-	Helpers::ImageLoader Heightmap;
-	if (!Heightmap.Load("Data\\Heightmaps\\curvy.gif"))
-	/*if (!Heightmap.Load("Data\\Heightmaps\\testHM.png"))*/
+	const uint32_t width{ (uint32_t)columns.size() };
+	for (uint32_t r = 0; r + 1 < rows.size(); r++)
 	{
-
+		for (uint32_t c = 0; c + 1 < width; c++)
+		{
+			const uint32_t i{ r * width + c };
+			occluder->indices.insert(occluder->indices.end(), { i, i + 1, i + width + 1, i, i + width + 1, i + width });
+		}
 	}
+	return occluder;
+}
 
+// What the terrain's virtual texture is made from, read on the worker that builds it
+struct TerrainTextureSources
+{
+	Helpers::ImageLoader heightmap;
+	Helpers::MipChain grass;
+	Helpers::MipChain dirt;
+};
 
+// Bilinear sample of a level of chain, wrapping
+static glm::vec3 SampleMipLevel(const Helpers::MipChain& chain, int level, float u, float v)
+{
+	const Helpers::MipChain::Level& source{ chain.levels[level] };
+	const BYTE* texels{ chain.LevelData(level) };
 
-	Model Terrain;
-	Terrain.ModelName = "Terrain";
-	
-	Mesh terrainMesh;
+	const float x{ u * source.width - 0.5f };
+	const float y{ v * source.height - 0.5f };
+	const float fx{ x - std::floor(x) };
+	const float fy{ y - std::floor(y) };
 
+	const auto wrap = [](int i, int size) { return ((i % size) + size) % size; };
+	const int x0{ wrap((int)std::floor(x), source.width) }, x1{ wrap(x0 + 1, source.width) };
+	const int y0{ wrap((int)std::floor(y), source.height) }, y1{ wrap(y0 + 1, source.height) };
 
+	const auto texel = [&](int tx, int ty)
+	{
+		const BYTE* p{ texels + ((size_t)ty * source.width + tx) * 4 };
+		return glm::vec3(p[0], p[1], p[2]);
+	};
 
+	return glm::mix(glm::mix(texel(x0, y0), texel(x1, y0), fx), glm::mix(texel(x0, y1), texel(x1, y1), fx), fy);
+}
 
-	std::vector<glm::vec3> colours;
+// Bilinear sample of the heightmap grey value, 0 to 1, clamped at the edges
+static float SampleHeight(const Helpers::ImageLoader& heightmap, float u, float v)
+{
+	const float x{ glm::clamp(u * (heightmap.Width() - 1), 0.0f, (float)(heightmap.Width() - 1)) };
+	const float y{ glm::clamp(v * (heightmap.Height() - 1), 0.0f, (float)(heightmap.Height() - 1)) };
+	const int x0{ (int)x }, x1{ std::min(x0 + 1, heightmap.Width() - 1) };
+	const int y0{ (int)y }, y1{ std::min(y0 + 1, heightmap.Height() - 1) };
 
-	std::vector<glm::vec3> vertices;
+	const auto height = [&](int hx, int hy) { return heightmap.GetGreyTexel(hx, hy) / 255.0f; };
 
-	std::vector<GLuint> elements;
+	return glm::mix(glm::mix(height(x0, y0), height(x1, y0), x - x0), glm::mix(height(x0, y1), height(x1, y1), x - x0), y - y0);
+}
 
-	std::vector<glm::vec2> uvCoords;
+// Unique terrain texture: moss and dirt in the low ground and on slopes, grass higher up, both tiling detail textures
+// sampled from the mip level matching the virtual level so distant pages are not noisy
+static void GenerateTerrainTexels(const TerrainTextureSources& sources, int virtualSize, int level, int x0, int y0,
+	int width, int height, BYTE* rgba)
+{
+	const int levelSize{ std::max(1, virtualSize >> level) };
 
+	// Times the detail textures repeat across the terrain
+	const float repeats{ 64.0f };
 
-	std::vector<glm::vec3> normals;
-	std::vector<glm::vec3> positions;
+	const auto sourceLevel = [&](const Helpers::MipChain& chain)
+	{
+		const float texelsPerTexel{ repeats * chain.levels[0].width / levelSize };
+		return glm::clamp((int)std::round(std::log2(std::max(texelsPerTexel, 1.0f))), 0, (int)chain.levels.size() - 1);
+	};
+	const int grassLevel{ sourceLevel(sources.grass) };
+	const int dirtLevel{ sourceLevel(sources.dirt) };
 
-	int numCellsX = 250;
-	int numCellsZ = 250;
+	// Slope is measured a heightmap texel either side, heights are in 0 to 1 over a terrain about 16 times wider
+	const float step{ 1.0f / sources.heightmap.Width() };
+	const float slopeScale{ 1.0f / (16.0f * step) };
 
-	int numVertX = numCellsX + 1;
-	int numVertZ = numCellsZ + 1;
+	for (int y = 0; y < height; y++)
+	{
+		// Borders past the edge repeat the edge
+		const float v{ (glm::clamp(y0 + y, 0, levelSize - 1) + 0.5f) / levelSize };
 
-	int numVerts = numVertX * numVertZ;
+		for (int x = 0; x < width; x++)
+		{
+			const float u{ (glm::clamp(x0 + x, 0, levelSize - 1) + 0.5f) / levelSize };
 
-	float imageX = 0;
-	float imageZ = 0;
+			const float h{ SampleHeight(sources.heightmap, u, v) };
+			const float dx{ SampleHeight(sources.heightmap, u + step, v) - SampleHeight(sources.heightmap, u - step, v) };
+			const float dz{ SampleHeight(sources.heightmap, u, v + step) - SampleHeight(sources.heightmap, u, v - step) };
+			const float slope{ std::sqrt(dx * dx + dz * dz) * 0.5f * slopeScale };
 
-	positions.resize(numVerts);
-	
-	normals.resize(numVerts);
+			const float grassiness{ glm::smoothstep(0.2f, 0.5f, h) * (1.0f - glm::smoothstep(0.3f, 0.8f, slope)) };
 
-	for (int i = 0; i < numVerts; i++)
-	{
-		normals[i] = glm::vec3(0, 0, 0);
+			const glm::vec3 colour{ glm::mix(SampleMipLevel(sources.dirt, dirtLevel, u * repeats, v * repeats),
+				SampleMipLevel(sources.grass, grassLevel, u * repeats, v * repeats), grassiness) };
+
+			BYTE* texel{ rgba + ((size_t)y * width + x) * 4 };
+			texel[0] = (BYTE)(colour.r + 0.5f);
+			texel[1] = (BYTE)(colour.g + 0.5f);
+			texel[2] = (BYTE)(colour.b + 0.5f);
+			texel[3] = 255;
+		}
 	}
-	
+}
 
-	for (int i = 0; i < numVertZ; i++)
+// Identifies the sources and layout of the terrain page file, 0 if a source is missing
+static uint64_t TerrainTextureStamp(const std::vector<std::string>& sources, int virtualSize, Helpers::VirtualTextureFormat format)
+{
+	// FNV-1a over the size and time of each source
+	uint64_t stamp{ 14695981039346656037ull };
+	const auto add = [&stamp](uint64_t value)
 	{
-		for (int j = 0; j < numVertX; j++)
+		for (int i = 0; i < 8; i++)
 		{
-			vertices.push_back(glm::vec3(i * 8, 0, j * 8));
-			normals.push_back(glm::vec3(0, 1, 0));
-			colours.push_back(glm::vec3(0, 0, 1));
-
-			uvCoords.push_back(glm::vec2((j / (float)numCellsX), (i / (float)numCellsZ)));
-
+			stamp ^= (value >> (i * 8)) & 0xFF;
+			stamp *= 1099511628211ull;
 		}
+	};
+
+	for (const std::string& source : sources)
+	{
+		std::error_code error;
+		add(fs::file_size(source, error));
+		if (error)
+			return 0;
+		add((uint64_t)fs::last_write_time(source, error).time_since_epoch().count());
 	}
-	
 
-	float vertexXtoImage = (float)Heightmap.Width() / numVertX;
-	float vertexZtoImage = (float)Heightmap.Height() / numVertZ;
+	add((uint64_t)virtualSize);
+	add((uint64_t)format);
+	add(kTerrainGeneratorVersion);
+	return stamp;
+}
 
-	GLbyte* imageData = (GLbyte*)Heightmap.GetData();
+Renderer::Renderer() 
+{
 
+}
 
+// On exit must clean up any OpenGL resources e.g. the program, the buffers
+Renderer::~Renderer()
+{
+	// TODO: clean up any memory used including OpenGL objects via glDelete* calls
+	glDeleteBuffers(1, &m_VAO);
+}
 
-	for (int Z = 0; Z < numVertZ; Z++)
-	{
-		imageZ = vertexZtoImage * Z;
-		
-		
-		for (int X = 0; X < numVertX; X++)
-		{
-			imageX = vertexXtoImage * X;
-			
-			size_t offset = ((size_t)imageX + (size_t)imageZ * Heightmap.Width()) * 4;
-			BYTE height = imageData[offset];
-			int myvec = (Z * numVertX) + X;
-			vertices[myvec].y = (float)height / 2;
-		}
+// Use IMGUI for a simple on screen GUI
+void Renderer::DefineGUI()
+{
+	// Show a simple window that we create ourselves. We use a Begin/End pair to created a named window.
+	ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
-	}
+	ImGui::Begin("3GP");						// Create a window called "3GP" and append into it.
 
+	ImGui::Text("Visibility.");					// Display some text (you can use a format strings too)	
 
-	//Tessellation 
-	bool toggleDiamondPattern = true;
+	ImGui::Checkbox("Wireframe", &m_wireframe);	// A checkbox linked to a member variable
 
-	for (int cellZ = 0; cellZ < numCellsZ; cellZ++)
+	// Frustum culling of the mesh draws
+	int cullMode{ (int)m_drawCuller.GetMode() };
+	ImGui::Text("Culling:");
+	ImGui::SameLine();
+	ImGui::RadioButton("Off", &cullMode, (int)Helpers::CullMode::Off);
+	ImGui::SameLine();
+	ImGui::RadioButton("CPU", &cullMode, (int)Helpers::CullMode::CPU);
+	ImGui::SameLine();
+	ImGui::RadioButton("GPU", &cullMode, (int)Helpers::CullMode::GPU);
+	m_drawCuller.SetMode((Helpers::CullMode)cullMode);
+
+	ImGui::Checkbox("Cull meshes with the BVH before queueing", &m_bvhCulling);
+	if (m_bvhCulling)
 	{
-		for (int cellX = 0; cellX < numCellsX; cellX++)
-		{
-			int StartVertIndex = (cellZ * numVertX) + cellX;
+		const Helpers::SceneBVH::Stats& bvhStats{ m_meshBVH.GetStats() };
+		ImGui::Text("BVH: %zu of %zu meshes visible, %zu of %zu nodes visited", bvhStats.visible, bvhStats.objects,
+			bvhStats.nodesVisited, bvhStats.nodes);
+	}
 
-			if (toggleDiamondPattern)
-			{
-				elements.push_back(StartVertIndex);
-				elements.push_back(StartVertIndex + 1);
-				elements.push_back(StartVertIndex + numVertX + 1);
+	ImGui::Checkbox("Occlusion cull meshes on the CPU", &m_occlusionCulling);
+	if (m_occlusionBuffer.HasAVX2())
+	{
+		bool avx2{ m_occlusionBuffer.UsingAVX2() };
+		ImGui::SameLine();
+		if (ImGui::Checkbox("AVX2", &avx2))
+			m_occlusionBuffer.SetUseAVX2(avx2);
+	}
+	if (m_occlusionCulling)
+	{
+		const Helpers::OcclusionBuffer::Stats& occlusionStats{ m_occlusionBuffer.GetStats() };
+		ImGui::Text("Occlusion: %zu of %zu meshes occluded, %zu occluder triangles (%zu clipped) at %dx%d", occlusionStats.occluded,
+			occlusionStats.tested, occlusionStats.triangles, occlusionStats.trianglesClipped, m_occlusionBuffer.Width(), m_occlusionBuffer.Height());
+		ImGui::Text("Occlusion cost: raster %.3f ms, test %.3f ms (%s)", occlusionStats.rasterMilliseconds, occlusionStats.testMilliseconds,
+			occlusionStats.avx2 ? "AVX2" : "SSE");
+	}
 
-				elements.push_back(StartVertIndex);
-				elements.push_back(StartVertIndex + numVertX + 1);
-				elements.push_back(StartVertIndex + numVertX);
+	const Helpers::DrawCuller::Stats& cullStats{ m_drawCuller.GetStats() };
+	if (cullStats.mode == Helpers::CullMode::CPU)
+		ImGui::Text("Culled on the CPU: %zu of %zu draws visible", cullStats.visible, cullStats.tested);
+	else if (cullStats.mode == Helpers::CullMode::GPU)
+		ImGui::Text("Culled on the GPU: %zu draws tested", cullStats.tested);
 
-			}
+	if (ImGui::Button("Compare GPU and CPU culling"))
+	{
+		m_drawCuller.SetMode(Helpers::CullMode::GPU);
+		m_drawCuller.RequestComparison();
+	}
+	if (!m_drawCuller.GetComparison().empty())
+		ImGui::TextUnformatted(m_drawCuller.GetComparison().c_str());
+
+	// Two phase occlusion against the depth pyramid, GPU culling only
+	bool gpuOcclusion{ m_drawCuller.GetOcclusion() };
+	if (ImGui::Checkbox("Occlusion cull on the GPU against a depth pyramid", &gpuOcclusion))
+		m_drawCuller.SetOcclusion(gpuOcclusion);
+	if (cullStats.occlusion)
+	{
+		const Helpers::DepthPyramid::Stats& pyramidStats{ m_drawCuller.GetPyramidStats() };
+		ImGui::Text("Depth pyramid: %dx%d, %d levels", pyramidStats.width, pyramidStats.height, pyramidStats.levels);
+		if (ImGui::Button("Count GPU occluded draws"))
+			m_drawCuller.RequestOcclusionReport();
+	}
+	if (!m_drawCuller.GetOcclusionReport().empty())
+		ImGui::TextUnformatted(m_drawCuller.GetOcclusionReport().c_str());
+
+	// Pass order, and what each pass costs in fragments shaded per pixel
+	ImGui::Checkbox("Depth prepass", &m_depthPrepass);
+	ImGui::SameLine();
+	ImGui::Checkbox("Sky last", &m_skyLast);
+
+	bool countOverdraw{ m_overdraw.IsEnabled() };
+	if (ImGui::Checkbox("Count overdraw", &countOverdraw) && m_overdrawSweep < 0)
+		m_overdraw.SetEnabled(countOverdraw);
+	if (m_overdraw.IsEnabled() && m_overdraw.FramesMeasured() > 0)
+	{
+		ImGui::Text("Fragments per pixel: %.2f (prepass %.2f, opaque %.2f, sky %.2f)", m_overdraw.TotalPerPixel(),
+			m_overdraw.PerPixel(kPrepassPass), m_overdraw.PerPixel(kOpaquePass), m_overdraw.PerPixel(kSkyPass));
+	}
+	if (m_overdrawSweep < 0 && ImGui::Button("Measure every pass order"))
+	{
+		m_sweepSavedPrepass = m_depthPrepass;
+		m_sweepSavedSkyLast = m_skyLast;
+		m_overdraw.SetEnabled(true);
+		m_overdrawReport.clear();
+		m_overdrawSweep = 0;
+		m_overdrawSweepStart = m_overdraw.FramesMeasured();
+	}
+	else if (m_overdrawSweep >= 0)
+	{
+		ImGui::Text("Measuring %s", kPassOrders[m_overdrawSweep].name);
+	}
+	if (!m_overdrawReport.empty())
+		ImGui::TextUnformatted(m_overdrawReport.c_str());
 
-			else
+	if (ImGui::BeginCombo("Sky", kSkySets[m_skyIndex].name))
+	{
+		for (int i = 0; i < (int)std::size(kSkySets); i++)
+		{
+			if (ImGui::Selectable(kSkySets[i].name, i == m_skyIndex) && i != m_skyIndex)
 			{
-				elements.push_back(StartVertIndex);
-				elements.push_back(StartVertIndex + 1);
-				elements.push_back(StartVertIndex + numVertX);
-
-				elements.push_back(StartVertIndex + 1);
-				elements.push_back(StartVertIndex + numVertX + 1);
-				elements.push_back(StartVertIndex + numVertX);
-
+				// Decoded and uploaded over the next frames, the current sky stays up until then
+				m_skyIndex = i;
+				m_skySwitchFrameTimes.Reset();
+				m_skybox.BeginLoad(kSkySets[i].filepath);
 			}
-			toggleDiamondPattern = !toggleDiamondPattern;
 		}
-		toggleDiamondPattern = !toggleDiamondPattern;
+		ImGui::EndCombo();
 	}
 
+	const Helpers::Skybox::Stats skyStats{ m_skybox.GetStats() };
+	if (!skyStats.loading.empty())
+		ImGui::Text("Sky loading: %.0f%% uploaded", skyStats.uploadProgress * 100.0f);
 
-	//Calculating normals
-	for (int e = 0; e < elements.size(); e += 3)
+	// Frame times overall and while the last sky switch ran, a hitch shows up as a frame far to the right
+	const std::vector<float>& frameBuckets{ m_frameTimes.Buckets() };
+	ImGui::PlotHistogram("Frame ms", frameBuckets.data(), (int)frameBuckets.size(), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 50));
+	ImGui::Text("Frames: avg %.2f ms, 99%% under %.0f ms, worst %.1f ms", m_frameTimes.AverageMilliseconds(),
+		m_frameTimes.PercentileMilliseconds(0.99f), m_frameTimes.WorstMilliseconds());
+	if (m_skySwitchFrameTimes.Frames() > 0)
 	{
-		positions[0] = vertices[elements[e]];
-		positions[1] = vertices[elements[(size_t)e + 1]];
-		positions[2] = vertices[elements[(size_t)e + 2]];
-
-		glm::vec3 edge1 = positions[1] - positions[0];
-		glm::vec3 edge2 = positions[2] - positions[0];
-
-
-		normals[elements[e]] += glm::cross(edge1, edge2);
-		normals[elements[(size_t)e + 1]] += glm::cross(edge1, edge2);
-		normals[elements[(size_t)e + 2]] += glm::cross(edge1, edge2);
-		
+		const std::vector<float>& switchBuckets{ m_skySwitchFrameTimes.Buckets() };
+		ImGui::PlotHistogram("Sky switch ms", switchBuckets.data(), (int)switchBuckets.size(), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 50));
+		ImGui::Text("Sky switch: %zu frames, avg %.2f ms, worst %.1f ms", m_skySwitchFrameTimes.Frames(),
+			m_skySwitchFrameTimes.AverageMilliseconds(), m_skySwitchFrameTimes.WorstMilliseconds());
 	}
-
-	//normalising the normals
-	for (int n = 0; n < normals.size(); n++)
+	if (ImGui::Button("Reset frame times"))
+		m_frameTimes.Reset();
+
+	// Written as PNGs in the background, recording keeps every frame without slowing them down
+	if (ImGui::Button("Screenshot"))
+		m_frameCapture.Screenshot("screenshot_" + std::to_string(m_captureCount++));
+	ImGui::SameLine();
+	if (ImGui::Button(m_frameCapture.IsRecording() ? "Stop recording" : "Record frames"))
 	{
-		glm::normalize(normals[n]);
+		if (m_frameCapture.IsRecording())
+			m_frameCapture.StopRecording();
+		else
+		{
+			m_frameCapture.StartRecording("recording_" + std::to_string(m_captureCount++));
+			m_frameTimes.Reset();
+		}
+	}
+	const Helpers::FrameCapture::Stats captureStats{ m_frameCapture.GetStats() };
+	if (captureStats.captured > 0)
+	{
+		ImGui::Text("Captured %zu, written %zu, dropped %zu, %zu encoding (%.0f MB)", captureStats.captured, captureStats.written,
+			captureStats.dropped, captureStats.queuedFrames, captureStats.queuedBytes / (1024.0f * 1024.0f));
 	}
 
-	//Terrain VBOs
-
-	GLuint positionsVBO;
-	
-	glGenBuffers(1, &positionsVBO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
-
-	//Clearing buffer
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	GLuint coloursVBO;
-	glGenBuffers(1, &coloursVBO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, coloursVBO);
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)* colours.size(), colours.data(), GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 
+	// Uniform traffic since the last GUI frame, the cached values stop most per mesh sets reaching GL
+	size_t uniformUploads{ 0 };
+	size_t uniformsSkipped{ 0 };
+	for (Helpers::ShaderProgram* program : { &m_program, &m_cubeProgram, &m_skyboxProgram, &m_virtualTextureProgram, &m_virtualFeedbackProgram,
+		&m_depthProgram, &m_cubeDepthProgram })
+	{
+		uniformUploads += program->GetStats().uploads;
+		uniformsSkipped += program->GetStats().skipped;
+		program->ResetStats();
+	}
+	ImGui::Text("Uniforms: %zu uploaded, %zu unchanged", uniformUploads, uniformsSkipped);
+
+	const Helpers::RenderQueue::Stats& queueStats{ m_renderQueue.GetStats() };
+	ImGui::Text("Draws: %zu in %zu multi-draws, binds: %zu programs %zu textures %zu VAOs %zu draw data, %zu saved", queueStats.draws,
+		queueStats.batches, queueStats.programChanges, queueStats.textureChanges, queueStats.vaoChanges, queueStats.drawDataChanges,
+		queueStats.changesSaved);
+
+	// Instances ride along in one draw per mesh, so draws stay put as the counts grow
+	if (ImGui::SliderInt("Instanced cubes", &m_cubeFieldCount, 0, 50000))
+		ScatterInstances(m_cubeField, m_cubeFieldCount, 0.5f, 5.0f);
+	if (ImGui::SliderInt("Instanced jeeps", &m_jeepFieldCount, 0, 5000))
+		ScatterInstances(m_jeepField, m_jeepFieldCount, 0.5f, 0.0f);
+
+	const Helpers::InstanceBuffer::Stats& instanceStats{ m_instances.GetStats() };
+	ImGui::Text("Instances: %zu in %zu sets, %zu drawn by %zu draws, %.1f KB uploaded last frame", instanceStats.instances,
+		instanceStats.sets, queueStats.instances, queueStats.draws, instanceStats.bytesUploaded / 1024.0f);
+
+	const Helpers::GeometryPool::Stats& geometryStats{ m_geometryPool.GetStats() };
+	ImGui::Text("Geometry: %zu meshes, %zu vertices, %zu indices in %zu pages (%.1f MB)", geometryStats.meshes, geometryStats.vertices,
+		geometryStats.indices, geometryStats.pages, geometryStats.bytes / (1024.0f * 1024.0f));
+
+	const Helpers::UniformRing::Stats& ringStats{ m_uniformRing.GetStats() };
+	ImGui::Text("Uniform blocks: %zu (%.1f KB) last frame, %zu did not fit", ringStats.blocks, ringStats.bytes / 1024.0f, ringStats.failed);
+
+	const Helpers::TextureCache::Stats& textureStats{ m_textureCache.GetStats() };
+	ImGui::Text("Textures: %zu (%.1f MB)", textureStats.textureCount, textureStats.vramBytes / (1024.0f * 1024.0f));
+	ImGui::Text("Texture cache hits: %zu misses: %zu same content: %zu", textureStats.hits, textureStats.misses, textureStats.contentHits);
+	ImGui::Text("Texture loading %.1f ms, %zu mip chains from cache", textureStats.loadMilliseconds, textureStats.mipCacheHits);
+	ImGui::Text("Block compressed textures: %zu", textureStats.compressedCount);
+
+	const Helpers::TextureAtlas::Stats atlasStats{ m_textureAtlas.GetStats() };
+	ImGui::Text("Atlas: %zu textures in %zu pages, %.0f%% full", atlasStats.textures, atlasStats.pages, atlasStats.occupancy * 100.0f);
+
+	// Streamed texture residency against the budget
+	const Helpers::TextureStreamer::Stats& streamStats{ m_textureStreamer.GetStats() };
+	ImGui::Text("Streamed textures: %zu, %.1f of %.1f MB resident", streamStats.textureCount,
+		streamStats.residentBytes / (1024.0f * 1024.0f), streamStats.fullBytes / (1024.0f * 1024.0f));
+	ImGui::Text("Background loads pending: %zu, %zu via mapped buffer", textureStats.pendingUploads + streamStats.pendingLoads,
+		textureStats.ringUploads + streamStats.ringUploads);
+
+	Helpers::TextureStreamerOptions streamOptions{ m_textureStreamer.GetOptions() };
+	int budgetMB{ (int)(streamOptions.vramBudgetBytes / (1024 * 1024)) };
+	if (ImGui::SliderInt("Streaming budget MB", &budgetMB, 1, 1024))
+	{
+		streamOptions.vramBudgetBytes = (size_t)budgetMB * 1024 * 1024;
+		m_textureStreamer.SetOptions(streamOptions);
+	}
 
+	// Virtual texture residency, the terrain uses the streamed texture until the page file is built
+	ImGui::Checkbox("Virtual texture terrain", &m_useVirtualTexture);
+	if (m_terrainTexture.IsOpen())
+	{
+		const Helpers::VirtualTexture::Stats& vtStats{ m_terrainTexture.GetStats() };
+		ImGui::Text("Virtual texture pages: %zu of %zu resident, %zu in view, %zu loading", vtStats.residentPages,
+			vtStats.physicalPages, vtStats.requestedPages, vtStats.loadsInFlight);
+		ImGui::Text("Virtual texture pages loaded: %zu evicted: %zu", vtStats.pagesLoaded, vtStats.pagesEvicted);
+	}
+	else if (m_terrainTextureBuild.valid())
+	{
+		ImGui::Text("Virtual texture: building page file");
+	}
 
-	//Terrain texture object
+	// Compares driver mip generation against CPU generated and cached chains
+	if (ImGui::Button("Time texture loading"))
+		m_textureBenchmarkReport = m_textureCache.BenchmarkLoadPaths();
+	if (!m_textureBenchmarkReport.empty())
+		ImGui::TextUnformatted(m_textureBenchmarkReport.c_str());
 
-	glGenTextures(1, &terrainMesh.tex);
+	if (ImGui::Button("Time frustum culling"))
+		m_cullBenchmarkReport = Helpers::BenchmarkFrustumCulling();
+	if (!m_cullBenchmarkReport.empty())
+		ImGui::TextUnformatted(m_cullBenchmarkReport.c_str());
 
-	glBindTexture(GL_TEXTURE_2D, terrainMesh.tex);
+	if (ImGui::Button("Time occlusion culling"))
+		m_occlusionBenchmarkReport = Helpers::BenchmarkOcclusionCulling();
+	if (!m_occlusionBenchmarkReport.empty())
+		ImGui::TextUnformatted(m_occlusionBenchmarkReport.c_str());
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if (ImGui::Button("Time image resampling"))
+		m_resampleBenchmarkReport = Helpers::BenchmarkResampler();
+	if (!m_resampleBenchmarkReport.empty())
+		ImGui::TextUnformatted(m_resampleBenchmarkReport.c_str());
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	ImGui::End();
+}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+// Upload a loaded mesh into the geometry pool
+Mesh Renderer::CreateMesh(const Helpers::Mesh& mesh)
+{
+	Mesh newMesh;
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	newMesh.name = std::string(mesh.name);
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GrassTexture.Width(), GrassTexture.Height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, GrassTexture.GetData());
+	newMesh.localBounds = mesh.bounds;
+	newMesh.localSphere = mesh.boundingSphere;
 
-	glGenerateMipmap(GL_TEXTURE_2D);
+	if (!mesh.uvCoords.empty())
+		newMesh.uvDensity = ComputeUVDensity(mesh.vertices.data(), mesh.uvCoords.data(), mesh.elements.data(), mesh.elements.size());
 
-	GLuint normalsVBO;
+	// Into the shared buffers, attributes the mesh does not have are left zero
+	m_geometryPool.Add(mesh.vertices.data(), mesh.normals.empty() ? nullptr : mesh.normals.data(),
+		mesh.uvCoords.empty() ? nullptr : mesh.uvCoords.data(), mesh.vertices.size(), mesh.elements.data(), mesh.elements.size(),
+		newMesh.geometry);
 
-	glGenBuffers(1, &normalsVBO);
+	return newMesh;
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
+// Vertex data of several meshes appended together, mesh points into the vectors
+struct MergedMesh
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> uvCoords;
+	std::vector<unsigned int> elements;
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * normals.size(), normals.data(), GL_STATIC_DRAW);
+	Helpers::Mesh mesh;
+};
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+// Combines meshes that share a texture and have the same attributes so they can be drawn at once
+static void MergeMeshes(const std::vector<const Helpers::Mesh*>& meshes, MergedMesh& merged)
+{
+	for (const Helpers::Mesh* mesh : meshes)
+	{
+		const unsigned int base{ (unsigned int)merged.vertices.size() };
 
-	GLuint TexVBO;
+		merged.vertices.insert(merged.vertices.end(), mesh->vertices.begin(), mesh->vertices.end());
+		merged.normals.insert(merged.normals.end(), mesh->normals.begin(), mesh->normals.end());
+		merged.uvCoords.insert(merged.uvCoords.end(), mesh->uvCoords.begin(), mesh->uvCoords.end());
 
-	glGenBuffers(1, &TexVBO);
+		for (unsigned int element : mesh->elements)
+			merged.elements.push_back(base + element);
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, TexVBO);
+	merged.mesh.name = meshes.front()->name;
+	merged.mesh.materialIndex = meshes.front()->materialIndex;
+	merged.mesh.vertices = { merged.vertices.data(), merged.vertices.size() };
+	merged.mesh.normals = { merged.normals.data(), merged.normals.size() };
+	merged.mesh.uvCoords = { merged.uvCoords.data(), merged.uvCoords.size() };
+	merged.mesh.elements = { merged.elements.data(), merged.elements.size() };
+	merged.mesh.CalculateBounds();
+}
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * uvCoords.size(), uvCoords.data(), GL_STATIC_DRAW);
+// Packs the files marked packable into the texture atlas, decoding them in parallel. Returns where each ended up,
+// invalid for files not packed.
+std::vector<Helpers::AtlasRegion> Renderer::PackIntoAtlas(const std::vector<std::string>& filepaths, const std::vector<bool>& packable)
+{
+	std::vector<Helpers::AtlasRegion> regions(filepaths.size());
+	std::vector<size_t> toDecode;
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	for (size_t i = 0; i < filepaths.size(); i++)
+	{
+		if (!packable[i])
+			continue;
 
-	//Terrain element buffer
+		// Already packed by an earlier model
+		regions[i] = m_textureAtlas.Find(filepaths[i]);
+		if (regions[i].IsValid())
+			continue;
 
-	terrainMesh.numElements = elements.size();
+		int width{ 0 }, height{ 0 };
+		if (Helpers::ImageLoader::ReadSize(filepaths[i], width, height) && m_textureAtlas.Accepts(width, height))
+			toDecode.push_back(i);
+	}
 
-	GLuint elementEBO;
+	if (toDecode.empty())
+		return regions;
 
-	glGenBuffers(1, &elementEBO);
+	std::vector<Helpers::ImageLoader> images(toDecode.size());
+	std::vector<char> loaded(toDecode.size(), 0);
+	Helpers::ThreadPool::Global().ParallelFor(toDecode.size(), [&](size_t i)
+	{
+		loaded[i] = images[i].Load(filepaths[toDecode[i]]);
+	});
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementEBO);
+	// Packing has to be in order, the page contents depend on it
+	for (size_t i = 0; i < toDecode.size(); i++)
+	{
+		if (loaded[i])
+			regions[toDecode[i]] = m_textureAtlas.Add(filepaths[toDecode[i]], images[i].GetData(), images[i].Width(), images[i].Height());
+	}
 
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * elements.size(), elements.data(), GL_STATIC_DRAW);
+	m_textureAtlas.Upload();
+	return regions;
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+// Load a model from file, uploading each mesh and resolving its material textures through the texture cache.
+// With useAtlas small textures are packed into the shared atlas, then meshes sharing a texture are merged into one draw.
+bool Renderer::LoadModel(Model& model, const std::string& filepath, const Helpers::TextureSettings& textureSettings, bool useAtlas)
+{
+	Helpers::ModelLoader loader;
+	if (!loader.LoadFromFile(filepath))
+		return false;
 
-	
-	
-	//Terrain VAO
-	glGenVertexArrays(1, &terrainMesh.vao);
-	
-	glBindVertexArray(terrainMesh.vao);
+	// Material texture filenames are relative to the model
+	const fs::path directory{ fs::path(filepath).parent_path() };
+	const std::vector<Helpers::Material>& materials{ loader.GetMaterialVector() };
+	std::vector<Helpers::Mesh>& meshes{ loader.GetMeshVector() };
 
-	glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
+	std::vector<std::string> texturePaths;
+	std::vector<size_t> materialToPath(materials.size(), SIZE_MAX);
+	for (size_t m = 0; m < materials.size(); m++)
+	{
+		if (materials[m].diffuseTextureFilename.empty())
+			continue;
 
-	glEnableVertexAttribArray(0);
+		// Exporters often store the artist's folder structure so fall back to looking next to the model
+		fs::path texturePath{ directory / materials[m].diffuseTextureFilename };
+		if (!fs::exists(texturePath))
+			texturePath = directory / fs::path(materials[m].diffuseTextureFilename).filename();
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		materialToPath[m] = texturePaths.size();
+		texturePaths.push_back(texturePath.string());
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
+	std::vector<size_t> meshToPath(meshes.size(), SIZE_MAX);
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		if (meshes[i].materialIndex < materials.size())
+			meshToPath[i] = materialToPath[meshes[i].materialIndex];
+	}
 
-	glEnableVertexAttribArray(1);
+	// A texture can only be packed if every mesh using it keeps its coordinates inside it
+	std::vector<bool> packable(texturePaths.size(), useAtlas);
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		if (meshToPath[i] != SIZE_MAX && !Helpers::TextureAtlas::FitsUnitSquare(meshes[i].uvCoords.data(), meshes[i].uvCoords.size()))
+			packable[meshToPath[i]] = false;
+	}
 
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	const std::vector<Helpers::AtlasRegion> regions{ useAtlas ? PackIntoAtlas(texturePaths, packable) :
+		std::vector<Helpers::AtlasRegion>(texturePaths.size()) };
 
-	glBindBuffer(GL_ARRAY_BUFFER, TexVBO);
+	// Everything not packed is decoded in parallel through the cache
+	std::vector<std::string> cachePaths;
+	std::vector<size_t> pathToCache(texturePaths.size(), SIZE_MAX);
+	for (size_t i = 0; i < texturePaths.size(); i++)
+	{
+		if (!regions[i].IsValid())
+		{
+			pathToCache[i] = cachePaths.size();
+			cachePaths.push_back(texturePaths[i]);
+		}
+	}
 
-	glEnableVertexAttribArray(2);
+	const std::vector<GLuint> cacheTextures{ m_textureCache.AcquireBatch(cachePaths, textureSettings) };
 
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	// Texture of each mesh, packed meshes have their coordinates moved into the atlas page
+	std::vector<GLuint> meshTextures(meshes.size(), 0);
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		const size_t path{ meshToPath[i] };
+		if (path == SIZE_MAX)
+			continue;
 
-	//Terrain EBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementEBO);
+		if (regions[path].IsValid())
+		{
+			for (glm::vec2& uv : meshes[i].uvCoords)
+				uv = regions[path].Remap(uv);
+			meshTextures[i] = m_textureAtlas.PageTexture(regions[path].page);
+		}
+		else
+		{
+			meshTextures[i] = cacheTextures[pathToCache[path]];
+		}
+	}
 
-	glBindVertexArray(0);
+	// Meshes that now differ only by texture become one draw
+	std::vector<std::vector<const Helpers::Mesh*>> groups;
+	std::map<std::tuple<GLuint, bool, bool>, size_t> groupLookup;
+	std::vector<GLuint> groupTextures;
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		const auto key{ std::make_tuple(meshTextures[i], meshes[i].normals.empty(), meshes[i].uvCoords.empty()) };
+		auto found{ groupLookup.find(key) };
+		if (found == groupLookup.end())
+		{
+			found = groupLookup.emplace(key, groups.size()).first;
+			groups.emplace_back();
+			groupTextures.push_back(meshTextures[i]);
+		}
+		groups[found->second].push_back(&meshes[i]);
+	}
 
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		Mesh newMesh;
+		if (groups[g].size() == 1)
+		{
+			newMesh = CreateMesh(*groups[g].front());
+		}
+		else
+		{
+			MergedMesh merged;
+			MergeMeshes(groups[g], merged);
+			newMesh = CreateMesh(merged.mesh);
+		}
 
-	Terrain.meshVector.push_back(terrainMesh);
+		// Atlas pages are owned by the atlas, AddRef ignores them
+		const GLuint texture{ groupTextures[g] };
+		if (texture != 0)
+		{
+			m_textureCache.AddRef(texture);
+			newMesh.tex = texture;
+		}
+		else
+		{
+			newMesh.tex = m_textureCache.GetWhiteTexture();
+		}
 
+		model.meshVector.push_back(newMesh);
+	}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////JEEP MODEL///////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// The batch gave one reference per material, each mesh now holds its own
+	for (GLuint texture : cacheTextures)
+		m_textureCache.Release(texture);
 
-	Model jeep;
-	
-	jeep.ModelName = "jeep";
+	// Everything is now on the GPU so free the CPU copy in one go
+	loader.ReleaseCPUData();
 
+	return true;
+}
 
-	// Load in the jeep
-	Helpers::ModelLoader JeepLoad;
-	if (!JeepLoad.LoadFromFile("Data\\Models\\Jeep\\jeep.obj"))
-		return false;
+// Builds the terrain page file on a worker if it is missing or out of date
+void Renderer::StartTerrainTextureBuild()
+{
+	// BC1 quarters the file and physical texture where the driver has it, otherwise plain RGBA8 at half the size
+	const bool compress{ GLEW_EXT_texture_compression_s3tc != 0 };
+	const Helpers::VirtualTextureFormat format{ compress ? Helpers::VirtualTextureFormat::BC1 : Helpers::VirtualTextureFormat::RGBA8 };
+	const int virtualSize{ compress ? 8192 : 4096 };
 
-	//Load in the jeep texture
-	Helpers::ImageLoader JeepTexture;
-	if (JeepTexture.Load("Data\\Models\\Jeep\\jeep_army.jpg"))
+	m_terrainTextureBuild = Helpers::ThreadPool::Global().Submit([format, virtualSize]()
 	{
+		const std::vector<std::string> files{ "Data\\Heightmaps\\curvy.gif", "Data\\Textures\\grass_green-01_df_.dds",
+			"Data\\Textures\\dirt_earth-n-moss_df_.dds" };
 
+		const uint64_t stamp{ TerrainTextureStamp(files, virtualSize, format) };
+		if (stamp == 0)
+			return false;
+		if (Helpers::VirtualTexture::IsFileCurrent(kTerrainPageFile, stamp))
+			return true;
 
+		TerrainTextureSources sources;
+		Helpers::ImageLoader grass, dirt;
+		if (!sources.heightmap.LoadKeepingFormat(files[0]) || !grass.Load(files[1]) || !dirt.Load(files[2]))
+			return false;
 
-	}
-
+		Helpers::GenerateMipChain(grass.GetData(), grass.Width(), grass.Height(), Helpers::MipSettings(), sources.grass);
+		Helpers::GenerateMipChain(dirt.GetData(), dirt.Width(), dirt.Height(), Helpers::MipSettings(), sources.dirt);
 
+		return Helpers::VirtualTexture::BuildFile(kTerrainPageFile, virtualSize, 128, 4, format, stamp,
+			[&sources, virtualSize](int level, int x, int y, int width, int height, BYTE* rgba)
+		{
+			GenerateTerrainTexels(sources, virtualSize, level, x, y, width, height, rgba);
+		});
+	});
+}
 
+// Load / create geometry into OpenGL buffers	
+bool Renderer::InitialiseGeometry()
+{
+	//// Load and compile shaders into m_program
+	//if (!CreateProgram())
+	//	return false;
+	m_program.Load("Data\\Shaders\\vertex_shader.vert", "Data\\Shaders\\fragment_shader.frag");
+	m_cubeProgram.Load("Data\\Shaders\\cube_vertex_shader.vert", "Data\\Shaders\\cube_fragment_shader.frag");
+	m_skyboxProgram.Load("Data\\Shaders\\skybox_vertex_shader.vert", "Data\\Shaders\\skybox_fragment_shader.frag");
+	m_virtualTextureProgram.Load("Data\\Shaders\\vertex_shader.vert", "Data\\Shaders\\vt_terrain.frag");
+	m_virtualFeedbackProgram.Load("Data\\Shaders\\vertex_shader.vert", "Data\\Shaders\\vt_feedback.frag");
+	m_depthProgram.Load("Data\\Shaders\\vertex_shader.vert", "Data\\Shaders\\depth_only.frag");
+	m_cubeDepthProgram.Load("Data\\Shaders\\cube_vertex_shader.vert", "Data\\Shaders\\depth_only.frag");
+
+	// Every mesh program reads the camera from the same binding point
+	for (Helpers::ShaderProgram* program : { &m_program, &m_cubeProgram, &m_virtualTextureProgram, &m_virtualFeedbackProgram,
+		&m_depthProgram, &m_cubeDepthProgram })
+		program->BindBlock("FrameUniforms", kFrameUniformsBinding);
+	m_uniformRing.Create();
+	m_drawCuller.Create("Data\\Shaders\\cull_draws.comp", "Data\\Shaders\\depth_pyramid.comp");
 
-	// Now we can loop through all the mesh in the loaded model:
-	for (const Helpers::Mesh& mesh : JeepLoad.GetMeshVector())
+	Helpers::ImageLoader Heightmap;
+	// Greyscale so kept at a byte per texel
+	if (!Heightmap.LoadKeepingFormat("Data\\Heightmaps\\curvy.gif"))
+	/*if (!Heightmap.LoadKeepingFormat("Data\\Heightmaps\\testHM.png"))*/
 	{
-		// We can extract from the mesh via:
-		//mesh.vertices  - a vector of glm::vec3 (3 floats) giving the position of each vertex
-		//mesh.elements - a vector of unsigned int defining which vert make up each triangle
-		// TODO: create VBO for the vertices and a EBO for the elements
 
-		Mesh jeepMesh;
+	}
 
-		//Jeep VBOs
-		GLuint positionsVBO;
 
-		glGenBuffers(1, &positionsVBO);
 
-		glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
+	Model Terrain;
+	Terrain.ModelName = "Terrain";
+	Terrain.shading = ModelShading::Terrain;
+	
+	Mesh terrainMesh;
 
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * mesh.vertices.size(), mesh.vertices.data(), GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 
-		GLuint normalsVBO;
+	std::vector<glm::vec3> colours;
 
-		glGenBuffers(1, &normalsVBO);
+	std::vector<glm::vec3> vertices;
 
-		glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
+	std::vector<GLuint> elements;
 
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * mesh.normals.size(), mesh.normals.data(), GL_STATIC_DRAW);
+	std::vector<glm::vec2> uvCoords;
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		jeepMesh.numElements = mesh.elements.size();
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec3> positions;
 
-		GLuint elementsEBO;
+	int numCellsX = 250;
+	int numCellsZ = 250;
 
-		glGenBuffers(1, &elementsEBO);
+	int numVertX = numCellsX + 1;
+	int numVertZ = numCellsZ + 1;
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsEBO);
+	int numVerts = numVertX * numVertZ;
 
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * mesh.elements.size(), mesh.elements.data(), GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	positions.resize(numVerts);
+	
+	normals.resize(numVerts);
 
+	for (int i = 0; i < numVerts; i++)
+	{
+		normals[i] = glm::vec3(0, 0, 0);
+	}
+	
 
+	for (int i = 0; i < numVertZ; i++)
+	{
+		for (int j = 0; j < numVertX; j++)
+		{
+			vertices.push_back(glm::vec3(i * 8, 0, j * 8));
+			normals.push_back(glm::vec3(0, 1, 0));
+			colours.push_back(glm::vec3(0, 0, 1));
 
-		//Jeep texture object
-		glGenTextures(1, &jeepMesh.tex);
+			uvCoords.push_back(glm::vec2((j / (float)numCellsX), (i / (float)numCellsZ)));
 
-		glBindTexture(GL_TEXTURE_2D, jeepMesh.tex);
+		}
+	}
+	
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// Filtered to exactly a texel per vertex rather than point sampled, which aliases when the sizes differ.
+	// Resampled as R16 so the heights keep the fractions filtering gives them.
+	Heightmap.Convert(Helpers::PixelFormat::R16);
+	Helpers::ImageLoader gridHeights;
+	Helpers::ResampleImage(Heightmap, numVertX, numVertZ, Helpers::ResampleFilter::Bilinear, gridHeights);
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	for (int Z = 0; Z < numVertZ; Z++)
+	{
+		for (int X = 0; X < numVertX; X++)
+		{
+			float height = gridHeights.GetTexelValue(X, Z) * 255.0f;
+			int myvec = (Z * numVertX) + X;
+			vertices[myvec].y = height / 2;
+		}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// Instanced models are scattered over the grid points
+	m_scatterPoints = vertices;
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, JeepTexture.Width(), JeepTexture.Height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, JeepTexture.GetData());
 
-		glGenerateMipmap(GL_TEXTURE_2D);
+	terrainMesh.localBounds = Helpers::ComputeAABB(vertices.data(), vertices.size());
+	terrainMesh.localSphere = Helpers::ComputeBoundingSphere(vertices.data(), vertices.size(), terrainMesh.localBounds);
 
+	// A few thousand triangles are plenty for the hills to hide what is behind them
+	Terrain.occluder = BuildTerrainOccluder(vertices, numVertX, numVertZ, 10);
 
-		GLuint TexVBO;
+	//Tessellation 
+	bool toggleDiamondPattern = true;
 
-		glGenBuffers(1, &TexVBO);
+	for (int cellZ = 0; cellZ < numCellsZ; cellZ++)
+	{
+		for (int cellX = 0; cellX < numCellsX; cellX++)
+		{
+			int StartVertIndex = (cellZ * numVertX) + cellX;
 
-		glBindBuffer(GL_ARRAY_BUFFER, TexVBO);
+			if (toggleDiamondPattern)
+			{
+				elements.push_back(StartVertIndex);
+				elements.push_back(StartVertIndex + 1);
+				elements.push_back(StartVertIndex + numVertX + 1);
 
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * mesh.uvCoords.size(), mesh.uvCoords.data(), GL_STATIC_DRAW);
+				elements.push_back(StartVertIndex);
+				elements.push_back(StartVertIndex + numVertX + 1);
+				elements.push_back(StartVertIndex + numVertX);
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+			}
 
+			else
+			{
+				elements.push_back(StartVertIndex);
+				elements.push_back(StartVertIndex + 1);
+				elements.push_back(StartVertIndex + numVertX);
 
+				elements.push_back(StartVertIndex + 1);
+				elements.push_back(StartVertIndex + numVertX + 1);
+				elements.push_back(StartVertIndex + numVertX);
 
-		//Jeep VAO
+			}
+			toggleDiamondPattern = !toggleDiamondPattern;
+		}
+		toggleDiamondPattern = !toggleDiamondPattern;
+	}
 
-		glGenVertexArrays(1, &jeepMesh.vao);
 
-		glBindVertexArray(jeepMesh.vao);
+	//Calculating normals
+	for (int e = 0; e < elements.size(); e += 3)
+	{
+		positions[0] = vertices[elements[e]];
+		positions[1] = vertices[elements[(size_t)e + 1]];
+		positions[2] = vertices[elements[(size_t)e + 2]];
 
-		glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
+		glm::vec3 edge1 = positions[1] - positions[0];
+		glm::vec3 edge2 = positions[2] - positions[0];
 
-		glEnableVertexAttribArray(0);
 
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		normals[elements[e]] += glm::cross(edge1, edge2);
+		normals[elements[(size_t)e + 1]] += glm::cross(edge1, edge2);
+		normals[elements[(size_t)e + 2]] += glm::cross(edge1, edge2);
+		
+	}
 
-		glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
+	//normalising the normals
+	for (int n = 0; n < normals.size(); n++)
+	{
+		glm::normalize(normals[n]);
+	}
 
-		glEnableVertexAttribArray(1);
+	//Terrain texture object, streamed so only the mip levels the view needs are resident.
+	//Used until the virtual texture is ready, or if it is turned off. Its first levels upload through the cache's mapped buffer.
+	m_textureStreamer.SetUploadRing(m_textureCache.GetUploadRing());
+	terrainMesh.tex = m_textureStreamer.Add("Data\\Textures\\grass.jpg");
+	StartTerrainTextureBuild();
 
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	//Terrain geometry, in the shared buffers with everything else
+	terrainMesh.uvDensity = ComputeUVDensity(vertices.data(), uvCoords.data(), elements.data(), elements.size());
+	m_geometryPool.Add(vertices.data(), normals.data(), uvCoords.data(), vertices.size(), elements.data(), elements.size(), terrainMesh.geometry);
 
-		glBindBuffer(GL_ARRAY_BUFFER, TexVBO);
 
-		glEnableVertexAttribArray(2);
+	Terrain.meshVector.push_back(terrainMesh);
 
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////JEEP MODEL///////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsEBO);
+	Model jeep;
+	
+	jeep.ModelName = "jeep";
 
-		glBindVertexArray(0);
 
+	// Load in the jeep, its textures are picked up from its materials
+	if (!LoadModel(jeep, "Data\\Models\\Jeep\\jeep.obj"))
+		return false;
 
-		jeep.meshVector.emplace_back(jeepMesh);
-	}
+	jeep.SetTransform(glm::translate(glm::scale(glm::mat4(1), glm::vec3(0.5f)), glm::vec3(2000, 10, 2500)));
 
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -484,6 +1042,8 @@ bool Renderer::InitialiseGeometry()
 	Model cube;
 
 	cube.ModelName = "cube";
+	cube.shading = ModelShading::VertexColour;
+	cube.spins = true;
 
 	Mesh theCube;
 
@@ -648,257 +1208,201 @@ bool Renderer::InitialiseGeometry()
 	cubeElements.push_back(21);
 
 
-	//Cube VBO
-
-	GLuint CubePositionsVBO;
-
-	glGenBuffers(1, &CubePositionsVBO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, CubePositionsVBO);
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)* cubeVertices.size(), cubeVertices.data(), GL_STATIC_DRAW);
-
-	//Clearing buffer
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	GLuint CubeColoursVBO;
-	glGenBuffers(1, &CubeColoursVBO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, CubeColoursVBO);
-
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)* cubeColours.size(), cubeColours.data(), GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	//Cube element buffer
-
-	theCube.numElements = elements.size();
-
-	GLuint CubeElementEBO;
-
-	glGenBuffers(1, &CubeElementEBO);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, CubeElementEBO);
-
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)* cubeElements.size(), cubeElements.data(), GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	//Cube geometry, the colours go in the attribute the cube shader reads them from
+	m_geometryPool.Add(cubeVertices.data(), (const glm::vec3*)cubeColours.data(), nullptr, cubeVertices.size(),
+		cubeElements.data(), cubeElements.size(), theCube.geometry);
 
 
-
-	/*
-		TODO 4: Finally create a VAO to wrap the buffers. You need to specify the streams for the positions
-		(attribute 0) and colours (attribute 1). You also need to bind the element buffer.
-		Use the member variable m_VAO
-	*/
-
-	//VBO
-	glGenVertexArrays(1, &theCube.vao);
-
-	glBindVertexArray(theCube.vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, CubePositionsVBO);
-
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-	glBindBuffer(GL_ARRAY_BUFFER, CubeColoursVBO);
-
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-	//EBO
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, CubeElementEBO);
-
-	glBindVertexArray(0);
-
+	theCube.localBounds = Helpers::ComputeAABB(cubeVertices.data(), cubeVertices.size());
+	theCube.localSphere = Helpers::ComputeBoundingSphere(cubeVertices.data(), cubeVertices.size(), theCube.localBounds);
 
 	cube.meshVector.push_back(theCube);
 
+	// The cube's own triangles are few enough to occlude with directly
+	cube.occluder = std::make_shared<Helpers::OccluderMesh>(Helpers::OccluderMesh{ cubeVertices, cubeElements });
+
 /////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////SKYBOX///////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////
 
 
-	Model skybox;
-
-	skybox.ModelName = "skybox";
-
-
-	Helpers::ModelLoader skyboxLoad;
-	
-
-	if (!skyboxLoad.LoadFromFile("Data\\Models\\Sky\\Clouds\\skybox.x"))
+	// One cubemap drawn after the scene, resampled from the six faces of the sky model
+	if (!m_skybox.Load(kSkySets[m_skyIndex].filepath))
 		return false;
-	
-	int TextureIndex = 0;
-
-	for (const Helpers::Mesh& mesh : skyboxLoad.GetMeshVector())
-	{
-
-		Mesh skyboxMesh;
-
-		GLuint positionsVBO;
-
-		//Skybox VBO
-		glGenBuffers(1, &positionsVBO);
-
-		glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
-
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * mesh.vertices.size(), mesh.vertices.data(), GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-
-		GLuint normalsVBO;
-
-		glGenBuffers(1, &normalsVBO);
-
-		glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
-
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * mesh.normals.size(), mesh.normals.data(), GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-		skyboxMesh.numElements = mesh.elements.size();
-
-		GLuint elementsEBO;
-
-		glGenBuffers(1, &elementsEBO);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsEBO);
-
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * mesh.elements.size(), mesh.elements.data(), GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	//Pushing back each model created above
+	modelVector.emplace_back(Terrain);
+	modelVector.emplace_back(jeep);
+	modelVector.emplace_back(cube);
 
-		GLuint TexVBO;
+	// Copies sharing the cube and jeep geometry, drawn once per mesh for all their instances
+	Model cubeField{ cube };
+	cubeField.ModelName = "cube field";
+	m_cubeField = RegisterInstancedModel(cubeField);
+	ScatterInstances(m_cubeField, m_cubeFieldCount, 0.5f, 5.0f);
 
-		glGenBuffers(1, &TexVBO);
+	Model jeepField{ jeep };
+	jeepField.ModelName = "jeep field";
+	jeepField.SetTransform(glm::mat4(1));
+	m_jeepField = RegisterInstancedModel(jeepField);
+	ScatterInstances(m_jeepField, m_jeepFieldCount, 0.5f, 0.0f);
 
-		glBindBuffer(GL_ARRAY_BUFFER, TexVBO);
+	for (Model& model : modelVector)
+	{
+		if (!model.instanced)
+			model.UpdateWorldBounds();
+	}
 
-		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * mesh.uvCoords.size(), mesh.uvCoords.data(), GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
 
+// Adds a model drawn once per instance, returning its index
+size_t Renderer::RegisterInstancedModel(Model model)
+{
+	model.instanced = true;
+	model.instanceSet = m_instances.CreateSet();
+	model.instanceVersion = UINT64_MAX;
+	model.boundsDirty = true;
+	modelVector.push_back(std::move(model));
+	return modelVector.size() - 1;
+}
 
-		//Skybox VAO
-		glGenVertexArrays(1, &skyboxMesh.vao);
+uint32_t Renderer::AddInstance(size_t model, const glm::mat4& transform, const glm::vec4& tint)
+{
+	return m_instances.Add(modelVector[model].instanceSet, transform, tint);
+}
 
-		glBindVertexArray(skyboxMesh.vao);
+void Renderer::UpdateInstance(size_t model, uint32_t instance, const glm::mat4& transform, const glm::vec4& tint)
+{
+	m_instances.Update(modelVector[model].instanceSet, instance, transform, tint);
+}
 
-		glBindBuffer(GL_ARRAY_BUFFER, positionsVBO);
+void Renderer::ClearInstances(size_t model)
+{
+	m_instances.Clear(modelVector[model].instanceSet);
+}
 
-		glEnableVertexAttribArray(0);
+// Gives an instanced model count instances at random terrain points, keeping those it already has when growing
+void Renderer::ScatterInstances(size_t model, int count, float scale, float lift)
+{
+	if (model >= modelVector.size() || m_scatterPoints.empty())
+		return;
 
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	const Helpers::InstanceBuffer::SetId set{ modelVector[model].instanceSet };
+	if ((uint32_t)count < m_instances.Count(set))
+		m_instances.Clear(set);
 
-		glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
+	// Seeded by instance so an instance lands in the same place however the count got to it
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (uint32_t i = m_instances.Count(set); i < (uint32_t)count; i++)
+	{
+		std::mt19937 random{ (uint32_t)(model * 100003 + i) };
+		const glm::vec3 point{ m_scatterPoints[random() % m_scatterPoints.size()] };
 
-		glEnableVertexAttribArray(1);
+		glm::mat4 transform{ glm::translate(glm::mat4(1), point + glm::vec3(0, lift, 0)) };
+		transform = glm::rotate(transform, unit(random) * glm::two_pi<float>(), glm::vec3(0, 1, 0));
+		transform = glm::scale(transform, glm::vec3(scale));
 
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		const glm::vec4 tint{ 0.5f + 0.5f * unit(random), 0.5f + 0.5f * unit(random), 0.5f + 0.5f * unit(random), 1.0f };
+		m_instances.Add(set, transform, tint);
+	}
+}
 
-		glBindBuffer(GL_ARRAY_BUFFER, TexVBO);
+// Moves the overdraw sweep on to the next pass order once the current one has been measured
+void Renderer::UpdateOverdrawSweep()
+{
+	if (m_overdrawSweep < 0)
+		return;
 
-		glEnableVertexAttribArray(2);
+	// Results come back a few frames late, so frames drawn before the switch are skipped
+	if (m_overdraw.FramesMeasured() > m_overdrawSweepStart + Helpers::OverdrawCounter::kFramesInFlight)
+	{
+		char line[160];
+		snprintf(line, sizeof(line), "%s: %.2f per pixel (prepass %.2f, opaque %.2f, sky %.2f)\n", kPassOrders[m_overdrawSweep].name,
+			m_overdraw.TotalPerPixel(), m_overdraw.PerPixel(kPrepassPass), m_overdraw.PerPixel(kOpaquePass), m_overdraw.PerPixel(kSkyPass));
+		m_overdrawReport += line;
 
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		m_overdrawSweep++;
+		m_overdrawSweepStart = m_overdraw.FramesMeasured();
+	}
 
+	if (m_overdrawSweep >= (int)std::size(kPassOrders))
+	{
+		m_depthPrepass = m_sweepSavedPrepass;
+		m_skyLast = m_sweepSavedSkyLast;
+		m_overdrawSweep = -1;
+		return;
+	}
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsEBO);
+	m_depthPrepass = kPassOrders[m_overdrawSweep].depthPrepass;
+	m_skyLast = kPassOrders[m_overdrawSweep].skyLast;
+}
 
-		glBindVertexArray(0);
+// Animate the models and bring their world bounds up to date
+void Renderer::UpdateModels(float deltaTime)
+{
+	for (Model& model : modelVector)
+	{
+		if (model.spins)
+		{
+			glm::mat4 model_xform = glm::scale(glm::mat4(1), glm::vec3{ 10,10,10 });
+			model_xform = glm::translate(model_xform, glm::vec3(100, 25, 0));
 
+			if (m_cubeRotateY) // Rotate around y axis		
+				model_xform = glm::rotate(model_xform, m_cubeAngle, glm::vec3{ 0 ,1,0 });
+			else // Rotate around x axis		
+				model_xform = glm::rotate(model_xform, m_cubeAngle, glm::vec3{ 1 ,0,0 });
 
-		//Switching between each texture for each face of the skybox
-		Helpers::ImageLoader hillsTexture;
-		switch (TextureIndex)
-		{
-		case 0:
-			if (!hillsTexture.Load("Data\\Models\\Sky\\Clouds\\SkyBox_Top.tga"))
-			{
-				return false;
-			}
-			break;
-		case 1:
-			if (!hillsTexture.Load("Data\\Models\\Sky\\Clouds\\SkyBox_Right.tga"))
-			{
-				return false;
-			}
-			break;
-		case 2:
-			if (!hillsTexture.Load("Data\\Models\\Sky\\Clouds\\SkyBox_Left.tga"))
-			{
-				return false;
-			}
-			break;
-		case 3:
-			if (!hillsTexture.Load("Data\\Models\\Sky\\Clouds\\SkyBox_Front.tga"))
-			{
-				return false;
-			}
-			break;
-		case 4:
-			if (!hillsTexture.Load("Data\\Models\\Sky\\Clouds\\SkyBox_Back.tga"))
-			{
-				return false;
-			}
-			break;
-		case 5:
-			if (!hillsTexture.Load("Data\\Models\\Sky\\Clouds\\SkyBox_Bottom.tga"))
+			m_cubeAngle += 0.001f;
+			if (m_cubeAngle > glm::two_pi<float>())
 			{
-				return false;
+				m_cubeAngle = 0;
+				m_cubeRotateY = !m_cubeRotateY;
 			}
-			break;
-		}
-
-		//Skybox texture object
-		glGenTextures(1, &skyboxMesh.tex);
-
-		glBindTexture(GL_TEXTURE_2D, skyboxMesh.tex);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, hillsTexture.Width(), hillsTexture.Height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, hillsTexture.GetData());
-
-		glGenerateMipmap(GL_TEXTURE_2D);
-
 
+			model.SetTransform(model_xform);
+		}
 
-		skybox.meshVector.emplace_back(skyboxMesh);
+		// Instanced model bounds follow their instances
+		if (model.instanced && model.instanceVersion != m_instances.Version(model.instanceSet))
+		{
+			model.boundsDirty = true;
+			model.instanceVersion = m_instances.Version(model.instanceSet);
+		}
 
-		TextureIndex++;
+		// Only does work for models whose transform or instances changed
+		model.UpdateWorldBounds(model.instanced ? &m_instances.Instances(model.instanceSet) : nullptr);
 	}
-
-	//Pushing back each model created above
-	modelVector.emplace_back(skybox);
-	modelVector.emplace_back(Terrain);
-	modelVector.emplace_back(jeep);
-	modelVector.emplace_back(cube);
-
-	
-
-
-	return true;
 }
 
 // Render the scene. Passed the delta time since last called.
 void Renderer::Render(const Helpers::Camera& camera, float deltaTime)
 {			
+	// Frames while a sky switch runs are also counted on their own
+	m_frameTimes.Add(deltaTime * 1000.0f);
+	if (m_skybox.IsLoading())
+		m_skySwitchFrameTimes.Add(deltaTime * 1000.0f);
+
+	// Finish any textures that have loaded in the background, stream levels from last frame's usage
+	m_textureCache.Update();
+	m_textureStreamer.Update();
+	m_skybox.Update();
+
+	// The terrain switches over to its virtual texture once the page file is ready
+	if (m_terrainTextureBuild.valid() && m_terrainTextureBuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		if (!m_terrainTextureBuild.get() || !m_terrainTexture.Open(kTerrainPageFile))
+			std::cout << "Terrain virtual texture unavailable, using the streamed texture" << std::endl;
+	}
+
+	const bool virtualTerrain{ m_useVirtualTexture && m_terrainTexture.IsOpen() && m_virtualTextureProgram.IsValid() && m_virtualFeedbackProgram.IsValid() };
+	if (virtualTerrain)
+		m_terrainTexture.Update();
+
+	UpdateModels(deltaTime);
+	UpdateOverdrawSweep();
+
 	// Configure pipeline settings
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
@@ -917,129 +1421,238 @@ void Renderer::Render(const Helpers::Camera& camera, float deltaTime)
 	GLint viewportSize[4];
 	glGetIntegerv(GL_VIEWPORT, viewportSize);
 	const float aspect_ratio = viewportSize[2] / (float)viewportSize[3];
-	glm::mat4 projection_xform = glm::perspective(glm::radians(45.0f), aspect_ratio, 0.1f, 4000.0f);
+	const float fieldOfView{ glm::radians(45.0f) };
+	const float nearPlane{ 0.1f };
+	const float farPlane{ 4000.0f };
+	glm::mat4 projection_xform = glm::perspective(fieldOfView, aspect_ratio, nearPlane, farPlane);
 
-	// Compute camera view matrix and combine with projection matrix for passing to shader
-	/*glm::mat4 view_xform = glm::lookAt(camera.GetPosition(), camera.GetPosition() + camera.GetLookVector(), camera.GetUpVector());
-	glm::mat4 combined_xform = projection_xform * view_xform;*/
+	m_overdraw.BeginFrame(viewportSize[2] * viewportSize[3]);
 
+	// Screen pixels covered by one world unit at a distance of one, for texture streaming feedback
+	const float pixelsPerUnit{ viewportSize[3] / (2.0f * std::tan(fieldOfView * 0.5f)) };
 
-	// Send the combined matrix to the shader in a uniform
-	
-	glm::mat4 model_xform = glm::mat4(1);
+	// Compute camera view matrix and combine with projection matrix for passing to shader
+	const glm::mat4 view_xform = glm::lookAt(camera.GetPosition(), camera.GetPosition() + camera.GetLookVector(), camera.GetUpVector());
 
-	
-	//Looping through each mesh of each model 
-	for (Model& model : modelVector)
-	{
-		for (Mesh& mesh : model.meshVector)
-		{
-			if (model.ModelName == "skybox")
-			{
-				//Disabling the depth mask and depth test for the skybox
-				glDepthMask(GL_FALSE);
-				glDisable(GL_DEPTH_TEST);
-				
+	// The camera block is written and bound once for every program, per draw transforms go with each multi-draw
+	m_uniformRing.BeginFrame();
 
+	FrameUniforms frameUniforms;
+	frameUniforms.combined_xform = projection_xform * view_xform;
+	frameUniforms.view_xform = view_xform;
+	frameUniforms.projection_xform = projection_xform;
+	frameUniforms.camera_position = glm::vec4(camera.GetPosition(), 1.0f);
 
-				glm::mat4 view_xform = glm::lookAt(camera.GetPosition(), camera.GetPosition() + camera.GetLookVector(), camera.GetUpVector());
-				glm::mat4 view_xform2 = glm::mat4(glm::mat3(view_xform));
-				glm::mat4 combined_xform = projection_xform * view_xform2;
+	size_t frameOffset{ 0 };
+	if (m_uniformRing.Write(frameUniforms, frameOffset))
+		m_uniformRing.Bind(kFrameUniformsBinding, frameOffset, sizeof(FrameUniforms));
 
-				glUseProgram(m_skyboxProgram);
+	Helpers::DrawBindings bindings;
+	bindings.drawDataBinding = kDrawDataBinding;
+	bindings.sampler = kSamplerTex;
+	bindings.textureUnit = 0;
 
-				GLuint combined_xform_id = glGetUniformLocation(m_skyboxProgram, "combined_xform");
-				glUniformMatrix4fv(combined_xform_id, 1, GL_FALSE, glm::value_ptr(combined_xform));
-			}
+	// Low resolution pass writing the virtual texture page each terrain pixel needs, read back in a later frame
+	if (virtualTerrain)
+	{
+		m_terrainTexture.BeginFeedback();
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-			else if (model.ModelName == "cube")
-			{
-				glDepthMask(GL_TRUE);
-				glEnable(GL_DEPTH_TEST);
+		m_feedbackQueue.Clear();
+		for (const Model& model : modelVector)
+		{
+			if (model.shading != ModelShading::Terrain)
+				continue;
 
-				glm::mat4 view_xform = glm::lookAt(camera.GetPosition(), camera.GetPosition() + camera.GetLookVector(), camera.GetUpVector());
-				glm::mat4 combined_xform = projection_xform * view_xform;
+			for (const Mesh& mesh : model.meshVector)
+			{
+				Helpers::DrawCommand command;
+				command.program = &m_virtualFeedbackProgram;
+				command.geometry = mesh.geometry;
+				command.transform = model.transform;
+				m_feedbackQueue.Add(0, command);
+			}
+		}
 
-				glUseProgram(m_cubeProgram);
+		m_feedbackQueue.Execute(m_uniformRing, bindings, [this](Helpers::ShaderProgram& program)
+		{
+			m_terrainTexture.Bind(program, 1);
+		});
 
-				GLuint combined_xform_id = glGetUniformLocation(m_cubeProgram, "combined_xform");
-				glUniformMatrix4fv(combined_xform_id, 1, GL_FALSE, glm::value_ptr(combined_xform));
+		m_terrainTexture.EndFeedback();
+		glPolygonMode(GL_FRONT_AND_BACK, m_wireframe ? GL_LINE : GL_FILL);
+	}
 
-				model_xform = glm::scale(model_xform, glm::vec3{ 10,10,10 });
-				model_xform = glm::translate(model_xform, glm::vec3(100, 25, 0));
+	// Instances that changed since last frame, then every instance for the draws to read
+	m_instances.Upload();
+	m_instances.Bind(kInstanceBinding);
 
-				static float angle = 0;
-				static bool rotateY = true;
+	const Helpers::Frustum frustum{ Helpers::ExtractFrustum(frameUniforms.combined_xform) };
 
-				if (rotateY) // Rotate around y axis		
-					model_xform = glm::rotate(model_xform, angle, glm::vec3{ 0 ,1,0 });
-				else // Rotate around x axis		
-					model_xform = glm::rotate(model_xform, angle, glm::vec3{ 1 ,0,0 });
+	// Mesh boxes in the order the loop below visits them, the tree is refitted to them every frame
+	m_meshBounds.clear();
+	for (const Model& model : modelVector)
+	{
+		for (const Mesh& mesh : model.meshVector)
+			m_meshBounds.push_back(mesh.worldBounds);
+	}
+	m_meshBVH.Refit(m_meshBounds);
 
-				angle += 0.001f;
-				if (angle > glm::two_pi<float>())
-				{
-					angle = 0;
-					rotateY = !rotateY;
-				}
+	m_meshVisible.assign(m_meshBounds.size(), !m_bvhCulling);
+	if (m_bvhCulling)
+	{
+		m_meshBVH.Cull(frustum, m_visibleMeshes);
+		for (uint32_t index : m_visibleMeshes)
+			m_meshVisible[index] = true;
+	}
 
+	// Occluders drawn on the CPU at low resolution, then the meshes still in view tested against them
+	if (m_occlusionCulling)
+	{
+		const int occlusionHeight{ (int)(m_occlusionBuffer.Width() / aspect_ratio) };
+		if (std::abs(occlusionHeight - m_occlusionBuffer.Height()) >= Helpers::OcclusionBuffer::kTileSize)
+			m_occlusionBuffer.Resize(m_occlusionBuffer.Width(), occlusionHeight);
 
-			}
+		m_occlusionBuffer.Begin(frameUniforms.combined_xform);
+		for (const Model& model : modelVector)
+		{
+			if (model.occluder && !model.instanced)
+				m_occlusionBuffer.AddOccluder(*model.occluder, model.transform);
+		}
+		m_occlusionBuffer.Rasterize();
+		m_occlusionBuffer.Cull(m_meshBounds, m_meshVisible);
+	}
 
-			else if (model.ModelName == "jeep")
-			{
-				glDepthMask(GL_TRUE);
-				glEnable(GL_DEPTH_TEST);
+	// Every visible mesh goes in the queue with a key grouping it by program, texture and VAO, nearest first in a group.
+	// The prepass only changes program with the vertex layout, so its queue groups by that and VAO.
+	m_renderQueue.Clear();
+	m_depthQueue.Clear();
+	const glm::vec3 eye{ camera.GetPosition() };
+	size_t meshIndex{ 0 };
 
-				glm::mat4 view_xform = glm::lookAt(camera.GetPosition(), camera.GetPosition() + camera.GetLookVector(), camera.GetUpVector());
-				glm::mat4 combined_xform = projection_xform * view_xform;
+	for (const Model& model : modelVector)
+	{
+		const bool virtualMesh{ virtualTerrain && model.shading == ModelShading::Terrain };
 
-				glUseProgram(m_program);
+		Helpers::ShaderProgram* program{ &m_program };
+		if (model.shading == ModelShading::VertexColour)
+			program = &m_cubeProgram;
+		else if (virtualMesh)
+			program = &m_virtualTextureProgram;
 
-				GLuint combined_xform_id = glGetUniformLocation(m_program, "combined_xform");
-				glUniformMatrix4fv(combined_xform_id, 1, GL_FALSE, glm::value_ptr(combined_xform));
+		const float modelScale{ std::cbrt(std::fabs(glm::determinant(glm::mat3(model.transform)))) };
+		const uint32_t instanceCount{ model.instanced ? m_instances.Count(model.instanceSet) : 0 };
 
-				model_xform = glm::scale(model_xform, glm::vec3{0.5,0.5,0.5});
-				model_xform = glm::translate(model_xform, glm::vec3(2000, 10, 2500));
+		for (const Mesh& mesh : model.meshVector)
+		{
+			if (!m_meshVisible[meshIndex++] || (model.instanced && instanceCount == 0))
+				continue;
+
+			const glm::vec3 outside{ glm::max(glm::max(mesh.worldBounds.minExtents - eye, eye - mesh.worldBounds.maxExtents), glm::vec3(0)) };
+			const float distance{ std::max(glm::length(outside), nearPlane) };
+
+			// Tell the streamer how finely the nearest part of this mesh samples its texture
+			if (!virtualMesh && mesh.uvDensity > 0 && m_textureStreamer.IsStreamed(mesh.tex))
+				m_textureStreamer.ReportUsage(mesh.tex, mesh.uvDensity * distance / (modelScale * pixelsPerUnit));
+
+			Helpers::DrawCommand command;
+			command.program = program;
+			command.texture = mesh.tex;
+			command.geometry = mesh.geometry;
+			command.transform = model.transform;
+			command.bounds = mesh.worldSphere;
+			command.object = (uint32_t)(meshIndex - 1);
+			if (model.instanced)
+			{
+				command.instanceCount = instanceCount;
+				command.firstInstance = m_instances.First(model.instanceSet);
+			}
 
+			m_renderQueue.Add(Helpers::RenderQueue::MakeKey(0, program->Id(), mesh.tex, mesh.geometry.vao, distance / farPlane), command);
 
+			if (m_depthPrepass)
+			{
+				Helpers::DrawCommand depthCommand{ command };
+				depthCommand.program = model.shading == ModelShading::VertexColour ? &m_cubeDepthProgram : &m_depthProgram;
+				depthCommand.texture = 0;
+				m_depthQueue.Add(Helpers::RenderQueue::MakeKey(0, depthCommand.program->Id(), 0, mesh.geometry.vao, distance / farPlane),
+					depthCommand);
 			}
+		}
+	}
 
-			else if (model.ModelName != "cube" && model.ModelName != "jeep" && model.ModelName != "skybox")
-			{
-				glDepthMask(GL_TRUE);
-				glEnable(GL_DEPTH_TEST);
+	m_renderQueue.Sort();
+	m_depthQueue.Sort();
 
-				glm::mat4 view_xform = glm::lookAt(camera.GetPosition(), camera.GetPosition() + camera.GetLookVector(), camera.GetUpVector());
-				glm::mat4 combined_xform = projection_xform * view_xform;
+	m_drawCuller.SetFrustum(frustum);
+	m_drawCuller.SetView(frameUniforms.combined_xform, viewportSize[2], viewportSize[3]);
+
+	// Sky first covers the whole screen, every pixel the scene then covers is shaded twice
+	if (!m_skyLast)
+	{
+		m_overdraw.BeginPass(kSkyPass);
+		glDisable(GL_DEPTH_TEST);
+		glDepthMask(GL_FALSE);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-				glUseProgram(m_program);
+		m_skybox.Render(m_skyboxProgram, view_xform, projection_xform);
 
-				GLuint combined_xform_id = glGetUniformLocation(m_program, "combined_xform");
-				glUniformMatrix4fv(combined_xform_id, 1, GL_FALSE, glm::value_ptr(combined_xform));
-			}
+		glPolygonMode(GL_FRONT_AND_BACK, m_wireframe ? GL_LINE : GL_FILL);
+		m_overdraw.EndPass();
+	}
 
+	// Pass state is set once for each whole queue
+	glEnable(GL_DEPTH_TEST);
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
 
+	// Depth alone, then the shading pass only passes the nearest fragment of each pixel. Culling already decided what
+	// is visible this frame so the shading pass reuses that.
+	if (m_depthPrepass)
+	{
+		m_overdraw.BeginPass(kPrepassPass);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-			// Send the model matrix to the shader in a uniform
-			GLuint model_xform_id = glGetUniformLocation(m_program, "model_xform");
-			glUniformMatrix4fv(model_xform_id, 1, GL_FALSE, glm::value_ptr(model_xform));
+		m_depthQueue.Execute(m_uniformRing, bindings, nullptr, &m_drawCuller);
 
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, mesh.tex);
-			glUniform1i(glGetUniformLocation(m_program, "sampler_tex"), 0);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		m_overdraw.EndPass();
 
-			// Bind our VAO and render
-			glBindVertexArray(mesh.vao);
-			glDrawElements(GL_TRIANGLES, mesh.numElements, GL_UNSIGNED_INT, (void*)0);
-		}
+		glDepthMask(GL_FALSE);
+		glDepthFunc(GL_EQUAL);
+		m_drawCuller.SetVisibilityCurrent(true);
 	}
 
+	m_overdraw.BeginPass(kOpaquePass);
+	m_renderQueue.Execute(m_uniformRing, bindings, [this](Helpers::ShaderProgram& program)
+	{
+		if (&program == &m_virtualTextureProgram)
+			m_terrainTexture.Bind(program, 1);
+	}, &m_drawCuller);
+	m_overdraw.EndPass();
+
+	m_drawCuller.SetVisibilityCurrent(false);
 
+	// Sky last at the far plane, so only the pixels the scene left uncovered are shaded
+	if (m_skyLast)
+	{
+		m_overdraw.BeginPass(kSkyPass);
+		glDepthMask(GL_FALSE);
+		glDepthFunc(GL_LEQUAL);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
+		m_skybox.Render(m_skyboxProgram, view_xform, projection_xform);
+		m_overdraw.EndPass();
+	}
 
+	// Every draw reading this frame's uniform blocks has been issued
+	m_uniformRing.EndFrame();
+	m_overdraw.EndFrame();
 
-	
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
 
+	// Before the GUI is drawn so captures show just the scene
+	m_frameCapture.Update();
 }
 
@@ -5,25 +5,90 @@
 #include "Helper.h"
 #include "Mesh.h"
 #include "Camera.h"
+#include "Bounds.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+#include "VirtualTexture.h"
+#include "TextureAtlas.h"
+#include "Skybox.h"
+#include "FrameTimeHistogram.h"
+#include "FrameCapture.h"
+#include "ShaderProgram.h"
+#include "UniformRing.h"
+#include "RenderQueue.h"
+#include "GeometryPool.h"
+#include "SceneBVH.h"
+#include "InstanceBuffer.h"
+#include "OcclusionBuffer.h"
+#include "OverdrawCounter.h"
 
 
 
 
 struct Mesh
 {
-	GLuint vao;
-	GLuint numElements;
+	// Where the mesh is in the renderer's geometry pool
+	Helpers::GeometryRange geometry;
 	glm::vec3 rotation = glm::vec3(0, 0, 0);
 	std::string name;
 	GLuint tex;
+
+	// Bounds in local model space, calculated once at load
+	Helpers::AABB localBounds;
+	Helpers::BoundingSphere localSphere;
+
+	// Bounds in world space, only recalculated when the model transform changes
+	Helpers::AABB worldBounds;
+	Helpers::BoundingSphere worldSphere;
+
+	// Texture coordinate units per local space unit, tells the texture streamer how finely tex is sampled
+	float uvDensity{ 0 };
 };
 
 
+// How a model is shaded, decided when it is made so drawing never compares names
+enum class ModelShading
+{
+	Textured,
+	VertexColour,
+	Terrain
+};
+
 struct Model
 {
 	std::vector<Mesh> meshVector;
 	GLuint numCubeElements = 0;
 	std::string ModelName;
+	ModelShading shading{ ModelShading::Textured };
+
+	// Turned about its own axis each frame by UpdateModels, set when the model is created
+	bool spins{ false };
+
+	// Model to world transform, use SetTransform so the world bounds are kept up to date
+	glm::mat4 transform{ 1 };
+
+	// Union of the mesh world bounds
+	Helpers::AABB worldBounds;
+
+	// Set when the transform changes so the world bounds are recalculated on the next update
+	bool boundsDirty{ true };
+
+	// Instanced models draw each mesh once per instance in the renderer's instance buffer, placed by transform times
+	// the instance's own. Their world bounds then hold every instance.
+	bool instanced{ false };
+	Helpers::InstanceBuffer::SetId instanceSet{ 0 };
+
+	// Version of the instance set the world bounds were last calculated for
+	uint64_t instanceVersion{ UINT64_MAX };
+
+	// Simplified stand in drawn into the occlusion buffer, shared by copies of the model. Not used when instanced.
+	std::shared_ptr<const Helpers::OccluderMesh> occluder;
+
+	void SetTransform(const glm::mat4& newTransform) { transform = newTransform; boundsDirty = true; }
+
+	// Recalculates the world bounds of each mesh if the transform has changed since the last call. Instanced models
+	// pass their instances.
+	void UpdateWorldBounds(const std::vector<Helpers::InstanceData>* instances = nullptr);
 };
 
 
@@ -31,9 +96,65 @@ class Renderer
 {
 private:
 	// Program object - to host shaders
-	GLuint m_program{ 0 };
-	GLuint m_cubeProgram{ 0 };
-	GLuint m_skyboxProgram{ 0 };
+	Helpers::ShaderProgram m_program;
+	Helpers::ShaderProgram m_cubeProgram;
+	Helpers::ShaderProgram m_skyboxProgram;
+
+	// Depth only versions of the mesh programs for the prepass, with the same vertex shaders so depths match exactly
+	Helpers::ShaderProgram m_depthProgram;
+	Helpers::ShaderProgram m_cubeDepthProgram;
+
+	// Terrain sampled through its virtual texture, and the pass reporting which pages it needs
+	Helpers::ShaderProgram m_virtualTextureProgram;
+	Helpers::ShaderProgram m_virtualFeedbackProgram;
+
+	// Matrices for the mesh programs' uniform blocks, written each frame
+	Helpers::UniformRing m_uniformRing;
+
+	// Static vertex and index data of every mesh
+	Helpers::GeometryPool m_geometryPool;
+
+	// Mesh draws of the frame in state order, and the virtual texture feedback pass's
+	Helpers::RenderQueue m_renderQueue;
+	Helpers::RenderQueue m_feedbackQueue;
+
+	// Pass order: an optional depth prepass so the opaque pass shades each pixel once, and the sky first or last
+	Helpers::RenderQueue m_depthQueue;
+	bool m_depthPrepass{ true };
+	bool m_skyLast{ true };
+
+	// Fragments shaded per pixel by each pass, and a sweep measuring every pass order in turn
+	Helpers::OverdrawCounter m_overdraw;
+	int m_overdrawSweep{ -1 };
+	size_t m_overdrawSweepStart{ 0 };
+	bool m_sweepSavedPrepass{ true };
+	bool m_sweepSavedSkyLast{ true };
+	std::string m_overdrawReport;
+
+	// Frustum culls the mesh draws on the GPU, or the CPU if asked or if the compute shader is unavailable
+	Helpers::DrawCuller m_drawCuller;
+
+	// Mesh world boxes in model then mesh order, and the tree culling them before they are queued
+	Helpers::SceneBVH m_meshBVH;
+	std::vector<Helpers::AABB> m_meshBounds;
+	std::vector<uint32_t> m_visibleMeshes;
+	std::vector<bool> m_meshVisible;
+	bool m_bvhCulling{ true };
+
+	// Meshes hidden behind the terrain and other occluders are dropped before queueing
+	Helpers::OcclusionBuffer m_occlusionBuffer;
+	bool m_occlusionCulling{ true };
+	std::string m_occlusionBenchmarkReport;
+
+	// Transforms and tints of every instanced model's instances
+	Helpers::InstanceBuffer m_instances;
+
+	// Instanced cubes and jeeps scattered over the terrain grid points, counts set in the GUI
+	size_t m_cubeField{ SIZE_MAX };
+	size_t m_jeepField{ SIZE_MAX };
+	int m_cubeFieldCount{ 2000 };
+	int m_jeepFieldCount{ 100 };
+	std::vector<glm::vec3> m_scatterPoints;
 	
 	// Vertex Array Object to wrap all render settings
 	GLuint m_VAO{ 0 };
@@ -48,9 +169,67 @@ private:
 	//Texture
 	GLuint tex;
 
+	// Every texture is loaded through here so meshes using the same image share one GL texture
+	Helpers::TextureCache m_textureCache;
+
+	// Small model textures packed together so their meshes can share draws
+	Helpers::TextureAtlas m_textureAtlas;
+
+	// Textures that only keep the mip levels they are drawn at on the GPU
+	Helpers::TextureStreamer m_textureStreamer;
+
+	// Unique terrain texture far larger than the GPU holds, paged in from a file built on a worker on the first run
+	Helpers::VirtualTexture m_terrainTexture;
+	std::future<bool> m_terrainTextureBuild;
+	bool m_useVirtualTexture{ true };
+
+	// Result of the last texture load benchmark, shown in the GUI
+	std::string m_textureBenchmarkReport;
+
+	// Result of the last image resampling benchmark
+	std::string m_resampleBenchmarkReport;
+	std::string m_cullBenchmarkReport;
+
+	// Sky cubemap and which of the sets it was made from
+	Helpers::Skybox m_skybox;
+	int m_skyIndex{ 0 };
+
+	// Every frame, and just the frames of the last sky switch, to check switching does not hitch
+	Helpers::FrameTimeHistogram m_frameTimes;
+	Helpers::FrameTimeHistogram m_skySwitchFrameTimes;
+
+	// Screenshots and recordings, numbered so each gets its own files
+	Helpers::FrameCapture m_frameCapture;
+	int m_captureCount{ 0 };
+
 	bool m_wireframe{ false };
 
-	GLuint CreateProgram(std::string, std::string);
+	// Cube animation
+	float m_cubeAngle{ 0 };
+	bool m_cubeRotateY{ true };
+
+	// Upload a loaded mesh into VBOs and an EBO wrapped by a VAO
+	Mesh CreateMesh(const Helpers::Mesh& mesh);
+
+	// Packs the files marked packable into the texture atlas, returning where each ended up
+	std::vector<Helpers::AtlasRegion> PackIntoAtlas(const std::vector<std::string>& filepaths, const std::vector<bool>& packable);
+
+	// Load a model from file, uploading each mesh and resolving its material textures through the texture cache.
+	// With useAtlas small textures are packed into the shared atlas, then meshes sharing a texture are merged into one draw.
+	bool LoadModel(Model& model, const std::string& filepath, const Helpers::TextureSettings& textureSettings = Helpers::TextureSettings(),
+		bool useAtlas = true);
+
+	// Builds the terrain page file on a worker if it is missing or out of date
+	void StartTerrainTextureBuild();
+
+	// Animate the models and bring their world bounds up to date
+	void UpdateModels(float deltaTime);
+
+	// Moves the overdraw sweep on to the next pass order once the current one has been measured
+	void UpdateOverdrawSweep();
+
+	// Gives an instanced model count instances at random terrain points, keeping those it already has when growing
+	void ScatterInstances(size_t model, int count, float scale, float lift);
 public:
 	Renderer();
 	~Renderer();
@@ -63,5 +242,13 @@ public:
 
 	// Render the scene
 	void Render(const Helpers::Camera& camera, float deltaTime);
+
+	// Adds a model drawn once per instance with one draw per mesh however many instances it has, returning its index
+	size_t RegisterInstancedModel(Model model);
+
+	// Instance transforms are relative to the model's transform. Only instances that change are uploaded again.
+	uint32_t AddInstance(size_t model, const glm::mat4& transform, const glm::vec4& tint = glm::vec4(1));
+	void UpdateInstance(size_t model, uint32_t instance, const glm::mat4& transform, const glm::vec4& tint = glm::vec4(1));
+	void ClearInstances(size_t model);
 };
 
@@ -0,0 +1,305 @@
+#include "Resampler.h"
+#include "ThreadPool.h"
+
+#include <xmmintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+
+namespace Helpers
+{
+	// Rows handed to each job of a pass
+	static const int kResampleRowsPerJob{ 16 };
+
+	// Which source texels make up each destination texel along one axis
+	struct ResampleAxis
+	{
+		// Taps per destination texel, the same for all so the inner loop has a fixed length
+		int taps{ 0 };
+
+		// First source texel of each destination texel, may be off either end of the source
+		std::vector<int> first;
+
+		// taps weights per destination texel, summing to one
+		std::vector<float> weights;
+	};
+
+	static float FilterSupport(ResampleFilter filter)
+	{
+		switch (filter)
+		{
+		case ResampleFilter::Box: return 0.5f;
+		case ResampleFilter::Bilinear: return 1.0f;
+		default: return 3.0f;
+		}
+	}
+
+	static float FilterWeight(ResampleFilter filter, float x)
+	{
+		switch (filter)
+		{
+		case ResampleFilter::Box:
+			return x >= -0.5f && x < 0.5f ? 1.0f : 0.0f;
+		case ResampleFilter::Bilinear:
+			return std::max(0.0f, 1.0f - std::abs(x));
+		default:
+		{
+			if (std::abs(x) >= 3.0f)
+				return 0;
+			if (std::abs(x) < 1e-5f)
+				return 1;
+			const float px{ x * 3.14159265f };
+			return 3.0f * std::sin(px) * std::sin(px / 3.0f) / (px * px);
+		}
+		}
+	}
+
+	// Works out the taps for resizing sourceSize to destSize, padding the tap count to a multiple of tapMultiple
+	static ResampleAxis ComputeAxis(int sourceSize, int destSize, ResampleFilter filter, int tapMultiple)
+	{
+		// When shrinking the filter widens to cover every source texel under the destination one
+		const float scale{ (float)sourceSize / destSize };
+		const float filterScale{ std::max(scale, 1.0f) };
+		const float support{ FilterSupport(filter) * filterScale };
+
+		ResampleAxis axis;
+		axis.taps = (int)std::ceil(support * 2) + 1;
+		axis.taps = (axis.taps + tapMultiple - 1) / tapMultiple * tapMultiple;
+		axis.first.resize(destSize);
+		axis.weights.assign((size_t)destSize * axis.taps, 0.0f);
+
+		for (int i = 0; i < destSize; i++)
+		{
+			// Texel i covers [i, i + 1) so its centre maps to (i + 0.5) * scale in the source
+			const float centre{ (i + 0.5f) * scale };
+			const int first{ (int)std::floor(centre - support) };
+			float* weights{ axis.weights.data() + (size_t)i * axis.taps };
+
+			float total{ 0 };
+			for (int t = 0; t < axis.taps; t++)
+			{
+				weights[t] = FilterWeight(filter, (first + t + 0.5f - centre) / filterScale);
+				total += weights[t];
+			}
+
+			// A box narrower than a texel can miss every centre, fall back to the nearest
+			if (total <= 0)
+			{
+				const int nearest{ std::clamp((int)centre - first, 0, axis.taps - 1) };
+				weights[nearest] = total = 1;
+			}
+
+			for (int t = 0; t < axis.taps; t++)
+				weights[t] /= total;
+
+			axis.first[i] = first;
+		}
+
+		return axis;
+	}
+
+	static float ChannelScale(PixelFormat format)
+	{
+		return format == PixelFormat::R16 ? 65535.0f : 255.0f;
+	}
+
+	// Reads texel x of a row as channels floats in 0 to 1
+	static void ReadTexel(const BYTE* row, int x, PixelFormat format, int channels, float* out)
+	{
+		if (format == PixelFormat::R16)
+		{
+			out[0] = ((const UINT16*)row)[x] * (1.0f / 65535.0f);
+			return;
+		}
+
+		const BYTE* texel{ row + (size_t)x * channels };
+		for (int c = 0; c < channels; c++)
+			out[c] = texel[c] * (1.0f / 255.0f);
+	}
+
+	// Sums the lanes of a dot product belonging to the same channel, leaving channel c in lane c
+	static inline __m128 ReduceLanes(__m128 sum, int channels)
+	{
+		if (channels == 4)
+			return sum;
+
+		// Lanes 0 + 2 and 1 + 3
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		if (channels == 2)
+			return sum;
+
+		return _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+	}
+
+	// Resamples width x height pixels of format into newWidth x newHeight at destination
+	void ResampleImage(const BYTE* source, int width, int height, PixelFormat format, BYTE* destination,
+		int newWidth, int newHeight, ResampleFilter filter)
+	{
+		if (width <= 0 || height <= 0 || newWidth <= 0 || newHeight <= 0)
+			return;
+
+		// R16 is one channel of two bytes
+		const int bytesPerPixel{ BytesPerPixel(format) };
+		const int channels{ format == PixelFormat::R16 ? 1 : bytesPerPixel };
+
+		// Horizontal taps padded so each texel's taps fill whole SSE registers, then one multiply add per register
+		const ResampleAxis horizontal{ ComputeAxis(width, newWidth, filter, 4 / channels) };
+		const ResampleAxis vertical{ ComputeAxis(height, newHeight, filter, 1) };
+
+		// Horizontal weights repeated per channel to line up with interleaved texels
+		const int lanes{ horizontal.taps * channels };
+		std::vector<float> expandedWeights((size_t)newWidth * lanes);
+		for (size_t i = 0; i < (size_t)newWidth * horizontal.taps; i++)
+		{
+			for (int c = 0; c < channels; c++)
+				expandedWeights[i * channels + c] = horizontal.weights[i];
+		}
+
+		// Source rows are extended with their edge texels so every tap reads inside the row
+		int pad{ 0 };
+		for (int i = 0; i < newWidth; i++)
+			pad = std::max({ pad, -horizontal.first[i], horizontal.first[i] + horizontal.taps - width });
+
+		const size_t rowFloats{ (size_t)newWidth * channels };
+		std::vector<float> filteredRows((size_t)height * rowFloats);
+
+		// Horizontal pass, every source row into floats at the new width
+		ThreadPool& pool{ ThreadPool::Global() };
+		pool.ParallelFor((size_t)(height + kResampleRowsPerJob - 1) / kResampleRowsPerJob, [&](size_t job)
+		{
+			std::vector<float> padded((size_t)(width + 2 * pad) * channels + 4);
+			const int rowEnd{ std::min(height, (int)job * kResampleRowsPerJob + kResampleRowsPerJob) };
+
+			for (int y = (int)job * kResampleRowsPerJob; y < rowEnd; y++)
+			{
+				const BYTE* row{ source + (size_t)y * width * bytesPerPixel };
+				for (int x = -pad; x < width + pad; x++)
+					ReadTexel(row, std::clamp(x, 0, width - 1), format, channels, padded.data() + (size_t)(x + pad) * channels);
+
+				float* out{ filteredRows.data() + (size_t)y * rowFloats };
+				for (int x = 0; x < newWidth; x++)
+				{
+					const float* texels{ padded.data() + (size_t)(horizontal.first[x] + pad) * channels };
+					const float* weights{ expandedWeights.data() + (size_t)x * lanes };
+
+					__m128 sum{ _mm_setzero_ps() };
+					for (int i = 0; i < lanes; i += 4)
+						sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(texels + i), _mm_loadu_ps(weights + i)));
+
+					alignas(16) float result[4];
+					_mm_store_ps(result, ReduceLanes(sum, channels));
+					for (int c = 0; c < channels; c++)
+						out[(size_t)x * channels + c] = result[c];
+				}
+			}
+		});
+
+		// Vertical pass, weighted sums of whole filtered rows, four floats at a time
+		const float scale{ ChannelScale(format) };
+		pool.ParallelFor((size_t)(newHeight + kResampleRowsPerJob - 1) / kResampleRowsPerJob, [&](size_t job)
+		{
+			std::vector<float> sum(rowFloats);
+			const int rowEnd{ std::min(newHeight, (int)job * kResampleRowsPerJob + kResampleRowsPerJob) };
+
+			for (int y = (int)job * kResampleRowsPerJob; y < rowEnd; y++)
+			{
+				std::fill(sum.begin(), sum.end(), 0.0f);
+
+				const float* weights{ vertical.weights.data() + (size_t)y * vertical.taps };
+				for (int t = 0; t < vertical.taps; t++)
+				{
+					if (weights[t] == 0)
+						continue;
+
+					const float* row{ filteredRows.data() + (size_t)std::clamp(vertical.first[y] + t, 0, height - 1) * rowFloats };
+					const __m128 weight{ _mm_set1_ps(weights[t]) };
+
+					size_t i{ 0 };
+					for (; i + 4 <= rowFloats; i += 4)
+						_mm_storeu_ps(sum.data() + i, _mm_add_ps(_mm_loadu_ps(sum.data() + i), _mm_mul_ps(_mm_loadu_ps(row + i), weight)));
+					for (; i < rowFloats; i++)
+						sum[i] += row[i] * weights[t];
+				}
+
+				BYTE* out{ destination + (size_t)y * newWidth * bytesPerPixel };
+				if (format == PixelFormat::R16)
+				{
+					for (size_t i = 0; i < rowFloats; i++)
+						((UINT16*)out)[i] = (UINT16)(std::clamp(sum[i], 0.0f, 1.0f) * scale + 0.5f);
+				}
+				else
+				{
+					for (size_t i = 0; i < rowFloats; i++)
+						out[i] = (BYTE)(std::clamp(sum[i], 0.0f, 1.0f) * scale + 0.5f);
+				}
+			}
+		});
+	}
+
+	// Resamples source into destination, keeping its pixel format
+	void ResampleImage(const ImageLoader& source, int newWidth, int newHeight, ResampleFilter filter, ImageLoader& destination)
+	{
+		BYTE* pixels{ destination.Allocate(newWidth, newHeight, source.Format()) };
+		ResampleImage(source.GetData(), source.Width(), source.Height(), source.Format(), pixels, newWidth, newHeight, filter);
+	}
+
+	// Times each filter on synthetic images, returning a report in megapixels of source per second
+	std::string BenchmarkResampler()
+	{
+		struct Case
+		{
+			const char* name;
+			PixelFormat format;
+			int width;
+			int height;
+			int newWidth;
+			int newHeight;
+		};
+
+		const Case cases[]{
+			{ "RGBA8 2048 to 1024", PixelFormat::RGBA8, 2048, 2048, 1024, 1024 },
+			{ "RGBA8 1024 to 1536", PixelFormat::RGBA8, 1024, 1024, 1536, 1536 },
+			{ "R8 2048 to 1365", PixelFormat::R8, 2048, 2048, 1365, 1365 },
+			{ "R16 256 to 251", PixelFormat::R16, 256, 256, 251, 251 }
+		};
+
+		const std::pair<const char*, ResampleFilter> filters[]{
+			{ "box", ResampleFilter::Box }, { "bilinear", ResampleFilter::Bilinear }, { "lanczos3", ResampleFilter::Lanczos3 } };
+
+		std::ostringstream report;
+		report << std::fixed << std::setprecision(0);
+
+		for (const Case& test : cases)
+		{
+			// Noise rather than a flat image so nothing is cheaper than it would be for real
+			std::vector<BYTE> source((size_t)test.width * test.height * BytesPerPixel(test.format));
+			uint32_t state{ 12345 };
+			for (BYTE& value : source)
+			{
+				state = state * 1664525u + 1013904223u;
+				value = (BYTE)(state >> 24);
+			}
+			std::vector<BYTE> destination((size_t)test.newWidth * test.newHeight * BytesPerPixel(test.format));
+
+			report << test.name << ":";
+			for (const auto& filter : filters)
+			{
+				// Best of a few runs, the first also warms the pool up
+				double best{ 1e30 };
+				for (int run = 0; run < 3; run++)
+				{
+					const auto start{ std::chrono::steady_clock::now() };
+					ResampleImage(source.data(), test.width, test.height, test.format, destination.data(), test.newWidth, test.newHeight, filter.second);
+					best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+				}
+
+				report << " " << filter.first << " " << (double)test.width * test.height / (best * 1e6) << " MP/s";
+			}
+			report << "\n";
+		}
+
+		return report.str();
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+// Resizing images to any size, e.g. heightmaps to a grid or textures to a quality setting
+
+#include "ExternalLibraryHeaders.h"
+#include "ImageLoader.h"
+
+namespace Helpers
+{
+	enum class ResampleFilter
+	{
+		// Average of the source texels under each destination texel, blocky when enlarging
+		Box,
+
+		// Tent filter, linear interpolation when enlarging
+		Bilinear,
+
+		// Windowed sinc over 3 lobes, sharpest but rings slightly at hard edges
+		Lanczos3
+	};
+
+	// Separable: each row is filtered horizontally into floats, then the columns of those vertically. The per texel
+	// weights are worked out once per axis and applied with SSE, rows are spread across the thread pool. Values are
+	// filtered as stored, no sRGB conversion, and negative Lanczos lobes are clamped on the way out.
+	// Resamples width x height pixels of format into newWidth x newHeight at destination, which must hold
+	// newWidth * newHeight * BytesPerPixel(format) bytes.
+	void ResampleImage(const BYTE* source, int width, int height, PixelFormat format, BYTE* destination,
+		int newWidth, int newHeight, ResampleFilter filter);
+
+	// Resamples source into destination, keeping its pixel format
+	void ResampleImage(const ImageLoader& source, int newWidth, int newHeight, ResampleFilter filter, ImageLoader& destination);
+
+	// Times each filter on synthetic images, returning a report in megapixels of source per second
+	std::string BenchmarkResampler();
+}
@@ -0,0 +1,359 @@
+#include "SceneBVH.h"
+#include "ThreadPool.h"
+
+#include <xmmintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+namespace Helpers
+{
+	// Sets child slot of node to box
+	void SceneBVH::SetChildBounds(Node& node, int slot, const AABB& box)
+	{
+		node.minX[slot] = box.minExtents.x;
+		node.minY[slot] = box.minExtents.y;
+		node.minZ[slot] = box.minExtents.z;
+		node.maxX[slot] = box.maxExtents.x;
+		node.maxY[slot] = box.maxExtents.y;
+		node.maxZ[slot] = box.maxExtents.z;
+	}
+
+	AABB SceneBVH::ChildBounds(const Node& node, int slot)
+	{
+		AABB box;
+		box.minExtents = glm::vec3(node.minX[slot], node.minY[slot], node.minZ[slot]);
+		box.maxExtents = glm::vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]);
+		return box;
+	}
+
+	// Builds the node for objects m_order[begin, end), returning its index
+	int32_t SceneBVH::BuildNode(const std::vector<AABB>& bounds, std::vector<glm::vec3>& centres, size_t begin, size_t end)
+	{
+		// Halves a range at the centroid median of its longest axis
+		auto split = [&](size_t first, size_t last)
+		{
+			if (last - first < 2)
+				return last;
+
+			AABB spread;
+			for (size_t i = first; i < last; i++)
+			{
+				spread.minExtents = glm::min(spread.minExtents, centres[m_order[i]]);
+				spread.maxExtents = glm::max(spread.maxExtents, centres[m_order[i]]);
+			}
+
+			const glm::vec3 size{ spread.maxExtents - spread.minExtents };
+			const int axis{ size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2) };
+
+			const size_t middle{ first + (last - first) / 2 };
+			std::nth_element(m_order.begin() + first, m_order.begin() + middle, m_order.begin() + last,
+				[&centres, axis](uint32_t a, uint32_t b) { return centres[a][axis] < centres[b][axis]; });
+			return middle;
+		};
+
+		const int32_t index{ (int32_t)m_nodes.size() };
+		m_nodes.emplace_back();
+
+		const size_t middle{ split(begin, end) };
+		const size_t parts[5]{ begin, split(begin, middle), middle, split(middle, end), end };
+
+		Node node;
+		for (int slot = 0; slot < 4; slot++)
+		{
+			const size_t first{ parts[slot] };
+			const size_t last{ parts[slot + 1] };
+
+			AABB box;
+			for (size_t i = first; i < last; i++)
+				box.Merge(bounds[m_order[i]]);
+			SetChildBounds(node, slot, box);
+
+			if (first == last)
+			{
+				node.child[slot] = kEmpty;
+				node.count[slot] = 0;
+			}
+			else if (last - first <= (size_t)kLeafSize)
+			{
+				node.child[slot] = (int32_t)first;
+				node.count[slot] = (uint32_t)(last - first);
+			}
+			else
+			{
+				node.child[slot] = BuildNode(bounds, centres, first, last);
+				node.count[slot] = 0;
+			}
+		}
+
+		// Children were added after this node, so it is only written now
+		m_nodes[index] = node;
+		return index;
+	}
+
+	// Builds the tree over bounds, object i is bounds[i]
+	void SceneBVH::Build(const std::vector<AABB>& bounds)
+	{
+		m_nodes.clear();
+		m_order.resize(bounds.size());
+		for (size_t i = 0; i < bounds.size(); i++)
+			m_order[i] = (uint32_t)i;
+
+		std::vector<glm::vec3> centres(bounds.size());
+		for (size_t i = 0; i < bounds.size(); i++)
+			centres[i] = bounds[i].Centre();
+
+		if (!bounds.empty())
+			BuildNode(bounds, centres, 0, bounds.size());
+
+		m_leafBounds.resize(bounds.size());
+		for (size_t i = 0; i < m_order.size(); i++)
+			m_leafBounds[i] = bounds[m_order[i]];
+
+		m_stats = Stats();
+		m_stats.objects = bounds.size();
+		m_stats.nodes = m_nodes.size();
+	}
+
+	// Updates the boxes for new bounds of the same objects in the same order
+	void SceneBVH::Refit(const std::vector<AABB>& bounds)
+	{
+		if (bounds.size() != m_order.size())
+		{
+			Build(bounds);
+			return;
+		}
+
+		for (size_t i = 0; i < m_order.size(); i++)
+			m_leafBounds[i] = bounds[m_order[i]];
+
+		// Children always come after their parent, so going backwards every child is done first
+		for (size_t n = m_nodes.size(); n-- > 0;)
+		{
+			Node& node{ m_nodes[n] };
+			for (int slot = 0; slot < 4; slot++)
+			{
+				if (node.child[slot] == kEmpty)
+					continue;
+
+				AABB box;
+				if (node.count[slot] > 0)
+				{
+					for (uint32_t i = 0; i < node.count[slot]; i++)
+						box.Merge(m_leafBounds[(size_t)node.child[slot] + i]);
+				}
+				else
+				{
+					const Node& child{ m_nodes[node.child[slot]] };
+					for (int childSlot = 0; childSlot < 4; childSlot++)
+					{
+						if (child.child[childSlot] != kEmpty)
+							box.Merge(ChildBounds(child, childSlot));
+					}
+				}
+				SetChildBounds(node, slot, box);
+			}
+		}
+	}
+
+	// Appends the objects under a child slot without testing them
+	void SceneBVH::AddAll(const Node& node, int slot, std::vector<uint32_t>& visible) const
+	{
+		if (node.count[slot] > 0)
+		{
+			for (uint32_t i = 0; i < node.count[slot]; i++)
+				visible.push_back(m_order[(size_t)node.child[slot] + i]);
+			return;
+		}
+
+		const Node& child{ m_nodes[node.child[slot]] };
+		for (int childSlot = 0; childSlot < 4; childSlot++)
+		{
+			if (child.child[childSlot] != kEmpty)
+				AddAll(child, childSlot, visible);
+		}
+	}
+
+	// Tests the four children of a node, recursing into child nodes or deferring them if deferred is given.
+	// Returns the nodes visited.
+	size_t SceneBVH::VisitNode(int32_t nodeIndex, const Frustum& frustum, std::vector<uint32_t>& visible, std::vector<int32_t>* deferred) const
+	{
+		const Node& node{ m_nodes[nodeIndex] };
+
+		const __m128 minX{ _mm_load_ps(node.minX) };
+		const __m128 minY{ _mm_load_ps(node.minY) };
+		const __m128 minZ{ _mm_load_ps(node.minZ) };
+		const __m128 maxX{ _mm_load_ps(node.maxX) };
+		const __m128 maxY{ _mm_load_ps(node.maxY) };
+		const __m128 maxZ{ _mm_load_ps(node.maxZ) };
+		const __m128 zero{ _mm_setzero_ps() };
+
+		// Outside if the corner furthest along a plane's normal is behind it, cut by it if the nearest corner is
+		__m128 outside{ zero };
+		__m128 cut{ zero };
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			const __m128 nx{ _mm_set1_ps(plane.x) };
+			const __m128 ny{ _mm_set1_ps(plane.y) };
+			const __m128 nz{ _mm_set1_ps(plane.z) };
+			const __m128 w{ _mm_set1_ps(plane.w) };
+
+			const __m128 farX{ plane.x >= 0 ? maxX : minX };
+			const __m128 farY{ plane.y >= 0 ? maxY : minY };
+			const __m128 farZ{ plane.z >= 0 ? maxZ : minZ };
+			const __m128 nearX{ plane.x >= 0 ? minX : maxX };
+			const __m128 nearY{ plane.y >= 0 ? minY : maxY };
+			const __m128 nearZ{ plane.z >= 0 ? minZ : maxZ };
+
+			const __m128 farDistance{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, farX), _mm_mul_ps(ny, farY)), _mm_add_ps(_mm_mul_ps(nz, farZ), w)) };
+			const __m128 nearDistance{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nearX), _mm_mul_ps(ny, nearY)), _mm_add_ps(_mm_mul_ps(nz, nearZ), w)) };
+
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(farDistance, zero));
+			cut = _mm_or_ps(cut, _mm_cmplt_ps(nearDistance, zero));
+		}
+
+		const int outsideMask{ _mm_movemask_ps(outside) };
+		const int cutMask{ _mm_movemask_ps(cut) };
+
+		size_t visited{ 1 };
+		for (int slot = 0; slot < 4; slot++)
+		{
+			if (node.child[slot] == kEmpty || (outsideMask & (1 << slot)))
+				continue;
+
+			if (!(cutMask & (1 << slot)))
+			{
+				AddAll(node, slot, visible);
+			}
+			else if (node.count[slot] > 0)
+			{
+				// A leaf the frustum cuts, its objects are tested one by one
+				for (uint32_t i = 0; i < node.count[slot]; i++)
+				{
+					const size_t leaf{ (size_t)node.child[slot] + i };
+					if (AABBInFrustum(frustum, m_leafBounds[leaf]))
+						visible.push_back(m_order[leaf]);
+				}
+			}
+			else if (deferred)
+			{
+				deferred->push_back(node.child[slot]);
+			}
+			else
+			{
+				visited += VisitNode(node.child[slot], frustum, visible, nullptr);
+			}
+		}
+		return visited;
+	}
+
+	// Fills visible with the indices of objects whose boxes are at least partly inside frustum
+	void SceneBVH::Cull(const Frustum& frustum, std::vector<uint32_t>& visible, bool threaded)
+	{
+		visible.clear();
+		m_stats.visible = 0;
+		m_stats.nodesVisited = 0;
+
+		if (m_nodes.empty())
+			return;
+
+		if (!threaded)
+		{
+			m_stats.nodesVisited = VisitNode(0, frustum, visible, nullptr);
+			m_stats.visible = visible.size();
+			return;
+		}
+
+		// The top two levels are done here, leaving up to sixteen subtrees for the workers
+		std::vector<int32_t> level;
+		std::vector<int32_t> subtrees;
+		m_stats.nodesVisited += VisitNode(0, frustum, visible, &level);
+		for (int32_t node : level)
+			m_stats.nodesVisited += VisitNode(node, frustum, visible, &subtrees);
+
+		std::vector<std::vector<uint32_t>> results(subtrees.size());
+		std::vector<size_t> visits(subtrees.size());
+		ThreadPool::Global().ParallelFor(subtrees.size(), [&](size_t i)
+		{
+			visits[i] = VisitNode(subtrees[i], frustum, results[i], nullptr);
+		});
+
+		for (size_t i = 0; i < subtrees.size(); i++)
+		{
+			visible.insert(visible.end(), results[i].begin(), results[i].end());
+			m_stats.nodesVisited += visits[i];
+		}
+		m_stats.visible = visible.size();
+	}
+
+	// Times building and culling random boxes at 10k, 100k and 1M objects, as text
+	std::string BenchmarkFrustumCulling()
+	{
+		using Clock = std::chrono::high_resolution_clock;
+
+		// Looking along +x from the middle of a 10km cube of objects, so a few percent are in view
+		const glm::mat4 viewProjection{ glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 4000.0f) *
+			glm::lookAt(glm::vec3(0), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0)) };
+		const Frustum frustum{ ExtractFrustum(viewProjection) };
+
+		std::ostringstream report;
+		report << std::fixed;
+
+		for (size_t count : { (size_t)10000, (size_t)100000, (size_t)1000000 })
+		{
+			std::vector<AABB> bounds(count);
+			uint32_t state{ 12345 };
+			auto random = [&state]()
+			{
+				state = state * 1664525u + 1013904223u;
+				return (state >> 8) / 16777216.0f;
+			};
+			for (AABB& box : bounds)
+			{
+				const glm::vec3 centre{ random() * 10000 - 5000, random() * 10000 - 5000, random() * 10000 - 5000 };
+				const glm::vec3 half{ 1 + random() * 10, 1 + random() * 10, 1 + random() * 10 };
+				box.minExtents = centre - half;
+				box.maxExtents = centre + half;
+			}
+
+			SceneBVH bvh;
+			const Clock::time_point buildStart{ Clock::now() };
+			bvh.Build(bounds);
+			const double buildMs{ std::chrono::duration<double, std::milli>(Clock::now() - buildStart).count() };
+
+			// Best of a few runs so a stray context switch does not count
+			std::vector<uint32_t> visible;
+			visible.reserve(count);
+			auto best = [](const std::function<void()>& run)
+			{
+				double bestUs{ 1e30 };
+				for (int i = 0; i < 5; i++)
+				{
+					const Clock::time_point start{ Clock::now() };
+					run();
+					bestUs = std::min(bestUs, std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+				}
+				return std::max(bestUs, 0.001);
+			};
+
+			const double singleUs{ best([&]() { bvh.Cull(frustum, visible, false); }) };
+			const double threadedUs{ best([&]() { bvh.Cull(frustum, visible, true); }) };
+			const double linearUs{ best([&]()
+			{
+				visible.clear();
+				for (size_t i = 0; i < count; i++)
+				{
+					if (AABBInFrustum(frustum, bounds[i]))
+						visible.push_back((uint32_t)i);
+				}
+			}) };
+
+			report << std::setprecision(0) << count << " objects (" << visible.size() << " visible), build "
+				<< std::setprecision(1) << buildMs << " ms, objects culled per us: BVH " << count / singleUs
+				<< ", BVH threaded " << count / threadedUs << ", every box " << count / linearUs << "\n";
+		}
+
+		return report.str();
+	}
+}
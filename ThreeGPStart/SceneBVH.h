@@ -0,0 +1,87 @@
+#pragma once
+// Bounding volume hierarchy over object boxes, frustum culled four boxes at a time with SSE
+
+#include "ExternalLibraryHeaders.h"
+#include "Bounds.h"
+
+namespace Helpers
+{
+	// Each node has up to four children whose boxes are stored as structure of arrays, so one SSE compare tests all
+	// four against a plane. A child is another node or a leaf of up to kLeafSize objects. Building splits at the
+	// centroid median of the longest axis, twice per node. Refit keeps the tree shape and grows or shrinks the boxes
+	// for objects that moved, which is far cheaper than a build and fine while they do not move far.
+	// Culling skips the plane tests below a node wholly inside the frustum. It can run the subtrees on worker threads.
+	class SceneBVH
+	{
+	public:
+		static const int kLeafSize{ 4 };
+
+		struct Stats
+		{
+			size_t objects{ 0 };
+			size_t nodes{ 0 };
+
+			// Last Cull
+			size_t visible{ 0 };
+			size_t nodesVisited{ 0 };
+		};
+	private:
+		struct alignas(16) Node
+		{
+			float minX[4];
+			float minY[4];
+			float minZ[4];
+			float maxX[4];
+			float maxY[4];
+			float maxZ[4];
+
+			// Index of a child node, or for a leaf the first object in m_order. kEmpty for an unused slot.
+			int32_t child[4];
+
+			// Objects in a leaf, zero for a child node
+			uint32_t count[4];
+		};
+
+		static const int32_t kEmpty{ -1 };
+
+		std::vector<Node> m_nodes;
+
+		// Object indices in leaf order
+		std::vector<uint32_t> m_order;
+
+		// Object boxes in leaf order, tested one by one in leaves the frustum cuts
+		std::vector<AABB> m_leafBounds;
+
+		Stats m_stats;
+
+		// Builds the node for objects m_order[begin, end), returning its index
+		int32_t BuildNode(const std::vector<AABB>& bounds, std::vector<glm::vec3>& centres, size_t begin, size_t end);
+
+		// Sets child slot of node to box
+		static void SetChildBounds(Node& node, int slot, const AABB& box);
+		static AABB ChildBounds(const Node& node, int slot);
+
+		// Appends the objects under a child slot without testing them
+		void AddAll(const Node& node, int slot, std::vector<uint32_t>& visible) const;
+
+		// Tests the four children of a node, recursing into child nodes or deferring them if deferred is given.
+		// Returns the nodes visited.
+		size_t VisitNode(int32_t nodeIndex, const Frustum& frustum, std::vector<uint32_t>& visible, std::vector<int32_t>* deferred) const;
+	public:
+		// Builds the tree over bounds, object i is bounds[i]
+		void Build(const std::vector<AABB>& bounds);
+
+		// Updates the boxes for new bounds of the same objects in the same order
+		void Refit(const std::vector<AABB>& bounds);
+
+		// Fills visible with the indices of objects whose boxes are at least partly inside frustum, in no set order
+		void Cull(const Frustum& frustum, std::vector<uint32_t>& visible, bool threaded = false);
+
+		size_t Size() const { return m_order.size(); }
+
+		const Stats& GetStats() const { return m_stats; }
+	};
+
+	// Times building and culling random boxes at 10k, 100k and 1M objects, as text
+	std::string BenchmarkFrustumCulling();
+}
@@ -0,0 +1,240 @@
+#include "ShaderProgram.h"
+#include "Helper.h"
+
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+namespace Helpers
+{
+	// Every uniform name seen, shared by all programs
+	struct UniformNames
+	{
+		std::mutex mutex;
+		std::unordered_map<std::string, UniformName> ids;
+	};
+
+	static UniformNames& Names()
+	{
+		static UniformNames names;
+		return names;
+	}
+
+	// Number for a uniform name, giving the same number for the same name every time
+	UniformName ShaderProgram::Name(const std::string& name)
+	{
+		UniformNames& names{ Names() };
+		std::lock_guard<std::mutex> lock(names.mutex);
+		return names.ids.emplace(name, (UniformName)names.ids.size()).first->second;
+	}
+
+	// Reads a resource's name, which the queries below give the length of including the terminator
+	static std::string ResourceName(GLuint program, GLenum programInterface, GLuint index, GLint length)
+	{
+		std::string name(std::max(length, 1), '\0');
+		glGetProgramResourceName(program, programInterface, index, length, nullptr, &name[0]);
+		name.resize(strlen(name.c_str()));
+		return name;
+	}
+
+	// Reads the uniforms, attributes and blocks of the linked program
+	void ShaderProgram::Reflect()
+	{
+		GLint count{ 0 };
+
+		// Uniforms, only those outside blocks have locations
+		glGetProgramInterfaceiv(m_program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			const GLenum properties[]{ GL_NAME_LENGTH, GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE, GL_BLOCK_INDEX };
+			GLint values[5]{};
+			glGetProgramResourceiv(m_program, GL_UNIFORM, i, 5, properties, 5, nullptr, values);
+			if (values[4] != -1)
+				continue;
+
+			UniformInfo uniform;
+			uniform.name = ResourceName(m_program, GL_UNIFORM, i, values[0]);
+			uniform.location = values[1];
+			uniform.type = (GLenum)values[2];
+			uniform.arraySize = values[3];
+
+			// Arrays are reported as name[0], setting the first element by the plain name is the usual use
+			const size_t bracket{ uniform.name.find('[') };
+			const UniformName name{ Name(bracket == std::string::npos ? uniform.name : uniform.name.substr(0, bracket)) };
+
+			if (name >= m_uniformByName.size())
+				m_uniformByName.resize((size_t)name + 1, -1);
+			m_uniformByName[name] = (int)m_uniforms.size();
+			m_uniforms.push_back(uniform);
+		}
+
+		glGetProgramInterfaceiv(m_program, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			const GLenum properties[]{ GL_NAME_LENGTH, GL_LOCATION, GL_TYPE };
+			GLint values[3]{};
+			glGetProgramResourceiv(m_program, GL_PROGRAM_INPUT, i, 3, properties, 3, nullptr, values);
+
+			AttributeInfo attribute;
+			attribute.name = ResourceName(m_program, GL_PROGRAM_INPUT, i, values[0]);
+			attribute.location = values[1];
+			attribute.type = (GLenum)values[2];
+			m_attributes.push_back(attribute);
+		}
+
+		glGetProgramInterfaceiv(m_program, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			const GLenum properties[]{ GL_NAME_LENGTH, GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+			GLint values[3]{};
+			glGetProgramResourceiv(m_program, GL_UNIFORM_BLOCK, i, 3, properties, 3, nullptr, values);
+
+			BlockInfo block;
+			block.name = ResourceName(m_program, GL_UNIFORM_BLOCK, i, values[0]);
+			block.index = (GLuint)i;
+			block.binding = values[1];
+			block.dataSize = values[2];
+			m_blocks.push_back(block);
+		}
+
+		m_values.assign(m_uniforms.size() * kMaxValueBytes, 0);
+		m_valueKnown.assign(m_uniforms.size(), false);
+	}
+
+	// Links the compiled shaders into the program, deleting them either way. Returns false on error.
+	bool ShaderProgram::Link(const std::vector<GLuint>& shaders)
+	{
+		for (GLuint shader : shaders)
+		{
+			if (shader == 0)
+			{
+				for (GLuint other : shaders)
+					glDeleteShader(other);
+				return false;
+			}
+		}
+
+		const GLuint program{ glCreateProgram() };
+		for (GLuint shader : shaders)
+			glAttachShader(program, shader);
+
+		// The program keeps what it needs once linked
+		for (GLuint shader : shaders)
+			glDeleteShader(shader);
+
+		if (!LinkProgramShaders(program))
+		{
+			glDeleteProgram(program);
+			return false;
+		}
+
+		m_program = program;
+		Reflect();
+		return true;
+	}
+
+	// Compiles and links a vertex and fragment shader from file. Returns false on error.
+	bool ShaderProgram::Load(const std::string& vertexShaderPath, const std::string& fragmentShaderPath)
+	{
+		Destroy();
+		return Link({ LoadAndCompileShader(GL_VERTEX_SHADER, vertexShaderPath), LoadAndCompileShader(GL_FRAGMENT_SHADER, fragmentShaderPath) });
+	}
+
+	// Compiles and links a compute shader from file. Returns false on error.
+	bool ShaderProgram::LoadCompute(const std::string& computeShaderPath)
+	{
+		Destroy();
+		return Link({ LoadAndCompileShader(GL_COMPUTE_SHADER, computeShaderPath) });
+	}
+
+	void ShaderProgram::Destroy()
+	{
+		if (m_program)
+			glDeleteProgram(m_program);
+
+		m_program = 0;
+		m_uniforms.clear();
+		m_attributes.clear();
+		m_blocks.clear();
+		m_uniformByName.clear();
+		m_values.clear();
+		m_valueKnown.clear();
+	}
+
+	// Index into m_uniforms if value differs from the last one set (and records it), otherwise -1
+	int ShaderProgram::Changed(UniformName name, const void* value, size_t bytes)
+	{
+		if (!Has(name))
+			return -1;
+
+		const int index{ m_uniformByName[name] };
+		BYTE* cached{ m_values.data() + (size_t)index * kMaxValueBytes };
+		if (m_valueKnown[index] && memcmp(cached, value, bytes) == 0)
+		{
+			m_stats.skipped++;
+			return -1;
+		}
+
+		memcpy(cached, value, bytes);
+		m_valueKnown[index] = true;
+		m_stats.uploads++;
+		return index;
+	}
+
+	void ShaderProgram::Set(UniformName name, int value)
+	{
+		const int index{ Changed(name, &value, sizeof(value)) };
+		if (index >= 0)
+			glProgramUniform1i(m_program, m_uniforms[index].location, value);
+	}
+
+	void ShaderProgram::Set(UniformName name, float value)
+	{
+		const int index{ Changed(name, &value, sizeof(value)) };
+		if (index >= 0)
+			glProgramUniform1f(m_program, m_uniforms[index].location, value);
+	}
+
+	void ShaderProgram::Set(UniformName name, const glm::vec2& value)
+	{
+		const int index{ Changed(name, &value, sizeof(value)) };
+		if (index >= 0)
+			glProgramUniform2fv(m_program, m_uniforms[index].location, 1, glm::value_ptr(value));
+	}
+
+	void ShaderProgram::Set(UniformName name, const glm::vec3& value)
+	{
+		const int index{ Changed(name, &value, sizeof(value)) };
+		if (index >= 0)
+			glProgramUniform3fv(m_program, m_uniforms[index].location, 1, glm::value_ptr(value));
+	}
+
+	void ShaderProgram::Set(UniformName name, const glm::vec4& value)
+	{
+		const int index{ Changed(name, &value, sizeof(value)) };
+		if (index >= 0)
+			glProgramUniform4fv(m_program, m_uniforms[index].location, 1, glm::value_ptr(value));
+	}
+
+	void ShaderProgram::Set(UniformName name, const glm::mat4& value)
+	{
+		const int index{ Changed(name, &value, sizeof(value)) };
+		if (index >= 0)
+			glProgramUniformMatrix4fv(m_program, m_uniforms[index].location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+	// Points the uniform block called name at a binding, returns false if the program has no such block
+	bool ShaderProgram::BindBlock(const std::string& name, GLuint binding)
+	{
+		for (BlockInfo& block : m_blocks)
+		{
+			if (block.name == name)
+			{
+				glUniformBlockBinding(m_program, block.index, binding);
+				block.binding = (GLint)binding;
+				return true;
+			}
+		}
+		return false;
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+// GL program that knows its own uniforms, so setting one never asks the driver where it is
+
+#include "ExternalLibraryHeaders.h"
+
+namespace Helpers
+{
+	// Small number standing for a uniform name, the same in every program. Get one once with ShaderProgram::Name and
+	// keep it, e.g. in a static.
+	using UniformName = uint32_t;
+
+	// Active uniforms, vertex inputs and uniform blocks are reflected with the program interface queries once, after
+	// linking. Locations go in a flat table indexed by UniformName, and the last value set of each uniform is kept so
+	// setting the same value again costs a compare rather than a GL call. Setters use glProgramUniform so the program
+	// does not need to be bound. Values set other than through the setters are not seen, so set each uniform one way.
+	class ShaderProgram
+	{
+	public:
+		struct UniformInfo
+		{
+			std::string name;
+			GLint location{ -1 };
+			GLenum type{ 0 };
+			GLint arraySize{ 1 };
+		};
+
+		struct AttributeInfo
+		{
+			std::string name;
+			GLint location{ -1 };
+			GLenum type{ 0 };
+		};
+
+		struct BlockInfo
+		{
+			std::string name;
+			GLuint index{ 0 };
+			GLint binding{ 0 };
+			GLint dataSize{ 0 };
+		};
+
+		struct Stats
+		{
+			size_t uploads{ 0 };
+
+			// Setter calls that matched the last value, so made no GL call
+			size_t skipped{ 0 };
+		};
+	private:
+		GLuint m_program{ 0 };
+
+		// Uniforms outside blocks, which are the ones with locations
+		std::vector<UniformInfo> m_uniforms;
+		std::vector<AttributeInfo> m_attributes;
+		std::vector<BlockInfo> m_blocks;
+
+		// Index into m_uniforms for each UniformName, -1 if not active in this program
+		std::vector<int> m_uniformByName;
+
+		// Last value of each uniform, zero filled to the largest type supported
+		static const size_t kMaxValueBytes{ sizeof(glm::mat4) };
+		std::vector<BYTE> m_values;
+		std::vector<bool> m_valueKnown;
+
+		Stats m_stats;
+
+		// Reads the uniforms, attributes and blocks of the linked program
+		void Reflect();
+
+		// Links the compiled shaders into the program, deleting them either way. Returns false on error.
+		bool Link(const std::vector<GLuint>& shaders);
+
+		// Index into m_uniforms if value differs from the last one set (and records it), otherwise -1
+		int Changed(UniformName name, const void* value, size_t bytes);
+	public:
+		ShaderProgram() = default;
+		~ShaderProgram() { Destroy(); }
+
+		ShaderProgram(const ShaderProgram&) = delete;
+		ShaderProgram& operator=(const ShaderProgram&) = delete;
+
+		// Number for a uniform name, giving the same number for the same name every time
+		static UniformName Name(const std::string& name);
+
+		// Compiles and links a vertex and fragment shader from file. Returns false on error.
+		bool Load(const std::string& vertexShaderPath, const std::string& fragmentShaderPath);
+
+		// Compiles and links a compute shader from file. Returns false on error.
+		bool LoadCompute(const std::string& computeShaderPath);
+
+		void Destroy();
+
+		bool IsValid() const { return m_program != 0; }
+		GLuint Id() const { return m_program; }
+
+		void Use() const { glUseProgram(m_program); }
+
+		// True if the uniform is used by the program
+		bool Has(UniformName name) const { return name < m_uniformByName.size() && m_uniformByName[name] >= 0; }
+
+		// Location of an active uniform, -1 if it is not
+		GLint Location(UniformName name) const { return Has(name) ? m_uniforms[m_uniformByName[name]].location : -1; }
+
+		// Setting a uniform the program does not use does nothing, as with location -1
+		void Set(UniformName name, int value);
+		void Set(UniformName name, float value);
+		void Set(UniformName name, const glm::vec2& value);
+		void Set(UniformName name, const glm::vec3& value);
+		void Set(UniformName name, const glm::vec4& value);
+		void Set(UniformName name, const glm::mat4& value);
+
+		// Points the uniform block called name at a binding, returns false if the program has no such block
+		bool BindBlock(const std::string& name, GLuint binding);
+
+		const std::vector<UniformInfo>& Uniforms() const { return m_uniforms; }
+		const std::vector<AttributeInfo>& Attributes() const { return m_attributes; }
+		const std::vector<BlockInfo>& Blocks() const { return m_blocks; }
+
+		const Stats& GetStats() const { return m_stats; }
+		void ResetStats() { m_stats = Stats(); }
+	};
+}
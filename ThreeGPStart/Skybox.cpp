@@ -0,0 +1,447 @@
+#include "Skybox.h"
+#include "ImageLoader.h"
+#include "Mesh.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <iostream>
+#include <filesystem>
+#include <memory>
+
+namespace fs = std::filesystem;
+
+namespace Helpers
+{
+	namespace
+	{
+		// One quad of the sky model and how to find texture coordinates on it
+		struct FaceSource
+		{
+			// The two axes in the plane of the face
+			int a{ 0 };
+			int b{ 0 };
+
+			// Distance of the plane from the model centre along its axis, signed
+			float offset{ 0 };
+
+			// uv = uv0 + uvFromPlane * (q - q0) for q a point in the plane given by its a and b coordinates
+			glm::vec2 q0{ 0 };
+			glm::vec2 uv0{ 0 };
+			glm::mat2 uvFromPlane{ 1 };
+
+			std::unique_ptr<ImageLoader> image;
+		};
+
+		// Direction through the texel centre (s, t) of a face, GL cubemap convention
+		glm::vec3 FaceDirection(int face, float s, float t)
+		{
+			const float sc{ 2 * s - 1 };
+			const float tc{ 2 * t - 1 };
+			switch (face)
+			{
+			case 0: return glm::vec3(1, -tc, -sc);
+			case 1: return glm::vec3(-1, -tc, sc);
+			case 2: return glm::vec3(sc, 1, tc);
+			case 3: return glm::vec3(sc, -1, -tc);
+			case 4: return glm::vec3(sc, -tc, 1);
+			default: return glm::vec3(-sc, -tc, -1);
+			}
+		}
+
+		// Bilinear with clamp to edge, as the quads were textured
+		void SampleBilinear(const ImageLoader& image, glm::vec2 uv, BYTE* out)
+		{
+			const int width{ image.Width() };
+			const int height{ image.Height() };
+			const float x{ std::clamp(uv.x * width - 0.5f, 0.0f, (float)(width - 1)) };
+			const float y{ std::clamp(uv.y * height - 0.5f, 0.0f, (float)(height - 1)) };
+
+			const int x0{ (int)x };
+			const int y0{ (int)y };
+			const int x1{ std::min(x0 + 1, width - 1) };
+			const int y1{ std::min(y0 + 1, height - 1) };
+			const float fx{ x - x0 };
+			const float fy{ y - y0 };
+
+			const BYTE* data{ image.GetData() };
+			const BYTE* p00{ data + ((size_t)y0 * width + x0) * 4 };
+			const BYTE* p10{ data + ((size_t)y0 * width + x1) * 4 };
+			const BYTE* p01{ data + ((size_t)y1 * width + x0) * 4 };
+			const BYTE* p11{ data + ((size_t)y1 * width + x1) * 4 };
+
+			for (int c = 0; c < 4; c++)
+			{
+				const float bottom{ p00[c] + (p10[c] - p00[c]) * fx };
+				const float top{ p01[c] + (p11[c] - p01[c]) * fx };
+				out[c] = (BYTE)(bottom + (top - bottom) * fy + 0.5f);
+			}
+		}
+	}
+
+	// Loads a six quad sky model and its images and resamples them into cubemap faces
+	bool Skybox::BuildFaces(const std::string& modelFilepath, CubemapFaces& cubemap)
+	{
+		ModelLoader loader;
+		if (!loader.LoadFromFile(modelFilepath))
+			return false;
+
+		const std::vector<Mesh>& meshes{ loader.GetMeshVector() };
+		const std::vector<Material>& materials{ loader.GetMaterialVector() };
+
+		// Faces are told apart by which side of the centre they lie
+		glm::vec3 centre{ 0 };
+		size_t numVertices{ 0 };
+		for (const Mesh& mesh : meshes)
+		{
+			for (const glm::vec3& vertex : mesh.vertices)
+				centre += vertex;
+			numVertices += mesh.vertices.size();
+		}
+		if (numVertices == 0)
+			return false;
+		centre /= (float)numVertices;
+
+		// Material texture filenames are relative to the model
+		const fs::path directory{ fs::path(modelFilepath).parent_path() };
+
+		FaceSource sources[6];
+		int maxSize{ 0 };
+		for (const Mesh& mesh : meshes)
+		{
+			if (mesh.elements.size() < 3 || mesh.uvCoords.size() != mesh.vertices.size() || mesh.materialIndex >= materials.size())
+				continue;
+
+			glm::vec3 centroid{ 0 };
+			for (const glm::vec3& vertex : mesh.vertices)
+				centroid += vertex;
+			centroid = centroid / (float)mesh.vertices.size() - centre;
+
+			const glm::vec3 extent{ glm::abs(centroid) };
+			const int axis{ extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2) };
+			const int face{ axis * 2 + (centroid[axis] < 0 ? 1 : 0) };
+
+			FaceSource& source{ sources[face] };
+			source.a = (axis + 1) % 3;
+			source.b = (axis + 2) % 3;
+			source.offset = centroid[axis];
+
+			// The quad is flat and its coordinates affine, one triangle gives the whole mapping
+			const unsigned int* tri{ &mesh.elements[0] };
+			const glm::vec3& p0{ mesh.vertices[tri[0]] };
+			const glm::vec3& p1{ mesh.vertices[tri[1]] };
+			const glm::vec3& p2{ mesh.vertices[tri[2]] };
+			const glm::mat2 plane(glm::vec2(p1[source.a] - p0[source.a], p1[source.b] - p0[source.b]),
+				glm::vec2(p2[source.a] - p0[source.a], p2[source.b] - p0[source.b]));
+			if (std::abs(glm::determinant(plane)) < 1e-8f)
+				continue;
+
+			const glm::vec2& uv0{ mesh.uvCoords[tri[0]] };
+			const glm::mat2 uv(mesh.uvCoords[tri[1]] - uv0, mesh.uvCoords[tri[2]] - uv0);
+			source.q0 = glm::vec2(p0[source.a], p0[source.b]);
+			source.uv0 = uv0;
+			source.uvFromPlane = uv * glm::inverse(plane);
+
+			fs::path texturePath{ directory / materials[mesh.materialIndex].diffuseTextureFilename };
+			if (!fs::exists(texturePath))
+				texturePath = directory / fs::path(materials[mesh.materialIndex].diffuseTextureFilename).filename();
+
+			std::unique_ptr<ImageLoader> image{ std::make_unique<ImageLoader>() };
+			if (!image->Load(texturePath.string()))
+				continue;
+
+			maxSize = std::max(maxSize, std::max(image->Width(), image->Height()));
+			source.image = std::move(image);
+		}
+
+		if (maxSize == 0)
+			return false;
+
+		// Resampled a row of a face per job into level 0, the mips are built from that
+		std::vector<BYTE> pixels[6];
+		for (std::vector<BYTE>& face : pixels)
+			face.assign((size_t)maxSize * maxSize * 4, 0);
+
+		ThreadPool::Global().ParallelFor((size_t)6 * maxSize, [&](size_t job)
+		{
+			const int face{ (int)(job / maxSize) };
+			const int y{ (int)(job % maxSize) };
+			const FaceSource& source{ sources[face] };
+			if (!source.image)
+				return;
+
+			const int axis{ face / 2 };
+			BYTE* row{ pixels[face].data() + (size_t)y * maxSize * 4 };
+			const float t{ (y + 0.5f) / maxSize };
+			for (int x = 0; x < maxSize; x++)
+			{
+				// Where the direction from the centre meets the plane of the quad
+				const glm::vec3 direction{ FaceDirection(face, (x + 0.5f) / maxSize, t) };
+				const glm::vec3 hit{ direction * (source.offset / direction[axis]) };
+				const glm::vec2 q{ centre[source.a] + hit[source.a], centre[source.b] + hit[source.b] };
+
+				SampleBilinear(*source.image, source.uv0 + source.uvFromPlane * (q - source.q0), row + (size_t)x * 4);
+			}
+		});
+
+		// Faces meet at their edges rather than repeat
+		MipSettings mipSettings;
+		mipSettings.wrap = false;
+		for (int face = 0; face < 6; face++)
+			GenerateMipChain(pixels[face].data(), maxSize, maxSize, mipSettings, cubemap.faces[face]);
+
+		cubemap.size = maxSize;
+		return true;
+	}
+
+	// Creates an immutable cubemap sized for cubemap with no texels yet
+	GLuint Skybox::CreateTexture(const CubemapFaces& cubemap)
+	{
+		GLuint texture{ 0 };
+		glGenTextures(1, &texture);
+
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, (GLsizei)cubemap.faces[0].levels.size(), GL_RGBA8, cubemap.size, cubemap.size);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+		// Filter across face edges so the seams do not show
+		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+		return texture;
+	}
+
+	// Replaces the cubemap with these faces in one go
+	void Skybox::Upload(const CubemapFaces& cubemap)
+	{
+		if (!cubemap.IsValid())
+			return;
+
+		if (m_vao == 0)
+			glGenVertexArrays(1, &m_vao);
+
+		const GLuint texture{ CreateTexture(cubemap) };
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+		for (int face = 0; face < 6; face++)
+		{
+			const MipChain& chain{ cubemap.faces[face] };
+			for (size_t level = 0; level < chain.levels.size(); level++)
+			{
+				glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, (GLint)level, 0, 0, chain.levels[level].width,
+					chain.levels[level].height, GL_RGBA, GL_UNSIGNED_BYTE, chain.LevelData(level));
+			}
+		}
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+		if (m_cubemap)
+			glDeleteTextures(1, &m_cubemap);
+		m_cubemap = texture;
+	}
+
+	// BuildFaces then Upload on this thread
+	bool Skybox::Load(const std::string& modelFilepath)
+	{
+		CubemapFaces cubemap;
+		if (!BuildFaces(modelFilepath, cubemap))
+			return false;
+
+		Upload(cubemap);
+		return true;
+	}
+
+	// Starts switching to another sky in the background
+	void Skybox::BeginLoad(const std::string& modelFilepath)
+	{
+		if (IsLoading())
+		{
+			m_queuedFilepath = modelFilepath;
+			return;
+		}
+
+		m_loadingFilepath = modelFilepath;
+		m_decode = ThreadPool::Global().Submit([modelFilepath]()
+		{
+			std::shared_ptr<CubemapFaces> cubemap{ std::make_shared<CubemapFaces>() };
+			if (!BuildFaces(modelFilepath, *cubemap))
+				cubemap.reset();
+			return cubemap;
+		});
+	}
+
+	// Uploads up to the per frame byte budget of m_faces, returns true once all of it is on its way
+	bool Skybox::UploadSlice()
+	{
+		glBindTexture(GL_TEXTURE_CUBE_MAP, m_incoming);
+
+		size_t budget{ m_options.uploadBytesPerFrame };
+		while (m_uploadFace < 6)
+		{
+			const MipChain& chain{ m_faces->faces[m_uploadFace] };
+			const MipChain::Level& level{ chain.levels[m_uploadLevel] };
+			const size_t rowBytes{ (size_t)level.width * 4 };
+
+			// Always at least a row a frame so a tiny budget still gets there, but never start a row over budget
+			if (budget < rowBytes && budget < m_options.uploadBytesPerFrame)
+				break;
+			const int rows{ std::clamp((int)(budget / rowBytes), 1, level.height - m_uploadRow) };
+
+			glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + m_uploadFace, m_uploadLevel, 0, m_uploadRow, level.width, rows,
+				GL_RGBA, GL_UNSIGNED_BYTE, chain.LevelData(m_uploadLevel) + (size_t)m_uploadRow * rowBytes);
+
+			const size_t bytes{ (size_t)rows * rowBytes };
+			m_uploadedBytes += bytes;
+			budget -= std::min(budget, bytes);
+
+			m_uploadRow += rows;
+			if (m_uploadRow == level.height)
+			{
+				m_uploadRow = 0;
+				if (++m_uploadLevel == (int)chain.levels.size())
+				{
+					m_uploadLevel = 0;
+					m_uploadFace++;
+				}
+			}
+
+			if (budget == 0)
+				break;
+		}
+
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		return m_uploadFace == 6;
+	}
+
+	// Moves a switch along, call once a frame
+	void Skybox::Update()
+	{
+		if (!IsLoading())
+			return;
+
+		// Waiting on the workers
+		if (!m_faces && m_incoming == 0)
+		{
+			if (m_decode.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				return;
+
+			m_faces = m_decode.get();
+			if (!m_faces || !m_faces->IsValid())
+			{
+				std::cout << "Could not load sky " << m_loadingFilepath << std::endl;
+				CancelLoad();
+			}
+			else
+			{
+				m_incoming = CreateTexture(*m_faces);
+				m_uploadFace = m_uploadLevel = m_uploadRow = 0;
+				m_uploadedBytes = 0;
+				m_totalBytes = 0;
+				for (const MipChain& chain : m_faces->faces)
+					m_totalBytes += chain.data.size();
+			}
+		}
+		// Copying the texels over a slice a frame
+		else if (m_faces)
+		{
+			if (UploadSlice())
+			{
+				m_faces.reset();
+				m_uploadFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			}
+		}
+		// Swap once the GPU has it all, drawing it any sooner would stall until it had
+		else
+		{
+			const GLenum status{ glClientWaitSync(m_uploadFence, 0, 0) };
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				return;
+
+			glDeleteSync(m_uploadFence);
+			m_uploadFence = nullptr;
+
+			if (m_vao == 0)
+				glGenVertexArrays(1, &m_vao);
+			if (m_cubemap)
+				glDeleteTextures(1, &m_cubemap);
+			m_cubemap = m_incoming;
+			m_incoming = 0;
+			m_loadingFilepath.clear();
+			m_switches++;
+		}
+
+		// The next asked for starts once this one is done
+		if (!IsLoading() && !m_queuedFilepath.empty())
+		{
+			const std::string next{ std::move(m_queuedFilepath) };
+			m_queuedFilepath.clear();
+			BeginLoad(next);
+		}
+	}
+
+	// Abandons any switch in progress, waiting for the decode if it is running
+	void Skybox::CancelLoad()
+	{
+		if (m_decode.valid())
+			m_decode.wait();
+		m_decode = std::future<std::shared_ptr<CubemapFaces>>();
+		m_faces.reset();
+
+		if (m_uploadFence)
+			glDeleteSync(m_uploadFence);
+		if (m_incoming)
+			glDeleteTextures(1, &m_incoming);
+		m_uploadFence = nullptr;
+		m_incoming = 0;
+		m_loadingFilepath.clear();
+	}
+
+	void Skybox::Destroy()
+	{
+		CancelLoad();
+		m_queuedFilepath.clear();
+
+		if (m_cubemap)
+			glDeleteTextures(1, &m_cubemap);
+		if (m_vao)
+			glDeleteVertexArrays(1, &m_vao);
+		m_cubemap = 0;
+		m_vao = 0;
+	}
+
+	Skybox::Stats Skybox::GetStats() const
+	{
+		Stats stats;
+		stats.loading = m_loadingFilepath;
+		stats.switches = m_switches;
+		if (m_incoming && m_totalBytes > 0)
+			stats.uploadProgress = (float)m_uploadedBytes / m_totalBytes;
+		return stats;
+	}
+
+	// Draws the sky as one triangle covering the screen
+	void Skybox::Render(ShaderProgram& program, const glm::mat4& view, const glm::mat4& projection) const
+	{
+		static const UniformName inverseViewProjectionName{ ShaderProgram::Name("inverse_view_projection") };
+		static const UniformName samplerName{ ShaderProgram::Name("sampler_sky") };
+
+		if (m_cubemap == 0)
+			return;
+
+		// Rotation only, the sky is infinitely far away
+		const glm::mat4 inverseViewProjection{ glm::inverse(projection * glm::mat4(glm::mat3(view))) };
+
+		program.Use();
+		program.Set(inverseViewProjectionName, inverseViewProjection);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, m_cubemap);
+		program.Set(samplerName, 0);
+
+		glBindVertexArray(m_vao);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	}
+}
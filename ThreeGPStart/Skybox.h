@@ -0,0 +1,120 @@
+#pragma once
+// Sky drawn from a cubemap with a single fullscreen triangle
+
+#include "ExternalLibraryHeaders.h"
+#include "MipGenerator.h"
+#include "ShaderProgram.h"
+
+#include <future>
+#include <memory>
+
+namespace Helpers
+{
+	// Six square RGBA8 faces in GL order: +X, -X, +Y, -Y, +Z, -Z, each with its full mip chain
+	struct CubemapFaces
+	{
+		int size{ 0 };
+		MipChain faces[6];
+
+		bool IsValid() const { return size > 0; }
+	};
+
+	struct SkyboxOptions
+	{
+		// Most texel bytes copied to the GPU per Update while switching, so no single frame pays for the whole set
+		size_t uploadBytesPerFrame{ 2 * 1024 * 1024 };
+	};
+
+	// The sky sets are modelled as six textured quads, one per face of a box. Rather than hand writing which image goes
+	// on which face the model is loaded and every cubemap texel is resampled from the quad its direction hits, so each
+	// set keeps exactly the orientation it had as a mesh. The triangle is drawn at the far plane after everything else
+	// with GL_LEQUAL so the sky is only shaded where nothing covers it.
+	// Switching with BeginLoad decodes on a worker and uploads a slice at a time into a second cubemap while the current
+	// one is still drawn. Once a fence shows the GPU has the lot they are swapped and the old one deleted.
+	class Skybox
+	{
+	public:
+		struct Stats
+		{
+			// Set being decoded or uploaded, empty when idle
+			std::string loading;
+
+			// Fraction of the texel bytes of the incoming set uploaded so far
+			float uploadProgress{ 0 };
+
+			size_t switches{ 0 };
+		};
+	private:
+		GLuint m_cubemap{ 0 };
+
+		// Core profile needs a VAO bound to draw, the triangle comes from gl_VertexID
+		GLuint m_vao{ 0 };
+
+		SkyboxOptions m_options;
+
+		// Switch in progress: decode, then sliced upload into m_incoming, then fence
+		std::string m_loadingFilepath;
+		std::future<std::shared_ptr<CubemapFaces>> m_decode;
+		std::shared_ptr<CubemapFaces> m_faces;
+		GLuint m_incoming{ 0 };
+		GLsync m_uploadFence{ nullptr };
+
+		// Next row to upload in m_faces
+		int m_uploadFace{ 0 };
+		int m_uploadLevel{ 0 };
+		int m_uploadRow{ 0 };
+		size_t m_uploadedBytes{ 0 };
+		size_t m_totalBytes{ 0 };
+
+		// Asked for while another switch was running, started when it finishes
+		std::string m_queuedFilepath;
+
+		size_t m_switches{ 0 };
+
+		// Creates an immutable cubemap sized for cubemap with no texels yet
+		static GLuint CreateTexture(const CubemapFaces& cubemap);
+
+		// Uploads up to the per frame byte budget of m_faces, returns true once all of it is on its way
+		bool UploadSlice();
+
+		// Abandons any switch in progress, waiting for the decode if it is running
+		void CancelLoad();
+	public:
+		explicit Skybox(const SkyboxOptions& options = SkyboxOptions()) : m_options(options) {}
+		~Skybox() { Destroy(); }
+
+		Skybox(const Skybox&) = delete;
+		Skybox& operator=(const Skybox&) = delete;
+
+		// Loads a six quad sky model and its images, resamples them into cubemap faces and builds their mips.
+		// No GL calls so safe on any thread. Returns false on error.
+		static bool BuildFaces(const std::string& modelFilepath, CubemapFaces& cubemap);
+
+		// Replaces the cubemap with these faces in one go
+		void Upload(const CubemapFaces& cubemap);
+
+		// BuildFaces then Upload on this thread, for the first sky before there is anything to draw. Returns false on
+		// error and leaves the current sky in place.
+		bool Load(const std::string& modelFilepath);
+
+		// Starts switching to another sky in the background, the current one is drawn until it is ready. If a switch is
+		// already running this one follows it.
+		void BeginLoad(const std::string& modelFilepath);
+
+		// Moves a switch along: picks up the decoded faces, uploads the next slice or swaps once the GPU is done.
+		// Call once a frame.
+		void Update();
+
+		bool IsLoading() const { return !m_loadingFilepath.empty(); }
+
+		void Destroy();
+
+		bool IsLoaded() const { return m_cubemap != 0; }
+
+		Stats GetStats() const;
+
+		// Draws the sky with program, which needs a mat4 inverse_view_projection and a samplerCube sampler_sky.
+		// Expects depth testing with GL_LEQUAL so it only fills what is still at the far plane.
+		void Render(ShaderProgram& program, const glm::mat4& view, const glm::mat4& projection) const;
+	};
+}
@@ -0,0 +1,182 @@
+/*
+	CullComparisonTest.cpp : checks that culling draws on the GPU keeps exactly the draws the CPU path keeps.
+
+	Runs headless in a hidden window, and needs nothing past OpenGL 4.5 so a software implementation such as Mesa's
+	llvmpipe can run it where there is no GPU (on Windows put Mesa's opengl32.dll beside the exe). Run from the
+	ThreeGPStart folder so the shaders are found. Returns 0 if every scene agrees, 1 otherwise.
+*/
+
+#include "ExternalLibraryHeaders.h"
+#include "DrawCuller.h"
+#include "UniformRing.h"
+
+#include <random>
+
+// Draws of one scene as RenderQueue hands them to the culler
+struct CullScene
+{
+	std::string name;
+	glm::mat4 viewProjection{ 1 };
+	std::vector<Helpers::IndirectCommand> commands;
+	std::vector<Helpers::BoundingSphere> spheres;
+	std::vector<uint32_t> objects;
+	std::vector<Helpers::DrawBatch> batches;
+};
+
+// Hidden window whose context does the work
+static GLFWwindow* CreateHiddenContext()
+{
+	if (!glfwInit())
+	{
+		std::cout << "Failed to initialise GLFW" << std::endl;
+		return nullptr;
+	}
+
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+	GLFWwindow* window{ glfwCreateWindow(64, 64, "Cull comparison test", nullptr, nullptr) };
+	if (!window)
+	{
+		std::cout << "Failed to create an OpenGL 4.5 context" << std::endl;
+		glfwTerminate();
+		return nullptr;
+	}
+
+	glfwMakeContextCurrent(window);
+	glewExperimental = true;
+	if (glewInit() != GLEW_OK)
+	{
+		std::cout << "Failed to initialise GLEW" << std::endl;
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return nullptr;
+	}
+
+	std::cout << glGetString(GL_VERSION) << ", " << glGetString(GL_RENDERER) << std::endl;
+	return window;
+}
+
+// count spheres scattered through a box round the camera in batches of 1 to 16 draws, always the same for a seed.
+// Spheres within a whisker of touching a plane are grown clear of it, as the GPU may round that case the other way.
+static CullScene MakeScene(const std::string& name, const glm::mat4& viewProjection, size_t count, unsigned seed)
+{
+	CullScene scene;
+	scene.name = name;
+	scene.viewProjection = viewProjection;
+
+	const Helpers::Frustum frustum{ Helpers::ExtractFrustum(viewProjection) };
+	std::mt19937 random{ seed };
+	std::uniform_real_distribution<float> position{ -600.0f, 600.0f };
+	std::uniform_real_distribution<float> radius{ 0.5f, 40.0f };
+	std::uniform_int_distribution<uint32_t> batchSize{ 1, 16 };
+	uint32_t batchTarget{ 0 };
+
+	// None of the draws are occlusion tested
+	const uint32_t noObject{ Helpers::DrawCuller::kNoObject };
+
+	for (size_t i = 0; i < count; i++)
+	{
+		Helpers::BoundingSphere sphere{ glm::vec3(position(random), position(random), position(random)), radius(random) };
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			const float gap{ glm::dot(glm::vec3(plane), sphere.centre) + plane.w + sphere.radius };
+			if (std::abs(gap) < 0.01f)
+				sphere.radius += 0.1f;
+		}
+
+		if (scene.batches.empty() || scene.batches.back().count == batchTarget)
+		{
+			scene.batches.push_back({ (uint32_t)i, 0 });
+			batchTarget = batchSize(random);
+		}
+		scene.batches.back().count++;
+
+		// baseInstance is the draw's index, as RenderQueue sets it
+		scene.commands.push_back({ 36, 1, 0, 0, (GLuint)i });
+		scene.spheres.push_back(sphere);
+		scene.objects.push_back(noObject);
+	}
+
+	return scene;
+}
+
+// Culls scene both ways and compares what survives each batch. False if they differ or the GPU path did not run.
+static bool CompareScene(Helpers::DrawCuller& culler, Helpers::UniformRing& ring, const CullScene& scene)
+{
+	culler.SetFrustum(Helpers::ExtractFrustum(scene.viewProjection));
+	ring.BeginFrame();
+
+	culler.SetMode(Helpers::CullMode::CPU);
+	culler.Cull(ring, scene.commands, scene.spheres, scene.objects, scene.batches);
+	const Helpers::DrawCuller::SurvivorSets cpu{ culler.ReadSurvivors() };
+
+	culler.SetMode(Helpers::CullMode::GPU);
+	culler.Cull(ring, scene.commands, scene.spheres, scene.objects, scene.batches);
+	const bool ranOnGPU{ culler.GetStats().mode == Helpers::CullMode::GPU };
+	const Helpers::DrawCuller::SurvivorSets gpu{ culler.ReadSurvivors() };
+
+	ring.EndFrame();
+
+	const Helpers::DrawCuller::Comparison comparison{ Helpers::DrawCuller::CompareSurvivors(gpu, cpu) };
+	const bool passed{ ranOnGPU && comparison.Agrees() };
+
+	std::cout << (passed ? "PASS " : "FAIL ") << scene.name << ": " << scene.commands.size() << " draws in " << comparison.batches
+		<< " batches, GPU kept " << comparison.gpuVisible << ", CPU kept " << comparison.cpuVisible;
+	if (!ranOnGPU)
+		std::cout << ", the GPU path fell back to the CPU";
+	else if (!comparison.Agrees())
+		std::cout << ", " << comparison.differingBatches << " batches differ";
+	std::cout << std::endl;
+
+	return passed;
+}
+
+int main()
+{
+	GLFWwindow* window{ CreateHiddenContext() };
+	if (!window)
+		return 1;
+
+	int failures{ 0 };
+	{
+		Helpers::UniformRing ring;
+		Helpers::DrawCuller culler;
+		if (!ring.Create() || !culler.Create("Data\\Shaders\\cull_draws.comp", "Data\\Shaders\\depth_pyramid.comp"))
+		{
+			std::cout << "FAIL could not create the uniform ring or load the culling shader" << std::endl;
+			failures++;
+		}
+		else
+		{
+			// The comparison is of the frustum test alone
+			culler.SetOcclusion(false);
+
+			const glm::mat4 projection{ glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 4000.0f) };
+			const glm::mat4 narrow{ glm::perspective(glm::radians(10.0f), 1.0f, 1.0f, 300.0f) };
+
+			const CullScene scenes[]{
+				MakeScene("looking along -z", projection * glm::lookAt(glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)), 5000, 1),
+				MakeScene("looking down at an angle", projection * glm::lookAt(glm::vec3(200, 300, 100), glm::vec3(0), glm::vec3(0, 1, 0)), 5000, 2),
+				MakeScene("narrow and short", narrow * glm::lookAt(glm::vec3(-100, 0, 0), glm::vec3(1, 0.2f, 0.1f), glm::vec3(0, 1, 0)), 5000, 3),
+				MakeScene("one draw", projection, 1, 4),
+				MakeScene("one group's worth", projection * glm::lookAt(glm::vec3(0), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0)), 64, 5),
+				MakeScene("past a group", projection * glm::lookAt(glm::vec3(0), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0)), 65, 6)
+			};
+
+			for (const CullScene& scene : scenes)
+			{
+				if (!CompareScene(culler, ring, scene))
+					failures++;
+			}
+		}
+	}
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+
+	std::cout << (failures == 0 ? "All scenes agree" : "Culling differs between GPU and CPU") << std::endl;
+	return failures == 0 ? 0 : 1;
+}
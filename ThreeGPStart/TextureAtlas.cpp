@@ -0,0 +1,209 @@
+#include "TextureAtlas.h"
+#include "MipGenerator.h"
+
+#include <algorithm>
+#include <cstring>
+
+// imgui_draw.cpp keeps its copy of the implementation static, this is ours
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imstb_rectpack.h"
+
+namespace Helpers
+{
+	struct TextureAtlas::Page
+	{
+		stbrp_context context;
+		std::vector<stbrp_node> nodes;
+
+		std::vector<BYTE> pixels;
+		GLuint texture{ 0 };
+
+		// Changed since it was last uploaded
+		bool dirty{ true };
+	};
+
+	TextureAtlas::TextureAtlas(const TextureAtlasOptions& options) : m_options(options)
+	{
+	}
+
+	TextureAtlas::~TextureAtlas()
+	{
+		Clear();
+	}
+
+	// Makes an empty page ready to pack into
+	TextureAtlas::Page& TextureAtlas::AddPage()
+	{
+		std::unique_ptr<Page> page{ std::make_unique<Page>() };
+
+		// A node per column is enough for the packer never to run out
+		page->nodes.resize(m_options.pageSize);
+		stbrp_init_target(&page->context, m_options.pageSize, m_options.pageSize, page->nodes.data(), (int)page->nodes.size());
+		page->pixels.assign((size_t)m_options.pageSize * m_options.pageSize * 4, 0);
+
+		m_pages.push_back(std::move(page));
+		return *m_pages.back();
+	}
+
+	// True if a texture of this size is small enough to pack
+	bool TextureAtlas::Accepts(int width, int height) const
+	{
+		return width > 0 && height > 0 && width <= m_options.maxTextureSize && height <= m_options.maxTextureSize &&
+			width + 2 * m_options.gutter <= m_options.pageSize && height + 2 * m_options.gutter <= m_options.pageSize;
+	}
+
+	// Packs width x height RGBA8 pixels under key, or returns the existing region if key was already added
+	AtlasRegion TextureAtlas::Add(const std::string& key, const BYTE* pixels, int width, int height)
+	{
+		auto found{ m_regions.find(key) };
+		if (found != m_regions.end())
+			return found->second;
+
+		if (!Accepts(width, height))
+			return AtlasRegion();
+
+		// Rounded up to the gutter so every texture starts on a boundary the mip levels keep
+		const int gutter{ m_options.gutter };
+		stbrp_rect rect{};
+		rect.w = (stbrp_coord)((width + 2 * gutter + gutter - 1) / gutter * gutter);
+		rect.h = (stbrp_coord)((height + 2 * gutter + gutter - 1) / gutter * gutter);
+
+		int pageIndex{ -1 };
+		for (int i = 0; i < (int)m_pages.size() && pageIndex < 0; i++)
+		{
+			if (stbrp_pack_rects(&m_pages[i]->context, &rect, 1) && rect.was_packed)
+				pageIndex = i;
+		}
+
+		if (pageIndex < 0)
+		{
+			Page& page{ AddPage() };
+			if (!stbrp_pack_rects(&page.context, &rect, 1) || !rect.was_packed)
+				return AtlasRegion();
+			pageIndex = (int)m_pages.size() - 1;
+		}
+
+		Page& page{ *m_pages[pageIndex] };
+		page.dirty = true;
+		m_usedTexels += (size_t)rect.w * rect.h;
+
+		// Copy with the edge texels repeated out into the gutter, as clamp to edge would sample them
+		const int pageSize{ m_options.pageSize };
+		const int left{ rect.x + gutter };
+		const int bottom{ rect.y + gutter };
+		for (int y = rect.y; y < rect.y + rect.h; y++)
+		{
+			const int sourceY{ std::clamp(y - bottom, 0, height - 1) };
+			const BYTE* sourceRow{ pixels + (size_t)sourceY * width * 4 };
+			BYTE* row{ page.pixels.data() + (size_t)y * pageSize * 4 };
+
+			for (int x = rect.x; x < left; x++)
+				memcpy(row + (size_t)x * 4, sourceRow, 4);
+			memcpy(row + (size_t)left * 4, sourceRow, (size_t)width * 4);
+			for (int x = left + width; x < rect.x + rect.w; x++)
+				memcpy(row + (size_t)x * 4, sourceRow + (size_t)(width - 1) * 4, 4);
+		}
+
+		AtlasRegion region;
+		region.page = pageIndex;
+		region.uvScale = glm::vec2((float)width, (float)height) / (float)pageSize;
+		region.uvOffset = glm::vec2((float)left, (float)bottom) / (float)pageSize;
+
+		m_regions[key] = region;
+		return region;
+	}
+
+	// Region of key, invalid if it was never added
+	AtlasRegion TextureAtlas::Find(const std::string& key) const
+	{
+		auto found{ m_regions.find(key) };
+		return found == m_regions.end() ? AtlasRegion() : found->second;
+	}
+
+	// Builds the mips of and uploads every page changed since the last call
+	void TextureAtlas::Upload()
+	{
+		// Each level halves the gutter, stop at one texel
+		int maxLevel{ 0 };
+		while ((m_options.gutter >> (maxLevel + 1)) > 0)
+			maxLevel++;
+
+		// Box filtering reads only the 2x2 block under each texel so never crosses an aligned boundary
+		MipSettings mipSettings;
+		mipSettings.filter = MipFilter::Box;
+		mipSettings.wrap = false;
+
+		for (std::unique_ptr<Page>& page : m_pages)
+		{
+			if (!page->dirty)
+				continue;
+
+			MipChain chain;
+			GenerateMipChain(page->pixels.data(), m_options.pageSize, m_options.pageSize, mipSettings, chain);
+
+			if (page->texture == 0)
+				glGenTextures(1, &page->texture);
+
+			glBindTexture(GL_TEXTURE_2D, page->texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+
+			for (int level = 0; level <= maxLevel && level < (int)chain.levels.size(); level++)
+			{
+				glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, chain.levels[level].width, chain.levels[level].height, 0,
+					GL_RGBA, GL_UNSIGNED_BYTE, chain.LevelData(level));
+			}
+
+			page->dirty = false;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// GL texture of a page, 0 until its first Upload
+	GLuint TextureAtlas::PageTexture(int page) const
+	{
+		return page >= 0 && page < (int)m_pages.size() ? m_pages[page]->texture : 0;
+	}
+
+	// Deletes every page
+	void TextureAtlas::Clear()
+	{
+		for (std::unique_ptr<Page>& page : m_pages)
+		{
+			if (page->texture)
+				glDeleteTextures(1, &page->texture);
+		}
+
+		m_pages.clear();
+		m_regions.clear();
+		m_usedTexels = 0;
+	}
+
+	TextureAtlas::Stats TextureAtlas::GetStats() const
+	{
+		Stats stats;
+		stats.pages = m_pages.size();
+		stats.textures = m_regions.size();
+		if (!m_pages.empty())
+			stats.occupancy = (float)m_usedTexels / ((float)m_pages.size() * m_options.pageSize * m_options.pageSize);
+		return stats;
+	}
+
+	// True if every coordinate lies within [0, 1] so the texture could be packed
+	bool TextureAtlas::FitsUnitSquare(const glm::vec2* uvCoords, size_t count)
+	{
+		// Exporters leave coordinates a hair outside the edge
+		const float epsilon{ 1e-3f };
+		for (size_t i = 0; i < count; i++)
+		{
+			if (uvCoords[i].x < -epsilon || uvCoords[i].x > 1 + epsilon || uvCoords[i].y < -epsilon || uvCoords[i].y > 1 + epsilon)
+				return false;
+		}
+		return count > 0;
+	}
+}
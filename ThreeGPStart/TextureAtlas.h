@@ -0,0 +1,95 @@
+#pragma once
+// Packs small textures into shared pages so meshes that only differ by texture can be drawn together
+
+#include "ExternalLibraryHeaders.h"
+
+#include <memory>
+#include <unordered_map>
+
+namespace Helpers
+{
+	struct TextureAtlasOptions
+	{
+		// Width and height of each page
+		int pageSize{ 2048 };
+
+		// Only textures this size and smaller are packed, larger ones are better off on their own
+		int maxTextureSize{ 512 };
+
+		// Texels of edge colour around every texture, a power of two. Mip levels stop when it shrinks to one texel
+		// so filtering never reaches a neighbour.
+		int gutter{ 8 };
+	};
+
+	// Where a texture ended up in the atlas
+	struct AtlasRegion
+	{
+		// Page index, -1 if not packed
+		int page{ -1 };
+
+		// Maps texture coordinates in [0, 1] of the original to the page
+		glm::vec2 uvScale{ 1 };
+		glm::vec2 uvOffset{ 0 };
+
+		bool IsValid() const { return page >= 0; }
+		glm::vec2 Remap(const glm::vec2& uv) const { return uvOffset + uv * uvScale; }
+	};
+
+	// Textures are packed with stb_rect_pack (bundled with imgui) as they are added, opening a new page when none has
+	// room. Each texture is surrounded by a gutter of its edge texels and placed on a gutter aligned boundary, so
+	// box filtered mips stay clean down to the level where the gutter is one texel. Only suitable for textures whose
+	// coordinates stay in [0, 1], repeats would sample the neighbours.
+	class TextureAtlas
+	{
+	public:
+		struct Stats
+		{
+			size_t pages{ 0 };
+			size_t textures{ 0 };
+
+			// Fraction of the page area holding texture and gutter
+			float occupancy{ 0 };
+		};
+	private:
+		struct Page;
+
+		std::vector<std::unique_ptr<Page>> m_pages;
+		std::unordered_map<std::string, AtlasRegion> m_regions;
+
+		TextureAtlasOptions m_options;
+		size_t m_usedTexels{ 0 };
+
+		// Makes an empty page ready to pack into
+		Page& AddPage();
+	public:
+		explicit TextureAtlas(const TextureAtlasOptions& options = TextureAtlasOptions());
+		~TextureAtlas();
+
+		TextureAtlas(const TextureAtlas&) = delete;
+		TextureAtlas& operator=(const TextureAtlas&) = delete;
+
+		// True if a texture of this size is small enough to pack
+		bool Accepts(int width, int height) const;
+
+		// Packs width x height RGBA8 pixels under key, or returns the existing region if key was already added.
+		// The page is not updated on the GPU until Upload. Returns an invalid region if the texture is too large.
+		AtlasRegion Add(const std::string& key, const BYTE* pixels, int width, int height);
+
+		// Region of key, invalid if it was never added
+		AtlasRegion Find(const std::string& key) const;
+
+		// Builds the mips of and uploads every page changed since the last call
+		void Upload();
+
+		// GL texture of a page, 0 until its first Upload
+		GLuint PageTexture(int page) const;
+
+		// Deletes every page
+		void Clear();
+
+		Stats GetStats() const;
+
+		// True if every coordinate lies within [0, 1] so the texture could be packed
+		static bool FitsUnitSquare(const glm::vec2* uvCoords, size_t count);
+	};
+}
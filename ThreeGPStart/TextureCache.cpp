@@ -0,0 +1,898 @@
+#include "TextureCache.h"
+#include "Resampler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+namespace fs = std::filesystem;
+
+namespace Helpers
+{
+	// Spreads every bit of x over the whole word (the splitmix64 finalizer)
+	static uint64_t MixWord(uint64_t x)
+	{
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	// FNV-1a over the pixels (or blocks), a word at a time to keep it cheap on large images. Each word is mixed first,
+	// as multiplying alone only carries bits upwards and changes to the top bits of two words would cancel out.
+	static uint64_t HashPixels(const BYTE* pixels, size_t bytes, int width, int height)
+	{
+		const uint64_t prime{ 1099511628211ull };
+		uint64_t hash{ 14695981039346656037ull };
+
+		hash = (hash ^ MixWord((uint64_t)width)) * prime;
+		hash = (hash ^ MixWord((uint64_t)height)) * prime;
+
+		size_t i{ 0 };
+		for (; i + 8 <= bytes; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, pixels + i, 8);
+			hash = (hash ^ MixWord(word)) * prime;
+		}
+
+		for (; i < bytes; i++)
+			hash = (hash ^ pixels[i]) * prime;
+
+		return hash;
+	}
+
+	static bool SameSettings(const TextureSettings& a, const TextureSettings& b)
+	{
+		return a.wrapS == b.wrapS && a.wrapT == b.wrapT && a.mipmaps == b.mipmaps;
+	}
+
+	// Settings are part of the key as they are stored in the texture object
+	static std::string SettingsKey(const TextureSettings& settings)
+	{
+		return "|" + std::to_string(settings.wrapS) + "|" + std::to_string(settings.wrapT) + "|" + (settings.mipmaps ? "m" : "");
+	}
+
+	static uint64_t SettingsHash(const TextureSettings& settings)
+	{
+		return ((uint64_t)settings.wrapS * 31 + (uint64_t)settings.wrapT) * 31 + (settings.mipmaps ? 1 : 0);
+	}
+
+	static bool IsDDSFile(const std::string& filepath)
+	{
+		std::string extension{ fs::path(filepath).extension().string() };
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		return extension == ".dds";
+	}
+
+	// Path in a form where different spellings of the same file compare equal
+	std::string TextureCache::CanonicalPath(const std::string& filepath)
+	{
+		std::error_code error;
+		fs::path path{ fs::weakly_canonical(fs::path(filepath), error) };
+		if (error)
+			path = fs::path(filepath).lexically_normal();
+
+		// Windows file names are case insensitive
+		std::string result{ path.generic_string() };
+		std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		return result;
+	}
+
+	// Key of a file loaded with settings, as used for lookups and cache file names
+	std::string TextureCache::CacheKey(const std::string& filepath, const TextureSettings& settings)
+	{
+		return CanonicalPath(filepath) + SettingsKey(settings);
+	}
+
+	// Creates a GL texture from RGBA pixels
+	GLuint TextureCache::CreateTexture(const BYTE* pixels, int width, int height, const TextureSettings& settings, GLuint texture) const
+	{
+		if (texture == 0)
+			glGenTextures(1, &texture);
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, settings.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, settings.wrapS);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, settings.wrapT);
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+		if (settings.mipmaps)
+			glGenerateMipmap(GL_TEXTURE_2D);
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		return texture;
+	}
+
+	// Creates a GL texture with every level of chain, no mip generation needed
+	GLuint TextureCache::CreateTexture(const MipChain& chain, const BYTE* data, const TextureSettings& settings, GLuint texture) const
+	{
+		if (texture == 0)
+			glGenTextures(1, &texture);
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, settings.wrapS);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, settings.wrapT);
+
+		glTexStorage2D(GL_TEXTURE_2D, (GLsizei)chain.levels.size(), GL_RGBA8, chain.levels[0].width, chain.levels[0].height);
+
+		for (size_t level = 0; level < chain.levels.size(); level++)
+		{
+			glTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, chain.levels[level].width, chain.levels[level].height,
+				GL_RGBA, GL_UNSIGNED_BYTE, data + chain.levels[level].offset);
+		}
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		return texture;
+	}
+
+	// Creates a GL texture from block compressed levels, only the first if settings has no mipmaps
+	GLuint TextureCache::CreateTexture(const CompressedImage& image, const BYTE* data, const TextureSettings& settings, GLuint texture) const
+	{
+		const size_t numLevels{ settings.mipmaps ? image.levels.size() : 1 };
+
+		if (texture == 0)
+			glGenTextures(1, &texture);
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, settings.wrapS);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, settings.wrapT);
+
+		// Files may stop short of 1x1, the texture is only complete if GL knows where the chain ends
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)numLevels - 1);
+
+		for (size_t level = 0; level < numLevels; level++)
+		{
+			glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, image.GLInternalFormat(), image.levels[level].width, image.levels[level].height,
+				0, (GLsizei)image.levels[level].size, data + image.levels[level].offset);
+		}
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		return texture;
+	}
+
+	// Creates whichever kind of texture decoded holds
+	GLuint TextureCache::CreateTexture(const DecodedTexture& decoded, const BYTE* data, const TextureSettings& settings, GLuint texture) const
+	{
+		if (!decoded.compressed.levels.empty())
+			return CreateTexture(decoded.compressed, data, settings, texture);
+
+		if (!decoded.mips.levels.empty())
+			return CreateTexture(decoded.mips, data, settings, texture);
+
+		return CreateTexture(data, decoded.image.Width(), decoded.image.Height(), settings, texture);
+	}
+
+	GLuint TextureCache::CreateTexture(const DecodedTexture& decoded, const TextureSettings& settings, GLuint texture) const
+	{
+		size_t bytes{ 0 };
+		return CreateTexture(decoded, UploadData(decoded, bytes), settings, texture);
+	}
+
+	// Bytes CreateTexture uploads for decoded, all in one block
+	const BYTE* TextureCache::UploadData(const DecodedTexture& decoded, size_t& bytes)
+	{
+		if (!decoded.compressed.levels.empty())
+		{
+			bytes = decoded.compressed.data.size();
+			return decoded.compressed.data.data();
+		}
+
+		if (!decoded.mips.levels.empty())
+		{
+			bytes = decoded.mips.data.size();
+			return decoded.mips.data.data();
+		}
+
+		bytes = decoded.image.DataSize();
+		return decoded.image.GetData();
+	}
+
+	// Estimated GPU memory of a texture made from decoded
+	size_t TextureCache::TextureBytes(const DecodedTexture& decoded, const TextureSettings& settings)
+	{
+		if (!decoded.compressed.levels.empty())
+		{
+			size_t bytes{ 0 };
+			const size_t numLevels{ settings.mipmaps ? decoded.compressed.levels.size() : 1 };
+			for (size_t level = 0; level < numLevels; level++)
+				bytes += decoded.compressed.levels[level].size;
+			return bytes;
+		}
+
+		size_t bytes{ decoded.mips.levels.empty() ? (size_t)decoded.image.Width() * (size_t)decoded.image.Height() * 4 : decoded.mips.LevelSize(0) };
+
+		// A full mip chain adds a third on top of the base level
+		if (settings.mipmaps)
+			bytes += bytes / 3;
+
+		return bytes;
+	}
+
+	// Scales image down with Lanczos3 so neither side is over maxSize, keeping the aspect. 0 is no limit.
+	static void LimitSize(ImageLoader& image, int maxSize)
+	{
+		const int largest{ std::max(image.Width(), image.Height()) };
+		if (maxSize <= 0 || largest <= maxSize)
+			return;
+
+		const int width{ std::max(1, (int)((int64_t)image.Width() * maxSize / largest)) };
+		const int height{ std::max(1, (int)((int64_t)image.Height() * maxSize / largest)) };
+
+		ImageLoader scaled;
+		ResampleImage(image, width, height, ResampleFilter::Lanczos3, scaled);
+		image = std::move(scaled);
+	}
+
+	// CPU side of loading: reads the cached chain or decodes the file, builds mips and compresses
+	void TextureCache::Decode(const std::string& filepath, const std::string& key, const TextureSettings& settings,
+		const TextureCacheOptions& options, DecodedTexture& decoded)
+	{
+		// DDS files come already compressed with their own mips, uncompressed ones are left to FreeImage
+		if (IsDDSFile(filepath) && LoadDDS(filepath, decoded.compressed))
+		{
+			decoded.ok = true;
+			return;
+		}
+
+		const bool compress{ options.compression != TextureCompression::None };
+
+		if (!compress && (!settings.mipmaps || !options.cpuMips))
+		{
+			decoded.ok = decoded.image.Load(filepath);
+			if (decoded.ok)
+				LimitSize(decoded.image, options.maxTextureSize);
+			return;
+		}
+
+		MipSettings mipSettings;
+		mipSettings.filter = options.mipFilter;
+		mipSettings.gammaCorrect = options.gammaCorrectMips;
+		mipSettings.wrap = settings.wrapS == GL_REPEAT && settings.wrapT == GL_REPEAT;
+
+		// Cache files are named after the key so different settings get different files
+		std::string cacheKey{ compress ? key + "|bc" + std::to_string((int)options.compression) : key };
+		if (options.maxTextureSize > 0)
+			cacheKey += "|max" + std::to_string(options.maxTextureSize);
+		std::ostringstream name;
+		name << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>()(cacheKey) << (compress ? ".dds" : ".mips");
+		const std::string cacheFilepath{ (fs::path(options.cacheDirectory) / name.str()).string() };
+
+		if (compress)
+		{
+			const uint32_t settingsStamp{ (uint32_t)mipSettings.filter | (mipSettings.gammaCorrect ? 0x100u : 0u) | (mipSettings.wrap ? 0x200u : 0u) |
+				((uint32_t)options.compression << 16) | (settings.mipmaps ? 0x100000u : 0u) };
+
+			if (options.useMipCache && LoadCompressedCache(cacheFilepath, filepath, settingsStamp, decoded.compressed))
+			{
+				decoded.ok = true;
+				decoded.fromMipCache = true;
+				return;
+			}
+
+			ImageLoader image;
+			if (!image.Load(filepath))
+				return;
+			LimitSize(image, options.maxTextureSize);
+
+			const int width{ image.Width() };
+			const int height{ image.Height() };
+			BlockFormat format{ BlockFormat::BC7 };
+			if (options.compression == TextureCompression::Auto)
+				format = HasAlpha(image.GetData(), (size_t)width * (size_t)height) ? BlockFormat::BC3 : BlockFormat::BC1;
+
+			if (settings.mipmaps)
+			{
+				MipChain chain;
+				GenerateMipChain(image.GetData(), width, height, mipSettings, chain);
+				CompressMipChain(chain, format, decoded.compressed);
+			}
+			else
+			{
+				decoded.compressed.Allocate(format, width, height, 1);
+				CompressImage(image.GetData(), width, height, format, decoded.compressed.data.data());
+			}
+
+			decoded.ok = true;
+
+			if (options.useMipCache && !SaveCompressedCache(cacheFilepath, filepath, settingsStamp, decoded.compressed))
+				std::cout << "Could not write compressed cache file: " << cacheFilepath << std::endl;
+			return;
+		}
+
+		if (options.useMipCache && LoadMipChain(cacheFilepath, filepath, mipSettings, decoded.mips))
+		{
+			decoded.ok = true;
+			decoded.fromMipCache = true;
+			return;
+		}
+
+		ImageLoader image;
+		if (!image.Load(filepath))
+			return;
+		LimitSize(image, options.maxTextureSize);
+
+		GenerateMipChain(image.GetData(), image.Width(), image.Height(), mipSettings, decoded.mips);
+		decoded.ok = true;
+
+		if (options.useMipCache && !SaveMipChain(cacheFilepath, filepath, mipSettings, decoded.mips))
+			std::cout << "Could not write mip cache file: " << cacheFilepath << std::endl;
+	}
+
+	// Hashes can collide, so a texture is only shared once its first level has been read back and compared byte for byte.
+	// This stalls on the GPU but only happens when a file really does look like one already loaded.
+	bool TextureCache::SameContent(GLuint texture, const BYTE* pixels, size_t bytes, int width, int height, GLenum format,
+		const TextureSettings& settings) const
+	{
+		auto found{ m_entries.find(texture) };
+		if (found == m_entries.end())
+			return false;
+
+		const Entry& entry{ found->second };
+		if (entry.width != width || entry.height != height || entry.format != format || entry.levelBytes != bytes ||
+			!SameSettings(entry.settings, settings))
+			return false;
+
+		std::vector<BYTE> existing(bytes);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		if (format == GL_RGBA8)
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, existing.data());
+		else
+			glGetCompressedTexImage(GL_TEXTURE_2D, 0, existing.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		return memcmp(existing.data(), pixels, bytes) == 0;
+	}
+
+	// Returns an existing texture with the same pixels or creates a new one, either way adding a reference
+	GLuint TextureCache::AddLoaded(const std::string& key, const std::string& filepath, const DecodedTexture& decoded, const TextureSettings& settings)
+	{
+		const bool isCompressed{ !decoded.compressed.levels.empty() };
+		const bool hasChain{ !decoded.mips.levels.empty() };
+
+		const BYTE* pixels{ decoded.image.GetData() };
+		int width{ decoded.image.Width() };
+		int height{ decoded.image.Height() };
+		size_t pixelBytes{ (size_t)width * (size_t)height * 4 };
+
+		if (isCompressed)
+		{
+			pixels = decoded.compressed.LevelData(0);
+			width = decoded.compressed.levels[0].width;
+			height = decoded.compressed.levels[0].height;
+			pixelBytes = decoded.compressed.levels[0].size;
+		}
+		else if (hasChain)
+		{
+			pixels = decoded.mips.LevelData(0);
+			width = decoded.mips.levels[0].width;
+			height = decoded.mips.levels[0].height;
+			pixelBytes = decoded.mips.LevelSize(0);
+		}
+
+		// A different file may hold identical pixels
+		const uint64_t contentHash{ HashPixels(pixels, pixelBytes, width, height) ^ SettingsHash(settings) };
+
+		const GLenum format{ isCompressed ? decoded.compressed.GLInternalFormat() : (GLenum)GL_RGBA8 };
+
+		auto sameContent{ m_contentLookup.find(contentHash) };
+		if (sameContent != m_contentLookup.end() && SameContent(sameContent->second, pixels, pixelBytes, width, height, format, settings))
+		{
+			m_stats.contentHits++;
+			m_entries[sameContent->second].refCount++;
+			m_pathLookup[key] = sameContent->second;
+			return sameContent->second;
+		}
+
+		if (decoded.fromMipCache)
+			m_stats.mipCacheHits++;
+
+		if (isCompressed)
+			m_stats.compressedCount++;
+
+		const GLuint texture{ CreateTexture(decoded, settings) };
+		const size_t bytes{ TextureBytes(decoded, settings) };
+
+		Entry& entry{ m_entries[texture] };
+		entry.key = key;
+		entry.sourcePath = filepath;
+		entry.settings = settings;
+		entry.contentHash = contentHash;
+		entry.width = width;
+		entry.height = height;
+		entry.format = format;
+		entry.levelBytes = pixelBytes;
+		entry.refCount = 1;
+		entry.bytes = bytes;
+
+		// A hash shared by different pixels keeps the newest texture, only found again if the hash matches
+		m_pathLookup[key] = texture;
+		m_contentLookup[contentHash] = texture;
+
+		m_stats.textureCount++;
+		m_stats.vramBytes += bytes;
+
+		return texture;
+	}
+
+	// Returns the texture for the image at filepath, loading it if not already cached. Returns 0 on error.
+	GLuint TextureCache::Acquire(const std::string& filepath, const TextureSettings& settings)
+	{
+		const std::string key{ CacheKey(filepath, settings) };
+
+		auto found{ m_pathLookup.find(key) };
+		if (found != m_pathLookup.end())
+		{
+			m_stats.hits++;
+			m_entries[found->second].refCount++;
+			return found->second;
+		}
+
+		m_stats.misses++;
+
+		const auto start{ std::chrono::steady_clock::now() };
+
+		DecodedTexture decoded;
+		Decode(filepath, key, settings, m_options, decoded);
+
+		GLuint texture{ 0 };
+		if (decoded.ok)
+			texture = AddLoaded(key, filepath, decoded, settings);
+
+		m_stats.loadMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		return texture;
+	}
+
+	// As Acquire but decoding any files not already cached in parallel
+	std::vector<GLuint> TextureCache::AcquireBatch(const std::vector<std::string>& filepaths, const TextureSettings& settings)
+	{
+		const auto start{ std::chrono::steady_clock::now() };
+
+		std::vector<GLuint> textures(filepaths.size(), 0);
+
+		// Work out which files need loading, each only once even if requested several times
+		std::vector<std::string> keys(filepaths.size());
+		std::vector<size_t> toLoad;
+		std::unordered_map<std::string, size_t> firstRequest;
+
+		for (size_t i = 0; i < filepaths.size(); i++)
+		{
+			keys[i] = CacheKey(filepaths[i], settings);
+			if (m_pathLookup.find(keys[i]) == m_pathLookup.end() && firstRequest.emplace(keys[i], i).second)
+				toLoad.push_back(i);
+		}
+
+		// Decoding and mip generation are the slow parts and do not touch GL so can happen on the workers
+		std::vector<DecodedTexture> decoded(toLoad.size());
+
+		ThreadPool::Global().ParallelFor(toLoad.size(), [&](size_t i)
+		{
+			Decode(filepaths[toLoad[i]], keys[toLoad[i]], settings, m_options, decoded[i]);
+		});
+
+		// GL calls have to be on this thread
+		for (size_t i = 0; i < toLoad.size(); i++)
+		{
+			m_stats.misses++;
+			if (!decoded[i].ok)
+				continue;
+
+			// Reference is handed to the first requester
+			textures[toLoad[i]] = AddLoaded(keys[toLoad[i]], filepaths[toLoad[i]], decoded[i], settings);
+		}
+
+		// Everything else is now a cache hit
+		for (size_t i = 0; i < filepaths.size(); i++)
+		{
+			if (textures[i] != 0)
+				continue;
+
+			auto found{ m_pathLookup.find(keys[i]) };
+			if (found == m_pathLookup.end())
+				continue;
+
+			m_stats.hits++;
+			m_entries[found->second].refCount++;
+			textures[i] = found->second;
+		}
+
+		m_stats.loadMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		return textures;
+	}
+
+	// As Acquire but returns straight away with a white placeholder, which Update fills once a worker has decoded the file
+	GLuint TextureCache::AcquireAsync(const std::string& filepath, const TextureSettings& settings)
+	{
+		const std::string key{ CacheKey(filepath, settings) };
+
+		auto found{ m_pathLookup.find(key) };
+		if (found != m_pathLookup.end())
+		{
+			m_stats.hits++;
+			m_entries[found->second].refCount++;
+			return found->second;
+		}
+
+		m_stats.misses++;
+
+		// If this fails the worker finds no space and uses ordinary memory
+		GetUploadRing();
+
+		// The name stays the same once loaded so meshes can use it straight away
+		const BYTE white[4]{ 255, 255, 255, 255 };
+		const GLuint texture{ CreateTexture(white, 1, 1, settings) };
+
+		// Pixels are written straight into mapped memory that is slow to read back, so no content lookup for these
+		Entry& entry{ m_entries[texture] };
+		entry.key = key;
+		entry.sourcePath = filepath;
+		entry.settings = settings;
+		entry.refCount = 1;
+		entry.bytes = sizeof(white);
+
+		m_pathLookup[key] = texture;
+
+		m_stats.textureCount++;
+		m_stats.vramBytes += entry.bytes;
+		m_stats.pendingUploads++;
+
+		PendingUpload pending;
+		pending.texture = texture;
+		pending.settings = settings;
+
+		const TextureCacheOptions options{ m_options };
+		MappedRingBuffer* ring{ &m_uploadRing };
+
+		pending.result = ThreadPool::Global().Submit([filepath, key, settings, options, ring]()
+		{
+			AsyncDecode result;
+
+			// Anything needing more than a straight decode is prepared as Acquire would, then copied into the ring
+			if (options.compression != TextureCompression::None || (options.cpuMips && settings.mipmaps) ||
+				options.maxTextureSize > 0 || IsDDSFile(filepath))
+			{
+				result.decoded = std::make_unique<DecodedTexture>();
+				Decode(filepath, key, settings, options, *result.decoded);
+				result.ok = result.decoded->ok;
+
+				if (result.ok)
+				{
+					size_t bytes{ 0 };
+					const BYTE* source{ UploadData(*result.decoded, bytes) };
+					BYTE* mapped{ ring->Allocate(bytes, 16, result.ringOffset) };
+					if (mapped)
+					{
+						std::memcpy(mapped, source, bytes);
+						result.inRing = true;
+					}
+				}
+				return result;
+			}
+
+			result.ok = ImageLoader::DecodeInto(filepath, [&](int width, int height) -> BYTE*
+			{
+				result.width = width;
+				result.height = height;
+
+				const size_t bytes{ (size_t)width * (size_t)height * 4 };
+				BYTE* mapped{ ring->Allocate(bytes, 4, result.ringOffset) };
+				if (mapped)
+				{
+					result.inRing = true;
+					return mapped;
+				}
+
+				// Ring full, e.g. many large images at once
+				result.fallback.resize(bytes);
+				return result.fallback.data();
+			});
+
+			return result;
+		});
+
+		m_pendingUploads.push_back(std::move(pending));
+
+		return texture;
+	}
+
+	// Fills the placeholder texture of a finished AcquireAsync decode
+	void TextureCache::FinishUpload(const PendingUpload& pending, AsyncDecode& result)
+	{
+		auto found{ pending.texture != 0 ? m_entries.find(pending.texture) : m_entries.end() };
+
+		// Released before it finished, or failed to load in which case the placeholder stays
+		if (found == m_entries.end() || !result.ok)
+		{
+			if (result.inRing)
+				m_uploadRing.Fence(result.ringOffset);
+
+			if (found != m_entries.end())
+				std::cout << "Could not load texture: " << found->second.sourcePath << std::endl;
+			return;
+		}
+
+		Entry& entry{ found->second };
+		size_t bytes{ 0 };
+
+		if (result.decoded)
+		{
+			if (result.inRing)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_uploadRing.Buffer());
+				CreateTexture(*result.decoded, (const BYTE*)(uintptr_t)result.ringOffset, pending.settings, pending.texture);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+				m_uploadRing.Fence(result.ringOffset);
+				m_stats.ringUploads++;
+			}
+			else
+			{
+				CreateTexture(*result.decoded, pending.settings, pending.texture);
+			}
+			bytes = TextureBytes(*result.decoded, pending.settings);
+
+			if (!result.decoded->compressed.levels.empty())
+				m_stats.compressedCount++;
+			if (result.decoded->fromMipCache)
+				m_stats.mipCacheHits++;
+		}
+		else
+		{
+			glBindTexture(GL_TEXTURE_2D, pending.texture);
+
+			// From the ring the copy into the texture happens on the GPU timeline, the fence says when the space is free again
+			if (result.inRing)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_uploadRing.Buffer());
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, result.width, result.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)(uintptr_t)result.ringOffset);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+				m_uploadRing.Fence(result.ringOffset);
+				m_stats.ringUploads++;
+			}
+			else
+			{
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, result.width, result.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, result.fallback.data());
+			}
+
+			if (pending.settings.mipmaps)
+				glGenerateMipmap(GL_TEXTURE_2D);
+
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			bytes = (size_t)result.width * (size_t)result.height * 4;
+			if (pending.settings.mipmaps)
+				bytes += bytes / 3;
+		}
+
+		m_stats.vramBytes += bytes - entry.bytes;
+		entry.bytes = bytes;
+	}
+
+	// Uploads AcquireAsync textures whose decode has finished and reuses upload ring space the GPU is done with
+	void TextureCache::Update()
+	{
+		const auto start{ std::chrono::steady_clock::now() };
+		bool uploaded{ false };
+
+		for (auto it = m_pendingUploads.begin(); it != m_pendingUploads.end();)
+		{
+			if (it->result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				++it;
+				continue;
+			}
+
+			AsyncDecode result{ it->result.get() };
+			FinishUpload(*it, result);
+			uploaded = true;
+
+			it = m_pendingUploads.erase(it);
+			m_stats.pendingUploads--;
+		}
+
+		if (m_uploadRing.IsCreated())
+			m_uploadRing.Retire();
+
+		if (uploaded)
+			m_stats.loadMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Mapped pixel unpack buffer AcquireAsync uploads from, created on first use
+	MappedRingBuffer* TextureCache::GetUploadRing()
+	{
+		if (!m_uploadRing.IsCreated() && !m_uploadRing.Create(GL_PIXEL_UNPACK_BUFFER, m_options.uploadRingBytes))
+			return nullptr;
+
+		return &m_uploadRing;
+	}
+
+	// Times loading every cached file with driver mips, CPU generated mips and mips from the cache directory
+	std::string TextureCache::BenchmarkLoadPaths()
+	{
+		struct Source
+		{
+			std::string filepath;
+			std::string key;
+			TextureSettings settings;
+		};
+
+		std::vector<Source> sources;
+		for (const auto& entry : m_entries)
+		{
+			if (entry.second.settings.mipmaps)
+				sources.push_back(Source{ entry.second.sourcePath, entry.second.key, entry.second.settings });
+		}
+
+		if (sources.empty())
+			return "No mipmapped textures loaded";
+
+		// Loads everything the same way the cache does, then throws the textures away
+		auto timeLoad = [&](const TextureCacheOptions& options)
+		{
+			const auto start{ std::chrono::steady_clock::now() };
+
+			std::vector<DecodedTexture> decoded(sources.size());
+			ThreadPool::Global().ParallelFor(sources.size(), [&](size_t i)
+			{
+				Decode(sources[i].filepath, sources[i].key, sources[i].settings, options, decoded[i]);
+			});
+
+			std::vector<GLuint> textures;
+			for (size_t i = 0; i < sources.size(); i++)
+			{
+				if (decoded[i].ok)
+					textures.push_back(CreateTexture(decoded[i], sources[i].settings));
+			}
+
+			// Make sure the driver has actually done the work
+			glFinish();
+			const double ms{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+			glDeleteTextures((GLsizei)textures.size(), textures.data());
+			return ms;
+		};
+
+		TextureCacheOptions driver{ m_options };
+		driver.cpuMips = false;
+		driver.compression = TextureCompression::None;
+
+		TextureCacheOptions generate{ m_options };
+		generate.cpuMips = true;
+		generate.useMipCache = false;
+		generate.compression = TextureCompression::None;
+
+		TextureCacheOptions cached{ m_options };
+		cached.cpuMips = true;
+		cached.useMipCache = true;
+		cached.compression = TextureCompression::None;
+
+		TextureCacheOptions compressed{ m_options };
+		compressed.useMipCache = true;
+		if (compressed.compression == TextureCompression::None)
+			compressed.compression = TextureCompression::Auto;
+
+		// Run the cached paths twice, the first makes sure the files exist
+		const double driverMs{ timeLoad(driver) };
+		const double generateMs{ timeLoad(generate) };
+		timeLoad(cached);
+		const double cachedMs{ timeLoad(cached) };
+		timeLoad(compressed);
+		const double compressedMs{ timeLoad(compressed) };
+
+		std::ostringstream report;
+		report << std::fixed << std::setprecision(1) << sources.size() << " textures\n"
+			<< "glGenerateMipmap: " << driverMs << " ms\n"
+			<< "CPU mips: " << generateMs << " ms\n"
+			<< "Cached mips: " << cachedMs << " ms\n"
+			<< "Cached compressed mips: " << compressedMs << " ms";
+
+		std::cout << "Texture load benchmark\n" << report.str() << std::endl;
+
+		return report.str();
+	}
+
+	// Adds a reference to an already acquired texture
+	void TextureCache::AddRef(GLuint texture)
+	{
+		auto found{ m_entries.find(texture) };
+		if (found != m_entries.end())
+			found->second.refCount++;
+	}
+
+	// Drops a reference, the GL texture is deleted when no longer used
+	void TextureCache::Release(GLuint texture)
+	{
+		auto found{ m_entries.find(texture) };
+		if (found == m_entries.end())
+			return;
+
+		Entry& entry{ found->second };
+		if (--entry.refCount > 0)
+			return;
+
+		// A decode still in flight must not fill a later texture given the same name
+		for (PendingUpload& pending : m_pendingUploads)
+		{
+			if (pending.texture == texture)
+				pending.texture = 0;
+		}
+
+		// Several paths may map to this texture
+		for (auto it = m_pathLookup.begin(); it != m_pathLookup.end();)
+		{
+			if (it->second == texture)
+				it = m_pathLookup.erase(it);
+			else
+				++it;
+		}
+		auto sameContent{ m_contentLookup.find(entry.contentHash) };
+		if (sameContent != m_contentLookup.end() && sameContent->second == texture)
+			m_contentLookup.erase(sameContent);
+
+		m_stats.textureCount--;
+		m_stats.vramBytes -= entry.bytes;
+
+		glDeleteTextures(1, &texture);
+		m_entries.erase(found);
+	}
+
+	// 1x1 white texture, owned by the cache so needs no Release
+	GLuint TextureCache::GetWhiteTexture()
+	{
+		if (m_whiteTexture == 0)
+		{
+			const BYTE white[4]{ 255, 255, 255, 255 };
+			TextureSettings settings;
+			settings.mipmaps = false;
+			m_whiteTexture = CreateTexture(white, 1, 1, settings);
+		}
+
+		return m_whiteTexture;
+	}
+
+	// Deletes every texture regardless of references
+	void TextureCache::Clear()
+	{
+		// Workers may still be writing into the upload ring
+		for (PendingUpload& pending : m_pendingUploads)
+			pending.result.wait();
+		m_pendingUploads.clear();
+		m_uploadRing.Destroy();
+		m_stats.pendingUploads = 0;
+
+		for (auto& entry : m_entries)
+			glDeleteTextures(1, &entry.first);
+
+		if (m_whiteTexture != 0)
+			glDeleteTextures(1, &m_whiteTexture);
+		m_whiteTexture = 0;
+
+		m_entries.clear();
+		m_pathLookup.clear();
+		m_contentLookup.clear();
+
+		m_stats.textureCount = 0;
+		m_stats.vramBytes = 0;
+	}
+}
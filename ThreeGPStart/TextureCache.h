@@ -0,0 +1,268 @@
+#pragma once
+// Shares one OpenGL texture between every mesh / material that uses the same image
+
+#include "ExternalLibraryHeaders.h"
+#include "BlockCompressor.h"
+#include "ImageLoader.h"
+#include "MappedRingBuffer.h"
+#include "MipGenerator.h"
+
+#include <future>
+#include <memory>
+#include <unordered_map>
+
+namespace Helpers
+{
+	// How a texture is sampled. Textures with different settings cannot share a GL texture object.
+	struct TextureSettings
+	{
+		GLint wrapS{ GL_REPEAT };
+		GLint wrapT{ GL_REPEAT };
+		bool mipmaps{ true };
+	};
+
+	// Block compression applied to images that are not already compressed
+	enum class TextureCompression
+	{
+		// Upload as RGBA8
+		None,
+
+		// BC1 for opaque images, BC3 for those with alpha
+		Auto,
+
+		// BC7, better quality than BC1 / BC3 at the cost of a slower encode
+		BC7
+	};
+
+	// How the cache builds mip chains, applies to textures loaded after it is set
+	struct TextureCacheOptions
+	{
+		// Generate mips on the CPU (in parallel, with the filter below) rather than with glGenerateMipmap.
+		// Compressed textures always have their mips generated on the CPU.
+		bool cpuMips{ true };
+		MipFilter mipFilter{ MipFilter::Kaiser };
+		bool gammaCorrectMips{ true };
+
+		// Encode on the CPU so the GPU holds 4 - 8x less data. DDS files are always uploaded as they are.
+		TextureCompression compression{ TextureCompression::Auto };
+
+		// Store generated chains (compressed or not) so later runs upload them directly without decoding the source image
+		bool useMipCache{ true };
+		std::string cacheDirectory{ "Data\\Cache" };
+
+		// Quality setting: images larger than this on either side are scaled down with Lanczos3 on load, keeping their
+		// aspect. 0 for no limit. DDS files are used as they are.
+		int maxTextureSize{ 0 };
+
+		// Size of the mapped pixel unpack buffer AcquireAsync uploads from, textures that do not fit use ordinary memory
+		size_t uploadRingBytes{ 128 * 1024 * 1024 };
+	};
+
+	// Result of the CPU side of loading a texture, safe to produce on a worker thread
+	struct DecodedTexture
+	{
+		// Block compressed levels from a DDS file or the encoder
+		CompressedImage compressed;
+
+		// Full chain when mips are generated on the CPU
+		MipChain mips;
+
+		// Otherwise just the image
+		ImageLoader image;
+
+		bool ok{ false };
+		bool fromMipCache{ false };
+	};
+
+	// Loads textures on request, returning an existing texture if the same file (or identical pixels) has been seen before.
+	// Textures are reference counted so each Acquire should be matched by a Release.
+	class TextureCache
+	{
+	public:
+		struct Stats
+		{
+			// Number of Acquire calls satisfied by the path lookup
+			size_t hits{ 0 };
+
+			// Number of Acquire calls that had to load the file
+			size_t misses{ 0 };
+
+			// Misses where the pixels turned out to match an existing texture
+			size_t contentHits{ 0 };
+
+			// Misses whose mip chain came straight from the cache directory
+			size_t mipCacheHits{ 0 };
+
+			// Misses uploaded as block compressed data, from DDS files or the encoder
+			size_t compressedCount{ 0 };
+
+			// AcquireAsync textures still decoding, and those that were uploaded from the mapped ring
+			size_t pendingUploads{ 0 };
+			size_t ringUploads{ 0 };
+
+			// Live textures and the estimated GPU memory they use
+			size_t textureCount{ 0 };
+			size_t vramBytes{ 0 };
+
+			// Wall clock time spent loading (decode, mip generation and upload)
+			double loadMilliseconds{ 0 };
+		};
+	private:
+		// Result of an AcquireAsync decode on a worker thread
+		struct AsyncDecode
+		{
+			// Where the data to upload starts in the upload ring, if it fitted
+			size_t ringOffset{ 0 };
+			bool inRing{ false };
+
+			// RGBA8 pixels decoded straight into the ring, or into fallback if it was full
+			int width{ 0 };
+			int height{ 0 };
+			std::vector<BYTE> fallback;
+
+			// Textures needing more than a decode (compression, CPU mips, resizing) go through Decode, then are copied into
+			// the ring. Set for these even if the copy did not fit.
+			std::unique_ptr<DecodedTexture> decoded;
+
+			bool ok{ false };
+		};
+
+		struct PendingUpload
+		{
+			// Zero if released before the decode finished
+			GLuint texture{ 0 };
+			TextureSettings settings;
+			std::future<AsyncDecode> result;
+		};
+
+		struct Entry
+		{
+			std::string key;
+			std::string sourcePath;
+			TextureSettings settings;
+			uint64_t contentHash{ 0 };
+
+			// First level as uploaded, to confirm a matching hash really is the same image
+			int width{ 0 };
+			int height{ 0 };
+			GLenum format{ 0 };
+			size_t levelBytes{ 0 };
+
+			int refCount{ 0 };
+			size_t bytes{ 0 };
+		};
+
+		// Canonical path + settings to texture
+		std::unordered_map<std::string, GLuint> m_pathLookup;
+
+		// Content hash + settings to texture, catches the same image saved under different names
+		std::unordered_map<uint64_t, GLuint> m_contentLookup;
+
+		std::unordered_map<GLuint, Entry> m_entries;
+
+		Stats m_stats;
+
+		TextureCacheOptions m_options;
+
+		// Plain white texture for meshes without one
+		GLuint m_whiteTexture{ 0 };
+
+		// AcquireAsync decodes in flight and the buffer they upload from
+		std::vector<PendingUpload> m_pendingUploads;
+		MappedRingBuffer m_uploadRing;
+
+		// The CreateTexture functions fill texture if given, otherwise they create a new one
+
+		// Creates a GL texture from RGBA pixels
+		GLuint CreateTexture(const BYTE* pixels, int width, int height, const TextureSettings& settings, GLuint texture = 0) const;
+
+		// The functions below take the chain's bytes as data, either its own memory or, with a pixel unpack buffer bound,
+		// their offset in the buffer
+
+		// Creates a GL texture with every level of chain, no mip generation needed
+		GLuint CreateTexture(const MipChain& chain, const BYTE* data, const TextureSettings& settings, GLuint texture = 0) const;
+
+		// Creates a GL texture from block compressed levels, only the first if settings has no mipmaps
+		GLuint CreateTexture(const CompressedImage& image, const BYTE* data, const TextureSettings& settings, GLuint texture = 0) const;
+
+		// Creates whichever kind of texture decoded holds
+		GLuint CreateTexture(const DecodedTexture& decoded, const BYTE* data, const TextureSettings& settings, GLuint texture = 0) const;
+		GLuint CreateTexture(const DecodedTexture& decoded, const TextureSettings& settings, GLuint texture = 0) const;
+
+		// Bytes CreateTexture uploads for decoded, all in one block
+		static const BYTE* UploadData(const DecodedTexture& decoded, size_t& bytes);
+
+		// Estimated GPU memory of a texture made from decoded
+		static size_t TextureBytes(const DecodedTexture& decoded, const TextureSettings& settings);
+
+		// True if texture was made from exactly these first level bytes with the same settings
+		bool SameContent(GLuint texture, const BYTE* pixels, size_t bytes, int width, int height, GLenum format,
+			const TextureSettings& settings) const;
+
+		// Returns an existing texture with the same pixels or creates a new one, either way adding a reference
+		GLuint AddLoaded(const std::string& key, const std::string& filepath, const DecodedTexture& decoded, const TextureSettings& settings);
+
+		// Fills the placeholder texture of a finished AcquireAsync decode
+		void FinishUpload(const PendingUpload& pending, AsyncDecode& result);
+	public:
+		TextureCache() = default;
+		~TextureCache() { Clear(); }
+
+		TextureCache(const TextureCache&) = delete;
+		TextureCache& operator=(const TextureCache&) = delete;
+
+		// Returns the texture for the image at filepath, loading it if not already cached. Returns 0 on error.
+		GLuint Acquire(const std::string& filepath, const TextureSettings& settings = TextureSettings());
+
+		// As Acquire but for many files at once. Files not already cached are decoded in parallel on worker threads,
+		// only the GL upload happens on this thread. Returned textures match filepaths, 0 for any that failed.
+		std::vector<GLuint> AcquireBatch(const std::vector<std::string>& filepaths, const TextureSettings& settings = TextureSettings());
+
+		// As Acquire but returns straight away with a white placeholder, which Update fills once a worker has decoded the file.
+		// The upload is always from a persistently mapped pixel unpack buffer so it never stalls the frame. Images needing
+		// nothing but a decode are decoded straight into it, so the decode is the only CPU copy, then mipmapped on the GPU.
+		// Anything compressed, CPU mipped or resized is prepared as Acquire would, then copied in once on the worker.
+		GLuint AcquireAsync(const std::string& filepath, const TextureSettings& settings = TextureSettings());
+
+		// Uploads AcquireAsync textures whose decode has finished and reuses upload ring space the GPU is done with.
+		// Never waits, call once a frame.
+		void Update();
+
+		// Mapped pixel unpack buffer AcquireAsync uploads from, created on first use. Others such as the TextureStreamer may
+		// share it as long as they are done with it before the cache is cleared. Returns nullptr if it cannot be created.
+		MappedRingBuffer* GetUploadRing();
+
+		// Adds a reference to an already acquired texture, e.g. when another mesh starts using it
+		void AddRef(GLuint texture);
+
+		// Drops a reference, the GL texture is deleted when no longer used
+		void Release(GLuint texture);
+
+		// Deletes every texture regardless of references, waiting for any decodes in flight
+		void Clear();
+
+		const Stats& GetStats() const { return m_stats; }
+
+		const TextureCacheOptions& GetOptions() const { return m_options; }
+		void SetOptions(const TextureCacheOptions& options) { m_options = options; }
+
+		// Times loading every cached file with driver mips, CPU generated mips, mips from the cache directory
+		// and block compressed mips from the cache directory.
+		// Returns a report for display.
+		std::string BenchmarkLoadPaths();
+
+		// 1x1 white texture, owned by the cache so needs no Release
+		GLuint GetWhiteTexture();
+
+		// CPU side of loading: reads the cached chain or decodes the file, builds mips and compresses as options say.
+		// key names the cache file, normally the canonical path plus settings. Does not touch GL so is safe on any thread.
+		static void Decode(const std::string& filepath, const std::string& key, const TextureSettings& settings,
+			const TextureCacheOptions& options, DecodedTexture& decoded);
+
+		// Path in a form where different spellings of the same file compare equal
+		static std::string CanonicalPath(const std::string& filepath);
+
+		// Key of a file loaded with settings, as used for lookups and cache file names
+		static std::string CacheKey(const std::string& filepath, const TextureSettings& settings);
+	};
+}
@@ -0,0 +1,381 @@
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Helpers
+{
+	int TextureStreamer::NumLevels(const DecodedTexture& data)
+	{
+		return (int)(data.compressed.levels.empty() ? data.mips.levels.size() : data.compressed.levels.size());
+	}
+
+	const BYTE* TextureStreamer::LevelData(const DecodedTexture& data, int level)
+	{
+		return data.compressed.levels.empty() ? data.mips.LevelData(level) : data.compressed.LevelData(level);
+	}
+
+	size_t TextureStreamer::LevelBytes(const DecodedTexture& data, int level)
+	{
+		return data.compressed.levels.empty() ? data.mips.LevelSize(level) : data.compressed.levels[level].size;
+	}
+
+	// Bytes of level and every coarser level
+	size_t TextureStreamer::BytesFrom(const StreamedTexture& texture, int level)
+	{
+		size_t bytes{ 0 };
+		for (int i = std::max(level, 0); i < texture.numLevels; i++)
+			bytes += LevelBytes(*texture.data, i);
+		return bytes;
+	}
+
+	// Finest level of data no larger than residentTailSize
+	int TextureStreamer::TailLevel(const DecodedTexture& data, int residentTailSize)
+	{
+		const int numLevels{ NumLevels(data) };
+		const int width{ data.compressed.levels.empty() ? std::max(data.mips.levels[0].width, data.mips.levels[0].height) :
+			std::max(data.compressed.levels[0].width, data.compressed.levels[0].height) };
+
+		int tailLevel{ numLevels - 1 };
+		while (tailLevel > 0 && (width >> (tailLevel - 1)) <= residentTailSize)
+			tailLevel--;
+		return tailLevel;
+	}
+
+	// Uploads level of texture from pixels: its CPU copy, or with the unpack buffer bound an offset in it
+	void TextureStreamer::UploadLevel(GLuint name, const StreamedTexture& texture, int level, const BYTE* pixels) const
+	{
+		glBindTexture(GL_TEXTURE_2D, name);
+
+		const DecodedTexture& data{ *texture.data };
+		if (!data.compressed.levels.empty())
+		{
+			const CompressedImage::Level& source{ data.compressed.levels[level] };
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, data.compressed.GLInternalFormat(), source.width, source.height, 0,
+				(GLsizei)source.size, pixels);
+		}
+		else
+		{
+			const MipChain::Level& source{ data.mips.levels[level] };
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, source.width, source.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		}
+	}
+
+	// Sets the finest level sampled
+	void TextureStreamer::SetBaseLevel(GLuint name, int level) const
+	{
+		glBindTexture(GL_TEXTURE_2D, name);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	}
+
+	// Frees the memory of a level, a zero size level is ignored as long as it is above the base level
+	static void FreeLevel(GLuint name, int level)
+	{
+		glBindTexture(GL_TEXTURE_2D, name);
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	}
+
+	// Starts loading filepath on a worker and returns its texture, white until the first levels arrive
+	GLuint TextureStreamer::Add(const std::string& filepath, const TextureSettings& settings)
+	{
+		GLuint name{ 0 };
+		glGenTextures(1, &name);
+
+		const BYTE white[4]{ 255, 255, 255, 255 };
+		glBindTexture(GL_TEXTURE_2D, name);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, settings.wrapS);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, settings.wrapT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// Streaming needs the whole chain
+		TextureSettings decodeSettings{ settings };
+		decodeSettings.mipmaps = true;
+
+		TextureCacheOptions options{ m_options.decodeOptions };
+		options.cpuMips = true;
+
+		const std::string key{ TextureCache::CacheKey(filepath, decodeSettings) };
+		const int residentTailSize{ m_options.residentTailSize };
+		MappedRingBuffer* ring{ m_uploadRing };
+
+		StreamedTexture& texture{ m_textures[name] };
+		texture.filepath = filepath;
+		texture.settings = decodeSettings;
+		texture.loading = ThreadPool::Global().Submit([filepath, key, decodeSettings, options, residentTailSize, ring]()
+		{
+			Loaded loaded;
+			loaded.data = std::make_unique<DecodedTexture>();
+			TextureCache::Decode(filepath, key, decodeSettings, options, *loaded.data);
+			if (!loaded.data->ok)
+				return loaded;
+
+			// The tail is uploaded as soon as the load finishes, copying it here keeps that copy off the GL thread
+			const DecodedTexture& data{ *loaded.data };
+			loaded.tailLevel = TailLevel(data, residentTailSize);
+
+			size_t bytes{ 0 };
+			for (int level = loaded.tailLevel; level < NumLevels(data); level++)
+				bytes += LevelBytes(data, level);
+
+			BYTE* mapped{ ring ? ring->Allocate(bytes, 16, loaded.ringOffset) : nullptr };
+			if (mapped)
+			{
+				for (int level = loaded.tailLevel; level < NumLevels(data); level++)
+				{
+					std::memcpy(mapped, LevelData(data, level), LevelBytes(data, level));
+					mapped += LevelBytes(data, level);
+				}
+				loaded.inRing = true;
+			}
+
+			return loaded;
+		});
+
+		m_stats.textureCount++;
+		m_stats.pendingLoads++;
+
+		return name;
+	}
+
+	// Puts the tail levels of a newly decoded texture on the GPU in place of the placeholder
+	void TextureStreamer::FinishLoad(GLuint name, StreamedTexture& texture)
+	{
+		Loaded loaded{ texture.loading.get() };
+		texture.data = std::move(loaded.data);
+		m_stats.pendingLoads--;
+
+		if (!texture.data->ok)
+		{
+			std::cout << "TextureStreamer: could not load " << texture.filepath << std::endl;
+			texture.data.reset();
+			return;
+		}
+
+		const DecodedTexture& data{ *texture.data };
+		const bool compressed{ !data.compressed.levels.empty() };
+		texture.numLevels = NumLevels(data);
+		texture.width = compressed ? std::max(data.compressed.levels[0].width, data.compressed.levels[0].height) :
+			std::max(data.mips.levels[0].width, data.mips.levels[0].height);
+		texture.tailLevel = loaded.tailLevel;
+
+		glBindTexture(GL_TEXTURE_2D, name);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.numLevels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture.numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+
+		// Level 0 still holds the placeholder
+		FreeLevel(name, 0);
+
+		// From the ring the copy into the texture happens on the GPU timeline, the fence says when the space is free again
+		if (loaded.inRing)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_uploadRing->Buffer());
+
+			size_t offset{ loaded.ringOffset };
+			for (int level = texture.tailLevel; level < texture.numLevels; level++)
+			{
+				UploadLevel(name, texture, level, (const BYTE*)(uintptr_t)offset);
+				offset += LevelBytes(data, level);
+			}
+
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			m_uploadRing->Fence(loaded.ringOffset);
+			m_stats.ringUploads++;
+		}
+		else
+		{
+			for (int level = texture.numLevels - 1; level >= texture.tailLevel; level--)
+				UploadLevel(name, texture, level, LevelData(data, level));
+		}
+		SetBaseLevel(name, texture.tailLevel);
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		texture.residentLevel = texture.tailLevel;
+		texture.wantedLevel = texture.tailLevel;
+
+		m_stats.fullBytes += BytesFrom(texture, 0);
+	}
+
+	// Usage feedback: texture was drawn this frame with uvPerPixel texture coordinate units per screen pixel
+	void TextureStreamer::ReportUsage(GLuint texture, float uvPerPixel)
+	{
+		auto found{ m_textures.find(texture) };
+		if (found == m_textures.end() || !found->second.data || uvPerPixel <= 0)
+			return;
+
+		// Texels per pixel at level 0 is 2 ^ the level the hardware would pick
+		StreamedTexture& streamed{ found->second };
+		streamed.requestedLevel = std::min(streamed.requestedLevel, std::log2(uvPerPixel * streamed.width));
+	}
+
+	// Finishes loads, then raises or drops levels from this frame's usage within the budget
+	void TextureStreamer::Update()
+	{
+		m_stats.levelsUploaded = 0;
+		m_stats.levelsDropped = 0;
+		m_stats.budgetLimited = 0;
+
+		for (auto& entry : m_textures)
+		{
+			if (entry.second.loading.valid() && entry.second.loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+				FinishLoad(entry.first, entry.second);
+		}
+
+		// What each loaded texture would like this frame
+		std::vector<std::pair<GLuint, StreamedTexture*>> loaded;
+		size_t total{ 0 };
+
+		for (auto& entry : m_textures)
+		{
+			StreamedTexture& texture{ entry.second };
+			if (!texture.data)
+				continue;
+
+			if (texture.requestedLevel == FLT_MAX)
+			{
+				// Not drawn, keep what is there for a while in case it comes back into view
+				texture.wantedLevel = ++texture.framesUnused > m_options.framesBeforeDrop ? texture.tailLevel : texture.residentLevel;
+			}
+			else
+			{
+				texture.framesUnused = 0;
+				texture.wantedLevel = std::clamp((int)std::floor(texture.requestedLevel + m_options.lodBias), 0, texture.tailLevel);
+			}
+
+			texture.requestedLevel = FLT_MAX;
+			total += BytesFrom(texture, texture.wantedLevel);
+			loaded.emplace_back(entry.first, &texture);
+		}
+
+		// Over budget, coarsen whichever texture has the largest finest level until it fits
+		while (total > m_options.vramBudgetBytes)
+		{
+			StreamedTexture* largest{ nullptr };
+			size_t largestBytes{ 0 };
+			for (auto& entry : loaded)
+			{
+				StreamedTexture& texture{ *entry.second };
+				if (texture.wantedLevel < texture.tailLevel && LevelBytes(*texture.data, texture.wantedLevel) > largestBytes)
+				{
+					largest = &texture;
+					largestBytes = LevelBytes(*texture.data, texture.wantedLevel);
+				}
+			}
+
+			// Only tails left
+			if (!largest)
+				break;
+
+			largest->wantedLevel++;
+			total -= largestBytes;
+			m_stats.budgetLimited++;
+		}
+
+		// Drops are immediate so the memory is free for the uploads below
+		for (auto& entry : loaded)
+		{
+			StreamedTexture& texture{ *entry.second };
+			if (texture.wantedLevel <= texture.residentLevel)
+				continue;
+
+			SetBaseLevel(entry.first, texture.wantedLevel);
+			for (int level = texture.residentLevel; level < texture.wantedLevel; level++)
+			{
+				FreeLevel(entry.first, level);
+				m_stats.levelsDropped++;
+			}
+			texture.residentLevel = texture.wantedLevel;
+		}
+
+		// Uploads go to the textures furthest from what they want first, a level at a time from coarse to fine
+		std::sort(loaded.begin(), loaded.end(), [](const auto& a, const auto& b)
+		{
+			return a.second->residentLevel - a.second->wantedLevel > b.second->residentLevel - b.second->wantedLevel;
+		});
+
+		size_t uploadedBytes{ 0 };
+		for (auto& entry : loaded)
+		{
+			StreamedTexture& texture{ *entry.second };
+			while (texture.residentLevel > texture.wantedLevel)
+			{
+				const int level{ texture.residentLevel - 1 };
+				const size_t bytes{ LevelBytes(*texture.data, level) };
+				if (uploadedBytes > 0 && uploadedBytes + bytes > m_options.uploadBytesPerFrame)
+					break;
+
+				UploadLevel(entry.first, texture, level, LevelData(*texture.data, level));
+				SetBaseLevel(entry.first, level);
+
+				texture.residentLevel = level;
+				uploadedBytes += bytes;
+				m_stats.levelsUploaded++;
+			}
+		}
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		m_stats.residentBytes = 0;
+		for (auto& entry : loaded)
+			m_stats.residentBytes += BytesFrom(*entry.second, entry.second->residentLevel);
+	}
+
+	// Waits for a load that will never be finished and hands back any ring space it took
+	void TextureStreamer::DiscardLoad(StreamedTexture& texture)
+	{
+		const Loaded loaded{ texture.loading.get() };
+		if (loaded.inRing)
+			m_uploadRing->Fence(loaded.ringOffset);
+	}
+
+	// Deletes a texture returned by Add
+	void TextureStreamer::Remove(GLuint texture)
+	{
+		auto found{ m_textures.find(texture) };
+		if (found == m_textures.end())
+			return;
+
+		// The decode cannot be cancelled so wait for it to finish
+		if (found->second.loading.valid())
+		{
+			DiscardLoad(found->second);
+			m_stats.pendingLoads--;
+		}
+
+		if (found->second.data)
+			m_stats.fullBytes -= BytesFrom(found->second, 0);
+
+		m_stats.textureCount--;
+
+		glDeleteTextures(1, &texture);
+		m_textures.erase(found);
+	}
+
+	// Waits for loads in flight and deletes every texture
+	void TextureStreamer::Clear()
+	{
+		for (auto& entry : m_textures)
+		{
+			if (entry.second.loading.valid())
+				DiscardLoad(entry.second);
+			glDeleteTextures(1, &entry.first);
+		}
+
+		m_textures.clear();
+		m_stats = Stats();
+	}
+
+	// Finest level currently on the GPU, -1 if still loading
+	int TextureStreamer::ResidentLevel(GLuint texture) const
+	{
+		auto found{ m_textures.find(texture) };
+		return found == m_textures.end() ? -1 : found->second.residentLevel;
+	}
+}
@@ -0,0 +1,163 @@
+#pragma once
+// Keeps only the mip levels a texture is actually being viewed at resident on the GPU, within a memory budget
+
+#include "ExternalLibraryHeaders.h"
+#include "TextureCache.h"
+
+#include <cfloat>
+#include <future>
+#include <memory>
+#include <unordered_map>
+
+namespace Helpers
+{
+	struct TextureStreamerOptions
+	{
+		// GPU memory all streamed textures together may use
+		size_t vramBudgetBytes{ 256 * 1024 * 1024 };
+
+		// Levels this size and smaller are uploaded as soon as a texture has loaded and never dropped
+		int residentTailSize{ 64 };
+
+		// Limits how much is uploaded in one frame to avoid hitches, at least one level is always uploaded
+		size_t uploadBytesPerFrame{ 8 * 1024 * 1024 };
+
+		// Added to the requested level, positive values trade sharpness for memory
+		float lodBias{ 0.0f };
+
+		// Frames a texture can go unused before its finer levels are dropped
+		int framesBeforeDrop{ 120 };
+
+		// How the source images are decoded, mips are always generated on the CPU
+		TextureCacheOptions decodeOptions;
+	};
+
+	// Textures start with a white placeholder and load on a worker. Once loaded only the small tail of the mip chain is
+	// uploaded, finer levels follow as ReportUsage asks for them. Residency is the texture's GL_TEXTURE_BASE_LEVEL,
+	// levels above it are freed. The full chain stays in CPU memory so raising a level is just an upload.
+	// Given an upload ring the worker also copies the tail into it, so the first upload never stalls the frame.
+	class TextureStreamer
+	{
+	public:
+		struct Stats
+		{
+			size_t textureCount{ 0 };
+
+			// Textures still decoding on a worker, and loads whose tail was uploaded from the mapped ring
+			size_t pendingLoads{ 0 };
+			size_t ringUploads{ 0 };
+
+			// GPU memory of the resident levels, and what it would be with every level resident
+			size_t residentBytes{ 0 };
+			size_t fullBytes{ 0 };
+
+			// Levels uploaded / dropped in the last Update
+			size_t levelsUploaded{ 0 };
+			size_t levelsDropped{ 0 };
+
+			// Levels held back by the budget in the last Update
+			size_t budgetLimited{ 0 };
+		};
+	private:
+		// Result of a load on a worker
+		struct Loaded
+		{
+			std::unique_ptr<DecodedTexture> data;
+			int tailLevel{ 0 };
+
+			// Tail levels in the upload ring, finest first, if they fitted
+			size_t ringOffset{ 0 };
+			bool inRing{ false };
+		};
+
+		struct StreamedTexture
+		{
+			std::string filepath;
+			TextureSettings settings;
+
+			// Decode running on a worker, then the CPU copy of every level
+			std::future<Loaded> loading;
+			std::unique_ptr<DecodedTexture> data;
+
+			// Larger of the width and height of level 0
+			int width{ 0 };
+			int numLevels{ 0 };
+
+			// Finest level of the always resident tail
+			int tailLevel{ 0 };
+
+			// Finest level on the GPU, -1 while the placeholder is showing
+			int residentLevel{ -1 };
+
+			// Finest level asked for this frame, the level chosen under the budget
+			float requestedLevel{ FLT_MAX };
+			int wantedLevel{ 0 };
+			int framesUnused{ 0 };
+		};
+
+		std::unordered_map<GLuint, StreamedTexture> m_textures;
+
+		TextureStreamerOptions m_options;
+		Stats m_stats;
+
+		// Not owned, nullptr to upload from memory
+		MappedRingBuffer* m_uploadRing{ nullptr };
+
+		static int NumLevels(const DecodedTexture& data);
+		static const BYTE* LevelData(const DecodedTexture& data, int level);
+		static size_t LevelBytes(const DecodedTexture& data, int level);
+		static size_t BytesFrom(const StreamedTexture& texture, int level);
+
+		// Finest level of data no larger than residentTailSize
+		static int TailLevel(const DecodedTexture& data, int residentTailSize);
+
+		// Uploads level of texture from pixels: its CPU copy, or with the unpack buffer bound an offset in it
+		void UploadLevel(GLuint name, const StreamedTexture& texture, int level, const BYTE* pixels) const;
+
+		// Sets the finest level sampled
+		void SetBaseLevel(GLuint name, int level) const;
+
+		// Puts the tail levels of a newly decoded texture on the GPU in place of the placeholder
+		void FinishLoad(GLuint name, StreamedTexture& texture);
+
+		// Waits for a load that will never be finished and hands back any ring space it took
+		void DiscardLoad(StreamedTexture& texture);
+	public:
+		TextureStreamer() = default;
+		~TextureStreamer() { Clear(); }
+
+		TextureStreamer(const TextureStreamer&) = delete;
+		TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+		// Starts loading filepath on a worker and returns its texture, white until the first levels arrive
+		GLuint Add(const std::string& filepath, const TextureSettings& settings = TextureSettings());
+
+		// Deletes a texture returned by Add
+		void Remove(GLuint texture);
+
+		// Usage feedback: texture was drawn this frame with uvPerPixel texture coordinate units per screen pixel
+		// at its nearest point. Called for every draw that uses the texture, the finest wins.
+		void ReportUsage(GLuint texture, float uvPerPixel);
+
+		// Finishes loads, then raises or drops levels from this frame's usage within the budget. Call once a frame.
+		void Update();
+
+		// Waits for loads in flight and deletes every texture
+		void Clear();
+
+		// True if the texture was returned by Add
+		bool IsStreamed(GLuint texture) const { return m_textures.find(texture) != m_textures.end(); }
+
+		// Finest level currently on the GPU, -1 if still loading
+		int ResidentLevel(GLuint texture) const;
+
+		const Stats& GetStats() const { return m_stats; }
+
+		const TextureStreamerOptions& GetOptions() const { return m_options; }
+		void SetOptions(const TextureStreamerOptions& options) { m_options = options; }
+
+		// Mapped pixel unpack buffer the workers copy tails into, e.g. the TextureCache's. Set before the first Add.
+		// Someone else must retire it each frame and keep it alive until Clear.
+		void SetUploadRing(MappedRingBuffer* ring) { m_uploadRing = ring; }
+	};
+}
@@ -0,0 +1,123 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace Helpers
+{
+	// numThreads of 0 means one per hardware thread, less one for the main thread
+	ThreadPool::ThreadPool(unsigned int numThreads)
+	{
+		// hardware_concurrency may be 0 when it cannot tell
+		if (numThreads == 0)
+		{
+			const unsigned int hardwareThreads{ std::thread::hardware_concurrency() };
+			numThreads = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+		}
+
+		for (unsigned int i = 0; i < numThreads; i++)
+			m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_condition.notify_all();
+
+		for (std::thread& worker : m_workers)
+			worker.join();
+	}
+
+	void ThreadPool::WorkerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_condition.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+
+				if (m_stopping && m_jobs.empty())
+					return;
+
+				job = std::move(m_jobs.front());
+				m_jobs.pop_front();
+			}
+
+			job();
+		}
+	}
+
+	// Queue a job to be run by the next free worker
+	void ThreadPool::Enqueue(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push_back(std::move(job));
+		}
+		m_condition.notify_one();
+	}
+
+	// Calls fn(i) for every i in [0, count) spread across the workers and the calling thread
+	void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn)
+	{
+		if (count == 0)
+			return;
+
+		if (count == 1 || m_workers.empty())
+		{
+			for (size_t i = 0; i < count; i++)
+				fn(i);
+			return;
+		}
+
+		// Shared as helpers that start late may still look at it after we return
+		struct State
+		{
+			std::atomic<size_t> next{ 0 };
+			std::atomic<size_t> done{ 0 };
+			size_t count{ 0 };
+			const std::function<void(size_t)>* fn{ nullptr };
+			std::mutex mutex;
+			std::condition_variable finished;
+		};
+
+		auto state{ std::make_shared<State>() };
+		state->count = count;
+		state->fn = &fn;
+
+		// Claim indices until there are none left. fn is only touched while an index is claimed,
+		// which cannot happen after the caller has returned.
+		auto work = [](State& s)
+		{
+			for (size_t i = s.next++; i < s.count; i = s.next++)
+			{
+				(*s.fn)(i);
+				if (++s.done == s.count)
+				{
+					std::lock_guard<std::mutex> lock(s.mutex);
+					s.finished.notify_all();
+				}
+			}
+		};
+
+		const size_t helpers{ std::min(count - 1, m_workers.size()) };
+		for (size_t h = 0; h < helpers; h++)
+			Enqueue([state, work]() { work(*state); });
+
+		// The caller works too so this never waits on a queue that is full of other work
+		work(*state);
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->finished.wait(lock, [&state]() { return state->done == state->count; });
+	}
+
+	// Shared pool for the whole program
+	ThreadPool& ThreadPool::Global()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+}
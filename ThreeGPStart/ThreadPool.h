@@ -0,0 +1,58 @@
+#pragma once
+// Fixed set of worker threads used for loading and other data parallel work
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Helpers
+{
+	class ThreadPool
+	{
+	private:
+		std::vector<std::thread> m_workers;
+
+		std::deque<std::function<void()>> m_jobs;
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		bool m_stopping{ false };
+
+		void WorkerLoop();
+
+		// Queue a job to be run by the next free worker
+		void Enqueue(std::function<void()> job);
+	public:
+		// numThreads of 0 means one per hardware thread, less one for the main thread
+		explicit ThreadPool(unsigned int numThreads = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		unsigned int NumThreads() const { return (unsigned int)m_workers.size(); }
+
+		// Run job on a worker, the returned future gives the result
+		template <typename F>
+		auto Submit(F&& job) -> std::future<decltype(job())>
+		{
+			using Result = decltype(job());
+			auto task{ std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job)) };
+			std::future<Result> result{ task->get_future() };
+			Enqueue([task]() { (*task)(); });
+			return result;
+		}
+
+		// Calls fn(i) for every i in [0, count) spread across the workers and the calling thread.
+		// Returns once all have completed. Safe to call from a worker.
+		void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+		// Shared pool for the whole program
+		static ThreadPool& Global();
+	};
+}
@@ -0,0 +1,119 @@
+#include "UniformRing.h"
+
+#include <cstring>
+
+namespace Helpers
+{
+	static size_t AlignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// Creates and maps the buffer. Returns false on error.
+	bool UniformRing::Create()
+	{
+		Destroy();
+
+		GLint uniformAlignment{ 0 };
+		GLint storageAlignment{ 0 };
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+		m_alignment = (size_t)std::max({ uniformAlignment, storageAlignment, 1 });
+
+		// One piece more than the frames in flight, the ring's head may never meet its tail
+		const size_t pieceSize{ AlignUp(std::max(m_options.bytesPerFrame, m_alignment), m_alignment) };
+		return m_ring.Create(GL_UNIFORM_BUFFER, pieceSize * (size_t)(std::max(m_options.framesInFlight, 1) + 1));
+	}
+
+	// Waits for the GPU to finish with the buffer then deletes it
+	void UniformRing::Destroy()
+	{
+		if (!m_ring.IsCreated())
+			return;
+
+		EndFrame();
+		m_ring.Destroy();
+	}
+
+	// Call before the first Write of a frame
+	void UniformRing::BeginFrame()
+	{
+		m_ring.Retire();
+		m_frame = Stats();
+	}
+
+	// Takes another piece of at least bytes for this frame, returns false if the ring cannot give one
+	bool UniformRing::NextPiece(size_t bytes)
+	{
+		const size_t size{ AlignUp(std::max(m_options.bytesPerFrame, bytes), m_alignment) };
+
+		// Waiting here is only on earlier frames, this frame's pieces are not fenced yet
+		size_t offset{ 0 };
+		BYTE* piece{ m_ring.AllocateWait(size, m_alignment, offset) };
+		if (!piece)
+			return false;
+
+		if (!m_framePieces.empty())
+			m_stats.extraPieces++;
+
+		m_piece = piece;
+		m_pieceOffset = offset;
+		m_pieceSize = size;
+		m_pieceUsed = 0;
+		m_framePieces.push_back(offset);
+		return true;
+	}
+
+	// Copies bytes into this frame's space, giving the offset to bind. Returns false if it does not fit.
+	bool UniformRing::Write(const void* data, size_t bytes, size_t& offset)
+	{
+		if (!m_ring.IsCreated())
+			return false;
+
+		if ((!m_piece || m_pieceUsed + bytes > m_pieceSize) && !NextPiece(bytes))
+		{
+			m_frame.failed++;
+			return false;
+		}
+
+		memcpy(m_piece + m_pieceUsed, data, bytes);
+		offset = m_pieceOffset + m_pieceUsed;
+		m_pieceUsed = AlignUp(m_pieceUsed + bytes, m_alignment);
+
+		m_frame.blocks++;
+		m_frame.bytes += bytes;
+		return true;
+	}
+
+	// Binds bytes written at offset to a uniform block binding point
+	void UniformRing::Bind(GLuint binding, size_t offset, size_t bytes) const
+	{
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, m_ring.Buffer(), (GLintptr)offset, (GLsizeiptr)bytes);
+	}
+
+	// Binds bytes written at offset to a shader storage block binding point
+	void UniformRing::BindStorage(GLuint binding, size_t offset, size_t bytes) const
+	{
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, m_ring.Buffer(), (GLintptr)offset, (GLsizeiptr)bytes);
+	}
+
+	// Call once every draw reading this frame's blocks has been issued
+	void UniformRing::EndFrame()
+	{
+		for (size_t offset : m_framePieces)
+			m_ring.Fence(offset);
+
+		if (!m_framePieces.empty() || m_frame.failed > 0)
+		{
+			m_stats.blocks = m_frame.blocks;
+			m_stats.bytes = m_frame.bytes;
+			m_stats.failed = m_frame.failed;
+			m_stats.frames++;
+		}
+
+		m_framePieces.clear();
+		m_piece = nullptr;
+		m_pieceUsed = 0;
+		m_pieceSize = 0;
+	}
+}
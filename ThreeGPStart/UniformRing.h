@@ -0,0 +1,95 @@
+#pragma once
+// Uniform block data written straight into mapped memory each frame and bound by offset
+
+#include "ExternalLibraryHeaders.h"
+#include "MappedRingBuffer.h"
+
+namespace Helpers
+{
+	struct UniformRingOptions
+	{
+		// Space one frame normally needs, taken from the ring in one piece. A frame needing more takes further pieces.
+		size_t bytesPerFrame{ 1024 * 1024 };
+
+		// Frames the GPU may still be reading while the next is written, three keeps writing from ever waiting on it
+		int framesInFlight{ 3 };
+	};
+
+	// Each frame takes a piece of a persistently mapped buffer and hands out blocks from it at the larger of the
+	// uniform and storage buffer offset alignments the driver asks for. A block is written once with memcpy and bound
+	// to as many draws as need it with glBindBufferRange, so a draw costs one bind rather than a glUniform call per
+	// value. The same buffer holds per draw storage arrays and indirect draw records.
+	// The frame's pieces are fenced together at EndFrame, after every draw reading them has been issued.
+	// All calls on the GL thread.
+	class UniformRing
+	{
+	public:
+		struct Stats
+		{
+			// Last finished frame
+			size_t blocks{ 0 };
+			size_t bytes{ 0 };
+
+			// Blocks that did not fit, the ring is too small for the scene
+			size_t failed{ 0 };
+
+			// Totals since creation
+			size_t frames{ 0 };
+			size_t extraPieces{ 0 };
+		};
+	private:
+		MappedRingBuffer m_ring;
+		UniformRingOptions m_options;
+		size_t m_alignment{ 256 };
+
+		// Piece being handed out and the offsets of every piece this frame, fenced at EndFrame
+		BYTE* m_piece{ nullptr };
+		size_t m_pieceOffset{ 0 };
+		size_t m_pieceSize{ 0 };
+		size_t m_pieceUsed{ 0 };
+		std::vector<size_t> m_framePieces;
+
+		Stats m_stats;
+		Stats m_frame;
+
+		// Takes another piece of at least bytes for this frame, returns false if the ring cannot give one
+		bool NextPiece(size_t bytes);
+	public:
+		explicit UniformRing(const UniformRingOptions& options = UniformRingOptions()) : m_options(options) {}
+		~UniformRing() { Destroy(); }
+
+		UniformRing(const UniformRing&) = delete;
+		UniformRing& operator=(const UniformRing&) = delete;
+
+		// Creates and maps the buffer. Returns false on error.
+		bool Create();
+
+		// Waits for the GPU to finish with the buffer then deletes it
+		void Destroy();
+
+		bool IsCreated() const { return m_ring.IsCreated(); }
+
+		// Call before the first Write of a frame
+		void BeginFrame();
+
+		// Copies bytes into this frame's space, giving the offset to bind. Returns false if it does not fit.
+		bool Write(const void* data, size_t bytes, size_t& offset);
+
+		template <typename T>
+		bool Write(const T& block, size_t& offset) { return Write(&block, sizeof(T), offset); }
+
+		// Binds bytes written at offset to a uniform block binding point
+		void Bind(GLuint binding, size_t offset, size_t bytes) const;
+
+		// Binds bytes written at offset to a shader storage block binding point
+		void BindStorage(GLuint binding, size_t offset, size_t bytes) const;
+
+		// For binding as the indirect draw buffer, offsets from Write index into it
+		GLuint Buffer() const { return m_ring.Buffer(); }
+
+		// Call once every draw reading this frame's blocks has been issued
+		void EndFrame();
+
+		const Stats& GetStats() const { return m_stats; }
+	};
+}
@@ -0,0 +1,597 @@
+#include "VirtualTexture.h"
+#include "BlockCompressor.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+namespace Helpers
+{
+	// Pages generated at once while building, bounds the memory held before writing
+	static const size_t kBuildBatchPages{ 64 };
+
+	// Page x and y go through the 8 bit feedback target
+	static const int kMaxPagesPerSide{ 256 };
+
+	static size_t TileBytes(VirtualTextureFormat format, int tileSize)
+	{
+		return format == VirtualTextureFormat::BC1 ? CompressedImage::LevelBytes(BlockFormat::BC1, tileSize, tileSize) :
+			(size_t)tileSize * tileSize * 4;
+	}
+
+	// Writes a page file for a virtualSize square texture, generating every page of every level in parallel
+	bool VirtualTexture::BuildFile(const std::string& filepath, int virtualSize, int pageSize, int border, VirtualTextureFormat format,
+		uint64_t sourceStamp, const VirtualTextureGenerator& generate)
+	{
+		const int pagesPerSide{ virtualSize / pageSize };
+		const int tileSize{ pageSize + 2 * border };
+
+		// Both powers of two, and BC1 needs whole blocks
+		if (pageSize <= 0 || pagesPerSide <= 0 || pagesPerSide > kMaxPagesPerSide || virtualSize != pagesPerSide * pageSize ||
+			(pagesPerSide & (pagesPerSide - 1)) != 0 || (format == VirtualTextureFormat::BC1 && tileSize % 4 != 0))
+		{
+			std::cout << "VirtualTexture: unsupported layout of " << virtualSize << " in pages of " << pageSize << std::endl;
+			return false;
+		}
+
+		FileHeader header;
+		header.virtualSize = (uint32_t)virtualSize;
+		header.pageSize = (uint32_t)pageSize;
+		header.border = (uint32_t)border;
+		header.format = format;
+		header.numLevels = 1;
+		while ((pagesPerSide >> header.numLevels) > 0)
+			header.numLevels++;
+		header.sourceStamp = sourceStamp;
+
+		// Every page in file order, finest level first then row by row
+		std::vector<uint32_t> pages;
+		for (uint32_t level = 0; level < header.numLevels; level++)
+		{
+			const int count{ std::max(1, pagesPerSide >> level) };
+			for (int y = 0; y < count; y++)
+				for (int x = 0; x < count; x++)
+					pages.push_back(PageKey((int)level, x, y));
+		}
+
+		// Written to one side first so an interrupted build never looks complete
+		std::error_code error;
+		fs::create_directories(fs::path(filepath).parent_path(), error);
+		const std::string buildPath{ filepath + ".build" };
+
+		FILE* file{ nullptr };
+		if (fopen_s(&file, buildPath.c_str(), "wb") != 0 || !file)
+			return false;
+
+		bool ok{ fwrite(&header, sizeof(header), 1, file) == 1 };
+
+		const size_t pageBytes{ TileBytes(format, tileSize) };
+		std::vector<BYTE> batch(kBuildBatchPages * pageBytes);
+
+		for (size_t first = 0; ok && first < pages.size(); first += kBuildBatchPages)
+		{
+			const size_t count{ std::min(kBuildBatchPages, pages.size() - first) };
+			ThreadPool::Global().ParallelFor(count, [&](size_t i)
+			{
+				const uint32_t page{ pages[first + i] };
+				BYTE* destination{ batch.data() + i * pageBytes };
+
+				std::vector<BYTE> rgba;
+				BYTE* texels{ destination };
+				if (format != VirtualTextureFormat::RGBA8)
+				{
+					rgba.resize((size_t)tileSize * tileSize * 4);
+					texels = rgba.data();
+				}
+
+				generate(PageLevel(page), PageX(page) * pageSize - border, PageY(page) * pageSize - border, tileSize, tileSize, texels);
+
+				if (format == VirtualTextureFormat::BC1)
+					CompressImage(texels, tileSize, tileSize, BlockFormat::BC1, destination);
+			});
+
+			ok = fwrite(batch.data(), pageBytes, count, file) == count;
+		}
+
+		fclose(file);
+
+		if (ok)
+			fs::rename(buildPath, filepath, error);
+		if (!ok || error)
+		{
+			std::cout << "VirtualTexture: could not write " << filepath << std::endl;
+			fs::remove(buildPath, error);
+			return false;
+		}
+
+		return true;
+	}
+
+	// True if filepath exists and was built from sourceStamp
+	bool VirtualTexture::IsFileCurrent(const std::string& filepath, uint64_t sourceStamp)
+	{
+		FILE* file{ nullptr };
+		if (fopen_s(&file, filepath.c_str(), "rb") != 0 || !file)
+			return false;
+
+		FileHeader header, expected;
+		const bool read{ fread(&header, sizeof(header), 1, file) == 1 };
+		fclose(file);
+
+		return read && memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 && header.version == expected.version &&
+			header.sourceStamp == sourceStamp;
+	}
+
+	// Reads one page from the file, safe on any thread
+	std::vector<BYTE> VirtualTexture::ReadPage(const std::string& filepath, size_t offset, size_t bytes)
+	{
+		std::vector<BYTE> data;
+
+		FILE* file{ nullptr };
+		if (fopen_s(&file, filepath.c_str(), "rb") != 0 || !file)
+			return data;
+
+		data.resize(bytes);
+		if (_fseeki64(file, (long long)offset, SEEK_SET) != 0 || fread(data.data(), 1, bytes, file) != bytes)
+			data.clear();
+
+		fclose(file);
+		return data;
+	}
+
+	size_t VirtualTexture::PageOffset(uint32_t page) const
+	{
+		// Pages of the finer levels come first
+		size_t index{ 0 };
+		for (int level = 0; level < PageLevel(page); level++)
+			index += (size_t)PagesAtLevel(level) * PagesAtLevel(level);
+		index += (size_t)PageY(page) * PagesAtLevel(PageLevel(page)) + PageX(page);
+
+		return sizeof(FileHeader) + index * m_pageBytes;
+	}
+
+	// Opens a page file and creates the GL objects. The coarsest page is loaded straight away.
+	bool VirtualTexture::Open(const std::string& filepath, const VirtualTextureOptions& options)
+	{
+		Destroy();
+
+		FILE* file{ nullptr };
+		if (fopen_s(&file, filepath.c_str(), "rb") != 0 || !file)
+		{
+			std::cout << "VirtualTexture: could not open " << filepath << std::endl;
+			return false;
+		}
+
+		FileHeader expected;
+		const bool read{ fread(&m_header, sizeof(m_header), 1, file) == 1 };
+		fclose(file);
+
+		if (!read || memcmp(m_header.magic, expected.magic, sizeof(expected.magic)) != 0 || m_header.version != expected.version ||
+			m_header.pageSize == 0 || m_header.numLevels == 0)
+		{
+			std::cout << "VirtualTexture: " << filepath << " is not a page file" << std::endl;
+			return false;
+		}
+
+		m_filepath = filepath;
+		m_options = options;
+		m_tileSize = (int)(m_header.pageSize + 2 * m_header.border);
+		m_pageBytes = TileBytes(m_header.format, m_tileSize);
+		m_stats = Stats();
+		m_frame = 0;
+		m_lastFeedbackFrame = 0;
+
+		const int physicalSize{ m_options.physicalPagesPerSide * m_tileSize };
+		const bool compressed{ m_header.format == VirtualTextureFormat::BC1 };
+
+		// Filtering stays inside a page thanks to the border, so no mips
+		glGenTextures(1, &m_physical);
+		glBindTexture(GL_TEXTURE_2D, m_physical);
+		glTexStorage2D(GL_TEXTURE_2D, 1, compressed ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGBA8, physicalSize, physicalSize);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		// Only ever read with texelFetch
+		const int pagesPerSide{ PagesAtLevel(0) };
+		glGenTextures(1, &m_pageTable);
+		glBindTexture(GL_TEXTURE_2D, m_pageTable);
+		glTexStorage2D(GL_TEXTURE_2D, (GLsizei)m_header.numLevels, GL_RGBA8, pagesPerSide, pagesPerSide);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)m_header.numLevels - 1);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		m_pageTableData.resize(m_header.numLevels);
+		for (int level = 0; level < (int)m_header.numLevels; level++)
+			m_pageTableData[level].assign((size_t)PagesAtLevel(level) * PagesAtLevel(level), 0);
+
+		m_physicalPages.assign((size_t)m_options.physicalPagesPerSide * m_options.physicalPagesPerSide, PhysicalPage());
+
+		// The single page of the coarsest level covers everything, it is what lookups fall back to
+		const uint32_t topPage{ PageKey((int)m_header.numLevels - 1, 0, 0) };
+		const std::vector<BYTE> topData{ ReadPage(m_filepath, PageOffset(topPage), m_pageBytes) };
+		if (topData.size() != m_pageBytes)
+		{
+			std::cout << "VirtualTexture: " << filepath << " is truncated" << std::endl;
+			Destroy();
+			return false;
+		}
+
+		UploadPage(0, topData);
+		m_physicalPages[0].page = topPage;
+		m_physicalPages[0].pinned = true;
+		m_residentPages[topPage] = 0;
+		m_stats.pagesLoaded = 1;
+
+		UpdatePageTable();
+		return true;
+	}
+
+	// Frees the GL objects, waiting for page loads in flight
+	void VirtualTexture::Destroy()
+	{
+		for (PageLoad& load : m_loads)
+			load.data.wait();
+		m_loads.clear();
+		m_loading.clear();
+		m_wanted.clear();
+
+		m_residentPages.clear();
+		m_physicalPages.clear();
+		m_pageTableData.clear();
+
+		for (int i = 0; i < 2; i++)
+		{
+			if (m_feedbackFence[i])
+				glDeleteSync(m_feedbackFence[i]);
+			m_feedbackFence[i] = 0;
+		}
+
+		if (m_feedbackPBO[0])
+			glDeleteBuffers(2, m_feedbackPBO);
+		if (m_feedbackFBO)
+			glDeleteFramebuffers(1, &m_feedbackFBO);
+		if (m_feedbackColour)
+			glDeleteRenderbuffers(1, &m_feedbackColour);
+		if (m_feedbackDepth)
+			glDeleteRenderbuffers(1, &m_feedbackDepth);
+		if (m_pageTable)
+			glDeleteTextures(1, &m_pageTable);
+		if (m_physical)
+			glDeleteTextures(1, &m_physical);
+
+		m_feedbackPBO[0] = m_feedbackPBO[1] = 0;
+		m_feedbackFBO = m_feedbackColour = m_feedbackDepth = 0;
+		m_feedbackWidth = m_feedbackHeight = 0;
+		m_pageTable = m_physical = 0;
+	}
+
+	// Copies page data into a physical slot
+	void VirtualTexture::UploadPage(int slot, const std::vector<BYTE>& data)
+	{
+		const int x{ (slot % m_options.physicalPagesPerSide) * m_tileSize };
+		const int y{ (slot / m_options.physicalPagesPerSide) * m_tileSize };
+
+		glBindTexture(GL_TEXTURE_2D, m_physical);
+		if (m_header.format == VirtualTextureFormat::BC1)
+		{
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, m_tileSize, m_tileSize, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+				(GLsizei)data.size(), data.data());
+		}
+		else
+		{
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, m_tileSize, m_tileSize, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// Finds a slot for a new page, evicting the least recently used. Returns -1 if every page is in use.
+	int VirtualTexture::AllocateSlot()
+	{
+		int oldest{ -1 };
+		for (int slot = 0; slot < (int)m_physicalPages.size(); slot++)
+		{
+			const PhysicalPage& physical{ m_physicalPages[slot] };
+			if (physical.page == kNoPage)
+				return slot;
+
+			// Anything the latest feedback asked for is on screen
+			if (!physical.pinned && physical.lastUsed < m_lastFeedbackFrame &&
+				(oldest < 0 || physical.lastUsed < m_physicalPages[oldest].lastUsed))
+				oldest = slot;
+		}
+
+		if (oldest >= 0)
+		{
+			m_residentPages.erase(m_physicalPages[oldest].page);
+			m_physicalPages[oldest].page = kNoPage;
+			m_stats.pagesEvicted++;
+			m_pageTableDirty = true;
+		}
+
+		return oldest;
+	}
+
+	// Reads the oldest feedback buffer if the GPU has finished writing it
+	void VirtualTexture::ReadFeedback()
+	{
+		GLsync& fence{ m_feedbackFence[m_feedbackIndex] };
+		if (!fence)
+			return;
+
+		const GLenum status{ glClientWaitSync(fence, 0, 0) };
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return;
+
+		glDeleteSync(fence);
+		fence = 0;
+
+		const size_t pixels{ (size_t)m_feedbackWidth * m_feedbackHeight };
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_feedbackPBO[m_feedbackIndex]);
+		const BYTE* feedback{ (const BYTE*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)(pixels * 4), GL_MAP_READ_BIT) };
+		if (!feedback)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			return;
+		}
+
+		// Neighbouring pixels mostly want the same page so skip repeats before the set
+		std::unordered_set<uint32_t> requested;
+		uint32_t previous{ kNoPage };
+		for (size_t i = 0; i < pixels; i++)
+		{
+			const BYTE* pixel{ feedback + i * 4 };
+			if (pixel[3] == 0)
+				continue;
+
+			const uint32_t page{ PageKey(std::min((int)pixel[2], (int)m_header.numLevels - 1), pixel[0], pixel[1]) };
+			if (page != previous)
+				requested.insert(page);
+			previous = page;
+		}
+
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		m_lastFeedbackFrame = m_frame;
+		m_stats.requestedPages = requested.size();
+
+		// A page is only useful once the coarser pages around it are in, so ancestors are wanted too
+		std::unordered_set<uint32_t> visited;
+		m_wanted.clear();
+		for (uint32_t page : requested)
+		{
+			int level{ PageLevel(page) }, x{ PageX(page) }, y{ PageY(page) };
+			if (x >= PagesAtLevel(level) || y >= PagesAtLevel(level))
+				continue;
+
+			while (visited.insert(PageKey(level, x, y)).second)
+			{
+				auto resident{ m_residentPages.find(PageKey(level, x, y)) };
+				if (resident != m_residentPages.end())
+					m_physicalPages[resident->second].lastUsed = m_frame;
+				else
+					m_wanted.push_back(PageKey(level, x, y));
+
+				if (++level >= (int)m_header.numLevels)
+					break;
+				x /= 2;
+				y /= 2;
+			}
+		}
+
+		std::sort(m_wanted.begin(), m_wanted.end(), [](uint32_t a, uint32_t b) { return PageLevel(a) > PageLevel(b); });
+	}
+
+	// Reads back feedback, uploads finished pages, starts new loads and updates the page table
+	void VirtualTexture::Update()
+	{
+		if (!IsOpen())
+			return;
+
+		m_frame++;
+		ReadFeedback();
+
+		int uploads{ 0 };
+		for (auto it = m_loads.begin(); it != m_loads.end();)
+		{
+			if (uploads >= m_options.maxUploadsPerFrame || it->data.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				++it;
+				continue;
+			}
+
+			const uint32_t page{ it->page };
+			const std::vector<BYTE> data{ it->data.get() };
+			m_loading.erase(page);
+			it = m_loads.erase(it);
+
+			// Nothing to replace, the page is asked for again by later feedback
+			const int slot{ data.size() == m_pageBytes ? AllocateSlot() : -1 };
+			if (slot < 0)
+				continue;
+
+			UploadPage(slot, data);
+			m_physicalPages[slot].page = page;
+			m_physicalPages[slot].lastUsed = m_frame;
+			m_residentPages[page] = slot;
+			m_pageTableDirty = true;
+			m_stats.pagesLoaded++;
+			uploads++;
+		}
+
+		// Coarsest first so what is on screen sharpens a level at a time
+		for (uint32_t page : m_wanted)
+		{
+			if ((int)m_loads.size() >= m_options.maxLoadsInFlight)
+				break;
+			if (m_residentPages.count(page) || !m_loading.insert(page).second)
+				continue;
+
+			PageLoad load;
+			load.page = page;
+			load.data = ThreadPool::Global().Submit([filepath = m_filepath, offset = PageOffset(page), bytes = m_pageBytes]()
+			{
+				return ReadPage(filepath, offset, bytes);
+			});
+			m_loads.push_back(std::move(load));
+		}
+		m_wanted.clear();
+
+		if (m_pageTableDirty)
+			UpdatePageTable();
+
+		m_stats.residentPages = m_residentPages.size();
+		m_stats.physicalPages = m_physicalPages.size();
+		m_stats.loadsInFlight = m_loads.size();
+	}
+
+	// Recalculates every page table entry and uploads them
+	void VirtualTexture::UpdatePageTable()
+	{
+		glBindTexture(GL_TEXTURE_2D, m_pageTable);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		// Coarse to fine so a missing page can copy its parent's entry
+		for (int level = (int)m_header.numLevels - 1; level >= 0; level--)
+		{
+			const int count{ PagesAtLevel(level) };
+			std::vector<uint32_t>& entries{ m_pageTableData[level] };
+
+			for (int y = 0; y < count; y++)
+			{
+				for (int x = 0; x < count; x++)
+				{
+					uint32_t& entry{ entries[(size_t)y * count + x] };
+
+					auto resident{ m_residentPages.find(PageKey(level, x, y)) };
+					if (resident != m_residentPages.end())
+					{
+						const uint32_t physicalX{ (uint32_t)(resident->second % m_options.physicalPagesPerSide) };
+						const uint32_t physicalY{ (uint32_t)(resident->second / m_options.physicalPagesPerSide) };
+						entry = physicalX | (physicalY << 8) | ((uint32_t)level << 16) | 0xFF000000u;
+					}
+					else if (level + 1 < (int)m_header.numLevels)
+					{
+						entry = m_pageTableData[level + 1][(size_t)(y / 2) * PagesAtLevel(level + 1) + x / 2];
+					}
+					else
+					{
+						entry = 0;
+					}
+				}
+			}
+
+			glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, count, count, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+		}
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+		m_pageTableDirty = false;
+	}
+
+	// Binds the feedback target and clears it
+	void VirtualTexture::BeginFeedback()
+	{
+		glGetIntegerv(GL_VIEWPORT, m_savedViewport);
+		const int width{ std::max(1, m_savedViewport[2] / m_options.feedbackDivisor) };
+		const int height{ std::max(1, m_savedViewport[3] / m_options.feedbackDivisor) };
+
+		if (width != m_feedbackWidth || height != m_feedbackHeight)
+		{
+			// Anything in flight is the old size
+			for (int i = 0; i < 2; i++)
+			{
+				if (m_feedbackFence[i])
+					glDeleteSync(m_feedbackFence[i]);
+				m_feedbackFence[i] = 0;
+			}
+
+			if (!m_feedbackFBO)
+			{
+				glGenFramebuffers(1, &m_feedbackFBO);
+				glGenRenderbuffers(1, &m_feedbackColour);
+				glGenRenderbuffers(1, &m_feedbackDepth);
+				glGenBuffers(2, m_feedbackPBO);
+			}
+
+			glBindRenderbuffer(GL_RENDERBUFFER, m_feedbackColour);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+			glBindRenderbuffer(GL_RENDERBUFFER, m_feedbackDepth);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+			glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, m_feedbackFBO);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_feedbackColour);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_feedbackDepth);
+
+			for (int i = 0; i < 2; i++)
+			{
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, m_feedbackPBO[i]);
+				glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, nullptr, GL_STREAM_READ);
+			}
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+			m_feedbackWidth = width;
+			m_feedbackHeight = height;
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, m_feedbackFBO);
+		glViewport(0, 0, m_feedbackWidth, m_feedbackHeight);
+
+		// Alpha of 0 means no page wanted
+		GLfloat clearColour[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColour);
+		glClearColor(0, 0, 0, 0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glClearColor(clearColour[0], clearColour[1], clearColour[2], clearColour[3]);
+	}
+
+	// Starts the read back of what was drawn and restores the default framebuffer and viewport
+	void VirtualTexture::EndFeedback()
+	{
+		// Into a buffer so the copy happens on the GPU timeline, mapped a frame or two later once fenced
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_feedbackPBO[m_feedbackIndex]);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, m_feedbackWidth, m_feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		if (m_feedbackFence[m_feedbackIndex])
+			glDeleteSync(m_feedbackFence[m_feedbackIndex]);
+		m_feedbackFence[m_feedbackIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_feedbackIndex ^= 1;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(m_savedViewport[0], m_savedViewport[1], m_savedViewport[2], m_savedViewport[3]);
+	}
+
+	// Binds the page table to textureUnit and the physical texture to textureUnit + 1 and sets the vt_ uniforms of program
+	void VirtualTexture::Bind(ShaderProgram& program, int textureUnit) const
+	{
+		static const UniformName pageTableName{ ShaderProgram::Name("vt_page_table") };
+		static const UniformName physicalName{ ShaderProgram::Name("vt_physical") };
+		static const UniformName paramsName{ ShaderProgram::Name("vt_params") };
+		static const UniformName physicalSizeName{ ShaderProgram::Name("vt_physical_size") };
+		static const UniformName feedbackBiasName{ ShaderProgram::Name("vt_feedback_bias") };
+
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_2D, m_pageTable);
+		glActiveTexture(GL_TEXTURE0 + textureUnit + 1);
+		glBindTexture(GL_TEXTURE_2D, m_physical);
+		glActiveTexture(GL_TEXTURE0);
+
+		program.Set(pageTableName, textureUnit);
+		program.Set(physicalName, textureUnit + 1);
+		program.Set(paramsName, glm::vec4((float)m_header.virtualSize, (float)m_header.pageSize,
+			(float)m_header.border, (float)(m_header.numLevels - 1)));
+		program.Set(physicalSizeName, (float)(m_options.physicalPagesPerSide * m_tileSize));
+
+		// The feedback target has fewer pixels so its derivatives are larger
+		program.Set(feedbackBiasName, -std::log2((float)m_options.feedbackDivisor));
+	}
+}
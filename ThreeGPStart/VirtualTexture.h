@@ -0,0 +1,200 @@
+#pragma once
+// Software virtual texturing: a huge texture split into pages on disk, with only the pages in view kept on the GPU
+
+#include "ExternalLibraryHeaders.h"
+#include "ShaderProgram.h"
+
+#include <functional>
+#include <future>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Helpers
+{
+	// How pages are stored on disk and in the physical texture
+	enum class VirtualTextureFormat : uint32_t
+	{
+		// Core GL, 4 bytes per texel
+		RGBA8,
+
+		// Needs EXT_texture_compression_s3tc, 0.5 bytes per texel
+		BC1
+	};
+
+	struct VirtualTextureOptions
+	{
+		// Physical texture holds this many pages in each direction
+		int physicalPagesPerSide{ 24 };
+
+		// Page loads running on workers at once
+		int maxLoadsInFlight{ 16 };
+
+		// Pages copied into the physical texture per frame
+		int maxUploadsPerFrame{ 8 };
+
+		// Feedback is rendered at the screen size divided by this
+		int feedbackDivisor{ 8 };
+	};
+
+	// Fills width x height RGBA8 texels of level starting at virtual texel (x, y). Coordinates may lie outside the level
+	// for page borders, the generator decides what goes there (e.g. clamp or wrap).
+	using VirtualTextureGenerator = std::function<void(int level, int x, int y, int width, int height, BYTE* rgba)>;
+
+	// The page table is a mipmapped texture with a texel per page per level, holding where in the physical texture
+	// that page lives. Pages not resident point at their nearest resident ancestor so there is always something to
+	// sample. A low resolution feedback pass renders the page each pixel wants, that is read back a frame or two later
+	// to decide which pages to load. Uses only FBOs, PBOs, fences and texelFetch, no sparse texture extensions.
+	class VirtualTexture
+	{
+	public:
+		struct Stats
+		{
+			size_t residentPages{ 0 };
+			size_t physicalPages{ 0 };
+
+			// Distinct pages the last feedback read back asked for
+			size_t requestedPages{ 0 };
+
+			size_t loadsInFlight{ 0 };
+
+			// Totals since Open
+			size_t pagesLoaded{ 0 };
+			size_t pagesEvicted{ 0 };
+		};
+	private:
+		struct FileHeader
+		{
+			char magic[4]{ 'V', 'T', 'E', 'X' };
+			uint32_t version{ 1 };
+			uint32_t virtualSize{ 0 };
+			uint32_t pageSize{ 0 };
+			uint32_t border{ 0 };
+			VirtualTextureFormat format{ VirtualTextureFormat::RGBA8 };
+			uint32_t numLevels{ 0 };
+			uint32_t reserved{ 0 };
+			uint64_t sourceStamp{ 0 };
+		};
+
+		static const uint32_t kNoPage{ 0xFFFFFFFF };
+
+		struct PhysicalPage
+		{
+			// Page held, kNoPage if free
+			uint32_t page{ kNoPage };
+
+			// Frame it was last wanted, the least recently wanted is replaced first
+			uint64_t lastUsed{ 0 };
+
+			// The coarsest page is never replaced so every lookup finds something
+			bool pinned{ false };
+		};
+
+		struct PageLoad
+		{
+			uint32_t page{ 0 };
+			std::future<std::vector<BYTE>> data;
+		};
+
+		std::string m_filepath;
+		FileHeader m_header;
+		size_t m_pageBytes{ 0 };
+		int m_tileSize{ 0 };
+
+		VirtualTextureOptions m_options;
+		Stats m_stats;
+		uint64_t m_frame{ 0 };
+
+		// Frame the latest feedback was read, pages it wanted are not evicted
+		uint64_t m_lastFeedbackFrame{ 0 };
+
+		GLuint m_pageTable{ 0 };
+		GLuint m_physical{ 0 };
+
+		// Page table contents a level at a time, RGBA8 of physical x, physical y, level of the page found
+		std::vector<std::vector<uint32_t>> m_pageTableData;
+		bool m_pageTableDirty{ false };
+
+		std::vector<PhysicalPage> m_physicalPages;
+		std::unordered_map<uint32_t, int> m_residentPages;
+
+		std::vector<PageLoad> m_loads;
+		std::unordered_set<uint32_t> m_loading;
+
+		// Pages the last feedback asked for that are not resident, coarsest first
+		std::vector<uint32_t> m_wanted;
+
+		GLuint m_feedbackFBO{ 0 };
+		GLuint m_feedbackColour{ 0 };
+		GLuint m_feedbackDepth{ 0 };
+		int m_feedbackWidth{ 0 };
+		int m_feedbackHeight{ 0 };
+
+		// Read back double buffered so the CPU never waits for the GPU
+		GLuint m_feedbackPBO[2]{};
+		GLsync m_feedbackFence[2]{};
+		int m_feedbackIndex{ 0 };
+
+		GLint m_savedViewport[4]{};
+
+		static uint32_t PageKey(int level, int x, int y) { return ((uint32_t)level << 24) | ((uint32_t)y << 12) | (uint32_t)x; }
+		static int PageLevel(uint32_t page) { return (int)(page >> 24); }
+		static int PageX(uint32_t page) { return (int)(page & 0xFFF); }
+		static int PageY(uint32_t page) { return (int)((page >> 12) & 0xFFF); }
+
+		int PagesAtLevel(int level) const { return std::max(1, (int)(m_header.virtualSize / m_header.pageSize) >> level); }
+
+		// Reads one page from the file, safe on any thread
+		static std::vector<BYTE> ReadPage(const std::string& filepath, size_t offset, size_t bytes);
+		size_t PageOffset(uint32_t page) const;
+
+		// Copies page data into a physical slot
+		void UploadPage(int slot, const std::vector<BYTE>& data);
+
+		// Finds a slot for a new page, evicting the least recently used. Returns -1 if every page is in use this frame.
+		int AllocateSlot();
+
+		// Reads the oldest feedback buffer if the GPU has finished writing it
+		void ReadFeedback();
+
+		// Recalculates every page table entry and uploads them
+		void UpdatePageTable();
+	public:
+		VirtualTexture() = default;
+		~VirtualTexture() { Destroy(); }
+
+		VirtualTexture(const VirtualTexture&) = delete;
+		VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+		// Writes a page file for a virtualSize square texture, generating every page of every level in parallel.
+		// sourceStamp identifies what it was made from, IsFileCurrent compares against it. Returns false on error.
+		static bool BuildFile(const std::string& filepath, int virtualSize, int pageSize, int border, VirtualTextureFormat format,
+			uint64_t sourceStamp, const VirtualTextureGenerator& generate);
+
+		// True if filepath exists and was built from sourceStamp
+		static bool IsFileCurrent(const std::string& filepath, uint64_t sourceStamp);
+
+		// Opens a page file and creates the GL objects. The coarsest page is loaded straight away. Returns false on error.
+		bool Open(const std::string& filepath, const VirtualTextureOptions& options = VirtualTextureOptions());
+
+		// Frees the GL objects, waiting for page loads in flight
+		void Destroy();
+
+		bool IsOpen() const { return m_physical != 0; }
+
+		// Reads back feedback, uploads finished pages, starts new loads and updates the page table. Call once a frame
+		// before rendering.
+		void Update();
+
+		// Binds the feedback target and clears it, draw the geometry using the texture with a feedback shader after
+		void BeginFeedback();
+
+		// Starts the read back of what was drawn and restores the default framebuffer and viewport
+		void EndFeedback();
+
+		// Binds the page table to textureUnit and the physical texture to textureUnit + 1 and sets the vt_ uniforms of program
+		void Bind(ShaderProgram& program, int textureUnit) const;
+
+		const Stats& GetStats() const { return m_stats; }
+		int NumLevels() const { return (int)m_header.numLevels; }
+	};
+}